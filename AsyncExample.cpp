@@ -0,0 +1,217 @@
+#include "System2.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+
+#include <sys/resource.h>
+
+//A coroutine that starts right away and nothing waits for
+struct DetachedTask
+{
+    struct promise_type
+    {
+        DetachedTask get_return_object() { return {}; }
+        std::suspend_never initial_suspend() { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+};
+
+#define EXIT_IF_FAILED(result) \
+    if(result != SYSTEM2_RESULT_SUCCESS) \
+    {\
+        printf("Error at %d: %d\n", __LINE__, result);\
+        exit(-1);\
+    }
+
+DetachedTask ReadOutputExample(System2::EventLoop& loop)
+{
+    //Cleaned up when the coroutine finishes
+    System2::Command ownedCommand;
+    ownedCommand.GetInfo().RedirectOutput = true;
+    ownedCommand.SetEnvironmentVariable("SECOND_WORD", "World");
+    SYSTEM2_RESULT result = ownedCommand.Run("echo Hello && sleep 1 && echo $SECOND_WORD");
+    EXIT_IF_FAILED(result);
+
+    System2::AsyncCommand command(loop, ownedCommand);
+
+    //Output:
+    //Read: Hello
+    //Read: World
+    char buffer[1024];
+    while(true)
+    {
+        System2::ReadResult readResult = co_await command.ReadSome(buffer);
+        if(readResult.Result != SYSTEM2_RESULT_READ_NOT_FINISHED)
+        {
+            EXIT_IF_FAILED(readResult.Result);
+            break;
+        }
+
+        printf("Read: %.*s", (int)readResult.BytesRead, buffer);
+    }
+
+    System2::WaitResult waitResult = co_await command.Wait();
+    EXIT_IF_FAILED(waitResult.Result);
+}
+
+DetachedTask WriteInputExample(System2::EventLoop& loop)
+{
+    System2CommandInfo commandInfo;
+    memset(&commandInfo, 0, sizeof(System2CommandInfo));
+    commandInfo.RedirectInput = true;
+    SYSTEM2_RESULT result = System2Run("read testVar && echo Written: $testVar", &commandInfo);
+    EXIT_IF_FAILED(result);
+
+    System2::AsyncCommand command(loop, commandInfo);
+
+    //Output: Written: test
+    result = co_await command.Write("test\n");
+    EXIT_IF_FAILED(result);
+
+    System2::WaitResult waitResult = co_await command.Wait();
+    EXIT_IF_FAILED(waitResult.Result);
+
+    result = System2CleanupCommand(&commandInfo);
+    EXIT_IF_FAILED(result);
+}
+
+DetachedTask WaitDeadlineExample(System2::EventLoop& loop)
+{
+    System2CommandInfo commandInfo;
+    memset(&commandInfo, 0, sizeof(System2CommandInfo));
+    SYSTEM2_RESULT result = System2Run("sleep 5", &commandInfo);
+    EXIT_IF_FAILED(result);
+
+    System2::AsyncCommand command(loop, commandInfo);
+
+    //Output: Wait result after 2 seconds: 2
+    auto deadline = System2::Clock::now() + std::chrono::seconds(2);
+    System2::WaitResult waitResult = co_await command.Wait(deadline);
+    printf("Wait result after 2 seconds: %d\n", waitResult.Result);
+
+    result = System2Kill(&commandInfo);
+    EXIT_IF_FAILED(result);
+
+    //Output: Wait result after kill: 3
+    waitResult = co_await command.Wait();
+    printf("Wait result after kill: %d\n", waitResult.Result);
+
+    result = System2CleanupCommand(&commandInfo);
+    EXIT_IF_FAILED(result);
+}
+
+DetachedTask PollErrorWaitExample(System2::EventLoop& loop, System2CommandInfo& commandInfo)
+{
+    System2::AsyncCommand command(loop, commandInfo);
+
+    //Output: Wait result after poll failed: -6
+    System2::WaitResult waitResult = co_await command.Wait();
+    printf("Wait result after poll failed: %d\n", waitResult.Result);
+    if(waitResult.Result != SYSTEM2_RESULT_COMMAND_WAIT_FAILED)
+    {
+        printf("Error at %d: unexpected result\n", __LINE__);
+        exit(-1);
+    }
+}
+
+//The loop stops and fails what is awaited when it can't poll, instead of spinning
+void PollErrorExample()
+{
+    System2CommandInfo commandInfo;
+    memset(&commandInfo, 0, sizeof(System2CommandInfo));
+    SYSTEM2_RESULT result = System2Run("sleep 5", &commandInfo);
+    EXIT_IF_FAILED(result);
+
+    System2::EventLoop loop;
+    PollErrorWaitExample(loop, commandInfo);
+
+    //poll() fails with EINVAL when it is given more fds than RLIMIT_NOFILE
+    struct rlimit originalLimit;
+    getrlimit(RLIMIT_NOFILE, &originalLimit);
+    struct rlimit lowLimit = originalLimit;
+    lowLimit.rlim_cur = 1;
+    setrlimit(RLIMIT_NOFILE, &lowLimit);
+
+    loop.Run();
+    setrlimit(RLIMIT_NOFILE, &originalLimit);
+
+    //Output: Poll error: 22
+    printf("Poll error: %d\n", loop.GetPollError());
+    if(loop.GetPollError() != EINVAL)
+    {
+        printf("Error at %d: unexpected poll error\n", __LINE__);
+        exit(-1);
+    }
+
+    result = System2Kill(&commandInfo);
+    EXIT_IF_FAILED(result);
+
+    int returnCode = -1;
+    System2GetCommandReturnValue(&commandInfo, -1, &returnCode);
+    result = System2CleanupCommand(&commandInfo);
+    EXIT_IF_FAILED(result);
+}
+
+//Commands are also run without the event loop, with the environment set either way
+void CommandEnvironmentExample()
+{
+    const char* names[] = { "FIRST_WORD" };
+    const char* values[] = { "Hello" };
+
+    for(int i = 0; i < 2; ++i)
+    {
+        System2::Command command;
+        command.GetInfo().RedirectOutput = true;
+        if(i == 0)
+        {
+            command.GetInfo().EnvVarsNames = names;
+            command.GetInfo().EnvVarsValues = values;
+            command.GetInfo().EnvVarsCount = 1;
+        }
+        else
+            command.SetEnvironmentVariable("FIRST_WORD", "Hi");
+
+        SYSTEM2_RESULT result = command.Run("echo $FIRST_WORD");
+        EXIT_IF_FAILED(result);
+
+        //Output:
+        //Environment: Hello
+        //Environment: Hi
+        std::string output;
+        result = command.ReadAllOutput(output);
+        EXIT_IF_FAILED(result);
+        printf("Environment: %s", output.c_str());
+
+        if(output != (i == 0 ? "Hello\n" : "Hi\n"))
+        {
+            printf("Error at %d: unexpected output\n", __LINE__);
+            exit(-1);
+        }
+
+        int returnCode = -1;
+        result = command.Wait(-1, returnCode);
+        EXIT_IF_FAILED(result);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    (void)argc;
+    (void)argv;
+
+    CommandEnvironmentExample();
+    PollErrorExample();
+
+    //All the commands are awaited at the same time on this thread
+    System2::EventLoop loop;
+    ReadOutputExample(loop);
+    WriteInputExample(loop);
+    WaitDeadlineExample(loop);
+    loop.Run();
+
+    return 0;
+}
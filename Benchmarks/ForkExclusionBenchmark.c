@@ -0,0 +1,161 @@
+/*
+Measures how long it takes to start a command with the fork backend across parent RSS sizes, with 
+the memory left as it is, registered with `MADV_DONTFORK` and registered with `MADV_WIPEONFORK` 
+through `System2RegisterForkExcludedMemory()`.
+
+Usage: ForkExclusionBenchmark [spawns per case] [RSS sizes in MB]
+
+RSS sizes are a comma separated list, i.e. `ForkExclusionBenchmark 100 0,1024,4096`
+
+Outputs one JSON object per line.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include "System2.h"
+
+#define MAX_LIST_COUNT 16
+
+static const char* ModeNames[] = { "none", "dontfork", "wipeonfork" };
+
+static double GetSeconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+static int ParseList(const char* text, int* outValues)
+{
+    int count = 0;
+    while(count < MAX_LIST_COUNT)
+    {
+        char* end;
+        outValues[count++] = (int)strtol(text, &end, 10);
+        if(*end != ',')
+            break;
+
+        text = end + 1;
+    }
+
+    return count;
+}
+
+static int CompareDoubles(const void* a, const void* b)
+{
+    double difference = *(const double*)a - *(const double*)b;
+    return (difference > 0) - (difference < 0);
+}
+
+//Times how long `System2RunSubprocess()` takes to start `true`, then waits for it to finish
+static int RunCase(int spawnsCount, int rssMB, int mode)
+{
+    double* spawnSeconds = (double*)malloc(sizeof(double) * spawnsCount);
+    if(!spawnSeconds)
+        return -1;
+    
+    double totalSpawnSeconds = 0;
+    for(int i = 0; i < spawnsCount; ++i)
+    {
+        System2CommandInfo commandInfo;
+        memset(&commandInfo, 0, sizeof(System2CommandInfo));
+        commandInfo.SpawnBackend = SYSTEM2_SPAWN_BACKEND_FORK;
+        
+        double startTime = GetSeconds();
+        SYSTEM2_RESULT result = System2RunSubprocess("true", NULL, 0, &commandInfo);
+        spawnSeconds[i] = GetSeconds() - startTime;
+        totalSpawnSeconds += spawnSeconds[i];
+        
+        int returnCode = -1;
+        if( result != SYSTEM2_RESULT_SUCCESS ||
+            System2GetCommandReturnValue(&commandInfo, -1, &returnCode) != SYSTEM2_RESULT_SUCCESS ||
+            System2CleanupCommand(&commandInfo) != SYSTEM2_RESULT_SUCCESS ||
+            returnCode != 0)
+        {
+            free(spawnSeconds);
+            return -1;
+        }
+    }
+    
+    qsort(spawnSeconds, spawnsCount, sizeof(double), CompareDoubles);
+    
+    printf( "{\"benchmark\":\"fork_exclusion\",\"mode\":\"%s\",\"parent_rss_mb\":%d,\"spawns\":%d,"
+            "\"spawn_us_mean\":%.1f,\"spawn_us_p50\":%.1f,\"spawn_us_p99\":%.1f}\n",
+            ModeNames[mode],
+            rssMB,
+            spawnsCount,
+            totalSpawnSeconds / spawnsCount * 1e6,
+            spawnSeconds[spawnsCount / 2] * 1e6,
+            spawnSeconds[(int)(spawnsCount * 0.99)] * 1e6);
+    fflush(stdout);
+    
+    free(spawnSeconds);
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    int spawnsCount = argc > 1 ? atoi(argv[1]) : 100;
+    
+    int rssSizes[MAX_LIST_COUNT];
+    int rssSizesCount = ParseList(argc > 2 ? argv[2] : "0,256,1024", rssSizes);
+    
+    if(spawnsCount <= 0)
+    {
+        fprintf(stderr, "Invalid spawns count\n");
+        return 1;
+    }
+    
+    for(int i = 0; i < rssSizesCount; ++i)
+    {
+        //Registered regions need to be page aligned, so map them directly
+        size_t rssBytes = (size_t)rssSizes[i] * 1024 * 1024;
+        char* rss = NULL;
+        if(rssBytes > 0)
+        {
+            void* memory = mmap(NULL, rssBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, 
+                                -1, 0);
+            if(memory == MAP_FAILED)
+            {
+                fprintf(stderr, "Failed to allocate %d MB\n", rssSizes[i]);
+                return 1;
+            }
+            
+            //Touch every page so that it is actually part of the RSS
+            rss = (char*)memory;
+            memset(rss, 1, rssBytes);
+        }
+        
+        for(int mode = 0; mode < 3; ++mode)
+        {
+            if(rss && mode > 0)
+            {
+                SYSTEM2_RESULT result = System2RegisterForkExcludedMemory(rss, rssBytes, mode == 2);
+                if(result != SYSTEM2_RESULT_SUCCESS)
+                {
+                    fprintf(stderr, "Failed to register %s memory: %d\n", ModeNames[mode], result);
+                    return 1;
+                }
+            }
+            
+            if(RunCase(spawnsCount, rssSizes[i], mode) != 0)
+            {
+                fprintf(stderr, "Fork exclusion benchmark failed\n");
+                return 1;
+            }
+            
+            if(rss && mode > 0)
+                System2UnregisterForkExcludedMemory(rss);
+        }
+        
+        if(rss)
+            munmap(rss, rssBytes);
+    }
+    
+    return 0;
+}
@@ -0,0 +1,175 @@
+/*
+Measures the makespan of a dependency graph of `sleep` commands with random durations, run level
+by level (waiting for the whole level before starting the next one), and with `System2GraphRun()`
+starting each node as soon as its dependencies are done. The graph is run without costs, where 
+the longest path is counted in nodes, and with the durations as costs, where the critical path 
+goes first.
+
+Each node after the first level depends on 2 random nodes of the level before it.
+
+Usage: GraphBenchmark [levels] [nodes per level] [max concurrency]
+
+Outputs one JSON object per line.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "System2.h"
+
+#define MAX_NODES 4096
+
+typedef struct
+{
+    int DurationMs;
+    char DurationArg[16];       //`DurationMs` in seconds for `sleep`
+    const char* Args[1];
+    int Dependencies[2];
+} BenchmarkNode;
+
+static BenchmarkNode Nodes[MAX_NODES];
+
+static double GetSeconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+//Same numbers on every run, so that the cases can be compared
+static uint32_t NextRandom(uint32_t* state)
+{
+    *state = *state * 1664525u + 1013904223u;
+    return *state >> 8;
+}
+
+static int AddNode(System2Graph* graph, int nodeIndex, bool withCost)
+{
+    System2SpawnSpec spec;
+    memset(&spec, 0, sizeof(System2SpawnSpec));
+    spec.Executable = "sleep";
+    spec.Args = Nodes[nodeIndex].Args;
+    spec.ArgsCount = 1;
+
+    uint64_t cost = withCost ? (uint64_t)Nodes[nodeIndex].DurationMs : 0;
+    return System2GraphAddNode(graph, &spec, NULL, cost, NULL) == SYSTEM2_RESULT_SUCCESS ? 0 : -1;
+}
+
+static void PrintResult(const char* schedule, int levels, int width, int concurrency, double seconds)
+{
+    printf( "{\"benchmark\":\"graph\",\"schedule\":\"%s\",\"levels\":%d,\"width\":%d,"
+            "\"concurrency\":%d,\"makespan_seconds\":%.3f}\n",
+            schedule,
+            levels,
+            width,
+            concurrency,
+            seconds);
+    fflush(stdout);
+}
+
+//Runs each level as a graph without edges, one after another
+static int RunLevelCase(int levels, int width, int concurrency)
+{
+    double startTime = GetSeconds();
+    for(int level = 0; level < levels; ++level)
+    {
+        System2Graph graph;
+        System2GraphInit(&graph);
+
+        SYSTEM2_RESULT result = SYSTEM2_RESULT_SUCCESS;
+        for(int i = 0; i < width && result == SYSTEM2_RESULT_SUCCESS; ++i)
+        {
+            if(AddNode(&graph, level * width + i, false) != 0)
+                result = SYSTEM2_RESULT_MALLOC_FAILED;
+        }
+
+        if(result == SYSTEM2_RESULT_SUCCESS)
+            result = System2GraphRun(&graph, concurrency, NULL);
+
+        System2GraphFree(&graph);
+        if(result != SYSTEM2_RESULT_SUCCESS)
+            return -1;
+    }
+
+    PrintResult("level", levels, width, concurrency, GetSeconds() - startTime);
+    return 0;
+}
+
+static int RunGraphCase(int levels, int width, int concurrency, bool criticalPath)
+{
+    System2Graph graph;
+    System2GraphInit(&graph);
+
+    SYSTEM2_RESULT result = SYSTEM2_RESULT_SUCCESS;
+    for(int i = 0; i < levels * width && result == SYSTEM2_RESULT_SUCCESS; ++i)
+    {
+        if(AddNode(&graph, i, criticalPath) != 0)
+            result = SYSTEM2_RESULT_MALLOC_FAILED;
+    }
+
+    for(int i = width; i < levels * width && result == SYSTEM2_RESULT_SUCCESS; ++i)
+    {
+        for(int j = 0; j < 2 && result == SYSTEM2_RESULT_SUCCESS; ++j)
+            result = System2GraphAddEdge(&graph, Nodes[i].Dependencies[j], i);
+    }
+
+    double startTime = GetSeconds();
+    if(result == SYSTEM2_RESULT_SUCCESS)
+        result = System2GraphRun(&graph, concurrency, NULL);
+
+    double seconds = GetSeconds() - startTime;
+    System2GraphFree(&graph);
+    if(result != SYSTEM2_RESULT_SUCCESS)
+        return -1;
+
+    PrintResult(criticalPath ? "graph_critical_path" : "graph_no_cost", 
+                levels, 
+                width, 
+                concurrency, 
+                seconds);
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    int levels = argc > 1 ? atoi(argv[1]) : 5;
+    int width = argc > 2 ? atoi(argv[2]) : 8;
+    int concurrency = argc > 3 ? atoi(argv[3]) : 4;
+
+    if(levels <= 0 || width <= 0 || levels * width > MAX_NODES)
+    {
+        fprintf(stderr, 
+                "Levels and nodes per level must be positive, with up to %d nodes\n", 
+                MAX_NODES);
+        return 1;
+    }
+
+    //Mostly short nodes with a few stragglers
+    uint32_t randomState = 2024;
+    for(int i = 0; i < levels * width; ++i)
+    {
+        BenchmarkNode* node = &Nodes[i];
+        node->DurationMs = NextRandom(&randomState) % 8 == 0 ?
+                           200 + (int)(NextRandom(&randomState) % 200) :
+                           10 + (int)(NextRandom(&randomState) % 60);
+        snprintf(node->DurationArg, sizeof(node->DurationArg), "%.3f", node->DurationMs / 1000.0);
+        node->Args[0] = node->DurationArg;
+
+        int levelStart = (i / width - 1) * width;
+        for(int j = 0; j < 2 && i >= width; ++j)
+            node->Dependencies[j] = levelStart + (int)(NextRandom(&randomState) % width);
+    }
+
+    if( RunLevelCase(levels, width, concurrency) != 0 ||
+        RunGraphCase(levels, width, concurrency, false) != 0 ||
+        RunGraphCase(levels, width, concurrency, true) != 0)
+    {
+        fprintf(stderr, "Graph benchmark failed\n");
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,284 @@
+/*
+Measures the pipe throughput of System2ReadFromOutput() and System2WriteToInput(), along with the
+number of syscalls used per MB. Build with `SYSTEM2_IO_URING 1` to measure the io_uring engine, and
+with `SYSTEM2_POSIX_SPAWN 1` for the posix_spawn backend.
+
+The same output is also captured with `CaptureOutputToFile` and read through System2MapOutput() 
+for comparison.
+
+Usage: PipeBenchmark [size in MB] [pipe size in KB]
+
+Outputs one JSON object per line.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sched.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+
+//Count the syscalls made by System2 by routing them through these before including it
+static uint64_t SyscallsCount = 0;
+
+static ssize_t CountedRead(int fd, void* buffer, size_t count)
+{
+    ++SyscallsCount;
+    return read(fd, buffer, count);
+}
+
+static ssize_t CountedWrite(int fd, const void* buffer, size_t count)
+{
+    ++SyscallsCount;
+    return write(fd, buffer, count);
+}
+
+static long CountedSyscall(long number, ...)
+{
+    long args[6];
+    va_list list;
+    va_start(list, number);
+    for(int i = 0; i < 6; ++i)
+        args[i] = va_arg(list, long);
+    va_end(list);
+
+    ++SyscallsCount;
+    return syscall(number, args[0], args[1], args[2], args[3], args[4], args[5]);
+}
+
+#define read CountedRead
+#define write CountedWrite
+#define syscall CountedSyscall
+#include "System2.h"
+#undef read
+#undef write
+#undef syscall
+
+#if SYSTEM2_IO_URING
+    #define IO_ENGINE "io_uring"
+#else
+    #define IO_ENGINE "read_write"
+#endif
+
+#if SYSTEM2_POSIX_SPAWN
+    #define BACKEND "posix_spawn"
+#else
+    #define BACKEND "fork"
+#endif
+
+#define BUFFER_SIZE (1024 * 1024)
+
+//Requested pipe capacity, 0 for the system default
+static int PipeSize = 0;
+
+static double GetSeconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+static long GetVoluntaryContextSwitches(void)
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_nvcsw;
+}
+
+static void PrintResult(const char* name,
+                        int pipeSize,
+                        uint64_t bytes,
+                        double seconds,
+                        uint64_t syscalls,
+                        long contextSwitches)
+{
+    double megabytes = (double)bytes / (1024.0 * 1024.0);
+    printf( "{\"benchmark\":\"%s\",\"backend\":\"%s\",\"io_engine\":\"%s\",\"pipe_size\":%d,"
+            "\"bytes\":%llu,\"seconds\":%.6f,\"mb_per_second\":%.2f,\"syscalls\":%llu,"
+            "\"syscalls_per_mb\":%.3f,\"voluntary_context_switches\":%ld}\n",
+            name,
+            BACKEND,
+            IO_ENGINE,
+            pipeSize,
+            (unsigned long long)bytes,
+            seconds,
+            megabytes / seconds,
+            (unsigned long long)syscalls,
+            (double)syscalls / megabytes,
+            contextSwitches);
+}
+
+static int RunReadBenchmark(uint64_t totalBytes, char* buffer)
+{
+    System2CommandInfo commandInfo;
+    memset(&commandInfo, 0, sizeof(System2CommandInfo));
+    commandInfo.RedirectOutput = true;
+    commandInfo.StdoutPipeSize = PipeSize;
+
+    char command[128];
+    snprintf(   command,
+                sizeof(command),
+                "dd if=/dev/zero bs=65536 count=%llu status=none",
+                (unsigned long long)(totalBytes / 65536));
+
+    double startTime = GetSeconds();
+    SYSTEM2_RESULT result = System2Run(command, &commandInfo);
+    if(result != SYSTEM2_RESULT_SUCCESS)
+        return -1;
+
+    uint64_t startSyscalls = SyscallsCount;
+    long startContextSwitches = GetVoluntaryContextSwitches();
+    uint64_t bytesRead = 0;
+    do
+    {
+        uint32_t currentBytesRead = 0;
+        result = System2ReadFromOutput(&commandInfo, buffer, BUFFER_SIZE, &currentBytesRead);
+        bytesRead += currentBytesRead;
+    }
+    while(result == SYSTEM2_RESULT_READ_NOT_FINISHED);
+
+    uint64_t syscalls = SyscallsCount - startSyscalls;
+    long contextSwitches = GetVoluntaryContextSwitches() - startContextSwitches;
+    double seconds = GetSeconds() - startTime;
+
+    int returnCode = -1;
+    if( result != SYSTEM2_RESULT_SUCCESS ||
+        System2GetCommandReturnValue(&commandInfo, -1, &returnCode) != SYSTEM2_RESULT_SUCCESS ||
+        System2CleanupCommand(&commandInfo) != SYSTEM2_RESULT_SUCCESS)
+    {
+        return -1;
+    }
+
+    PrintResult("pipe_read", commandInfo.StdoutPipeSize, bytesRead, seconds, syscalls, contextSwitches);
+    return 0;
+}
+
+//Same as `RunReadBenchmark()`, but the output goes to a file which is mapped after the command exits
+static int RunCaptureFileBenchmark(uint64_t totalBytes)
+{
+    System2CommandInfo commandInfo;
+    memset(&commandInfo, 0, sizeof(System2CommandInfo));
+    commandInfo.CaptureOutputToFile = true;
+
+    char command[128];
+    snprintf(   command,
+                sizeof(command),
+                "dd if=/dev/zero bs=65536 count=%llu status=none",
+                (unsigned long long)(totalBytes / 65536));
+
+    double startTime = GetSeconds();
+    uint64_t startSyscalls = SyscallsCount;
+    long startContextSwitches = GetVoluntaryContextSwitches();
+    SYSTEM2_RESULT result = System2Run(command, &commandInfo);
+    if(result != SYSTEM2_RESULT_SUCCESS)
+        return -1;
+
+    int returnCode = -1;
+    System2OutputView view;
+    if( System2GetCommandReturnValue(&commandInfo, -1, &returnCode) != SYSTEM2_RESULT_SUCCESS ||
+        System2MapOutput(&commandInfo, false, &view) != SYSTEM2_RESULT_SUCCESS)
+    {
+        return -1;
+    }
+
+    //Fault in every page of the mapping, which is what it costs to access the output
+    uint64_t sum = 0;
+    for(uint64_t i = 0; i < view.Size; i += 4096)
+        sum += (unsigned char)view.Data[i];
+
+    uint64_t syscalls = SyscallsCount - startSyscalls;
+    long contextSwitches = GetVoluntaryContextSwitches() - startContextSwitches;
+    double seconds = GetSeconds() - startTime;
+
+    uint64_t bytesRead = view.Size;
+    if( sum != 0 ||
+        System2UnmapOutput(&view) != SYSTEM2_RESULT_SUCCESS ||
+        System2CleanupCommand(&commandInfo) != SYSTEM2_RESULT_SUCCESS)
+    {
+        return -1;
+    }
+
+    PrintResult("capture_file_read", 0, bytesRead, seconds, syscalls, contextSwitches);
+    return 0;
+}
+
+static int RunWriteBenchmark(uint64_t totalBytes, char* buffer)
+{
+    System2CommandInfo commandInfo;
+    memset(&commandInfo, 0, sizeof(System2CommandInfo));
+    commandInfo.RedirectInput = true;
+    commandInfo.StdinPipeSize = PipeSize;
+
+    double startTime = GetSeconds();
+    SYSTEM2_RESULT result = System2Run("cat > /dev/null", &commandInfo);
+    if(result != SYSTEM2_RESULT_SUCCESS)
+        return -1;
+
+    uint64_t startSyscalls = SyscallsCount;
+    long startContextSwitches = GetVoluntaryContextSwitches();
+    uint64_t bytesWritten = 0;
+    while(bytesWritten < totalBytes)
+    {
+        result = System2WriteToInput(&commandInfo, buffer, BUFFER_SIZE);
+        if(result != SYSTEM2_RESULT_SUCCESS)
+            return -1;
+
+        bytesWritten += BUFFER_SIZE;
+    }
+
+    uint64_t syscalls = SyscallsCount - startSyscalls;
+    long contextSwitches = GetVoluntaryContextSwitches() - startContextSwitches;
+
+    //Closes the input so that the command can finish
+    int returnCode = -1;
+    if( System2CleanupCommand(&commandInfo) != SYSTEM2_RESULT_SUCCESS ||
+        System2GetCommandReturnValue(&commandInfo, -1, &returnCode) != SYSTEM2_RESULT_SUCCESS)
+    {
+        return -1;
+    }
+
+    double seconds = GetSeconds() - startTime;
+    PrintResult("pipe_write", commandInfo.StdinPipeSize, bytesWritten, seconds, syscalls, contextSwitches);
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    uint64_t totalBytes = (uint64_t)(argc > 1 ? atoi(argv[1]) : 256) * 1024 * 1024;
+    PipeSize = argc > 2 ? atoi(argv[2]) * 1024 : 0;
+
+    char* buffer = (char*)malloc(BUFFER_SIZE);
+    if(!buffer)
+        return 1;
+
+    memset(buffer, 'a', BUFFER_SIZE);
+
+    if(RunReadBenchmark(totalBytes, buffer) != 0)
+    {
+        fprintf(stderr, "Read benchmark failed\n");
+        return 1;
+    }
+
+    if(RunCaptureFileBenchmark(totalBytes) != 0)
+    {
+        fprintf(stderr, "Capture file benchmark failed\n");
+        return 1;
+    }
+
+    if(RunWriteBenchmark(totalBytes, buffer) != 0)
+    {
+        fprintf(stderr, "Write benchmark failed\n");
+        return 1;
+    }
+
+    free(buffer);
+    return 0;
+}
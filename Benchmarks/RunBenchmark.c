@@ -0,0 +1,173 @@
+/*
+Measures how long `System2Run()` takes from start to exit for a command string that doesn't need 
+the shell, started directly and with `AlwaysUseShell`, and how long the same command takes in a 
+`System2ShellSession`.
+
+Usage: RunBenchmark [runs per case] [command]
+
+Outputs one JSON object per line.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "System2.h"
+
+static double GetSeconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+static int CompareDoubles(const void* a, const void* b)
+{
+    double difference = *(const double*)a - *(const double*)b;
+    return (difference > 0) - (difference < 0);
+}
+
+static int RunCase(int runsCount, const char* command, bool alwaysUseShell)
+{
+    double* runSeconds = (double*)malloc(sizeof(double) * runsCount);
+    if(!runSeconds)
+        return -1;
+    
+    double totalRunSeconds = 0;
+    for(int i = 0; i < runsCount; ++i)
+    {
+        System2CommandInfo commandInfo;
+        memset(&commandInfo, 0, sizeof(System2CommandInfo));
+        commandInfo.RedirectOutput = true;
+        commandInfo.AlwaysUseShell = alwaysUseShell;
+        
+        double startTime = GetSeconds();
+        SYSTEM2_RESULT result = System2Run(command, &commandInfo);
+        
+        //Discard the output
+        char output[4096];
+        uint32_t bytesRead = 0;
+        while(result == SYSTEM2_RESULT_SUCCESS || result == SYSTEM2_RESULT_READ_NOT_FINISHED)
+        {
+            result = System2ReadFromOutput(&commandInfo, output, sizeof(output), &bytesRead);
+            if(result == SYSTEM2_RESULT_SUCCESS)
+                break;
+        }
+        
+        int returnCode = -1;
+        if( result != SYSTEM2_RESULT_SUCCESS ||
+            System2GetCommandReturnValue(&commandInfo, -1, &returnCode) != SYSTEM2_RESULT_SUCCESS ||
+            System2CleanupCommand(&commandInfo) != SYSTEM2_RESULT_SUCCESS ||
+            returnCode != 0)
+        {
+            free(runSeconds);
+            return -1;
+        }
+        
+        runSeconds[i] = GetSeconds() - startTime;
+        totalRunSeconds += runSeconds[i];
+    }
+    
+    qsort(runSeconds, runsCount, sizeof(double), CompareDoubles);
+    
+    printf( "{\"benchmark\":\"run\",\"shell\":%s,\"runs\":%d,\"run_us_mean\":%.1f,"
+            "\"run_us_p50\":%.1f,\"run_us_p99\":%.1f}\n",
+            alwaysUseShell ? "true" : "false",
+            runsCount,
+            totalRunSeconds / runsCount * 1e6,
+            runSeconds[runsCount / 2] * 1e6,
+            runSeconds[(int)(runsCount * 0.99)] * 1e6);
+    fflush(stdout);
+    
+    free(runSeconds);
+    return 0;
+}
+
+static int RunSessionCase(int runsCount, const char* command)
+{
+    double* runSeconds = (double*)malloc(sizeof(double) * runsCount);
+    if(!runSeconds)
+        return -1;
+    
+    System2ShellSession session;
+    if(System2ShellSessionStart(&session, NULL) != SYSTEM2_RESULT_SUCCESS)
+    {
+        free(runSeconds);
+        return -1;
+    }
+    
+    double totalRunSeconds = 0;
+    for(int i = 0; i < runsCount; ++i)
+    {
+        const char* output = NULL;
+        uint32_t outputSize = 0;
+        int returnCode = -1;
+        
+        double startTime = GetSeconds();
+        SYSTEM2_RESULT result = System2ShellSessionRun( &session, 
+                                                        command, 
+                                                        -1, 
+                                                        &output, 
+                                                        &outputSize, 
+                                                        &returnCode);
+        if(result != SYSTEM2_RESULT_SUCCESS || returnCode != 0)
+        {
+            System2ShellSessionEnd(&session);
+            free(runSeconds);
+            return -1;
+        }
+        
+        runSeconds[i] = GetSeconds() - startTime;
+        totalRunSeconds += runSeconds[i];
+    }
+    
+    if(System2ShellSessionEnd(&session) != SYSTEM2_RESULT_SUCCESS)
+    {
+        free(runSeconds);
+        return -1;
+    }
+    
+    qsort(runSeconds, runsCount, sizeof(double), CompareDoubles);
+    
+    printf( "{\"benchmark\":\"run_session\",\"runs\":%d,\"run_us_mean\":%.1f,"
+            "\"run_us_p50\":%.1f,\"run_us_p99\":%.1f}\n",
+            runsCount,
+            totalRunSeconds / runsCount * 1e6,
+            runSeconds[runsCount / 2] * 1e6,
+            runSeconds[(int)(runsCount * 0.99)] * 1e6);
+    fflush(stdout);
+    
+    free(runSeconds);
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    int runsCount = argc > 1 ? atoi(argv[1]) : 200;
+    const char* command = argc > 2 ? argv[2] : "uname -s";
+    
+    if(runsCount <= 0)
+    {
+        fprintf(stderr, "Invalid runs count\n");
+        return 1;
+    }
+    
+    for(int alwaysUseShell = 0; alwaysUseShell < 2; ++alwaysUseShell)
+    {
+        if(RunCase(runsCount, command, alwaysUseShell) != 0)
+        {
+            fprintf(stderr, "Run benchmark failed\n");
+            return 1;
+        }
+    }
+    
+    if(RunSessionCase(runsCount, command) != 0)
+    {
+        fprintf(stderr, "Run session benchmark failed\n");
+        return 1;
+    }
+    
+    return 0;
+}
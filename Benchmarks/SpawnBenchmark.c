@@ -0,0 +1,349 @@
+/*
+Measures how fast commands can be spawned and how long it takes for their first output byte to
+arrive, across parent RSS sizes, spawning thread counts and with or without environment overrides.
+Build with `SYSTEM2_POSIX_SPAWN 1` to measure the posix_spawn backend, or with 
+`BENCHMARK_VFORK 1` to measure the vfork backend.
+
+Each RSS size also measures starting the same number of commands in bursts with `System2RunMany()`, 
+which uses several threads when built with `SYSTEM2_PARALLEL_SPAWN 1`.
+
+Usage: SpawnBenchmark [spawns per case] [RSS sizes in MB] [thread counts]
+
+RSS sizes and thread counts are comma separated lists, i.e. `SpawnBenchmark 200 0,256,1024 1,4`
+
+Outputs one JSON object per line.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "System2.h"
+
+#if BENCHMARK_VFORK
+    #define BACKEND "vfork"
+#elif SYSTEM2_POSIX_SPAWN
+    #define BACKEND "posix_spawn"
+#else
+    #define BACKEND "fork"
+#endif
+
+#if SYSTEM2_PARALLEL_SPAWN
+    #define BATCH_THREADS SYSTEM2_PARALLEL_SPAWN_THREADS
+#else
+    #define BATCH_THREADS 1
+#endif
+
+#define MAX_LIST_COUNT 16
+#define BATCH_SIZE 100
+
+typedef struct
+{
+    int SpawnsCount;
+    bool EnvOverrides;
+    double* FirstByteSeconds;       //One for each spawn
+    bool Failed;
+} ThreadData;
+
+static double GetSeconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+static int ParseList(const char* text, int* outValues)
+{
+    int count = 0;
+    while(count < MAX_LIST_COUNT)
+    {
+        char* end;
+        outValues[count++] = (int)strtol(text, &end, 10);
+        if(*end != ',')
+            break;
+
+        text = end + 1;
+    }
+
+    return count;
+}
+
+static int CompareDoubles(const void* a, const void* b)
+{
+    double difference = *(const double*)a - *(const double*)b;
+    return (difference > 0) - (difference < 0);
+}
+
+//Spawns `printf x`, reads the first byte of its output, then waits for it to finish
+static void* RunSpawns(void* data)
+{
+    ThreadData* threadData = (ThreadData*)data;
+    const char* envNames[] = { "SYSTEM2_BENCHMARK_VAR", "LC_ALL" };
+    const char* envValues[] = { "value", "C" };
+    const char* args[] = { "x" };
+
+    for(int i = 0; i < threadData->SpawnsCount; ++i)
+    {
+        System2CommandInfo commandInfo;
+        memset(&commandInfo, 0, sizeof(System2CommandInfo));
+        commandInfo.RedirectOutput = true;
+        if(threadData->EnvOverrides)
+        {
+            commandInfo.EnvVarsNames = envNames;
+            commandInfo.EnvVarsValues = envValues;
+            commandInfo.EnvVarsCount = 2;
+        }
+
+        double startTime = GetSeconds();
+        SYSTEM2_RESULT result = System2RunSubprocess("printf", args, 1, &commandInfo);
+        if(result != SYSTEM2_RESULT_SUCCESS)
+        {
+            threadData->Failed = true;
+            return NULL;
+        }
+
+        char output;
+        uint32_t bytesRead = 0;
+        result = System2ReadFromOutput(&commandInfo, &output, 1, &bytesRead);
+        threadData->FirstByteSeconds[i] = GetSeconds() - startTime;
+
+        while(result == SYSTEM2_RESULT_READ_NOT_FINISHED)
+            result = System2ReadFromOutput(&commandInfo, &output, 1, &bytesRead);
+
+        int returnCode = -1;
+        if( result != SYSTEM2_RESULT_SUCCESS ||
+            System2GetCommandReturnValue(&commandInfo, -1, &returnCode) != SYSTEM2_RESULT_SUCCESS ||
+            System2CleanupCommand(&commandInfo) != SYSTEM2_RESULT_SUCCESS ||
+            returnCode != 0)
+        {
+            threadData->Failed = true;
+            return NULL;
+        }
+    }
+
+    return NULL;
+}
+
+static int RunCase(int spawnsCount, int rssMB, int threadsCount, bool envOverrides)
+{
+    pthread_t threads[MAX_LIST_COUNT];
+    ThreadData threadsData[MAX_LIST_COUNT];
+    double* firstByteSeconds = (double*)malloc(sizeof(double) * spawnsCount);
+    if(!firstByteSeconds)
+        return -1;
+
+    //Split the spawns between the threads
+    int spawnsStarted = 0;
+    for(int i = 0; i < threadsCount; ++i)
+    {
+        threadsData[i].SpawnsCount = spawnsCount / threadsCount + (i < spawnsCount % threadsCount);
+        threadsData[i].EnvOverrides = envOverrides;
+        threadsData[i].FirstByteSeconds = firstByteSeconds + spawnsStarted;
+        threadsData[i].Failed = false;
+        spawnsStarted += threadsData[i].SpawnsCount;
+    }
+
+    double startTime = GetSeconds();
+    int threadsStarted = 0;
+    for(; threadsStarted < threadsCount; ++threadsStarted)
+    {
+        ThreadData* threadData = &threadsData[threadsStarted];
+        if(pthread_create(&threads[threadsStarted], NULL, RunSpawns, threadData) != 0)
+            break;
+    }
+
+    bool failed = threadsStarted != threadsCount;
+    for(int i = 0; i < threadsStarted; ++i)
+    {
+        pthread_join(threads[i], NULL);
+        failed = failed || threadsData[i].Failed;
+    }
+
+    double seconds = GetSeconds() - startTime;
+    if(failed)
+    {
+        free(firstByteSeconds);
+        return -1;
+    }
+
+    double totalFirstByteSeconds = 0;
+    for(int i = 0; i < spawnsCount; ++i)
+        totalFirstByteSeconds += firstByteSeconds[i];
+
+    qsort(firstByteSeconds, spawnsCount, sizeof(double), CompareDoubles);
+
+    printf( "{\"benchmark\":\"spawn\",\"backend\":\"%s\",\"parent_rss_mb\":%d,\"threads\":%d,"
+            "\"env_overrides\":%s,\"spawns\":%d,\"seconds\":%.6f,\"spawns_per_second\":%.2f,"
+            "\"first_byte_us_mean\":%.1f,\"first_byte_us_p50\":%.1f,\"first_byte_us_p99\":%.1f}\n",
+            BACKEND,
+            rssMB,
+            threadsCount,
+            envOverrides ? "true" : "false",
+            spawnsCount,
+            seconds,
+            spawnsCount / seconds,
+            totalFirstByteSeconds / spawnsCount * 1e6,
+            firstByteSeconds[spawnsCount / 2] * 1e6,
+            firstByteSeconds[(int)(spawnsCount * 0.99)] * 1e6);
+    fflush(stdout);
+
+    free(firstByteSeconds);
+    return 0;
+}
+
+//Starts the spawns in bursts of `BATCH_SIZE` with `System2RunMany()`, then waits for all of them
+static int RunBatchCase(int spawnsCount, int rssMB, bool envOverrides)
+{
+    const char* envNames[] = { "SYSTEM2_BENCHMARK_VAR", "LC_ALL" };
+    const char* envValues[] = { "value", "C" };
+    const char* args[] = { "x" };
+    
+    System2SpawnSpec specs[BATCH_SIZE];
+    System2CommandInfo commandInfos[BATCH_SIZE];
+    SYSTEM2_RESULT results[BATCH_SIZE];
+    for(int i = 0; i < BATCH_SIZE; ++i)
+    {
+        specs[i].Command = NULL;
+        specs[i].Executable = "printf";
+        specs[i].Args = args;
+        specs[i].ArgsCount = 1;
+    }
+    
+    double startTime = GetSeconds();
+    double runManySeconds = 0;
+    for(int spawnsStarted = 0; spawnsStarted < spawnsCount; spawnsStarted += BATCH_SIZE)
+    {
+        int batchSize = spawnsCount - spawnsStarted;
+        if(batchSize > BATCH_SIZE)
+            batchSize = BATCH_SIZE;
+        
+        memset(commandInfos, 0, sizeof(System2CommandInfo) * batchSize);
+        for(int i = 0; i < batchSize; ++i)
+        {
+            commandInfos[i].RedirectOutput = true;
+            if(envOverrides)
+            {
+                commandInfos[i].EnvVarsNames = envNames;
+                commandInfos[i].EnvVarsValues = envValues;
+                commandInfos[i].EnvVarsCount = 2;
+            }
+        }
+        
+        double runManyStartTime = GetSeconds();
+        SYSTEM2_RESULT result = System2RunMany(specs, batchSize, commandInfos, results);
+        runManySeconds += GetSeconds() - runManyStartTime;
+        
+        for(int i = 0; i < batchSize; ++i)
+        {
+            if(results[i] != SYSTEM2_RESULT_SUCCESS)
+                continue;
+            
+            char output;
+            uint32_t bytesRead = 0;
+            SYSTEM2_RESULT readResult;
+            do
+                readResult = System2ReadFromOutput(&commandInfos[i], &output, 1, &bytesRead);
+            while(readResult == SYSTEM2_RESULT_READ_NOT_FINISHED);
+            
+            int returnCode = -1;
+            if( readResult != SYSTEM2_RESULT_SUCCESS ||
+                System2GetCommandReturnValue(&commandInfos[i], -1, &returnCode) != 
+                    SYSTEM2_RESULT_SUCCESS ||
+                returnCode != 0)
+            {
+                result = SYSTEM2_RESULT_COMMAND_WAIT_FAILED;
+            }
+            
+            System2CleanupCommand(&commandInfos[i]);
+        }
+        
+        if(result != SYSTEM2_RESULT_SUCCESS)
+            return -1;
+    }
+    
+    double seconds = GetSeconds() - startTime;
+    printf( "{\"benchmark\":\"spawn_batch\",\"backend\":\"%s\",\"parent_rss_mb\":%d,\"threads\":%d,"
+            "\"env_overrides\":%s,\"spawns\":%d,\"batch_size\":%d,\"seconds\":%.6f,"
+            "\"spawns_per_second\":%.2f,\"run_many_us_per_spawn\":%.1f}\n",
+            BACKEND,
+            rssMB,
+            BATCH_THREADS,
+            envOverrides ? "true" : "false",
+            spawnsCount,
+            BATCH_SIZE,
+            seconds,
+            spawnsCount / seconds,
+            runManySeconds / spawnsCount * 1e6);
+    fflush(stdout);
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    int spawnsCount = argc > 1 ? atoi(argv[1]) : 200;
+
+    int rssSizes[MAX_LIST_COUNT];
+    int rssSizesCount = ParseList(argc > 2 ? argv[2] : "0,256,1024", rssSizes);
+
+    int threadCounts[MAX_LIST_COUNT];
+    int threadCountsCount = ParseList(argc > 3 ? argv[3] : "1,4", threadCounts);
+
+    if(spawnsCount <= 0)
+    {
+        fprintf(stderr, "Invalid spawns count\n");
+        return 1;
+    }
+    
+    #if BENCHMARK_VFORK
+        System2SetSpawnBackend(SYSTEM2_SPAWN_BACKEND_VFORK);
+    #endif
+
+    for(int i = 0; i < rssSizesCount; ++i)
+    {
+        //Touch every page so that it is actually part of the RSS
+        size_t rssBytes = (size_t)rssSizes[i] * 1024 * 1024;
+        char* rss = rssBytes > 0 ? (char*)malloc(rssBytes) : NULL;
+        if(rssBytes > 0 && !rss)
+        {
+            fprintf(stderr, "Failed to allocate %d MB\n", rssSizes[i]);
+            return 1;
+        }
+
+        if(rss)
+            memset(rss, 1, rssBytes);
+
+        for(int j = 0; j < threadCountsCount; ++j)
+        {
+            if(threadCounts[j] <= 0 || threadCounts[j] > MAX_LIST_COUNT)
+            {
+                fprintf(stderr, "Thread count must be between 1 and %d\n", MAX_LIST_COUNT);
+                return 1;
+            }
+
+            for(int envOverrides = 0; envOverrides < 2; ++envOverrides)
+            {
+                if(RunCase(spawnsCount, rssSizes[i], threadCounts[j], envOverrides) != 0)
+                {
+                    fprintf(stderr, "Spawn benchmark failed\n");
+                    return 1;
+                }
+            }
+        }
+        
+        for(int envOverrides = 0; envOverrides < 2; ++envOverrides)
+        {
+            if(RunBatchCase(spawnsCount, rssSizes[i], envOverrides) != 0)
+            {
+                fprintf(stderr, "Spawn batch benchmark failed\n");
+                return 1;
+            }
+        }
+
+        free(rss);
+    }
+
+    return 0;
+}
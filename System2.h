@@ -15,8 +15,44 @@ If you do not want to use header only due to system header leakage
 /*
 `#define SYSTEM2_POSIX_SPAWN 1`
 
-This bypasses inheriting memory from parent process on linux (glibc 2.24) but removes the ability 
-to use RunDirectory. See https://github.com/Neko-Box-Coder/System2/issues/3
+Makes posix_spawn the default spawn backend instead of fork, which bypasses inheriting memory from 
+parent process on linux (glibc 2.24). See https://github.com/Neko-Box-Coder/System2/issues/3
+The backend can also be chosen at runtime with `System2SetSpawnBackend()` or `SpawnBackend`.
+
+RunDirectory is applied with `posix_spawn_file_actions_addchdir_np()` on glibc 2.29 and later. 
+Otherwise, commands that change their directory are started with `vfork()` instead.
+*/
+
+/*
+`#define SYSTEM2_IO_URING 1`
+
+Linux only. Reads output with multishot io_uring reads into registered buffers and writes input 
+with linked io_uring writes, so that a single syscall can move multiple pipe buffers. This needs 
+Linux 6.7 for the output and falls back to read()/write() when io_uring is not available.
+*/
+
+/*
+`#define SYSTEM2_REAPER 1`
+
+POSIX only, needs pthreads. Commands run with `ReapOnCleanup` are handed to a background thread by
+`System2CleanupCommand()` if they haven't been waited for, so that they don't become zombies. Their 
+return value can still be retrieved with `System2GetCommandReturnValue()` afterwards.
+In header only mode, each translation unit has its own reaper thread.
+*/
+
+/*
+`#define SYSTEM2_INSTRUMENTATION 1`
+
+Keeps global counters of the System2 calls, which can be retrieved with `System2GetStats()`, and 
+calls the hooks set with `System2SetHooks()` around each spawn, read, write, wait, kill and term.
+In header only mode, each translation unit has its own counters and hooks.
+*/
+
+/*
+`#define SYSTEM2_PARALLEL_SPAWN 1`
+
+Lets `System2RunMany()` start the commands from up to `SYSTEM2_PARALLEL_SPAWN_THREADS` threads at
+the same time on POSIX. This needs pthreads.
 */
 
 #if SYSTEM2_DECLARATION_ONLY
@@ -61,13 +97,75 @@ to use RunDirectory. See https://github.com/Neko-Box-Coder/System2/issues/3
 #include <string.h>
 #include <stdbool.h>
 
+//Used by `System2ResourceLimit` for an unlimited resource
+#define SYSTEM2_RESOURCE_LIMIT_INFINITY UINT64_MAX
+
+typedef struct
+{
+    int Resource;               //`RLIMIT_*` value from <sys/resource.h>
+    uint64_t SoftLimit;         //Soft limit, or `SYSTEM2_RESOURCE_LIMIT_INFINITY`
+    uint64_t HardLimit;         //Hard limit, or `SYSTEM2_RESOURCE_LIMIT_INFINITY`
+} System2ResourceLimit;
+
+typedef enum
+{
+    SYSTEM2_SCHEDULE_POLICY_INHERIT = 0,
+    SYSTEM2_SCHEDULE_POLICY_OTHER = 1,
+    SYSTEM2_SCHEDULE_POLICY_BATCH = 2,  //Linux only
+    SYSTEM2_SCHEDULE_POLICY_IDLE = 3,   //Linux only
+    SYSTEM2_SCHEDULE_POLICY_FIFO = 4,
+    SYSTEM2_SCHEDULE_POLICY_RR = 5
+} SYSTEM2_SCHEDULE_POLICY;
+
+typedef enum
+{
+    SYSTEM2_IO_PRIORITY_CLASS_INHERIT = 0,
+    SYSTEM2_IO_PRIORITY_CLASS_REALTIME = 1,
+    SYSTEM2_IO_PRIORITY_CLASS_BEST_EFFORT = 2,
+    SYSTEM2_IO_PRIORITY_CLASS_IDLE = 3
+} SYSTEM2_IO_PRIORITY_CLASS;
+
+//How commands are started on POSIX
+typedef enum
+{
+    SYSTEM2_SPAWN_BACKEND_DEFAULT = 0,      //The one set with `System2SetSpawnBackend()`
+    SYSTEM2_SPAWN_BACKEND_AUTO = 1,         //posix_spawn if it can set up everything the command 
+                                            //needs before exec, vfork otherwise. Neither copies the 
+                                            //memory of the parent, so they don't fail with ENOMEM 
+                                            //for a big parent like fork can
+    SYSTEM2_SPAWN_BACKEND_FORK = 2,
+    SYSTEM2_SPAWN_BACKEND_POSIX_SPAWN = 3,  //Process attributes are applied right after the spawn
+    SYSTEM2_SPAWN_BACKEND_VFORK = 4         //The parent is suspended until the command starts
+} SYSTEM2_SPAWN_BACKEND;
+
+//Which watchdog stopped a command, see `System2GetFiredWatchdog()`
+typedef enum
+{
+    SYSTEM2_WATCHDOG_NONE = 0,
+    SYSTEM2_WATCHDOG_FIRST_OUTPUT = 1,      //`FirstOutputTimeoutMs`
+    SYSTEM2_WATCHDOG_OUTPUT_GAP = 2,        //`OutputGapTimeoutMs`
+    SYSTEM2_WATCHDOG_INPUT_CLOSED = 3       //`InputClosedTimeoutMs`
+} SYSTEM2_WATCHDOG;
+
+//Called by `System2Poll()` with each chunk of output. `data` is only valid during the call.
+typedef void (*System2OutputCallback)(void* userData, const char* data, uint32_t size);
+
+//Called by `System2Poll()` once the command has exited. `terminated` is true if it was terminated
+//by a signal, in which case `returnCode` is -1.
+typedef void (*System2ExitCallback)(void* userData, int returnCode, bool terminated);
+
+//Default value of `CallbackChunkSize`
+#ifndef SYSTEM2_CALLBACK_CHUNK_SIZE
+    #define SYSTEM2_CALLBACK_CHUNK_SIZE (64 * 1024)
+#endif
+
 typedef struct
 {
     bool RedirectInput;         //Redirect input with pipe?
     bool RedirectOutput;        //Redirect output with pipe?
     bool StandaloneStderr;      //Do not mix stdout and stderr?
     const char* RunDirectory;   //The directory to run the command in? NULL for current working 
-                                //directory. `SYSTEM2_POSIX_SPAWN` does not support this.
+                                //directory.
     const char** EnvVarsNames;  //Array of environment variables names to add/set/unset from parent's
                                 //copy of environment variables.
                                 //Will be ignored if NULL and will inherit parent's one
@@ -75,8 +173,98 @@ typedef struct
                                 //Will be ignored if NULL.
                                 //If the value itself is NULL, it will unset the environment variable
     int EnvVarsCount;           //How many environment variables, if `EnvVarsNames` is not NULL
+    bool ReapOnCleanup;         //Hand the command to the reaper thread on cleanup if it hasn't been
+                                //waited for, instead of leaving a zombie? Needs `SYSTEM2_REAPER`.
+                                //Has no effect on Windows
+    const void* InputBuffer;    //Given to the command as its stdin if not NULL, instead of 
+                                //`RedirectInput`. It is copied into a sealed memfd on Linux, or an 
+                                //unlinked temporary file on other POSIX systems, so the command 
+                                //can seek or mmap it. Not supported on Windows
+    uint64_t InputBufferSize;   //How many bytes in `InputBuffer`
+    bool CaptureOutputToFile;   //Write the output to a memfd on Linux (an unlinked temporary file 
+                                //on other POSIX systems) instead of a pipe, to be mapped with 
+                                //`System2MapOutput()` once the command has exited. Stderr goes to 
+                                //its own file if `StandaloneStderr` is true. Can't be used with 
+                                //`RedirectOutput`. Not supported on Windows
+    bool UsePty;                //Attach stdin, stdout and stderr of the command to a 
+                                //pseudo-terminal instead of pipes, so that it doesn't buffer its 
+                                //output. It is read and written like the pipes, and needs 
+                                //`RedirectInput` and `RedirectOutput` without `StandaloneStderr`. 
+                                //Reading past the end of the output might block if the command 
+                                //left a child with the terminal open. Not supported on Windows
+    uint16_t PtyColumns;        //Window size of the pseudo-terminal, 80 columns if 0
+    uint16_t PtyRows;           //24 rows if 0
+    bool PtyRawMode;            //Pass the input and output as they are, without line editing, 
+                                //signal characters or `\n` to `\r\n` translation
+    bool PtyNoEcho;             //Don't echo the input back to the output
+    bool AlwaysUseShell;        //Run the command of `System2Run()` in the shell even if it only 
+                                //has plain words, quotes and backslashes? Otherwise those are 
+                                //started directly. Has no effect on Windows
+    
+    //Callbacks called by `System2Poll()`. Output without a callback is not read by it.
+    System2OutputCallback OnStdout; //Called with the output, also stderr if not `StandaloneStderr`
+    System2OutputCallback OnStderr; //Called with stderr if `StandaloneStderr` is true
+    System2ExitCallback OnExit;     //Called after all the output with a callback has been read
+    void* CallbackUserData;         //Passed to the callbacks
+    uint32_t CallbackChunkSize;     //Max bytes passed to each output callback, 0 for 
+                                    //`SYSTEM2_CALLBACK_CHUNK_SIZE`
+    
+    //Watchdogs that stop a command which has gone quiet, in milliseconds, 0 to disable. They are 
+    //checked while the output is read by `System2ReadFromOutput()`, `System2ReadFromStderr()`, 
+    //`System2ReadLine()`, `System2CaptureOutput()` or `System2Poll()`, and while the command is 
+    //waited for by `System2GetCommandReturnValue()`. Once the command is stopped, only the output 
+    //left in the pipes is read. Not supported on Windows
+    uint32_t FirstOutputTimeoutMs;  //Max time from the start of the command to its first output
+    uint32_t OutputGapTimeoutMs;    //Max time between two chunks of output
+    uint32_t InputClosedTimeoutMs;  //Max time the command can keep running after 
+                                    //`System2CloseInput()`
+    uint32_t WatchdogTermGraceMs;   //Terminate the command first and only kill it if it is still 
+                                    //running this long after? 0 to kill it right away
     
     #if defined(__unix__) || defined(__APPLE__)
+        int RunDirectoryFd;                         //Open directory to run the command in instead 
+                                                    //of `RunDirectory`, which saves looking up the 
+                                                    //path for every command. Ignored if <= 0
+        SYSTEM2_SPAWN_BACKEND SpawnBackend;         //How to start the command
+        SYSTEM2_SPAWN_BACKEND SpawnBackendUsed;     //Set to how the command was started
+        
+        //Child process attributes. With the posix_spawn backend, these are applied to the child
+        //right after it is spawned instead of before the executable starts.
+        const System2ResourceLimit* ResourceLimits; //Array of resource limits to set for the child.
+                                                    //Will be ignored if NULL
+        int ResourceLimitsCount;                    //How many resource limits, if `ResourceLimits`
+                                                    //is not NULL
+        const int* CpuAffinity;                     //Array of CPU indices the child can run on.
+                                                    //Will be ignored if NULL. Linux only
+        int CpuAffinityCount;                       //How many CPU indices, if `CpuAffinity` is not
+                                                    //NULL
+        int NiceIncrement;                          //Added to the nice value of the child.
+                                                    //0 to inherit parent's one
+        SYSTEM2_IO_PRIORITY_CLASS IoPriorityClass;  //I/O scheduling class of the child. Linux only
+        int IoPriorityLevel;                        //0 (highest) to 7 (lowest), for realtime and
+                                                    //best effort I/O priority classes
+        SYSTEM2_SCHEDULE_POLICY SchedulePolicy;     //CPU scheduling policy of the child
+        int SchedulePriority;                       //Static priority for FIFO and RR policies
+        bool NewProcessGroup;                       //Start the command in its own process group, so
+                                                    //that `System2Kill()`, `System2Term()`, 
+                                                    //`System2Pause()` and `System2Resume()` reach 
+                                                    //its children as well? Implied by `UsePty`
+
+        //The child starts with no blocked signals and with ignored signals reset to default
+        //unless configured otherwise here.
+        bool KeepSignalMask;                        //Inherit parent's blocked signals instead?
+        bool KeepIgnoredSignals;                    //Inherit parent's ignored signals instead?
+        const int* BlockedSignals;                  //Array of signals to block in the child if
+                                                    //`KeepSignalMask` is false. Can be NULL
+        int BlockedSignalsCount;                    //How many signals, if `BlockedSignals` is not
+                                                    //NULL
+
+        //Requested pipe capacities in bytes, 0 for the system default. On return, these are set to
+        //the capacities actually granted (0 if not supported). Linux only
+        int StdinPipeSize;                          //Used if `RedirectInput` is true
+        int StdoutPipeSize;                         //Used if `RedirectOutput` is true
+        int StderrPipeSize;                         //Used if `StandaloneStderr` is true
+
         int ParentToChildPipes[2];
         int ChildToParentPipes[2];
         int ChildToParentPipesErr[2];
@@ -90,6 +278,8 @@ typedef struct
         HANDLE ChildToParentPipesErr[2];
         HANDLE ChildProcessHandle;
     #endif
+    
+    struct Internal_System2CommandState* InternalState;
 } System2CommandInfo;
 
 typedef enum
@@ -124,8 +314,80 @@ typedef enum
     SYSTEM2_RESULT_KILL_FAILED = -17,
     SYSTEM2_RESULT_TERM_FAILED = -18,
     SYSTEM2_RESULT_POSIX_SPAWN_TIMEOUT_NOT_SUPPORTED = -19,
+    SYSTEM2_RESULT_PROCESS_ATTRIBUTE_NOT_SUPPORTED = -20,
+    SYSTEM2_RESULT_SET_PROCESS_ATTRIBUTE_FAILED = -21,
+    SYSTEM2_RESULT_POSIX_SPAWN_ATTRIBUTE_FAILED = -22,
+    SYSTEM2_RESULT_REAPER_NOT_SUPPORTED = -23,
+    SYSTEM2_RESULT_REAPER_START_FAILED = -24,
+    SYSTEM2_RESULT_INSTRUMENTATION_NOT_ENABLED = -25,
+    SYSTEM2_RESULT_INPUT_BUFFER_NOT_SUPPORTED = -26,
+    SYSTEM2_RESULT_INPUT_BUFFER_CREATE_FAILED = -27,
+    SYSTEM2_RESULT_CAPTURE_FILE_NOT_SUPPORTED = -28,
+    SYSTEM2_RESULT_CAPTURE_FILE_CREATE_FAILED = -29,
+    SYSTEM2_RESULT_FORK_EXCLUSION_NOT_SUPPORTED = -30,
+    SYSTEM2_RESULT_PTY_NOT_SUPPORTED = -31,
+    SYSTEM2_RESULT_PTY_CREATE_FAILED = -32,
+    SYSTEM2_RESULT_SHELL_SESSION_NOT_SUPPORTED = -33,
+    SYSTEM2_RESULT_WATCHDOG_NOT_SUPPORTED = -34,
+    SYSTEM2_RESULT_PAUSE_FAILED = -35,
+    SYSTEM2_RESULT_RESUME_FAILED = -36,
+    SYSTEM2_RESULT_LIMIT_REACHED = -37,
+    SYSTEM2_RESULT_GRAPH_CYCLE = -38,
+    SYSTEM2_RESULT_GRAPH_NODE_FAILED = -39,
 } SYSTEM2_RESULT;
 
+//Operations reported to the hooks and counted in `System2Stats`
+typedef enum
+{
+    SYSTEM2_OPERATION_SPAWN = 0,    //`System2Run()` and `System2RunSubprocess()`
+    SYSTEM2_OPERATION_READ = 1,     //`System2ReadFromOutput()` and `System2ReadFromStderr()`
+    SYSTEM2_OPERATION_WRITE = 2,    //`System2WriteToInput()`
+    SYSTEM2_OPERATION_WAIT = 3,     //`System2GetCommandReturnValue()`
+    SYSTEM2_OPERATION_KILL = 4,     //`System2Kill()`
+    SYSTEM2_OPERATION_TERM = 5,     //`System2Term()`
+    SYSTEM2_OPERATION_COUNT = 6
+} SYSTEM2_OPERATION;
+
+//Called before an operation. `timestampNs` is from a monotonic clock.
+typedef void (*System2BeginHook)(   void* userData, 
+                                    SYSTEM2_OPERATION operation,
+                                    const System2CommandInfo* info,
+                                    uint64_t timestampNs);
+
+//Called after an operation with its result, and the bytes read or written for reads and writes
+typedef void (*System2EndHook)( void* userData, 
+                                SYSTEM2_OPERATION operation,
+                                const System2CommandInfo* info,
+                                uint64_t timestampNs,
+                                SYSTEM2_RESULT result,
+                                uint64_t bytes);
+
+typedef struct
+{
+    System2BeginHook OnBegin;   //Can be NULL
+    System2EndHook OnEnd;       //Can be NULL
+    void* UserData;             //Passed to the hooks
+} System2Hooks;
+
+//Number of failure results counted, indexed by the negated `SYSTEM2_RESULT`
+#define SYSTEM2_STATS_FAILURES_COUNT 64
+
+//Number of spawn latency buckets. Bucket 0 counts spawns under 1 microsecond, bucket i counts the
+//ones from 2^(i-1) up to 2^i microseconds, and the last one counts everything above.
+#define SYSTEM2_STATS_LATENCY_BUCKETS_COUNT 24
+
+typedef struct
+{
+    int64_t ActiveCommands;             //Spawned and not cleaned up yet
+    uint64_t TotalSpawns;               //Successful spawns
+    uint64_t BytesRead;                 //From stdout and stderr
+    uint64_t BytesWritten;              //To stdin
+    uint64_t Calls[SYSTEM2_OPERATION_COUNT];
+    uint64_t Failures[SYSTEM2_STATS_FAILURES_COUNT];
+    uint64_t SpawnLatencyHistogram[SYSTEM2_STATS_LATENCY_BUCKETS_COUNT];
+    uint64_t SpawnLatencyTotalNs;       //For the average spawn latency
+} System2Stats;
+
 /*
 Runs the command in system shell just like the `system()` funcion with the given settings 
 passed with `inOutCommandInfo`.
@@ -136,6 +398,11 @@ This uses
 `sh -c command` for POSIX and
 `cmd /s /v /c command` for Windows
 
+On POSIX, commands that only have plain words, quotes and backslashes are split into arguments and 
+started directly without the shell, unless `AlwaysUseShell` is set. The shell is still used if 
+the executable is a shell builtin, if it can't be found, if it is a script without `#!` (which 
+only the shell runs), or if PATH is overridden.
+
 Could return the following results:
 - SYSTEM2_RESULT_SUCCESS
 - SYSTEM2_RESULT_PIPE_CREATE_FAILED
@@ -144,8 +411,19 @@ Could return the following results:
 - SYSTEM2_RESULT_COMMAND_CONSTRUCT_FAILED
 - SYSTEM2_RESULT_POSIX_SPAWN_FILE_ACTION_DESTROY_FAILED
 - SYSTEM2_RESULT_POSIX_SPAWN_FILE_ACTION_DUP2_FAILED
-- SYSTEM2_RESULT_POSIX_SPAWN_RUN_DIRECTORY_NOT_SUPPORTED
+- SYSTEM2_RESULT_POSIX_SPAWN_ATTRIBUTE_FAILED
 - SYSTEM2_RESULT_INVALID_ARGUMENT
+- SYSTEM2_RESULT_PROCESS_ATTRIBUTE_NOT_SUPPORTED
+- SYSTEM2_RESULT_SET_PROCESS_ATTRIBUTE_FAILED
+- SYSTEM2_RESULT_REAPER_NOT_SUPPORTED
+- SYSTEM2_RESULT_INPUT_BUFFER_NOT_SUPPORTED
+- SYSTEM2_RESULT_INPUT_BUFFER_CREATE_FAILED
+- SYSTEM2_RESULT_CAPTURE_FILE_NOT_SUPPORTED
+- SYSTEM2_RESULT_CAPTURE_FILE_CREATE_FAILED
+- SYSTEM2_RESULT_PTY_NOT_SUPPORTED
+- SYSTEM2_RESULT_PTY_CREATE_FAILED
+- SYSTEM2_RESULT_WATCHDOG_NOT_SUPPORTED
+- SYSTEM2_RESULT_MALLOC_FAILED
 */
 SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2Run(  const char* command, 
                                                 System2CommandInfo* inOutCommandInfo);
@@ -171,9 +449,19 @@ Could return the following results:
 - SYSTEM2_RESULT_COMMAND_CONSTRUCT_FAILED
 - SYSTEM2_RESULT_POSIX_SPAWN_FILE_ACTION_DESTROY_FAILED
 - SYSTEM2_RESULT_POSIX_SPAWN_FILE_ACTION_DUP2_FAILED
-- SYSTEM2_RESULT_POSIX_SPAWN_RUN_DIRECTORY_NOT_SUPPORTED
+- SYSTEM2_RESULT_POSIX_SPAWN_ATTRIBUTE_FAILED
 - SYSTEM2_RESULT_INVALID_ARGUMENT
+- SYSTEM2_RESULT_PROCESS_ATTRIBUTE_NOT_SUPPORTED
+- SYSTEM2_RESULT_SET_PROCESS_ATTRIBUTE_FAILED
 - SYSTEM2_RESULT_WINDOWS_UNICODE_FAILED
+- SYSTEM2_RESULT_REAPER_NOT_SUPPORTED
+- SYSTEM2_RESULT_INPUT_BUFFER_NOT_SUPPORTED
+- SYSTEM2_RESULT_INPUT_BUFFER_CREATE_FAILED
+- SYSTEM2_RESULT_CAPTURE_FILE_NOT_SUPPORTED
+- SYSTEM2_RESULT_CAPTURE_FILE_CREATE_FAILED
+- SYSTEM2_RESULT_PTY_NOT_SUPPORTED
+- SYSTEM2_RESULT_PTY_CREATE_FAILED
+- SYSTEM2_RESULT_WATCHDOG_NOT_SUPPORTED
 - SYSTEM2_RESULT_MALLOC_FAILED
 */
 SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2RunSubprocess(const char* executable,
@@ -181,6 +469,42 @@ SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2RunSubprocess(const char* executable,
                                                         int argsCount,
                                                         System2CommandInfo* inOutCommandInfo);
 
+//Max number of threads starting commands for `System2RunMany()` with `SYSTEM2_PARALLEL_SPAWN`
+#ifndef SYSTEM2_PARALLEL_SPAWN_THREADS
+    #define SYSTEM2_PARALLEL_SPAWN_THREADS 4
+#endif
+
+//A command started by `System2RunMany()`
+typedef struct
+{
+    const char* Command;        //Runs this in the shell like `System2Run()` if not NULL
+    const char* Executable;     //Otherwise runs this like `System2RunSubprocess()`
+    const char* const* Args;    //Arguments for `Executable`, can be NULL
+    int ArgsCount;
+} System2SpawnSpec;
+
+/*
+Starts `count` commands, each with the settings passed with its own `inOutCommandInfos[i]`, as if 
+`System2Run()` or `System2RunSubprocess()` were called for each of them. The result of each one 
+is written to `outResults[i]`.
+
+On POSIX, the environment is read once and each executable is looked up in PATH once for the whole
+batch, unless a command overrides PATH. With `SYSTEM2_PARALLEL_SPAWN`, up to 
+`SYSTEM2_PARALLEL_SPAWN_THREADS` commands are started at the same time.
+
+`System2CleanupCommand()` should be called for each command that is started successfully.
+
+Could return the following results:
+- SYSTEM2_RESULT_SUCCESS if all of the commands are started
+- SYSTEM2_RESULT_INVALID_ARGUMENT
+- SYSTEM2_RESULT_MALLOC_FAILED
+- Otherwise the result of the first command that failed to start, see `System2RunSubprocess()`
+*/
+SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2RunMany(  const System2SpawnSpec* specs,
+                                                    int count,
+                                                    System2CommandInfo* inOutCommandInfos,
+                                                    SYSTEM2_RESULT* outResults);
+
 
 /*
 Reads the output from the command. `info->RedirectOutput` must be true when `info` was passed to one 
@@ -242,17 +566,333 @@ SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2WriteToInput( const System2CommandInfo
                                                         const char* inputBuffer, 
                                                         const uint32_t inputBufferSize);
 
+//Initial size of the buffer used by `System2LineReader`
+#ifndef SYSTEM2_LINE_READER_BUFFER_SIZE
+    #define SYSTEM2_LINE_READER_BUFFER_SIZE (64 * 1024)
+#endif
+
+/*
+Reads the output of a command one line at a time, initialized with `System2LineReaderInit()`.
+Lines are returned as views into an internal buffer, so they are not copied.
+*/
+typedef struct
+{
+    const System2CommandInfo* CommandInfo;
+    bool ReadStderr;
+    char Delimiter;
+    uint32_t MaxLineLength;
+    
+    char* Buffer;
+    uint32_t BufferSize;
+    uint32_t DataStart;         //Start of the unreturned data
+    uint32_t DataEnd;           //End of the data read from the pipe
+    uint32_t ScanEnd;           //End of the data already searched for the delimiter
+    bool ReadFinished;
+    bool DiscardingLine;        //Skipping the rest of a line longer than `MaxLineLength`?
+} System2LineReader;
+
+/*
+Initializes a line reader that reads the output (or stderr if `readStderr` is true) of the command.
+`info` must be redirecting the output in the same way as `System2ReadFromOutput()` and
+`System2ReadFromStderr()`, and must outlive the reader.
+
+Lines are separated by `delimiter`, which is usually '\n'.
+
+If `maxLineLength` is not 0, any line longer than it will be returned truncated to `maxLineLength` 
+bytes and the rest of it will be discarded. Otherwise the buffer grows to fit the longest line.
+
+The reader should be freed with `System2LineReaderFree()` when done.
+
+Could return the following results:
+- SYSTEM2_RESULT_SUCCESS
+- SYSTEM2_RESULT_INVALID_ARGUMENT
+- SYSTEM2_RESULT_MALLOC_FAILED
+*/
+SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2LineReaderInit(   System2LineReader* outReader,
+                                                            const System2CommandInfo* info,
+                                                            bool readStderr,
+                                                            char delimiter,
+                                                            uint32_t maxLineLength);
+
+/*
+Reads the next line from the command, blocking until a whole line is available.
+
+`outLine` points to the line inside the reader's buffer, which is only valid until the next call. 
+It is **NOT** null terminated, and `outLineLength` does not include the delimiter. 
+If `outTruncated` is not NULL, it is set to whether the line was longer than `maxLineLength`.
+
+If SYSTEM2_RESULT_READ_NOT_FINISHED is returned, a line is returned and this function can be called 
+again to get the next one. The last line is returned even if it doesn't end with the delimiter.
+SYSTEM2_RESULT_SUCCESS is returned without a line once all the output has been read.
+
+Could return the following results:
+- SYSTEM2_RESULT_SUCCESS
+- SYSTEM2_RESULT_READ_NOT_FINISHED
+- SYSTEM2_RESULT_READ_FAILED
+- SYSTEM2_RESULT_INVALID_ARGUMENT
+- SYSTEM2_RESULT_MALLOC_FAILED
+*/
+SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2ReadLine( System2LineReader* reader,
+                                                    const char** outLine,
+                                                    uint32_t* outLineLength,
+                                                    bool* outTruncated);
+
+/*
+Frees the buffer of the line reader. This does not cleanup the command.
+
+Could return the following results:
+- SYSTEM2_RESULT_SUCCESS
+- SYSTEM2_RESULT_INVALID_ARGUMENT
+*/
+SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2LineReaderFree(System2LineReader* reader);
+
+//How much of the output `System2CaptureOutput()` keeps
+typedef struct
+{
+    uint32_t HeadSize;          //Max bytes kept from the start of the output
+    uint32_t TailSize;          //Max bytes kept from the end of the output, after the head
+    uint64_t KillAfter;         //Kill the command once it has output more than this many bytes? 
+                                //0 for no limit
+} System2CapturePolicy;
+
+//Output kept by `System2CaptureOutput()`, to be freed with `System2CaptureFree()`
+typedef struct
+{
+    char* Head;                 //First bytes of the output, **NOT** null terminated
+    uint32_t HeadSize;
+    char* Tail;                 //Last bytes of the output after the head, **NOT** null terminated
+    uint32_t TailSize;
+    uint64_t TotalBytes;        //All the bytes output by the command, including the discarded ones
+    bool Truncated;             //Was anything between the head and the tail discarded?
+    bool Killed;                //Was the command killed for passing `KillAfter`?
+} System2Capture;
+
+/*
+Reads all the output (or stderr if `readStderr` is true) of the command, keeping only the first 
+`policy->HeadSize` and the last `policy->TailSize` bytes of it. The rest is discarded as it comes, 
+without being copied if possible (splice to /dev/null on Linux). Everything is kept if `policy` is 
+NULL or both sizes are 0.
+
+`info` must be redirecting the output in the same way as `System2ReadFromOutput()` and
+`System2ReadFromStderr()`.
+
+If the command outputs more than `policy->KillAfter` bytes, it is killed and the rest of the output 
+is not read. The command still needs to be waited for.
+
+The capture should be freed with `System2CaptureFree()`, even if this fails.
+
+Could return the following results:
+- SYSTEM2_RESULT_SUCCESS
+- SYSTEM2_RESULT_READ_FAILED
+- SYSTEM2_RESULT_INVALID_ARGUMENT
+- SYSTEM2_RESULT_MALLOC_FAILED
+- SYSTEM2_RESULT_KILL_FAILED
+*/
+SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2CaptureOutput(const System2CommandInfo* info,
+                                                        bool readStderr,
+                                                        const System2CapturePolicy* policy,
+                                                        System2Capture* outCapture);
+
+/*
+Frees the buffers of the capture.
+
+Could return the following results:
+- SYSTEM2_RESULT_SUCCESS
+- SYSTEM2_RESULT_INVALID_ARGUMENT
+*/
+SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2CaptureFree(System2Capture* capture);
+
+//Read-only view of the output of a command run with `CaptureOutputToFile`
+typedef struct
+{
+    const char* Data;           //**NOT** null terminated, NULL if `Size` is 0
+    uint64_t Size;
+} System2OutputView;
+
+/*
+Maps the output (or stderr if `readStderr` is true) that a command run with `CaptureOutputToFile` 
+has written into memory, without copying it. 
+
+This should be called once the command has exited and before `System2CleanupCommand()`. The view 
+stays valid after the cleanup until it is unmapped with `System2UnmapOutput()`.
+
+Could return the following results:
+- SYSTEM2_RESULT_SUCCESS
+- SYSTEM2_RESULT_READ_FAILED
+- SYSTEM2_RESULT_INVALID_ARGUMENT
+- SYSTEM2_RESULT_CAPTURE_FILE_NOT_SUPPORTED
+*/
+SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2MapOutput(const System2CommandInfo* info,
+                                                    bool readStderr,
+                                                    System2OutputView* outView);
+
+/*
+Unmaps the view from `System2MapOutput()`.
+
+Could return the following results:
+- SYSTEM2_RESULT_SUCCESS
+- SYSTEM2_RESULT_INVALID_ARGUMENT
+*/
+SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2UnmapOutput(System2OutputView* view);
+
+//Initial size of the output buffer used by `System2ShellSession`
+#ifndef SYSTEM2_SHELL_SESSION_BUFFER_SIZE
+    #define SYSTEM2_SHELL_SESSION_BUFFER_SIZE (4 * 1024)
+#endif
+
+/*
+A long-lived `/bin/sh` that runs commands one after another, started with 
+`System2ShellSessionStart()`. Running a command only costs a round trip through the pipes of the 
+shell instead of starting a new one. The shell state, like the working directory and variables, 
+is kept between the commands.
+*/
+typedef struct
+{
+    System2CommandInfo Settings;        //Used to start the shell again when the session is reset
+    System2CommandInfo ShellInfo;       //The running shell
+    bool ShellRunning;                  //Is `ShellInfo` started and not cleaned up yet?
+    char Token[48];                     //Makes the markers of this session unique
+    uint64_t CommandsCount;
+    
+    char* Buffer;
+    uint32_t BufferSize;
+    uint32_t DataStart;                 //Start of the output not returned yet
+    uint32_t DataEnd;                   //End of the data read from the pipe
+} System2ShellSession;
+
+/*
+Starts a shell session. The shell is run with `settings`, which can be NULL. Only the settings for 
+starting the command are used (like `RunDirectory` and the environment variables), the input and 
+output of the shell are always redirected through pipes without `StandaloneStderr`. The pointers in 
+`settings` must outlive the session, since they are used again if the shell needs restarting.
+
+The session should be ended with `System2ShellSessionEnd()` when done.
+
+Could return the following results:
+- SYSTEM2_RESULT_SUCCESS
+- SYSTEM2_RESULT_INVALID_ARGUMENT
+- SYSTEM2_RESULT_MALLOC_FAILED
+- SYSTEM2_RESULT_SHELL_SESSION_NOT_SUPPORTED
+- Any results from `System2RunSubprocess()`
+*/
+SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2ShellSessionStart(System2ShellSession* outSession,
+                                                            const System2CommandInfo* settings);
+
+/*
+Runs `command` in the shell of the session and waits for it to finish. The command can be anything 
+`System2Run()` accepts, its stdin is /dev/null and its stdout and stderr are returned together.
+
+`outOutput` points to the output inside the session's buffer, which is only valid until the next 
+call. It is **NOT** null terminated. `outReturnCode` is set to the exit status of the command.
+
+If `timeoutMs` is >= 0 and the command doesn't finish within `timeoutMs` milliseconds, the shell 
+is killed along with the command and started again, and SYSTEM2_RESULT_COMMAND_NOT_FINISHED is 
+returned. 
+If the command exits the shell, the output so far and the exit code of the shell are returned, and 
+a new shell is started for the next command.
+
+Any other error leaves the session unusable until `System2ShellSessionReset()` is called.
+
+Could return the following results:
+- SYSTEM2_RESULT_SUCCESS
+- SYSTEM2_RESULT_COMMAND_NOT_FINISHED
+- SYSTEM2_RESULT_READ_FAILED
+- SYSTEM2_RESULT_WRITE_FAILED
+- SYSTEM2_RESULT_INVALID_ARGUMENT
+- SYSTEM2_RESULT_MALLOC_FAILED
+- SYSTEM2_RESULT_SHELL_SESSION_NOT_SUPPORTED
+- Any results from `System2ShellSessionReset()`
+*/
+SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2ShellSessionRun(  System2ShellSession* session,
+                                                            const char* command,
+                                                            int timeoutMs,
+                                                            const char** outOutput,
+                                                            uint32_t* outOutputSize,
+                                                            int* outReturnCode);
+
+/*
+Kills the shell of the session and starts a new one, dropping its state and any unread output.
+
+Could return the following results:
+- SYSTEM2_RESULT_SUCCESS
+- SYSTEM2_RESULT_INVALID_ARGUMENT
+- SYSTEM2_RESULT_SHELL_SESSION_NOT_SUPPORTED
+- Any results from `System2RunSubprocess()`
+*/
+SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2ShellSessionReset(System2ShellSession* session);
+
+/*
+Exits the shell of the session, waits for it and frees the session.
+
+Could return the following results:
+- SYSTEM2_RESULT_SUCCESS
+- SYSTEM2_RESULT_INVALID_ARGUMENT
+- Any results from `System2GetCommandReturnValue()` and `System2CleanupCommand()`
+*/
+SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2ShellSessionEnd(System2ShellSession* session);
+
+/*
+Waits for the output and exit of the commands for up to `timeoutMs` milliseconds, and calls their 
+`OnStdout`, `OnStderr` and `OnExit` callbacks as they happen. 
+If `timeoutMs` is < 0, this keeps going until all the commands are finished.
+
+A command is finished once all the output with a callback is read and, if `OnExit` is set, the 
+command has exited. `System2GetCommandReturnValue()` can still be called afterwards.
+
+The output with a callback should not be read with other functions. Callbacks must not cleanup the 
+command. To have the callbacks called from a background thread, call this in a loop on that thread.
+
+Could return the following results:
+- SYSTEM2_RESULT_SUCCESS
+- SYSTEM2_RESULT_COMMAND_NOT_FINISHED
+- SYSTEM2_RESULT_READ_FAILED
+- SYSTEM2_RESULT_COMMAND_WAIT_FAILED
+- SYSTEM2_RESULT_INVALID_ARGUMENT
+- SYSTEM2_RESULT_MALLOC_FAILED
+*/
+SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2Poll( System2CommandInfo** commands, 
+                                                int commandsCount, 
+                                                int timeoutMs);
+
+
+/*
+Closes the input of the command, so that it reads the end of its input. This starts the 
+`InputClosedTimeoutMs` watchdog. With `UsePty`, the end of file character is sent instead, which 
+does nothing in `PtyRawMode`.
+
+Nothing can be written to the command afterwards.
+
+Could return the following results:
+- SYSTEM2_RESULT_SUCCESS
+- SYSTEM2_RESULT_WRITE_FAILED
+- SYSTEM2_RESULT_PIPE_FD_CLOSE_FAILED
+- SYSTEM2_RESULT_INVALID_ARGUMENT
+*/
+SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2CloseInput(System2CommandInfo* info);
+
+/*
+Gets which watchdog stopped the command, or `SYSTEM2_WATCHDOG_NONE` if none of them did. 
+This should be called before `System2CleanupCommand()`.
 
-//TODO: Might want to add this to have this ability to close input pipe manually
-//SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2CloseInput(System2CommandInfo* info);
+Could return the following results:
+- SYSTEM2_RESULT_SUCCESS
+- SYSTEM2_RESULT_INVALID_ARGUMENT
+*/
+SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2GetFiredWatchdog( const System2CommandInfo* info,
+                                                            SYSTEM2_WATCHDOG* outWatchdog);
 
 /*
 Cleanup any open handles associated with the command.
 
+If the command was run with `ReapOnCleanup` and hasn't been waited for, it is handed to the reaper
+thread (started on first use), which waits for it and keeps its return value for 
+`System2GetCommandReturnValue()`.
+
 Could return the following results:
 - SYSTEM2_RESULT_SUCCESS
 - SYSTEM2_RESULT_PIPE_FD_CLOSE_FAILED
 - SYSTEM2_RESULT_INVALID_ARGUMENT
+- SYSTEM2_RESULT_REAPER_START_FAILED
 */
 SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2CleanupCommand(const System2CommandInfo* info);
 
@@ -319,60 +959,313 @@ Could return the following results:
 SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2Term(const System2CommandInfo* info);
 
 /*
-Returns the count of environment variables, along with a resource handle which can be used to 
-access the environment variable values with `System2GetEnvironmentVariables()`.
+Pauses a spawned command until it is resumed with `System2Resume()`, which keeps the work it has 
+done so far. The time it is paused for is not counted by the watchdogs.
 
-The resource handle should be freed with `System2EnvironmentVariableFree()` when done.
+On POSIX, the command is sent `SIGSTOP`, along with its children if it has `NewProcessGroup`. 
+On Windows, all the threads of the command are suspended.
 
-NOTE: If you need to get a particular environment variable without iteration, use `getenv()` from the
-      standard library.
+NOTE: A paused command only handles `System2Term()` once it is resumed.
 
 Could return the following results:
 - SYSTEM2_RESULT_SUCCESS
 - SYSTEM2_RESULT_INVALID_ARGUMENT
-- SYSTEM2_RESULT_MALLOC_FAILED
+- SYSTEM2_RESULT_PAUSE_FAILED
 */
-SYSTEM2_FUNC_PREFIX 
-SYSTEM2_RESULT System2GetEnvironmentVariablesCount(int* outCount, void** outResource);
+SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2Pause(const System2CommandInfo* info);
 
 /*
-Returns the environment variable name and value for a given index. The behavior is undefined if 
-trying to index an environment variable outside of bound.
-
-The content of the returned environment name and value should be copied to a local buffer 
-immediately as changes to the environment variable might invalidate them.
-
-NOTE: If you need to get a particular environment variable without iteration, use `getenv()` from the
-      standard library.
+Resumes a command paused with `System2Pause()`. On POSIX, this sends `SIGCONT`.
 
 Could return the following results:
 - SYSTEM2_RESULT_SUCCESS
 - SYSTEM2_RESULT_INVALID_ARGUMENT
+- SYSTEM2_RESULT_RESUME_FAILED
 */
-SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2GetEnvironmentVariable(   const void* resource,
-                                                                    const char** outName,
-                                                                    int* outNameLength,
-                                                                    const char** outValue,
-                                                                    int* outValueLength,
-                                                                    int index);
+SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2Resume(const System2CommandInfo* info);
 
 /*
-Free the resource handle created by `System2GetEnvironmentVariablesCount()` and set it to NULL.
+Pauses all the commands with `System2Pause()`. If `outResults` is not NULL, the result for each 
+command is written to it. Every command is attempted even if some of them fail.
 
-Could return the following results:
-- SYSTEM2_RESULT_SUCCESS
-- SYSTEM2_RESULT_INVALID_ARGUMENT
+Returns the first result that is not SYSTEM2_RESULT_SUCCESS, if any.
 */
-SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2EnvironmentVariableFree(void** resource);
+SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2PauseMany(System2CommandInfo** commands,
+                                                    int commandsCount,
+                                                    SYSTEM2_RESULT* outResults);
 
 /*
-Sets/unsets an environment variable where it is unset if `envValue` is `NULL`.
-`envName` must be valid for the platform otherwise this function will fail.
+Resumes all the commands with `System2Resume()`. If `outResults` is not NULL, the result for each 
+command is written to it. Every command is attempted even if some of them fail.
 
-If the environment variable with `envName` does not exists when trying to unset, 
-this function MIGHT fail depending on the platform.
+Returns the first result that is not SYSTEM2_RESULT_SUCCESS, if any.
+*/
+SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2ResumeMany(   System2CommandInfo** commands,
+                                                        int commandsCount,
+                                                        SYSTEM2_RESULT* outResults);
 
-To make sure the environement variable is correctly set, you should get the environment variable.
+/*
+Limits how many commands run at the same time, adjusting the limit to what the host can take. 
+Set it up with `System2AdaptiveLimiterInit()` and call `System2AdaptiveLimiterAcquire()` before 
+starting each command.
+
+On Linux, the stall percentages of CPU, memory and IO are read from `/proc/pressure` every 
+`SampleIntervalMs`. If any of them is over `PressureThreshold`, the limit is multiplied by 
+`DecreaseFactor`, otherwise it is increased by 1 if the limit was reached since the last sample. 
+Until the first overload, the limit is doubled instead. Without pressure information, the limit 
+only grows up to `MaxConcurrency`.
+
+The wait fields measure how long admissions waited for the limit, from the first 
+`System2AdaptiveLimiterAcquire()` that couldn't admit until the one that did.
+*/
+typedef struct
+{
+    //Settings, can be changed after `System2AdaptiveLimiterInit()`
+    int MinConcurrency;
+    int MaxConcurrency;
+    uint32_t SampleIntervalMs;          //How often the pressure is read and the limit adjusted
+    float PressureThreshold;            //Percentage of time stalled on a resource that is too much
+    float DecreaseFactor;               //What the limit is multiplied by when it is too much
+    
+    //Updated by the limiter
+    float Limit;                        //How many commands are admitted at the same time
+    bool SlowStart;                     //Doubling the limit until the first overload?
+    bool LimitReached;                  //Has an admission been held back since the last sample?
+    bool PressureAvailable;             //Could the pressure be read at the last sample?
+    float CpuPressure;                  //Percentages of time stalled since the last sample
+    float MemoryPressure;
+    float IoPressure;
+    uint64_t StallTotalsUs[3];          //Stall totals of CPU, memory and IO at the last sample
+    int64_t LastSampleTimeMs;
+    int64_t WaitStartTimeMs;            //When the current admission started waiting, -1 if not
+    
+    //Metrics
+    uint64_t AdmittedCount;
+    uint64_t WaitedCount;               //Admissions that had to wait for the limit
+    uint64_t TotalWaitMs;
+    uint64_t MaxWaitMs;
+    uint64_t IncreasesCount;
+    uint64_t DecreasesCount;
+} System2AdaptiveLimiter;
+
+/*
+Sets up the limiter to keep between `minConcurrency` and `maxConcurrency` commands running, 
+starting from `minConcurrency`.
+
+Could return the following results:
+- SYSTEM2_RESULT_SUCCESS
+- SYSTEM2_RESULT_INVALID_ARGUMENT
+*/
+SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2AdaptiveLimiterInit(  System2AdaptiveLimiter* outLimiter,
+                                                                int minConcurrency,
+                                                                int maxConcurrency);
+
+/*
+Waits for up to `timeoutMs` milliseconds until fewer than `Limit` of the `runningCommands` are 
+still running, then admits one more command which the caller can start. 
+If `timeoutMs` is 0, this returns right away. If `timeoutMs` is < 0, this waits until admitted.
+
+`runningCommands` are the commands started with this limiter and not cleaned up yet, they count 
+until they have exited. The output of the commands is not read while waiting, so commands that 
+could fill their output pipes should be polled between calls with a `timeoutMs` of 0 instead.
+
+Could return the following results:
+- SYSTEM2_RESULT_SUCCESS
+- SYSTEM2_RESULT_LIMIT_REACHED
+- SYSTEM2_RESULT_INVALID_ARGUMENT
+*/
+SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT 
+System2AdaptiveLimiterAcquire(  System2AdaptiveLimiter* limiter,
+                                System2CommandInfo** runningCommands,
+                                int runningCommandsCount,
+                                int timeoutMs);
+
+//What `System2GraphRun()` does when a node fails
+typedef enum
+{
+    SYSTEM2_GRAPH_FAILURE_STOP = 0,             //Start no more nodes, let the running ones finish
+    SYSTEM2_GRAPH_FAILURE_KILL = 1,             //Start no more nodes and kill the running ones
+    SYSTEM2_GRAPH_FAILURE_SKIP_DEPENDENTS = 2,  //Only skip the nodes that depend on it
+    SYSTEM2_GRAPH_FAILURE_IGNORE = 3            //Run the nodes that depend on it anyway
+} SYSTEM2_GRAPH_FAILURE_POLICY;
+
+typedef enum
+{
+    SYSTEM2_GRAPH_NODE_PENDING = 0,
+    SYSTEM2_GRAPH_NODE_RUNNING = 1,
+    SYSTEM2_GRAPH_NODE_SUCCEEDED = 2,
+    SYSTEM2_GRAPH_NODE_FAILED = 3,      //Failed to start, exited with non-zero or was terminated
+    SYSTEM2_GRAPH_NODE_SKIPPED = 4      //Not run because of a failure
+} SYSTEM2_GRAPH_NODE_STATE;
+
+//A command in a `System2Graph`, added with `System2GraphAddNode()`
+typedef struct
+{
+    System2SpawnSpec Spec;
+    System2CommandInfo Settings;        //Used to start the command
+    uint64_t Cost;                      //Expected run time of the command in any unit, 0 counts 
+                                        //as 1. Used to find the critical path
+    
+    //Results of the last `System2GraphRun()`
+    SYSTEM2_GRAPH_NODE_STATE State;
+    SYSTEM2_RESULT Result;              //Result of starting or waiting for the command
+    int ReturnCode;
+    char* Output;                       //Output if `RedirectOutput`, also stderr if not 
+                                        //`StandaloneStderr`. **NOT** null terminated
+    uint64_t OutputSize;
+    char* Stderr;                       //Stderr if `RedirectOutput` and `StandaloneStderr`
+    uint64_t StderrSize;
+    
+    //Used by the graph
+    int* Dependents;                    //Nodes which depend on this one
+    int DependentsCount;
+    int DependentsCapacity;
+    int DependenciesCount;
+    int PendingDependencies;            //Dependencies which haven't succeeded yet
+    uint64_t Priority;                  //Cost of the longest path from this node to the end
+    uint64_t OutputCapacity;
+    uint64_t StderrCapacity;
+    bool Exited;
+    System2CommandInfo Info;            //The running command
+} System2GraphNode;
+
+/*
+Commands with dependencies between them, set up with `System2GraphInit()`, `System2GraphAddNode()` 
+and `System2GraphAddEdge()`, and run with `System2GraphRun()`.
+*/
+typedef struct
+{
+    System2GraphNode* Nodes;
+    int NodesCount;
+    int NodesCapacity;
+    SYSTEM2_GRAPH_FAILURE_POLICY FailurePolicy;
+} System2Graph;
+
+/*
+Sets up an empty graph. It should be freed with `System2GraphFree()` when done.
+
+Could return the following results:
+- SYSTEM2_RESULT_SUCCESS
+- SYSTEM2_RESULT_INVALID_ARGUMENT
+*/
+SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2GraphInit(System2Graph* outGraph);
+
+/*
+Adds a command to the graph, which is run like `System2RunMany()` runs `spec`, with `settings` 
+(which can be NULL). `cost` is how long the command is expected to take relative to the others. 
+The strings and arrays in `spec` and `settings` must outlive the graph.
+
+The input of the command can only be given with `InputBuffer`. The output callbacks are replaced 
+by the graph, which keeps the output in the node if `RedirectOutput` is true.
+
+Could return the following results:
+- SYSTEM2_RESULT_SUCCESS
+- SYSTEM2_RESULT_INVALID_ARGUMENT
+- SYSTEM2_RESULT_MALLOC_FAILED
+*/
+SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2GraphAddNode( System2Graph* graph,
+                                                        const System2SpawnSpec* spec,
+                                                        const System2CommandInfo* settings,
+                                                        uint64_t cost,
+                                                        int* outNodeIndex);
+
+/*
+Makes the node at `dependentIndex` wait for the node at `dependencyIndex` to succeed.
+
+Could return the following results:
+- SYSTEM2_RESULT_SUCCESS
+- SYSTEM2_RESULT_INVALID_ARGUMENT
+- SYSTEM2_RESULT_MALLOC_FAILED
+*/
+SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2GraphAddEdge( System2Graph* graph,
+                                                        int dependencyIndex,
+                                                        int dependentIndex);
+
+/*
+Runs all the nodes of the graph and waits for them. A node is started as soon as all of its 
+dependencies have succeeded, with up to `maxConcurrency` nodes running at the same time (no limit 
+if <= 0). If `limiter` is not NULL, it also has to admit each node. When more nodes are ready than 
+can be started, the ones on the longest remaining path of `Cost` go first.
+
+When a node fails, `FailurePolicy` of the graph decides what happens to the other nodes. 
+The state, return code and output of each node are kept in it until the next run.
+
+Could return the following results:
+- SYSTEM2_RESULT_SUCCESS if all the nodes succeeded
+- SYSTEM2_RESULT_GRAPH_NODE_FAILED
+- SYSTEM2_RESULT_GRAPH_CYCLE
+- SYSTEM2_RESULT_INVALID_ARGUMENT
+- SYSTEM2_RESULT_MALLOC_FAILED
+- Any results from `System2Poll()`
+*/
+SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2GraphRun( System2Graph* graph,
+                                                    int maxConcurrency,
+                                                    System2AdaptiveLimiter* limiter);
+
+/*
+Frees the nodes of the graph along with their output.
+
+Could return the following results:
+- SYSTEM2_RESULT_SUCCESS
+- SYSTEM2_RESULT_INVALID_ARGUMENT
+*/
+SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2GraphFree(System2Graph* graph);
+
+/*
+Returns the count of environment variables, along with a resource handle which can be used to 
+access the environment variable values with `System2GetEnvironmentVariables()`.
+
+The resource handle should be freed with `System2EnvironmentVariableFree()` when done.
+
+NOTE: If you need to get a particular environment variable without iteration, use `getenv()` from the
+      standard library.
+
+Could return the following results:
+- SYSTEM2_RESULT_SUCCESS
+- SYSTEM2_RESULT_INVALID_ARGUMENT
+- SYSTEM2_RESULT_MALLOC_FAILED
+*/
+SYSTEM2_FUNC_PREFIX 
+SYSTEM2_RESULT System2GetEnvironmentVariablesCount(int* outCount, void** outResource);
+
+/*
+Returns the environment variable name and value for a given index. The behavior is undefined if 
+trying to index an environment variable outside of bound.
+
+The content of the returned environment name and value should be copied to a local buffer 
+immediately as changes to the environment variable might invalidate them.
+
+NOTE: If you need to get a particular environment variable without iteration, use `getenv()` from the
+      standard library.
+
+Could return the following results:
+- SYSTEM2_RESULT_SUCCESS
+- SYSTEM2_RESULT_INVALID_ARGUMENT
+*/
+SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2GetEnvironmentVariable(   const void* resource,
+                                                                    const char** outName,
+                                                                    int* outNameLength,
+                                                                    const char** outValue,
+                                                                    int* outValueLength,
+                                                                    int index);
+
+/*
+Free the resource handle created by `System2GetEnvironmentVariablesCount()` and set it to NULL.
+
+Could return the following results:
+- SYSTEM2_RESULT_SUCCESS
+- SYSTEM2_RESULT_INVALID_ARGUMENT
+*/
+SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2EnvironmentVariableFree(void** resource);
+
+/*
+Sets/unsets an environment variable where it is unset if `envValue` is `NULL`.
+`envName` must be valid for the platform otherwise this function will fail.
+
+If the environment variable with `envName` does not exists when trying to unset, 
+this function MIGHT fail depending on the platform.
+
+To make sure the environement variable is correctly set, you should get the environment variable.
 
 Could return the following results:
 - SYSTEM2_RESULT_SUCCESS
@@ -384,6 +1277,81 @@ Could return the following results:
 SYSTEM2_FUNC_PREFIX 
 SYSTEM2_RESULT System2SetEnvironmentVariable(const char* envName, const char* envValue);
 
+/*
+Sets the spawn backend of the commands with `SYSTEM2_SPAWN_BACKEND_DEFAULT`. This starts as 
+`SYSTEM2_SPAWN_BACKEND_POSIX_SPAWN` if `SYSTEM2_POSIX_SPAWN` is defined, or 
+`SYSTEM2_SPAWN_BACKEND_FORK` otherwise. Has no effect on Windows.
+In header only mode, each translation unit has its own default backend.
+
+Could return the following results:
+- SYSTEM2_RESULT_SUCCESS
+- SYSTEM2_RESULT_INVALID_ARGUMENT
+*/
+SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2SetSpawnBackend(SYSTEM2_SPAWN_BACKEND backend);
+
+/*
+Registers a memory region that commands started with the fork backend should not copy, which saves 
+copying its page tables in every fork. The region is marked `MADV_DONTFORK` (or 
+`MADV_WIPEONFORK` if `wipeOnFork` is true) until it is unregistered.
+
+NOTE: The advice applies to the whole process, so every fork made while the region is registered 
+leaves it out (or zeroes it), including the ones made by `system()`, `popen()` or other libraries. 
+Only register memory that no forked child uses.
+
+`address` must be page aligned. With `wipeOnFork`, the region must be private anonymous memory and 
+needs Linux 4.14. The region must not hold anything passed to System2, since the child can't access 
+it before starting the command.
+
+This should not be called at the same time as `System2UnregisterForkExcludedMemory()` from other 
+threads. In header only mode, each translation unit keeps its own list of regions, so a region has 
+to be unregistered from the same one. Linux only.
+
+Could return the following results:
+- SYSTEM2_RESULT_SUCCESS
+- SYSTEM2_RESULT_INVALID_ARGUMENT
+- SYSTEM2_RESULT_MALLOC_FAILED
+- SYSTEM2_RESULT_FORK_EXCLUSION_NOT_SUPPORTED
+*/
+SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2RegisterForkExcludedMemory(   void* address, 
+                                                                        size_t size, 
+                                                                        bool wipeOnFork);
+
+/*
+Removes a region registered with `System2RegisterForkExcludedMemory()`, so that it is copied to the 
+children again. This should be done before the region is unmapped.
+
+Could return the following results:
+- SYSTEM2_RESULT_SUCCESS
+- SYSTEM2_RESULT_INVALID_ARGUMENT
+- SYSTEM2_RESULT_FORK_EXCLUSION_NOT_SUPPORTED
+*/
+SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2UnregisterForkExcludedMemory(void* address);
+
+/*
+Sets the hooks called around each operation, or removes them if `hooks` is NULL. This should be done
+before any command is run, since the hooks are not synchronized with other threads. The hooks can be
+called from any thread calling System2 functions.
+
+Needs `SYSTEM2_INSTRUMENTATION`.
+
+Could return the following results:
+- SYSTEM2_RESULT_SUCCESS
+- SYSTEM2_RESULT_INSTRUMENTATION_NOT_ENABLED
+*/
+SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2SetHooks(const System2Hooks* hooks);
+
+/*
+Gets a snapshot of the global counters. Each counter is read atomically, but not all of them at once.
+
+Needs `SYSTEM2_INSTRUMENTATION`.
+
+Could return the following results:
+- SYSTEM2_RESULT_SUCCESS
+- SYSTEM2_RESULT_INVALID_ARGUMENT
+- SYSTEM2_RESULT_INSTRUMENTATION_NOT_ENABLED
+*/
+SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2GetStats(System2Stats* outStats);
+
 
 //============================================================
 //Implementation
@@ -395,6 +1363,79 @@ SYSTEM2_RESULT System2SetEnvironmentVariable(const char* envName, const char* en
 #include <stdlib.h>
 #include <stdbool.h>
 
+#if defined(__AVX2__)
+    #define INTERNAL_SYSTEM2_AVX2 1
+    #include <immintrin.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #define INTERNAL_SYSTEM2_SSE2 1
+    #include <emmintrin.h>
+#endif
+
+#if defined(_MSC_VER) && (INTERNAL_SYSTEM2_AVX2 || INTERNAL_SYSTEM2_SSE2)
+    #include <intrin.h>
+#endif
+
+#if INTERNAL_SYSTEM2_AVX2 || INTERNAL_SYSTEM2_SSE2
+    SYSTEM2_FUNC_PREFIX
+    uint32_t Internal_System2CountTrailingZeros(uint32_t mask)
+    {
+        #if defined(_MSC_VER)
+            unsigned long index;
+            _BitScanForward(&index, mask);
+            return (uint32_t)index;
+        #else
+            return (uint32_t)__builtin_ctz(mask);
+        #endif
+    }
+#endif
+
+//Returns the index of the first `byte` in `data`, or `size` if there's none
+SYSTEM2_FUNC_PREFIX
+uint32_t Internal_System2FindByte(const char* data, uint32_t size, char byte)
+{
+    uint32_t index = 0;
+    
+    #if INTERNAL_SYSTEM2_AVX2
+        const __m256i pattern32 = _mm256_set1_epi8(byte);
+        for(; index + 32 <= size; index += 32)
+        {
+            __m256i chunk = _mm256_loadu_si256((const __m256i*)(data + index));
+            uint32_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, pattern32));
+            if(mask != 0)
+                return index + Internal_System2CountTrailingZeros(mask);
+        }
+    #endif
+    
+    #if INTERNAL_SYSTEM2_SSE2
+        const __m128i pattern16 = _mm_set1_epi8(byte);
+        for(; index + 16 <= size; index += 16)
+        {
+            __m128i chunk = _mm_loadu_si128((const __m128i*)(data + index));
+            uint32_t mask = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, pattern16));
+            if(mask != 0)
+                return index + Internal_System2CountTrailingZeros(mask);
+        }
+    #endif
+    
+    const char* found = (const char*)memchr(data + index, byte, size - index);
+    return found ? (uint32_t)(found - data) : size;
+}
+
+//Returns true if `System2Poll()` reads the stream, 0 for stdout and 1 for stderr
+SYSTEM2_FUNC_PREFIX
+bool Internal_System2IsPolledStream(const System2CommandInfo* commandInfo, int streamIndex)
+{
+    if(!commandInfo->RedirectOutput)
+        return false;
+    
+    if(streamIndex == 0)
+        return commandInfo->OnStdout != NULL;
+    else
+        return commandInfo->StandaloneStderr && commandInfo->OnStderr != NULL;
+}
+
 SYSTEM2_FUNC_PREFIX
 SYSTEM2_RESULT Internal_System2ValidateCustomEnv(System2CommandInfo* commandInfo)
 {
@@ -424,2014 +1465,7599 @@ SYSTEM2_RESULT Internal_System2ValidateCustomEnv(System2CommandInfo* commandInfo
     return SYSTEM2_RESULT_SUCCESS;
 }
 
-#if defined(__unix__) || defined(__APPLE__)
-    #include <signal.h>
-    #include <errno.h>
-    #include <sys/wait.h>
-    extern char** environ;
+#if defined(SYSTEM2_INSTRUMENTATION) && SYSTEM2_INSTRUMENTATION != 0
+    #define INTERNAL_SYSTEM2_INSTRUMENTATION 1
     
-    //This bypasses inheriting memory from parent process (glibc 2.24) but removes the rundir feature
-    //#define SYSTEM2_POSIX_SPAWN 1
-    #if defined(SYSTEM2_POSIX_SPAWN) && SYSTEM2_POSIX_SPAWN != 0
-        #include <spawn.h>
+    #if defined(_MSC_VER)
+        #define INTERNAL_SYSTEM2_ATOMIC_ADD(target, value) \
+            InterlockedExchangeAdd64((volatile LONG64*)(target), (LONG64)(value))
+        #define INTERNAL_SYSTEM2_ATOMIC_LOAD(target) \
+            InterlockedCompareExchange64((volatile LONG64*)(target), 0, 0)
+    #else
+        #define INTERNAL_SYSTEM2_ATOMIC_ADD(target, value) \
+            __atomic_fetch_add((target), (value), __ATOMIC_RELAXED)
+        #define INTERNAL_SYSTEM2_ATOMIC_LOAD(target) __atomic_load_n((target), __ATOMIC_RELAXED)
     #endif
-
-    SYSTEM2_FUNC_PREFIX 
-    SYSTEM2_RESULT System2RunSubprocessPosix(   const char* executable,
-                                                const char* const* args,
-                                                int argsCount,
-                                                System2CommandInfo* inOutCommandInfo)
+    
+    static System2Stats Internal_System2GlobalStats;
+    static System2Hooks Internal_System2GlobalHooks;
+    
+    SYSTEM2_FUNC_PREFIX uint64_t Internal_System2GetTimestampNs(void)
     {
-        if(!executable || !inOutCommandInfo)
-            return SYSTEM2_RESULT_INVALID_ARGUMENT;
-        
-        SYSTEM2_RESULT system2Result = Internal_System2ValidateCustomEnv(inOutCommandInfo);
-        if(system2Result != SYSTEM2_RESULT_SUCCESS)
-            return system2Result;
-        
-        if(inOutCommandInfo->RedirectInput)
+        #if defined(_WIN32)
+            LARGE_INTEGER frequency;
+            LARGE_INTEGER counter;
+            QueryPerformanceFrequency(&frequency);
+            QueryPerformanceCounter(&counter);
+            return  (uint64_t)(counter.QuadPart / frequency.QuadPart) * 1000000000u + 
+                    (uint64_t)(counter.QuadPart % frequency.QuadPart) * 1000000000u / 
+                    (uint64_t)frequency.QuadPart;
+        #else
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+        #endif
+    }
+#endif
+
+//Called at the start of each operation, returns the timestamp for `Internal_System2InstrumentEnd()`
+SYSTEM2_FUNC_PREFIX uint64_t Internal_System2InstrumentBegin(   SYSTEM2_OPERATION operation,
+                                                                const System2CommandInfo* info)
+{
+    #if INTERNAL_SYSTEM2_INSTRUMENTATION
+        uint64_t timestamp = Internal_System2GetTimestampNs();
+        if(Internal_System2GlobalHooks.OnBegin)
         {
-            int result = pipe(inOutCommandInfo->ParentToChildPipes);
-            if(result != 0)
-                return SYSTEM2_RESULT_PIPE_CREATE_FAILED;
+            Internal_System2GlobalHooks.OnBegin(Internal_System2GlobalHooks.UserData, 
+                                                operation, 
+                                                info, 
+                                                timestamp);
         }
-        else
-            memset(inOutCommandInfo->ParentToChildPipes, 0, sizeof(int) * 2);
         
-        if(inOutCommandInfo->RedirectOutput)
+        return timestamp;
+    #else
+        (void)operation;
+        (void)info;
+        return 0;
+    #endif
+}
+
+SYSTEM2_FUNC_PREFIX void Internal_System2InstrumentEnd( SYSTEM2_OPERATION operation,
+                                                        const System2CommandInfo* info,
+                                                        uint64_t beginTimestamp,
+                                                        SYSTEM2_RESULT result,
+                                                        uint64_t bytes)
+{
+    #if INTERNAL_SYSTEM2_INSTRUMENTATION
+        uint64_t timestamp = Internal_System2GetTimestampNs();
+        System2Stats* stats = &Internal_System2GlobalStats;
+        
+        INTERNAL_SYSTEM2_ATOMIC_ADD(&stats->Calls[operation], 1);
+        if(result < 0 && -result < SYSTEM2_STATS_FAILURES_COUNT)
+            INTERNAL_SYSTEM2_ATOMIC_ADD(&stats->Failures[-result], 1);
+        
+        if(operation == SYSTEM2_OPERATION_READ)
+            INTERNAL_SYSTEM2_ATOMIC_ADD(&stats->BytesRead, bytes);
+        else if(operation == SYSTEM2_OPERATION_WRITE)
+            INTERNAL_SYSTEM2_ATOMIC_ADD(&stats->BytesWritten, bytes);
+        else if(operation == SYSTEM2_OPERATION_SPAWN && result == SYSTEM2_RESULT_SUCCESS)
         {
-            int result = pipe(inOutCommandInfo->ChildToParentPipes);
-            if(result != 0)
-                return SYSTEM2_RESULT_PIPE_CREATE_FAILED;
+            INTERNAL_SYSTEM2_ATOMIC_ADD(&stats->TotalSpawns, 1);
+            INTERNAL_SYSTEM2_ATOMIC_ADD(&stats->ActiveCommands, 1);
             
-            if(inOutCommandInfo->StandaloneStderr)
+            uint64_t latencyNs = timestamp - beginTimestamp;
+            INTERNAL_SYSTEM2_ATOMIC_ADD(&stats->SpawnLatencyTotalNs, latencyNs);
+            
+            int bucket = 0;
+            for(uint64_t latencyUs = latencyNs / 1000; latencyUs > 0; latencyUs >>= 1)
             {
-                result = pipe(inOutCommandInfo->ChildToParentPipesErr);
-                if(result != 0)
-                    return SYSTEM2_RESULT_PIPE_CREATE_FAILED;
+                if(++bucket == SYSTEM2_STATS_LATENCY_BUCKETS_COUNT - 1)
+                    break;
             }
-            else
-                memset(inOutCommandInfo->ChildToParentPipesErr, 0, sizeof(int) * 2);
+            
+            INTERNAL_SYSTEM2_ATOMIC_ADD(&stats->SpawnLatencyHistogram[bucket], 1);
         }
-        else
+        
+        if(Internal_System2GlobalHooks.OnEnd)
         {
-            memset(inOutCommandInfo->ChildToParentPipes, 0, sizeof(int) * 2);
-            memset(inOutCommandInfo->ChildToParentPipesErr, 0, sizeof(int) * 2);
+            Internal_System2GlobalHooks.OnEnd(  Internal_System2GlobalHooks.UserData, 
+                                                operation, 
+                                                info, 
+                                                timestamp, 
+                                                result, 
+                                                bytes);
         }
+    #else
+        (void)operation;
+        (void)info;
+        (void)beginTimestamp;
+        (void)result;
+        (void)bytes;
+    #endif
+}
 
-        const char** nullTerminatedArgs = (const char**)calloc(argsCount + 2, sizeof(char*));
-        if(nullTerminatedArgs == NULL)
-            return SYSTEM2_RESULT_COMMAND_CONSTRUCT_FAILED;
-        
-        nullTerminatedArgs[0] = executable;
-        for(int i = 0; i < argsCount; ++i)
-            nullTerminatedArgs[i + 1] = args[i];
+SYSTEM2_FUNC_PREFIX void Internal_System2InstrumentCleanup(SYSTEM2_RESULT result)
+{
+    #if INTERNAL_SYSTEM2_INSTRUMENTATION
+        if(result != SYSTEM2_RESULT_INVALID_ARGUMENT)
+            INTERNAL_SYSTEM2_ATOMIC_ADD(&Internal_System2GlobalStats.ActiveCommands, -1);
+    #else
+        (void)result;
+    #endif
+}
+
+#if defined(__unix__) || defined(__APPLE__)
+    #include <signal.h>
+    #include <errno.h>
+    #include <sys/wait.h>
+    #include <sys/resource.h>
+    #include <sched.h>
+    #include <poll.h>
+    #include <fcntl.h>
+    #include <sys/stat.h>
+    #include <sys/mman.h>
+    #include <termios.h>
+    extern char** environ;
+
+    #if defined(__linux__)
+        #include <sys/syscall.h>
+        #include <sys/ioctl.h>
+        #include <fcntl.h>
+
+        //These are only exposed with _GNU_SOURCE
+        #ifndef SCHED_BATCH
+            #define SCHED_BATCH 3
+        #endif
+        #ifndef SCHED_IDLE
+            #define SCHED_IDLE 5
+        #endif
+        #ifndef F_SETPIPE_SZ
+            #define F_SETPIPE_SZ 1031
+        #endif
+        #ifndef F_GETPIPE_SZ
+            #define F_GETPIPE_SZ 1032
+        #endif
+        #ifndef F_ADD_SEALS
+            #define F_ADD_SEALS 1033
+            #define F_SEAL_SEAL 0x0001
+            #define F_SEAL_SHRINK 0x0002
+            #define F_SEAL_GROW 0x0004
+            #define F_SEAL_WRITE 0x0008
+        #endif
+        #ifndef MFD_CLOEXEC
+            #define MFD_CLOEXEC 0x0001U
+            #define MFD_ALLOW_SEALING 0x0002U
+        #endif
+        #ifndef MADV_DONTFORK
+            #define MADV_DONTFORK 10
+            #define MADV_DOFORK 11
+        #endif
+        #ifndef MADV_WIPEONFORK
+            #define MADV_WIPEONFORK 18
+            #define MADV_KEEPONFORK 19
+        #endif
         
-        #if !defined(SYSTEM2_POSIX_SPAWN) || SYSTEM2_POSIX_SPAWN == 0
-            pid_t pid = fork();
+        //Not declared in strict standard mode
+        #if defined(__GLIBC__) && !defined(__USE_MISC)
+            int madvise(void* address, size_t size, int advice);
+        #endif
         
-            if(pid < 0)
-            {
-                free(nullTerminatedArgs);
-                return SYSTEM2_RESULT_CREATE_CHILD_PROCESS_FAILED;
-            }
-            //Child
-            else if(pid == 0)
-            {
-                if(inOutCommandInfo->ParentToChildPipes[SYSTEM2_FD_WRITE])
-                {
-                    if(close(inOutCommandInfo->ParentToChildPipes[SYSTEM2_FD_WRITE]) != 0)
-                        _exit(2);
-                }
-                
-                if(inOutCommandInfo->ChildToParentPipes[SYSTEM2_FD_READ])
-                {
-                    if(close(inOutCommandInfo->ChildToParentPipes[SYSTEM2_FD_READ]) != 0)
-                        _exit(3);
-                }
-                
-                if(inOutCommandInfo->ChildToParentPipesErr[SYSTEM2_FD_READ])
-                {
-                    if(close(inOutCommandInfo->ChildToParentPipesErr[SYSTEM2_FD_READ]) != 0)
-                        _exit(3);
-                }
-                
-                if(inOutCommandInfo->RunDirectory != NULL)
-                {
-                    if(chdir(inOutCommandInfo->RunDirectory) != 0)
-                        _exit(4);
-                }
-                
-                //TODO: This is not safe in multi-threaded application after fork
-                //Cheating and be lazy to just use the system2 env var functions :)
-                if(inOutCommandInfo->EnvVarsNames)
-                {
-                    for(int i = 0; i < inOutCommandInfo->EnvVarsCount; ++i)
-                    {
-                        System2SetEnvironmentVariable(  inOutCommandInfo->EnvVarsNames[i], 
-                                                        inOutCommandInfo->EnvVarsValues[i]);
-                    }
-                }
-                
-                if(inOutCommandInfo->RedirectInput)
-                {
-                    int result = dup2(  inOutCommandInfo->ParentToChildPipes[SYSTEM2_FD_READ], 
-                                        STDIN_FILENO);
-                    if(result == -1)
-                        _exit(5);
-                }
+        #if defined(SYSTEM2_IO_URING) && SYSTEM2_IO_URING != 0
+            #define INTERNAL_SYSTEM2_IO_URING 1
+            #include <sys/mman.h>
+            #include <linux/io_uring.h>
+        #endif
+    #endif
+    
+    #if defined(SYSTEM2_REAPER) && SYSTEM2_REAPER != 0
+        #define INTERNAL_SYSTEM2_REAPER 1
+        #include <pthread.h>
+        #include <fcntl.h>
+        #if defined(__linux__)
+            #include <sys/syscall.h>
+        #endif
+    #endif
+
+    #if defined(SYSTEM2_PARALLEL_SPAWN) && SYSTEM2_PARALLEL_SPAWN != 0
+        #define INTERNAL_SYSTEM2_PARALLEL_SPAWN 1
+        #include <pthread.h>
+    #endif
+
+    //This makes posix_spawn the default backend, which bypasses inheriting memory from parent 
+    //process (glibc 2.24)
+    //#define SYSTEM2_POSIX_SPAWN 1
+    #include <spawn.h>
+    
+    //posix_spawn can change the directory of the child since glibc 2.29, otherwise commands that 
+    //change their directory are started with vfork()
+    #if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 29))
+        #define INTERNAL_SYSTEM2_SPAWN_CHDIR 1
+        
+        //These are only declared with _GNU_SOURCE
+        #if !defined(__USE_GNU)
+            int posix_spawn_file_actions_addchdir_np(   posix_spawn_file_actions_t* fileActions,
+                                                        const char* path);
+            int posix_spawn_file_actions_addfchdir_np(  posix_spawn_file_actions_t* fileActions,
+                                                        int fd);
+        #endif
+    #endif
+    
+    //Not declared in strict standard mode
+    #if defined(__GLIBC__) && !defined(__USE_MISC)
+        pid_t vfork(void);
+    #endif
+    
+    //These are only declared with _XOPEN_SOURCE
+    #if defined(__GLIBC__) && !defined(__USE_XOPEN2KXSI)
+        int posix_openpt(int flags);
+        int grantpt(int fd);
+        int unlockpt(int fd);
+    #endif
+    
+    //Backend of the commands with `SYSTEM2_SPAWN_BACKEND_DEFAULT`
+    #if defined(SYSTEM2_POSIX_SPAWN) && SYSTEM2_POSIX_SPAWN != 0
+        static int Internal_System2DefaultSpawnBackend = SYSTEM2_SPAWN_BACKEND_POSIX_SPAWN;
+    #else
+        static int Internal_System2DefaultSpawnBackend = SYSTEM2_SPAWN_BACKEND_FORK;
+    #endif
+    
+    #if defined(__linux__)
+        //Registered with `System2RegisterForkExcludedMemory()`
+        typedef struct
+        {
+            void* Address;
+            size_t Size;
+            bool WipeOnFork;
+        } Internal_System2ForkExcludedMemory;
+        
+        static Internal_System2ForkExcludedMemory* Internal_System2ForkExcludedRegions = NULL;
+        static int Internal_System2ForkExcludedRegionsCount = 0;
+    #endif
 
-                if(inOutCommandInfo->RedirectOutput)
+    //Enough for the CPU indices we accept in `CpuAffinity`, same as glibc's `CPU_SETSIZE`
+    #define INTERNAL_SYSTEM2_MAX_CPU_COUNT 1024
+    
+    //Number of signals + 1, `NSIG` is not exposed in strict standard mode
+    #if defined(NSIG)
+        #define INTERNAL_SYSTEM2_SIGNAL_COUNT NSIG
+    #else
+        #define INTERNAL_SYSTEM2_SIGNAL_COUNT 65
+    #endif
+
+    SYSTEM2_FUNC_PREFIX
+    void Internal_System2SetPipeSize(int pipeFd, int* inOutPipeSize)
+    {
+        if(*inOutPipeSize <= 0)
+            return;
+        
+        #if defined(__linux__)
+            int grantedSize = fcntl(pipeFd, F_SETPIPE_SZ, *inOutPipeSize);
+            
+            //Unprivileged processes can't go above the system maximum, retry with that instead
+            if(grantedSize < 0 && errno == EPERM)
+            {
+                FILE* maxSizeFile = fopen("/proc/sys/fs/pipe-max-size", "r");
+                int maxSize = 0;
+                if(maxSizeFile)
                 {
-                    int result = dup2(  inOutCommandInfo->ChildToParentPipes[SYSTEM2_FD_WRITE], 
-                                        STDOUT_FILENO);
-                    if(result == -1)
-                        _exit(6);
+                    if(fscanf(maxSizeFile, "%d", &maxSize) != 1)
+                        maxSize = 0;
                     
-                    result = dup2(  inOutCommandInfo->StandaloneStderr ?
-                                    inOutCommandInfo->ChildToParentPipesErr[SYSTEM2_FD_WRITE] :
-                                    inOutCommandInfo->ChildToParentPipes[SYSTEM2_FD_WRITE], 
-                                    STDERR_FILENO);
-                    if(result == -1)
-                        _exit(7);
+                    fclose(maxSizeFile);
                 }
                 
-                //TODO: Send the errno back to the host and display the error
-                if(execvp(executable, (char**)nullTerminatedArgs) == -1)
-                    _exit(52);
-                
-                //Should never be reached
-                
-                _exit(8);
-            } //else if(pid == 0)
-        #else //#if !defined(SYSTEM2_POSIX_SPAWN) || SYSTEM2_POSIX_SPAWN == 0
-            posix_spawn_file_actions_t file_actions;
-            posix_spawn_file_actions_init(&file_actions);
-
-            int* parentToChildPipes = inOutCommandInfo->ParentToChildPipes;
-            int* childToParentPipes = inOutCommandInfo->ChildToParentPipes;
-            int* childToParentPipesErr = inOutCommandInfo->ChildToParentPipesErr;
+                if(maxSize > 0 && maxSize < *inOutPipeSize)
+                    grantedSize = fcntl(pipeFd, F_SETPIPE_SZ, maxSize);
+            }
+            
+            //Not fatal, i.e. when over the per-user pipe buffer quota, report what we have
+            if(grantedSize < 0)
+                grantedSize = fcntl(pipeFd, F_GETPIPE_SZ);
             
-            //Close unused pipe ends in the child process
-            if(inOutCommandInfo->ParentToChildPipes[SYSTEM2_FD_WRITE])
+            *inOutPipeSize = grantedSize < 0 ? 0 : grantedSize;
+        #else
+            (void)pipeFd;
+            *inOutPipeSize = 0;
+        #endif
+    }
+    
+    SYSTEM2_FUNC_PREFIX
+    SYSTEM2_RESULT Internal_System2ValidateProcessAttributes(const System2CommandInfo* commandInfo)
+    {
+        if(commandInfo->ResourceLimits)
+        {
+            if(commandInfo->ResourceLimitsCount < 0)
+                return SYSTEM2_RESULT_INVALID_ARGUMENT;
+
+            for(int i = 0; i < commandInfo->ResourceLimitsCount; ++i)
             {
-                if(posix_spawn_file_actions_addclose(   &file_actions, 
-                                                        parentToChildPipes[SYSTEM2_FD_WRITE]) != 0) 
-                {
-                    posix_spawn_file_actions_destroy(&file_actions);
-                    free(nullTerminatedArgs);
-                    return SYSTEM2_RESULT_POSIX_SPAWN_FILE_ACTION_DESTROY_FAILED;
-                }
+                if(commandInfo->ResourceLimits[i].SoftLimit > commandInfo->ResourceLimits[i].HardLimit)
+                    return SYSTEM2_RESULT_INVALID_ARGUMENT;
             }
+        }
+
+        if(commandInfo->CpuAffinity)
+        {
+            #if !defined(__linux__)
+                return SYSTEM2_RESULT_PROCESS_ATTRIBUTE_NOT_SUPPORTED;
+            #endif
+
+            if(commandInfo->CpuAffinityCount <= 0)
+                return SYSTEM2_RESULT_INVALID_ARGUMENT;
 
-            if(inOutCommandInfo->ChildToParentPipes[SYSTEM2_FD_READ])
+            for(int i = 0; i < commandInfo->CpuAffinityCount; ++i)
             {
-                if(posix_spawn_file_actions_addclose(   &file_actions, 
-                                                        childToParentPipes[SYSTEM2_FD_READ]) != 0) 
+                if( commandInfo->CpuAffinity[i] < 0 ||
+                    commandInfo->CpuAffinity[i] >= INTERNAL_SYSTEM2_MAX_CPU_COUNT)
                 {
-                    posix_spawn_file_actions_destroy(&file_actions);
-                    free(nullTerminatedArgs);
-                    return SYSTEM2_RESULT_POSIX_SPAWN_FILE_ACTION_DESTROY_FAILED;
+                    return SYSTEM2_RESULT_INVALID_ARGUMENT;
                 }
             }
+        }
 
-            if(inOutCommandInfo->ChildToParentPipesErr[SYSTEM2_FD_READ])
+        if(commandInfo->IoPriorityClass != SYSTEM2_IO_PRIORITY_CLASS_INHERIT)
+        {
+            #if !defined(__linux__)
+                return SYSTEM2_RESULT_PROCESS_ATTRIBUTE_NOT_SUPPORTED;
+            #endif
+
+            if( commandInfo->IoPriorityClass < SYSTEM2_IO_PRIORITY_CLASS_INHERIT ||
+                commandInfo->IoPriorityClass > SYSTEM2_IO_PRIORITY_CLASS_IDLE ||
+                commandInfo->IoPriorityLevel < 0 ||
+                commandInfo->IoPriorityLevel > 7)
             {
-                if(posix_spawn_file_actions_addclose(   &file_actions, 
-                                                        childToParentPipesErr[SYSTEM2_FD_READ]) != 0) 
-                {
-                    posix_spawn_file_actions_destroy(&file_actions);
-                    free(nullTerminatedArgs);
-                    return SYSTEM2_RESULT_POSIX_SPAWN_FILE_ACTION_DESTROY_FAILED;
-                }
+                return SYSTEM2_RESULT_INVALID_ARGUMENT;
             }
+        }
+
+        //macOS does not implement sched_setscheduler()
+        #if defined(__APPLE__)
+            if(commandInfo->SchedulePolicy != SYSTEM2_SCHEDULE_POLICY_INHERIT)
+                return SYSTEM2_RESULT_PROCESS_ATTRIBUTE_NOT_SUPPORTED;
+        #endif
+
+        if(commandInfo->BlockedSignals)
+        {
+            if(commandInfo->BlockedSignalsCount < 0)
+                return SYSTEM2_RESULT_INVALID_ARGUMENT;
             
-            //Redirect input
-            if(inOutCommandInfo->RedirectInput)
+            for(int i = 0; i < commandInfo->BlockedSignalsCount; ++i)
             {
-                if(posix_spawn_file_actions_adddup2(&file_actions,
-                                                    parentToChildPipes[SYSTEM2_FD_READ],
-                                                    STDIN_FILENO) != 0) 
+                if( commandInfo->BlockedSignals[i] <= 0 ||
+                    commandInfo->BlockedSignals[i] >= INTERNAL_SYSTEM2_SIGNAL_COUNT)
                 {
-                    posix_spawn_file_actions_destroy(&file_actions);
-                    free(nullTerminatedArgs);
-                    return SYSTEM2_RESULT_POSIX_SPAWN_FILE_ACTION_DUP2_FAILED;
+                    return SYSTEM2_RESULT_INVALID_ARGUMENT;
                 }
             }
+        }
 
-            //Redirect output
-            if(inOutCommandInfo->RedirectOutput)
-            { 
-                if(posix_spawn_file_actions_adddup2(&file_actions,
-                                                    childToParentPipes[SYSTEM2_FD_WRITE],
-                                                    STDOUT_FILENO) != 0)
-                {
-                    posix_spawn_file_actions_destroy(&file_actions);
-                    free(nullTerminatedArgs);
-                    return SYSTEM2_RESULT_POSIX_SPAWN_FILE_ACTION_DUP2_FAILED;
-                }
+        switch(commandInfo->SchedulePolicy)
+        {
+            case SYSTEM2_SCHEDULE_POLICY_INHERIT:
+            case SYSTEM2_SCHEDULE_POLICY_OTHER:
+            case SYSTEM2_SCHEDULE_POLICY_FIFO:
+            case SYSTEM2_SCHEDULE_POLICY_RR:
+                break;
+            case SYSTEM2_SCHEDULE_POLICY_BATCH:
+            case SYSTEM2_SCHEDULE_POLICY_IDLE:
+                #if !defined(__linux__)
+                    return SYSTEM2_RESULT_PROCESS_ATTRIBUTE_NOT_SUPPORTED;
+                #endif
+                break;
+            default:
+                return SYSTEM2_RESULT_INVALID_ARGUMENT;
+        }
 
-                if(posix_spawn_file_actions_adddup2(&file_actions,
-                                                    (
-                                                        inOutCommandInfo->StandaloneStderr ?
-                                                        childToParentPipesErr[SYSTEM2_FD_WRITE] :
-                                                        childToParentPipes[SYSTEM2_FD_WRITE]
-                                                    ),
-                                                    STDERR_FILENO) != 0)
-                {
-                    posix_spawn_file_actions_destroy(&file_actions);
-                    free(nullTerminatedArgs);
-                    return SYSTEM2_RESULT_POSIX_SPAWN_FILE_ACTION_DUP2_FAILED;
-                }
-            }
+        return SYSTEM2_RESULT_SUCCESS;
+    }
 
-            //Close the duplicated file descriptors
-            if(inOutCommandInfo->ParentToChildPipes[SYSTEM2_FD_READ])
-                posix_spawn_file_actions_addclose(&file_actions, parentToChildPipes[SYSTEM2_FD_READ]);
-            
-            if(inOutCommandInfo->ChildToParentPipes[SYSTEM2_FD_WRITE])
-                posix_spawn_file_actions_addclose(&file_actions, childToParentPipes[SYSTEM2_FD_WRITE]);
+    //Gets the signal mask the child should start with
+    SYSTEM2_FUNC_PREFIX void Internal_System2GetChildSignalMask(   const System2CommandInfo* commandInfo,
+                                                                    sigset_t* outMask)
+    {
+        sigemptyset(outMask);
+        if(!commandInfo->BlockedSignals)
+            return;
+        
+        for(int i = 0; i < commandInfo->BlockedSignalsCount; ++i)
+            sigaddset(outMask, commandInfo->BlockedSignals[i]);
+    }
+    
+    /*
+    Resets the signal mask and ignored signals of the calling process according to `commandInfo`.
+    Only async-signal-safe calls are made here since it is called after `fork()`.
+    */
+    SYSTEM2_FUNC_PREFIX bool Internal_System2ResetSignals(const System2CommandInfo* commandInfo)
+    {
+        //Caught signals are reset by exec already, only ignored ones are inherited
+        if(!commandInfo->KeepIgnoredSignals)
+        {
+            struct sigaction defaultAction;
+            memset(&defaultAction, 0, sizeof(defaultAction));
+            defaultAction.sa_handler = SIG_DFL;
+            sigemptyset(&defaultAction.sa_mask);
             
-            if(inOutCommandInfo->ChildToParentPipesErr[SYSTEM2_FD_WRITE])
+            for(int sig = 1; sig < INTERNAL_SYSTEM2_SIGNAL_COUNT; ++sig)
             {
-                posix_spawn_file_actions_addclose(  &file_actions, 
-                                                    childToParentPipesErr[SYSTEM2_FD_WRITE]);
+                if(sig == SIGKILL || sig == SIGSTOP)
+                    continue;
+                
+                struct sigaction currentAction;
+                if(sigaction(sig, NULL, &currentAction) != 0)
+                    continue;
+                
+                if(currentAction.sa_handler == SIG_IGN && sigaction(sig, &defaultAction, NULL) != 0)
+                    return false;
             }
-
-            //Handle changing the directory
-            if(inOutCommandInfo->RunDirectory)
+        }
+        
+        if(!commandInfo->KeepSignalMask)
+        {
+            sigset_t mask;
+            Internal_System2GetChildSignalMask(commandInfo, &mask);
+            if(sigprocmask(SIG_SETMASK, &mask, NULL) != 0)
+                return false;
+        }
+        
+        return true;
+    }
+    
+    /*
+    Applies the child process attributes in `commandInfo` to process `pid`, where 0 is the calling
+    process. Only async-signal-safe calls are made here since it is called after `fork()`.
+    */
+    SYSTEM2_FUNC_PREFIX
+    bool Internal_System2ApplyProcessAttributes(const System2CommandInfo* commandInfo, pid_t pid)
+    {
+        if(commandInfo->ResourceLimits)
+        {
+            for(int i = 0; i < commandInfo->ResourceLimitsCount; ++i)
             {
-                free(nullTerminatedArgs);
-                return SYSTEM2_RESULT_POSIX_SPAWN_RUN_DIRECTORY_NOT_SUPPORTED;
+                const System2ResourceLimit* limit = &commandInfo->ResourceLimits[i];
+
+                #if defined(__linux__)
+                    //prlimit64 always takes 64 bits limits, where infinity is all bits set
+                    uint64_t newLimit[2] = { limit->SoftLimit, limit->HardLimit };
+                    if(syscall(SYS_prlimit64, pid, limit->Resource, newLimit, NULL) != 0)
+                        return false;
+                #else
+                    if(pid != 0)
+                        return false;
+
+                    struct rlimit newLimit;
+                    newLimit.rlim_cur = limit->SoftLimit == SYSTEM2_RESOURCE_LIMIT_INFINITY ?
+                                        RLIM_INFINITY : (rlim_t)limit->SoftLimit;
+                    newLimit.rlim_max = limit->HardLimit == SYSTEM2_RESOURCE_LIMIT_INFINITY ?
+                                        RLIM_INFINITY : (rlim_t)limit->HardLimit;
+                    if(setrlimit(limit->Resource, &newLimit) != 0)
+                        return false;
+                #endif
             }
+        }
 
-            pid_t pid;
-            int spawn_status;
-            if(inOutCommandInfo->EnvVarsNames)
+        #if defined(__linux__)
+            if(commandInfo->CpuAffinity)
             {
-                int curEnvCounts;
-                void* res;
-                system2Result = System2GetEnvironmentVariablesCount(&curEnvCounts, &res);
-                if(system2Result != SYSTEM2_RESULT_SUCCESS)
-                    return SYSTEM2_RESULT_CREATE_CHILD_PROCESS_FAILED;
-                
-                const char** entries = 
-                    (const char**)calloc(   (curEnvCounts + inOutCommandInfo->EnvVarsCount)+ 1, 
-                                            sizeof(char*));
-                bool* newUserEntries = (bool*)malloc(inOutCommandInfo->EnvVarsCount * sizeof(bool));
-                memset(newUserEntries, 1, inOutCommandInfo->EnvVarsCount * sizeof(bool));
-                
-                int entryIndex = 0;
-                
-                //Add the current existing env vars first
-                for(int i = 0; i < curEnvCounts; ++i)
-                {
-                    const char* envName;
-                    int envNameLength;
-                    const char* envValue;
-                    int envValueLength;
-                    system2Result = System2GetEnvironmentVariable(  res, 
-                                                                    &envName, 
-                                                                    &envNameLength,
-                                                                    &envValue,
-                                                                    &envValueLength,
-                                                                    i);
-                    if(system2Result != SYSTEM2_RESULT_SUCCESS)
-                        continue;
-                    
-                    //See if the current existing environment variable is mentioned from the user
-                    bool skipThis = false;
-                    for(int j = 0; j < inOutCommandInfo->EnvVarsCount; ++j)
-                    {
-                        if(envNameLength != (int)strlen(inOutCommandInfo->EnvVarsNames[j]))
-                            continue;
-                        
-                        if(memcmp(envName, inOutCommandInfo->EnvVarsNames[j], envNameLength) == 0)
-                        {
-                            skipThis = true;
-                            newUserEntries[j] = false;
-                            
-                            if(inOutCommandInfo->EnvVarsValues[j])
-                            {
-                                //+2 for `=` & `\0`
-                                size_t entrySize =  envNameLength + 
-                                                    strlen(inOutCommandInfo->EnvVarsValues[j]) + 2;
-                                char* entryStr = (char*)malloc(entrySize);
-                                snprintf(   entryStr, 
-                                            entrySize, 
-                                            "%.*s=%s", 
-                                            envNameLength, 
-                                            envName, 
-                                            inOutCommandInfo->EnvVarsValues[j]);
-                                
-                                entries[entryIndex++] = entryStr;
-                            }
-                            break;
-                        }
-                    }
-                    
-                    if(skipThis)
-                        continue;
-                    
-                    //If the user did not mention this, add it to the envp (+2 for `=` & `\0`)
-                    char* entryStr = (char*)malloc(envNameLength + envValueLength + 2);
-                    snprintf(   entryStr, 
-                                envNameLength + envValueLength + 2, 
-                                "%.*s=%.*s", 
-                                envNameLength, 
-                                envName, 
-                                envValueLength,
-                                envValue);
-                    entries[entryIndex++] = entryStr;
-                } //for(int i = 0; i < curEnvCounts; ++i)
-                
-                //Then add the user defined ones
-                for(int i = 0; i < inOutCommandInfo->EnvVarsCount; ++i)
-                {
-                    if(!newUserEntries[i])
-                        continue;
-                    
-                    size_t entrySize =  strlen(inOutCommandInfo->EnvVarsNames[i]) + 
-                                        strlen(inOutCommandInfo->EnvVarsValues[i]) + 2;
-                    char* entryStr = (char*)malloc(entrySize);
-                    snprintf(   entryStr, 
-                                entrySize, 
-                                "%s=%s", 
-                                inOutCommandInfo->EnvVarsNames[i],
-                                inOutCommandInfo->EnvVarsValues[i]);
-                    entries[entryIndex++] = entryStr;
-                }
-                
-                //Finally spawn the new process
-                spawn_status = posix_spawnp(&pid, 
-                                            executable, 
-                                            &file_actions, 
-                                            NULL, 
-                                            (char**)nullTerminatedArgs, 
-                                            (char**)entries);
-                
-                //Free stuff
-                free(newUserEntries);
-                const char** entry = entries;
-                while(*entry)
+                unsigned long mask[INTERNAL_SYSTEM2_MAX_CPU_COUNT / (8 * sizeof(unsigned long))];
+                memset(mask, 0, sizeof(mask));
+                for(int i = 0; i < commandInfo->CpuAffinityCount; ++i)
                 {
-                    free((char*)*entry);
-                    ++entry;
+                    int cpu = commandInfo->CpuAffinity[i];
+                    mask[cpu / (8 * sizeof(unsigned long))] |=
+                        1UL << (cpu % (8 * sizeof(unsigned long)));
                 }
-                
-                free(entries);
-                System2EnvironmentVariableFree(&res);
-            } //if(inOutCommandInfo->EnvVarsNames)
-            else
-            {
-                spawn_status = posix_spawnp(&pid, 
-                                            executable, 
-                                            &file_actions, 
-                                            NULL, 
-                                            (char **)nullTerminatedArgs, 
-                                            environ);
+
+                if(syscall(SYS_sched_setaffinity, pid, sizeof(mask), mask) != 0)
+                    return false;
             }
 
-            posix_spawn_file_actions_destroy(&file_actions);
-            if(spawn_status != 0)
+            if(commandInfo->IoPriorityClass != SYSTEM2_IO_PRIORITY_CLASS_INHERIT)
             {
-                fprintf(stderr, "posix_spawn failed: %s\n", strerror(spawn_status));
-                free(nullTerminatedArgs);
-                return SYSTEM2_RESULT_CREATE_CHILD_PROCESS_FAILED;
+                //IOPRIO_WHO_PROCESS is 1, class is stored above the lower 13 bits of level
+                int ioPriority = ((int)commandInfo->IoPriorityClass << 13) |
+                                 commandInfo->IoPriorityLevel;
+                if(syscall(SYS_ioprio_set, 1, pid, ioPriority) != 0)
+                    return false;
             }
-        #endif //#else
-        
-        //Parent code
+        #endif
+
+        #if !defined(__APPLE__)
+        if(commandInfo->SchedulePolicy != SYSTEM2_SCHEDULE_POLICY_INHERIT)
         {
-            free(nullTerminatedArgs);
-            
-            if(inOutCommandInfo->ParentToChildPipes[SYSTEM2_FD_READ])
+            int policy = SCHED_OTHER;
+            switch(commandInfo->SchedulePolicy)
             {
-                if(close(inOutCommandInfo->ParentToChildPipes[SYSTEM2_FD_READ]) != 0)
-                    return SYSTEM2_RESULT_PIPE_FD_CLOSE_FAILED;
-            }
-            
-            if(inOutCommandInfo->ChildToParentPipes[SYSTEM2_FD_WRITE])
-            {
-                if(close(inOutCommandInfo->ChildToParentPipes[SYSTEM2_FD_WRITE]) != 0)
-                    return SYSTEM2_RESULT_PIPE_FD_CLOSE_FAILED;
+                #if defined(__linux__)
+                    case SYSTEM2_SCHEDULE_POLICY_BATCH:
+                        policy = SCHED_BATCH;
+                        break;
+                    case SYSTEM2_SCHEDULE_POLICY_IDLE:
+                        policy = SCHED_IDLE;
+                        break;
+                #endif
+                case SYSTEM2_SCHEDULE_POLICY_FIFO:
+                    policy = SCHED_FIFO;
+                    break;
+                case SYSTEM2_SCHEDULE_POLICY_RR:
+                    policy = SCHED_RR;
+                    break;
+                default:
+                    break;
             }
-            
-            if(inOutCommandInfo->ChildToParentPipesErr[SYSTEM2_FD_WRITE])
-            {
-                if(close(inOutCommandInfo->ChildToParentPipesErr[SYSTEM2_FD_WRITE]) != 0)
-                    return SYSTEM2_RESULT_PIPE_FD_CLOSE_FAILED;
-            }
-            
-            inOutCommandInfo->ChildProcessID = pid;
+
+            struct sched_param param;
+            memset(&param, 0, sizeof(param));
+            param.sched_priority = commandInfo->SchedulePriority;
+            if(sched_setscheduler(pid, policy, &param) != 0)
+                return false;
         }
-        return SYSTEM2_RESULT_SUCCESS;
+        #endif
+
+        //Nice value is set last as lowering priority might stop us from setting the rest
+        if(commandInfo->NiceIncrement != 0)
+        {
+            errno = 0;
+            int currentNice = getpriority(PRIO_PROCESS, pid);
+            if(currentNice == -1 && errno != 0)
+                return false;
+
+            if(setpriority(PRIO_PROCESS, pid, currentNice + commandInfo->NiceIncrement) != 0)
+                return false;
+        }
+
+        return true;
     }
 
-    SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2RunPosix( const char* command, 
-                                                        System2CommandInfo* inOutCommandInfo)
+    #if INTERNAL_SYSTEM2_IO_URING
+        //Newer parts of the io_uring ABI which might not be in the installed kernel headers
+        #define INTERNAL_SYSTEM2_IORING_OP_READ_MULTISHOT 49
+        #define INTERNAL_SYSTEM2_IORING_REGISTER_PBUF_RING 22
+        #define INTERNAL_SYSTEM2_IORING_CQE_BUFFER_SHIFT 16
+        #ifndef IORING_CQE_F_MORE
+            #define IORING_CQE_F_MORE (1U << 1)
+        #endif
+
+        #ifndef SYSTEM2_IO_URING_BUFFER_COUNT
+            #define SYSTEM2_IO_URING_BUFFER_COUNT 8             //Must be a power of 2
+        #endif
+        #ifndef SYSTEM2_IO_URING_BUFFER_SIZE
+            #define SYSTEM2_IO_URING_BUFFER_SIZE (32 * 1024)
+        #endif
+
+        //Number of linked writes submitted at once
+        #define INTERNAL_SYSTEM2_IO_URING_WRITE_ENTRIES 8
+        #define INTERNAL_SYSTEM2_IO_URING_WRITE_CHUNK_SIZE (64 * 1024)
+
+        //Same layout as `struct io_uring_buf`, where the ring tail overlaps `Reserved` of the first one
+        typedef struct
+        {
+            uint64_t Address;
+            uint32_t Length;
+            uint16_t BufferId;
+            uint16_t Reserved;
+        } Internal_System2IoUringBuffer;
+
+        //Same layout as `struct io_uring_buf_reg`
+        typedef struct
+        {
+            uint64_t RingAddress;
+            uint32_t RingEntries;
+            uint16_t BufferGroup;
+            uint16_t Padding;
+            uint64_t Reserved[3];
+        } Internal_System2IoUringBufferRegister;
+
+        //A ring for a single pipe of a command
+        typedef struct
+        {
+            int RingFd;
+            int PipeFd;
+            unsigned SqEntries;
+
+            void* SqRing;
+            size_t SqRingSize;
+            void* CqRing;
+            size_t CqRingSize;
+            struct io_uring_sqe* Sqes;
+            size_t SqesSize;
+
+            unsigned* SqHead;
+            unsigned* SqTail;
+            unsigned* SqArray;
+            unsigned SqMask;
+            unsigned* CqHead;
+            unsigned* CqTail;
+            unsigned CqMask;
+            struct io_uring_cqe* Cqes;
+
+            //Provided buffers for the multishot read, NULL for input
+            Internal_System2IoUringBuffer* BufferRing;
+            size_t BufferRingSize;
+            char* Buffers;
+            uint16_t BufferRingTail;
+
+            //The buffer we are in the middle of handing out
+            int PendingBufferId;
+            uint32_t PendingOffset;
+            uint32_t PendingLength;
+
+            bool ReadArmed;
+            bool ReadFinished;
+            bool Unsupported;
+        } Internal_System2IoUring;
+
+        SYSTEM2_FUNC_PREFIX void Internal_System2IoUringDestroy(Internal_System2IoUring* ring)
+        {
+            if(!ring)
+                return;
+
+            if(ring->Sqes)
+                munmap(ring->Sqes, ring->SqesSize);
+            if(ring->CqRing && ring->CqRing != ring->SqRing)
+                munmap(ring->CqRing, ring->CqRingSize);
+            if(ring->SqRing)
+                munmap(ring->SqRing, ring->SqRingSize);
+            if(ring->BufferRing)
+                munmap(ring->BufferRing, ring->BufferRingSize);
+            if(ring->RingFd >= 0)
+                close(ring->RingFd);
+
+            free(ring->Buffers);
+            free(ring);
+        }
+
+        SYSTEM2_FUNC_PREFIX
+        void Internal_System2IoUringRecycleBuffer(Internal_System2IoUring* ring, int bufferId)
+        {
+            Internal_System2IoUringBuffer* buffer =
+                &ring->BufferRing[ring->BufferRingTail & (SYSTEM2_IO_URING_BUFFER_COUNT - 1)];
+            buffer->Address = (uint64_t)(uintptr_t)(ring->Buffers +
+                                                    (size_t)bufferId * SYSTEM2_IO_URING_BUFFER_SIZE);
+            buffer->Length = SYSTEM2_IO_URING_BUFFER_SIZE;
+            buffer->BufferId = (uint16_t)bufferId;
+
+            ++ring->BufferRingTail;
+            __atomic_store_n(&ring->BufferRing[0].Reserved, ring->BufferRingTail, __ATOMIC_RELEASE);
+        }
+
+        /*
+        Creates a ring for `pipeFd`, with provided buffers for multishot reads if `forOutput` is true.
+        Returns NULL if io_uring is not available.
+        */
+        SYSTEM2_FUNC_PREFIX
+        Internal_System2IoUring* Internal_System2IoUringCreate(int pipeFd, bool forOutput)
+        {
+            Internal_System2IoUring* ring =
+                (Internal_System2IoUring*)calloc(1, sizeof(Internal_System2IoUring));
+            if(!ring)
+                return NULL;
+
+            ring->RingFd = -1;
+            ring->PipeFd = pipeFd;
+            ring->PendingBufferId = -1;
+
+            struct io_uring_params params;
+            memset(&params, 0, sizeof(params));
+
+            //Multishot reads can post a completion for every buffer before we get to them
+            if(forOutput)
+            {
+                params.flags = IORING_SETUP_CQSIZE;
+                params.cq_entries = SYSTEM2_IO_URING_BUFFER_COUNT * 2;
+            }
+
+            ring->RingFd = (int)syscall(__NR_io_uring_setup,
+                                        forOutput ? 2 : INTERNAL_SYSTEM2_IO_URING_WRITE_ENTRIES,
+                                        &params);
+            if(ring->RingFd < 0)
+                goto failed;
+
+            ring->SqEntries = params.sq_entries;
+            ring->SqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+            ring->CqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+            if(params.features & IORING_FEAT_SINGLE_MMAP)
+            {
+                if(ring->CqRingSize > ring->SqRingSize)
+                    ring->SqRingSize = ring->CqRingSize;
+                ring->CqRingSize = ring->SqRingSize;
+            }
+
+            ring->SqRing = mmap(NULL,
+                                ring->SqRingSize,
+                                PROT_READ | PROT_WRITE,
+                                MAP_SHARED,
+                                ring->RingFd,
+                                IORING_OFF_SQ_RING);
+            if(ring->SqRing == MAP_FAILED)
+            {
+                ring->SqRing = NULL;
+                goto failed;
+            }
+
+            if(params.features & IORING_FEAT_SINGLE_MMAP)
+                ring->CqRing = ring->SqRing;
+            else
+            {
+                ring->CqRing = mmap(NULL,
+                                    ring->CqRingSize,
+                                    PROT_READ | PROT_WRITE,
+                                    MAP_SHARED,
+                                    ring->RingFd,
+                                    IORING_OFF_CQ_RING);
+                if(ring->CqRing == MAP_FAILED)
+                {
+                    ring->CqRing = NULL;
+                    goto failed;
+                }
+            }
+
+            ring->SqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+            ring->Sqes = (struct io_uring_sqe*)mmap(NULL,
+                                                    ring->SqesSize,
+                                                    PROT_READ | PROT_WRITE,
+                                                    MAP_SHARED,
+                                                    ring->RingFd,
+                                                    IORING_OFF_SQES);
+            if(ring->Sqes == MAP_FAILED)
+            {
+                ring->Sqes = NULL;
+                goto failed;
+            }
+
+            ring->SqHead = (unsigned*)((char*)ring->SqRing + params.sq_off.head);
+            ring->SqTail = (unsigned*)((char*)ring->SqRing + params.sq_off.tail);
+            ring->SqArray = (unsigned*)((char*)ring->SqRing + params.sq_off.array);
+            ring->SqMask = *(unsigned*)((char*)ring->SqRing + params.sq_off.ring_mask);
+            ring->CqHead = (unsigned*)((char*)ring->CqRing + params.cq_off.head);
+            ring->CqTail = (unsigned*)((char*)ring->CqRing + params.cq_off.tail);
+            ring->CqMask = *(unsigned*)((char*)ring->CqRing + params.cq_off.ring_mask);
+            ring->Cqes = (struct io_uring_cqe*)((char*)ring->CqRing + params.cq_off.cqes);
+
+            if(!forOutput)
+                return ring;
+
+            //Register the buffers the kernel reads the output into
+            ring->Buffers = (char*)malloc((size_t)SYSTEM2_IO_URING_BUFFER_COUNT *
+                                          SYSTEM2_IO_URING_BUFFER_SIZE);
+            if(!ring->Buffers)
+                goto failed;
+
+            ring->BufferRingSize = SYSTEM2_IO_URING_BUFFER_COUNT * sizeof(Internal_System2IoUringBuffer);
+            ring->BufferRing = (Internal_System2IoUringBuffer*)mmap(NULL,
+                                                                    ring->BufferRingSize,
+                                                                    PROT_READ | PROT_WRITE,
+                                                                    MAP_PRIVATE | MAP_ANONYMOUS,
+                                                                    -1,
+                                                                    0);
+            if(ring->BufferRing == MAP_FAILED)
+            {
+                ring->BufferRing = NULL;
+                goto failed;
+            }
+
+            Internal_System2IoUringBufferRegister bufferRegister;
+            memset(&bufferRegister, 0, sizeof(bufferRegister));
+            bufferRegister.RingAddress = (uint64_t)(uintptr_t)ring->BufferRing;
+            bufferRegister.RingEntries = SYSTEM2_IO_URING_BUFFER_COUNT;
+            bufferRegister.BufferGroup = 0;
+
+            if(syscall(__NR_io_uring_register,
+                       ring->RingFd,
+                       INTERNAL_SYSTEM2_IORING_REGISTER_PBUF_RING,
+                       &bufferRegister,
+                       1) != 0)
+            {
+                goto failed;
+            }
+
+            for(int i = 0; i < SYSTEM2_IO_URING_BUFFER_COUNT; ++i)
+                Internal_System2IoUringRecycleBuffer(ring, i);
+
+            return ring;
+
+            failed:;
+            Internal_System2IoUringDestroy(ring);
+            return NULL;
+        }
+
+        SYSTEM2_FUNC_PREFIX struct io_uring_sqe* Internal_System2IoUringGetSqe(Internal_System2IoUring* ring)
+        {
+            unsigned tail = *ring->SqTail;
+            if(tail - __atomic_load_n(ring->SqHead, __ATOMIC_ACQUIRE) >= ring->SqEntries)
+                return NULL;
+
+            struct io_uring_sqe* sqe = &ring->Sqes[tail & ring->SqMask];
+            memset(sqe, 0, sizeof(struct io_uring_sqe));
+            ring->SqArray[tail & ring->SqMask] = tail & ring->SqMask;
+            __atomic_store_n(ring->SqTail, tail + 1, __ATOMIC_RELEASE);
+            return sqe;
+        }
+
+        //Submits `submitCount` entries and waits for at least `waitCount` completions
+        SYSTEM2_FUNC_PREFIX
+        bool Internal_System2IoUringEnter(Internal_System2IoUring* ring, int submitCount, int waitCount)
+        {
+            while(true)
+            {
+                long result = syscall( __NR_io_uring_enter,
+                                       ring->RingFd,
+                                       submitCount,
+                                       waitCount,
+                                       waitCount > 0 ? IORING_ENTER_GETEVENTS : 0,
+                                       NULL,
+                                       0);
+                if(result >= 0)
+                    return true;
+
+                if(errno != EINTR)
+                    return false;
+
+                //Nothing was submitted if we are interrupted
+            }
+        }
+
+        /*
+        Same as the read() loop in `System2ReadFromOutputPosix()`, except the output is read by a
+        multishot read into the provided buffers. Completions that arrived while we were not
+        reading are collected without any syscall.
+
+        If multishot read is not supported, `ring->Unsupported` is set and nothing is read.
+        */
+        SYSTEM2_FUNC_PREFIX
+        SYSTEM2_RESULT Internal_System2ReadFromOutputIoUring(   Internal_System2IoUring* ring,
+                                                                bool returnOnData,
+                                                                char* outputBuffer,
+                                                                uint32_t outputBufferSize,
+                                                                uint32_t* outBytesRead)
+        {
+            *outBytesRead = 0;
+            bool gotCompletion = false;
+
+            while(true)
+            {
+                //Hand out what is left in the last buffer first
+                if(ring->PendingLength > 0)
+                {
+                    uint32_t copySize = outputBufferSize - *outBytesRead;
+                    if(copySize > ring->PendingLength)
+                        copySize = ring->PendingLength;
+
+                    memcpy( outputBuffer + *outBytesRead,
+                            ring->Buffers +
+                            (size_t)ring->PendingBufferId * SYSTEM2_IO_URING_BUFFER_SIZE +
+                            ring->PendingOffset,
+                            copySize);
+
+                    *outBytesRead += copySize;
+                    ring->PendingOffset += copySize;
+                    ring->PendingLength -= copySize;
+
+                    if(ring->PendingLength == 0)
+                    {
+                        Internal_System2IoUringRecycleBuffer(ring, ring->PendingBufferId);
+                        ring->PendingBufferId = -1;
+                    }
+
+                    if(outputBufferSize - *outBytesRead == 0)
+                        return SYSTEM2_RESULT_READ_NOT_FINISHED;
+                }
+
+                if(ring->ReadFinished)
+                    return SYSTEM2_RESULT_SUCCESS;
+
+                //Take the next completion if there's any
+                unsigned cqHead = *ring->CqHead;
+                if(cqHead != __atomic_load_n(ring->CqTail, __ATOMIC_ACQUIRE))
+                {
+                    struct io_uring_cqe* cqe = &ring->Cqes[cqHead & ring->CqMask];
+                    int32_t readResult = cqe->res;
+                    uint32_t flags = cqe->flags;
+                    __atomic_store_n(ring->CqHead, cqHead + 1, __ATOMIC_RELEASE);
+
+                    if(!(flags & IORING_CQE_F_MORE))
+                        ring->ReadArmed = false;
+
+                    if(readResult > 0)
+                    {
+                        ring->PendingBufferId = (int)(flags >> INTERNAL_SYSTEM2_IORING_CQE_BUFFER_SHIFT);
+                        ring->PendingOffset = 0;
+                        ring->PendingLength = (uint32_t)readResult;
+                    }
+                    //End of file
+                    else if(readResult == 0)
+                        ring->ReadFinished = true;
+                    //All buffers are in use, we will rearm once they are handed out
+                    else if(readResult == -ENOBUFS)
+                        ;
+                    //Multishot read is not supported by the kernel
+                    else if(readResult == -EINVAL && !gotCompletion && *outBytesRead == 0)
+                    {
+                        ring->Unsupported = true;
+                        return SYSTEM2_RESULT_SUCCESS;
+                    }
+                    else
+                        return SYSTEM2_RESULT_READ_FAILED;
+
+                    gotCompletion = true;
+                    continue;
+                }
+
+                //Nothing has completed, arm the read if needed and wait for it
+                if(returnOnData && *outBytesRead > 0)
+                    return SYSTEM2_RESULT_READ_NOT_FINISHED;
+                
+                int submitCount = 0;
+                if(!ring->ReadArmed)
+                {
+                    struct io_uring_sqe* sqe = Internal_System2IoUringGetSqe(ring);
+                    if(!sqe)
+                        return SYSTEM2_RESULT_READ_FAILED;
+
+                    sqe->opcode = INTERNAL_SYSTEM2_IORING_OP_READ_MULTISHOT;
+                    sqe->fd = ring->PipeFd;
+                    sqe->off = (uint64_t)-1;
+                    sqe->flags = IOSQE_BUFFER_SELECT;
+                    sqe->buf_group = 0;
+                    submitCount = 1;
+                    ring->ReadArmed = true;
+                }
+
+                if(!Internal_System2IoUringEnter(ring, submitCount, 1))
+                    return SYSTEM2_RESULT_READ_FAILED;
+            }
+        }
+
+        /*
+        Writes the input with linked writes, so that multiple pipe buffers worth of input only need
+        a single syscall.
+
+        If io_uring write is not supported, `ring->Unsupported` is set and `outBytesWritten` tells
+        how much has been written.
+        */
+        SYSTEM2_FUNC_PREFIX
+        SYSTEM2_RESULT Internal_System2WriteToInputIoUring( Internal_System2IoUring* ring,
+                                                            const char* inputBuffer,
+                                                            uint32_t inputBufferSize,
+                                                            uint32_t* outBytesWritten)
+        {
+            *outBytesWritten = 0;
+
+            while(*outBytesWritten < inputBufferSize)
+            {
+                int submitCount = 0;
+                uint32_t submitOffset = *outBytesWritten;
+                while(submitCount < INTERNAL_SYSTEM2_IO_URING_WRITE_ENTRIES &&
+                      submitOffset < inputBufferSize)
+                {
+                    struct io_uring_sqe* sqe = Internal_System2IoUringGetSqe(ring);
+                    if(!sqe)
+                        break;
+
+                    uint32_t chunkSize = inputBufferSize - submitOffset;
+                    if(chunkSize > INTERNAL_SYSTEM2_IO_URING_WRITE_CHUNK_SIZE)
+                        chunkSize = INTERNAL_SYSTEM2_IO_URING_WRITE_CHUNK_SIZE;
+
+                    sqe->opcode = IORING_OP_WRITE;
+                    sqe->fd = ring->PipeFd;
+                    sqe->off = (uint64_t)-1;
+                    sqe->addr = (uint64_t)(uintptr_t)(inputBuffer + submitOffset);
+                    sqe->len = chunkSize;
+                    sqe->flags = IOSQE_IO_LINK;
+
+                    submitOffset += chunkSize;
+                    ++submitCount;
+
+                    //The last one ends the chain
+                    if(submitCount == INTERNAL_SYSTEM2_IO_URING_WRITE_ENTRIES ||
+                       submitOffset == inputBufferSize)
+                    {
+                        sqe->flags = 0;
+                    }
+                }
+
+                if(submitCount == 0 || !Internal_System2IoUringEnter(ring, submitCount, submitCount))
+                    return SYSTEM2_RESULT_WRITE_FAILED;
+
+                //Collect all the completions in order. A short write cancels the rest of the chain,
+                //which we will submit again.
+                bool chainBroken = false;
+                for(int completed = 0; completed < submitCount;)
+                {
+                    unsigned cqHead = *ring->CqHead;
+                    if(cqHead == __atomic_load_n(ring->CqTail, __ATOMIC_ACQUIRE))
+                    {
+                        if(!Internal_System2IoUringEnter(ring, 0, 1))
+                            return SYSTEM2_RESULT_WRITE_FAILED;
+                        continue;
+                    }
+
+                    int32_t writeResult = ring->Cqes[cqHead & ring->CqMask].res;
+                    __atomic_store_n(ring->CqHead, cqHead + 1, __ATOMIC_RELEASE);
+                    ++completed;
+
+                    if(chainBroken || writeResult == -ECANCELED)
+                    {
+                        chainBroken = true;
+                        continue;
+                    }
+
+                    if(writeResult == -EINVAL && *outBytesWritten == 0)
+                    {
+                        ring->Unsupported = true;
+                        chainBroken = true;
+                        continue;
+                    }
+
+                    if(writeResult < 0)
+                        return SYSTEM2_RESULT_WRITE_FAILED;
+
+                    *outBytesWritten += (uint32_t)writeResult;
+                }
+
+                if(ring->Unsupported)
+                    return SYSTEM2_RESULT_SUCCESS;
+            }
+
+            return SYSTEM2_RESULT_SUCCESS;
+        }
+
+    #endif //#if INTERNAL_SYSTEM2_IO_URING
+    
+    //State of a command that needs to be kept between calls
+    struct Internal_System2CommandState
     {
-        const char* args[] = { "-c", command };
+        #if INTERNAL_SYSTEM2_IO_URING
+            //Created when the pipe is first used
+            Internal_System2IoUring* OutputRings[2];    //stdout, stderr
+            Internal_System2IoUring* InputRing;
+            bool RingsCreated[3];                       //stdout, stderr, stdin
+        #endif
         
-        return System2RunSubprocessPosix("/bin/sh", args, 2, inOutCommandInfo);
-    }
+        //Used by `System2Poll()`
+        char* CallbackBuffer;                           //Reused for every output callback
+        uint32_t CallbackChunkSize;
+        bool OutputFinished[2];                         //stdout, stderr
+        bool ExitReported;
+        #if defined(__linux__)
+            int PidFd;                                  //Becomes readable when the command exits
+            bool PidFdOpened;
+        #endif
+        
+        int CaptureFds[2];                              //stdout, stderr files for 
+                                                        //`CaptureOutputToFile`, -1 if not used
+        
+        //Used by the watchdogs, the times are -1 until they happen
+        int64_t StartTimeMs;
+        int64_t LastOutputTimeMs;
+        int64_t InputClosedTimeMs;
+        int64_t TermSentTimeMs;
+        int64_t PausedTimeMs;                           //When `System2Pause()` was called
+        SYSTEM2_WATCHDOG FiredWatchdog;
+        bool WatchdogStopped;
+    };
     
-    SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2ReadFromOutputPosix(  const System2CommandInfo* info, 
-                                                                    bool readStderr,
-                                                                    char* outputBuffer, 
-                                                                    uint32_t outputBufferSize,
-                                                                    uint32_t* outBytesRead)
+    SYSTEM2_FUNC_PREFIX
+    void Internal_System2FreeCommandState(struct Internal_System2CommandState* state)
     {
-        if(!info || !outputBuffer || !outBytesRead || !info->RedirectOutput)
-            return SYSTEM2_RESULT_INVALID_ARGUMENT;
+        if(!state)
+            return;
         
-        if(readStderr && !info->StandaloneStderr)
-            return SYSTEM2_RESULT_INVALID_ARGUMENT;
+        #if INTERNAL_SYSTEM2_IO_URING
+            Internal_System2IoUringDestroy(state->OutputRings[0]);
+            Internal_System2IoUringDestroy(state->OutputRings[1]);
+            Internal_System2IoUringDestroy(state->InputRing);
+        #endif
         
-        int32_t readResult;
-        *outBytesRead = 0;
+        #if defined(__linux__)
+            if(state->PidFdOpened && state->PidFd >= 0)
+                close(state->PidFd);
+        #endif
         
-        while (true)
+        for(int i = 0; i < 2; ++i)
         {
-            readResult = read(  (
-                                    readStderr ?
-                                    info->ChildToParentPipesErr[SYSTEM2_FD_READ] :
-                                    info->ChildToParentPipes[SYSTEM2_FD_READ]
-                                ), 
-                                outputBuffer, 
-                                outputBufferSize - *outBytesRead);
-            
-            if(readResult == 0)
-                break;
-            
-            if(readResult == -1)
-                return SYSTEM2_RESULT_READ_FAILED;
-
-            outputBuffer += readResult;
-            *outBytesRead += readResult;
-            
-            if(outputBufferSize - *outBytesRead == 0)
-                return SYSTEM2_RESULT_READ_NOT_FINISHED;
+            if(state->CaptureFds[i] != -1)
+                close(state->CaptureFds[i]);
         }
         
-        return SYSTEM2_RESULT_SUCCESS;
+        free(state->CallbackBuffer);
+        free(state);
     }
     
-    SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2WriteToInputPosix(const System2CommandInfo* info, 
-                                                                const char* inputBuffer, 
-                                                                const uint32_t inputBufferSize)
+    SYSTEM2_FUNC_PREFIX int Internal_System2CreateTempFile(const char* name);
+    SYSTEM2_FUNC_PREFIX int64_t Internal_System2GetTimeMs(void);
+    SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT Internal_System2PeekExit(const System2CommandInfo* info, 
+                                                                int* outReturnCode);
+    
+    SYSTEM2_FUNC_PREFIX bool Internal_System2HasWatchdogs(const System2CommandInfo* info)
     {
-        if(!info || !inputBuffer || !info->RedirectInput)
-            return SYSTEM2_RESULT_INVALID_ARGUMENT;
+        return  info->FirstOutputTimeoutMs > 0 || 
+                info->OutputGapTimeoutMs > 0 || 
+                info->InputClosedTimeoutMs > 0;
+    }
+    
+    //Only commands with callbacks, capturing to files, watchdogs or using io_uring need a state
+    SYSTEM2_FUNC_PREFIX
+    SYSTEM2_RESULT Internal_System2CreateCommandState(System2CommandInfo* commandInfo)
+    {
+        commandInfo->InternalState = NULL;
         
-        uint32_t currentWriteLengthLeft = inputBufferSize;
+        bool hasOutputCallback = commandInfo->OnStdout || commandInfo->OnStderr;
+        bool needsState =   hasOutputCallback || 
+                            commandInfo->OnExit || 
+                            commandInfo->CaptureOutputToFile ||
+                            Internal_System2HasWatchdogs(commandInfo);
+        #if INTERNAL_SYSTEM2_IO_URING
+            needsState = needsState || commandInfo->RedirectInput || commandInfo->RedirectOutput;
+        #endif
         
-        while(true)
+        if(!needsState)
+            return SYSTEM2_RESULT_SUCCESS;
+        
+        struct Internal_System2CommandState* state = 
+            (struct Internal_System2CommandState*)calloc(1, sizeof(struct Internal_System2CommandState));
+        if(!state)
+            return SYSTEM2_RESULT_MALLOC_FAILED;
+        
+        state->CaptureFds[0] = -1;
+        state->CaptureFds[1] = -1;
+        state->StartTimeMs = Internal_System2GetTimeMs();
+        state->LastOutputTimeMs = -1;
+        state->InputClosedTimeMs = -1;
+        state->TermSentTimeMs = -1;
+        state->PausedTimeMs = -1;
+        
+        if(hasOutputCallback)
         {
-            int32_t writeResult = write(info->ParentToChildPipes[SYSTEM2_FD_WRITE], 
-                                        inputBuffer, 
-                                        inputBufferSize);
-
-            if(writeResult == -1)
-                return SYSTEM2_RESULT_WRITE_FAILED;
+            state->CallbackChunkSize =  commandInfo->CallbackChunkSize > 0 ? 
+                                        commandInfo->CallbackChunkSize : 
+                                        SYSTEM2_CALLBACK_CHUNK_SIZE;
             
-            inputBuffer += writeResult;
-            currentWriteLengthLeft -= writeResult;
+            state->CallbackBuffer = (char*)malloc(state->CallbackChunkSize);
+            if(!state->CallbackBuffer)
+            {
+                free(state);
+                return SYSTEM2_RESULT_MALLOC_FAILED;
+            }
+        }
+        
+        if(commandInfo->CaptureOutputToFile)
+        {
+            state->CaptureFds[0] = Internal_System2CreateTempFile("System2Output");
+            bool created = state->CaptureFds[0] != -1;
+            if(created && commandInfo->StandaloneStderr)
+            {
+                state->CaptureFds[1] = Internal_System2CreateTempFile("System2Stderr");
+                created = state->CaptureFds[1] != -1;
+            }
             
-            if(currentWriteLengthLeft == 0)
-                break;
+            if(!created)
+            {
+                Internal_System2FreeCommandState(state);
+                return SYSTEM2_RESULT_CAPTURE_FILE_CREATE_FAILED;
+            }
         }
         
+        commandInfo->InternalState = state;
         return SYSTEM2_RESULT_SUCCESS;
     }
     
-    SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2CleanupCommandPosix(const System2CommandInfo* info)
+    SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT Internal_System2GetExitResult(int status, int* outReturnCode)
     {
-        if(!info)
-            return SYSTEM2_RESULT_INVALID_ARGUMENT;
-
-        if(info->ChildToParentPipes[SYSTEM2_FD_READ])
+        if(!WIFEXITED(status))
         {
-            if(close(info->ChildToParentPipes[SYSTEM2_FD_READ]) != 0)
-                return SYSTEM2_RESULT_PIPE_FD_CLOSE_FAILED;
+            *outReturnCode = -1;
+            return SYSTEM2_RESULT_COMMAND_TERMINATED;
         }
 
-        if(info->ChildToParentPipesErr[SYSTEM2_FD_READ])
-        {
-            if(close(info->ChildToParentPipesErr[SYSTEM2_FD_READ]) != 0)
-                return SYSTEM2_RESULT_PIPE_FD_CLOSE_FAILED;
-        }
-        
-        if(info->ParentToChildPipes[SYSTEM2_FD_WRITE])
-        {
-            if(close(info->ParentToChildPipes[SYSTEM2_FD_WRITE]) != 0)
-                return SYSTEM2_RESULT_PIPE_FD_CLOSE_FAILED;
-        }
-        
+        *outReturnCode = WEXITSTATUS(status);
         return SYSTEM2_RESULT_SUCCESS;
     }
     
-    SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT Internal_System2WaitPid( const System2CommandInfo* info, 
-                                                                bool noHang,
-                                                                int* outReturnCode)
-    {
-        if(!info || !outReturnCode)
-            return SYSTEM2_RESULT_INVALID_ARGUMENT;
+    #if INTERNAL_SYSTEM2_REAPER
+        //Return values of reaped commands kept for `System2GetCommandReturnValue()`. The oldest ones 
+        //are dropped after this
+        #ifndef SYSTEM2_REAPER_MAX_KEPT_RESULTS
+            #define SYSTEM2_REAPER_MAX_KEPT_RESULTS 1024
+        #endif
         
-        int status;
-        pid_t pidResult = waitpid(info->ChildProcessID, &status, noHang ? WNOHANG : 0);
-        if(pidResult == 0)
-            return SYSTEM2_RESULT_COMMAND_NOT_FINISHED;
-        else if(pidResult == -1)
-            return SYSTEM2_RESULT_COMMAND_WAIT_FAILED;
-
-        if(!WIFEXITED(status))
+        //A command run with `ReapOnCleanup`, from when it is run until its return value is retrieved
+        typedef struct
         {
-            *outReturnCode = -1;
-            return SYSTEM2_RESULT_COMMAND_TERMINATED;
-        }
-
-        *outReturnCode = WEXITSTATUS(status);
-        return SYSTEM2_RESULT_SUCCESS;
-    }
-    
-    SYSTEM2_FUNC_PREFIX 
-    SYSTEM2_RESULT System2GetCommandReturnValuePosix(   const System2CommandInfo* info, 
-                                                        int timeoutSec,
-                                                        int* outReturnCode)
-    {
-        if(!info || !outReturnCode)
-            return SYSTEM2_RESULT_INVALID_ARGUMENT;
+            pid_t ProcessID;
+            bool Waited;                //Waited for before it was cleaned up
+            bool HandedOff;             //Cleaned up before it was waited for, so the thread waits
+            bool Reaped;                //Waited for by the thread, with the result below
+            SYSTEM2_RESULT Result;
+            int ReturnCode;
+            uint64_t ReapedOrder;       //For dropping the oldest results
+            int PidFd;                  //Becomes readable when the command exits, -1 if not opened
+        } Internal_System2ReaperEntry;
         
-        if(timeoutSec == 0)
-            return Internal_System2WaitPid(info, true, outReturnCode);
-        else if(timeoutSec < 0)
-            return Internal_System2WaitPid(info, false, outReturnCode);
+        typedef struct
+        {
+            pthread_mutex_t Mutex;
+            pthread_cond_t ReapedCondition;     //Broadcasted whenever commands are reaped
+            bool ThreadStarted;
+            int WakePipe[2];                    //Written to when a command is handed off
+            Internal_System2ReaperEntry* Entries;
+            int EntriesCount;
+            int EntriesCapacity;
+            int KeptResultsCount;
+            uint64_t NextReapedOrder;
+        } Internal_System2Reaper;
         
-        //Modified from https://stackoverflow.com/a/20173592
-        sigset_t mask;
-        sigset_t origMask;
-        struct timespec timeout;
-        timeout.tv_sec = (time_t)timeoutSec;
-        timeout.tv_nsec = 0;
-
-        sigemptyset(&mask);
-        sigemptyset(&origMask);
-        sigaddset(&mask, SIGCHLD);
-        if(sigprocmask(SIG_BLOCK, &mask, &origMask) < 0) 
-            return SYSTEM2_RESULT_TIMEOUT_SIGPROCMASK_FAILED;
+        static Internal_System2Reaper Internal_System2ReaperInstance = 
+        {
+            PTHREAD_MUTEX_INITIALIZER,
+            PTHREAD_COND_INITIALIZER,
+            false,
+            { -1, -1 },
+            NULL,
+            0,
+            0,
+            0,
+            0
+        };
         
-        time_t curTime = time(NULL);
+        //The functions below must be called with the mutex locked, except the thread itself
+        SYSTEM2_FUNC_PREFIX Internal_System2ReaperEntry* Internal_System2ReaperFind(pid_t processID)
+        {
+            Internal_System2Reaper* reaper = &Internal_System2ReaperInstance;
+            for(int i = 0; i < reaper->EntriesCount; ++i)
+            {
+                if(reaper->Entries[i].ProcessID == processID)
+                    return &reaper->Entries[i];
+            }
+            
+            return NULL;
+        }
         
-        SYSTEM2_RESULT result;
-        while(true)
+        SYSTEM2_FUNC_PREFIX void Internal_System2ReaperRemove(Internal_System2ReaperEntry* entry)
         {
-            if(sigtimedwait(&mask, NULL, &timeout) < 0)
+            Internal_System2Reaper* reaper = &Internal_System2ReaperInstance;
+            if(entry->Reaped)
+                --reaper->KeptResultsCount;
+            
+            *entry = reaper->Entries[--reaper->EntriesCount];
+        }
+        
+        SYSTEM2_FUNC_PREFIX bool Internal_System2ReaperTryReap(Internal_System2ReaperEntry* entry)
+        {
+            Internal_System2Reaper* reaper = &Internal_System2ReaperInstance;
+            int status;
+            pid_t pidResult = waitpid(entry->ProcessID, &status, WNOHANG);
+            if(pidResult == 0 || (pidResult == -1 && errno == EINTR))
+                return false;
+            
+            if(pidResult == -1)
+                entry->Result = SYSTEM2_RESULT_COMMAND_WAIT_FAILED;
+            else
+                entry->Result = Internal_System2GetExitResult(status, &entry->ReturnCode);
+            
+            entry->Reaped = true;
+            entry->ReapedOrder = reaper->NextReapedOrder++;
+            if(entry->PidFd >= 0)
             {
-                //Interrupted by a signal other than SIGCHLD.
-                if(errno == EINTR) 
-                    goto rewait;
+                close(entry->PidFd);
+                entry->PidFd = -1;
             }
             
-            //A child terminated early, check if it is our child
-            if(time(NULL) - curTime < timeoutSec)
+            //Drop the oldest result nobody has asked for. This can move the entries, in which case
+            //the caller might skip one until the next time it checks them.
+            if(++reaper->KeptResultsCount > SYSTEM2_REAPER_MAX_KEPT_RESULTS)
             {
-                result = Internal_System2WaitPid(info, true, outReturnCode);
+                Internal_System2ReaperEntry* oldest = NULL;
+                for(int i = 0; i < reaper->EntriesCount; ++i)
+                {
+                    if( reaper->Entries[i].Reaped && 
+                        (!oldest || reaper->Entries[i].ReapedOrder < oldest->ReapedOrder))
+                    {
+                        oldest = &reaper->Entries[i];
+                    }
+                }
                 
-                //It is our child, return
-                if(result != SYSTEM2_RESULT_COMMAND_NOT_FINISHED)
-                    return result;
+                Internal_System2ReaperRemove(oldest);
+            }
+            
+            return true;
+        }
+        
+        SYSTEM2_FUNC_PREFIX void* Internal_System2ReaperThread(void* unused)
+        {
+            (void)unused;
+            Internal_System2Reaper* reaper = &Internal_System2ReaperInstance;
+            struct pollfd* pollFds = NULL;
+            pid_t* pollProcessIDs = NULL;
+            int pollCapacity = 0;
+            
+            pthread_mutex_lock(&reaper->Mutex);
+            while(true)
+            {
+                if(pollCapacity < reaper->EntriesCount + 1)
+                {
+                    int newCapacity = reaper->EntriesCount * 2 + 1;
+                    struct pollfd* newPollFds = 
+                        (struct pollfd*)realloc(pollFds, sizeof(struct pollfd) * newCapacity);
+                    if(newPollFds)
+                        pollFds = newPollFds;
+                    
+                    pid_t* newProcessIDs = 
+                        (pid_t*)realloc(pollProcessIDs, sizeof(pid_t) * newCapacity);
+                    if(newProcessIDs)
+                        pollProcessIDs = newProcessIDs;
+                    
+                    if(newPollFds && newProcessIDs)
+                        pollCapacity = newCapacity;
+                }
                 
-                //Otherwise continue waiting
-                rewait:;
-                timeoutSec -= time(NULL) - curTime;
+                //Without pidfds for all the commands, check them all periodically instead
+                struct pollfd wakeFd = { reaper->WakePipe[SYSTEM2_FD_READ], POLLIN, 0 };
+                int pollCount = 1;
+                bool checkPeriodically = pollCapacity == 0;
+                for(int i = 0; i < reaper->EntriesCount && !checkPeriodically; ++i)
+                {
+                    Internal_System2ReaperEntry* entry = &reaper->Entries[i];
+                    if(!entry->HandedOff || entry->Reaped)
+                        continue;
+                    
+                    if(entry->PidFd < 0 || pollCount >= pollCapacity)
+                    {
+                        checkPeriodically = true;
+                        break;
+                    }
+                    
+                    pollFds[pollCount].fd = entry->PidFd;
+                    pollFds[pollCount].events = POLLIN;
+                    pollFds[pollCount].revents = 0;
+                    pollProcessIDs[pollCount++] = entry->ProcessID;
+                }
+                
+                pthread_mutex_unlock(&reaper->Mutex);
+                
+                if(checkPeriodically)
+                    poll(&wakeFd, 1, 50);
+                else
+                {
+                    pollFds[0] = wakeFd;
+                    poll(pollFds, pollCount, -1);
+                    wakeFd = pollFds[0];
+                }
+                
+                if(wakeFd.revents & POLLIN)
+                {
+                    char wakeBuffer[64];
+                    while(read(reaper->WakePipe[SYSTEM2_FD_READ], wakeBuffer, sizeof(wakeBuffer)) > 0)
+                    {}
+                }
+                
+                pthread_mutex_lock(&reaper->Mutex);
+                
+                bool anyReaped = false;
+                if(checkPeriodically)
+                {
+                    for(int i = 0; i < reaper->EntriesCount; ++i)
+                    {
+                        Internal_System2ReaperEntry* entry = &reaper->Entries[i];
+                        if(entry->HandedOff && !entry->Reaped && Internal_System2ReaperTryReap(entry))
+                            anyReaped = true;
+                    }
+                }
+                else
+                {
+                    for(int i = 1; i < pollCount; ++i)
+                    {
+                        if(!pollFds[i].revents)
+                            continue;
+                        
+                        Internal_System2ReaperEntry* entry = 
+                            Internal_System2ReaperFind(pollProcessIDs[i]);
+                        if(entry && !entry->Reaped && Internal_System2ReaperTryReap(entry))
+                            anyReaped = true;
+                    }
+                }
+                
+                if(anyReaped)
+                    pthread_cond_broadcast(&reaper->ReapedCondition);
+            }
+            
+            return NULL;
+        }
+        
+        //Called after running a command with `ReapOnCleanup`
+        SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT Internal_System2ReaperAdd(pid_t processID)
+        {
+            Internal_System2Reaper* reaper = &Internal_System2ReaperInstance;
+            pthread_mutex_lock(&reaper->Mutex);
+            
+            //A result with the same process ID was never retrieved, and can't be anymore
+            Internal_System2ReaperEntry* oldEntry = Internal_System2ReaperFind(processID);
+            if(oldEntry)
+                Internal_System2ReaperRemove(oldEntry);
+            
+            if(reaper->EntriesCount == reaper->EntriesCapacity)
+            {
+                int newCapacity = reaper->EntriesCapacity == 0 ? 16 : reaper->EntriesCapacity * 2;
+                Internal_System2ReaperEntry* newEntries = 
+                    (Internal_System2ReaperEntry*)realloc(  reaper->Entries, 
+                                                            sizeof(Internal_System2ReaperEntry) * 
+                                                            newCapacity);
+                if(!newEntries)
+                {
+                    pthread_mutex_unlock(&reaper->Mutex);
+                    return SYSTEM2_RESULT_MALLOC_FAILED;
+                }
+                
+                reaper->Entries = newEntries;
+                reaper->EntriesCapacity = newCapacity;
+            }
+            
+            Internal_System2ReaperEntry* entry = &reaper->Entries[reaper->EntriesCount++];
+            memset(entry, 0, sizeof(Internal_System2ReaperEntry));
+            entry->ProcessID = processID;
+            entry->ReturnCode = -1;
+            entry->PidFd = -1;
+            
+            pthread_mutex_unlock(&reaper->Mutex);
+            return SYSTEM2_RESULT_SUCCESS;
+        }
+        
+        //Called after the command is waited for, so that it won't be handed off
+        SYSTEM2_FUNC_PREFIX void Internal_System2ReaperSetWaited(pid_t processID)
+        {
+            Internal_System2Reaper* reaper = &Internal_System2ReaperInstance;
+            pthread_mutex_lock(&reaper->Mutex);
+            
+            Internal_System2ReaperEntry* entry = Internal_System2ReaperFind(processID);
+            if(entry && !entry->HandedOff)
+                entry->Waited = true;
+            
+            pthread_mutex_unlock(&reaper->Mutex);
+        }
+        
+        SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT Internal_System2ReaperStartThread(void)
+        {
+            Internal_System2Reaper* reaper = &Internal_System2ReaperInstance;
+            if(pipe(reaper->WakePipe) != 0)
+                return SYSTEM2_RESULT_REAPER_START_FAILED;
+            
+            for(int i = 0; i < 2; ++i)
+            {
+                fcntl(reaper->WakePipe[i], F_SETFD, FD_CLOEXEC);
+                fcntl(reaper->WakePipe[i], F_SETFL, fcntl(reaper->WakePipe[i], F_GETFL) | O_NONBLOCK);
+            }
+            
+            pthread_attr_t attributes;
+            pthread_t thread;
+            bool started =  pthread_attr_init(&attributes) == 0 &&
+                            pthread_attr_setdetachstate(&attributes, PTHREAD_CREATE_DETACHED) == 0 &&
+                            pthread_create(&thread, &attributes, Internal_System2ReaperThread, NULL) == 0;
+            pthread_attr_destroy(&attributes);
+            
+            if(!started)
+            {
+                close(reaper->WakePipe[SYSTEM2_FD_READ]);
+                close(reaper->WakePipe[SYSTEM2_FD_WRITE]);
+                return SYSTEM2_RESULT_REAPER_START_FAILED;
+            }
+            
+            reaper->ThreadStarted = true;
+            return SYSTEM2_RESULT_SUCCESS;
+        }
+        
+        //Called on cleanup, hands the command to the thread if it hasn't been waited for
+        SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT Internal_System2ReaperHandOff(pid_t processID)
+        {
+            Internal_System2Reaper* reaper = &Internal_System2ReaperInstance;
+            pthread_mutex_lock(&reaper->Mutex);
+            
+            Internal_System2ReaperEntry* entry = Internal_System2ReaperFind(processID);
+            if(!entry || entry->HandedOff)
+            {
+                pthread_mutex_unlock(&reaper->Mutex);
+                return SYSTEM2_RESULT_SUCCESS;
+            }
+            
+            if(entry->Waited)
+            {
+                Internal_System2ReaperRemove(entry);
+                pthread_mutex_unlock(&reaper->Mutex);
+                return SYSTEM2_RESULT_SUCCESS;
+            }
+            
+            if(!reaper->ThreadStarted)
+            {
+                SYSTEM2_RESULT result = Internal_System2ReaperStartThread();
+                if(result != SYSTEM2_RESULT_SUCCESS)
+                {
+                    pthread_mutex_unlock(&reaper->Mutex);
+                    return result;
+                }
+            }
+            
+            entry->HandedOff = true;
+            #if defined(__linux__) && defined(SYS_pidfd_open)
+                entry->PidFd = (int)syscall(SYS_pidfd_open, processID, 0);
+                if(entry->PidFd >= 0)
+                    fcntl(entry->PidFd, F_SETFD, FD_CLOEXEC);
+            #endif
+            
+            //The pipe is non-blocking, if it is full the thread is going to wake up anyway
+            char wakeByte = 0;
+            if(write(reaper->WakePipe[SYSTEM2_FD_WRITE], &wakeByte, 1) < 0)
+            {}
+            
+            pthread_mutex_unlock(&reaper->Mutex);
+            return SYSTEM2_RESULT_SUCCESS;
+        }
+        
+        //Returns false if the command wasn't handed off, otherwise the result is set to the same as 
+        //`System2GetCommandReturnValue()` and the kept return value is removed once it is retrieved
+        SYSTEM2_FUNC_PREFIX bool Internal_System2ReaperGetReturnValue(  pid_t processID,
+                                                                        int timeoutSec,
+                                                                        int* outReturnCode,
+                                                                        SYSTEM2_RESULT* outResult)
+        {
+            Internal_System2Reaper* reaper = &Internal_System2ReaperInstance;
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_sec += timeoutSec;
+            
+            pthread_mutex_lock(&reaper->Mutex);
+            
+            Internal_System2ReaperEntry* entry = Internal_System2ReaperFind(processID);
+            if(!entry || !entry->HandedOff)
+            {
+                pthread_mutex_unlock(&reaper->Mutex);
+                return false;
+            }
+            
+            while(!entry->Reaped)
+            {
+                int waitResult = ETIMEDOUT;
                 if(timeoutSec < 0)
-                    break;
+                    waitResult = pthread_cond_wait(&reaper->ReapedCondition, &reaper->Mutex);
+                else if(timeoutSec > 0)
+                {
+                    waitResult = pthread_cond_timedwait(&reaper->ReapedCondition, 
+                                                        &reaper->Mutex, 
+                                                        &deadline);
+                }
                 
-                curTime = time(NULL);
-                timeout.tv_sec = (time_t)timeoutSec;
-                continue;
+                //The entries can move while waiting, or the result can be dropped or retrieved
+                entry = Internal_System2ReaperFind(processID);
+                if(!entry)
+                {
+                    pthread_mutex_unlock(&reaper->Mutex);
+                    *outResult = SYSTEM2_RESULT_COMMAND_WAIT_FAILED;
+                    return true;
+                }
+                
+                if(waitResult == ETIMEDOUT && !entry->Reaped)
+                {
+                    pthread_mutex_unlock(&reaper->Mutex);
+                    *outResult = SYSTEM2_RESULT_COMMAND_NOT_FINISHED;
+                    return true;
+                }
             }
-
-            break;
+            
+            *outReturnCode = entry->ReturnCode;
+            *outResult = entry->Result;
+            Internal_System2ReaperRemove(entry);
+            
+            pthread_mutex_unlock(&reaper->Mutex);
+            return true;
         }
+    #endif //#if INTERNAL_SYSTEM2_REAPER
+
+    //Creates a pipe that isn't inherited by commands started by other threads at the same time
+    SYSTEM2_FUNC_PREFIX bool Internal_System2CreatePipe(int pipes[2])
+    {
+        #if defined(__linux__) && defined(SYS_pipe2)
+            if(syscall(SYS_pipe2, pipes, O_CLOEXEC) == 0)
+                return true;
+            
+            if(errno != ENOSYS)
+                return false;
+        #endif
         
-        return Internal_System2WaitPid(info, true, outReturnCode);
+        if(pipe(pipes) != 0)
+            return false;
+        
+        fcntl(pipes[SYSTEM2_FD_READ], F_SETFD, FD_CLOEXEC);
+        fcntl(pipes[SYSTEM2_FD_WRITE], F_SETFD, FD_CLOEXEC);
+        return true;
     }
     
-    SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2KillPosix(const System2CommandInfo* info)
+    /*
+    Opens a pseudo-terminal for the command. The parent keeps the master side in 
+    `ChildToParentPipes[SYSTEM2_FD_READ]` and `ParentToChildPipes[SYSTEM2_FD_WRITE]`, and the child 
+    gets the terminal in the other ends, just like the pipes.
+    */
+    SYSTEM2_FUNC_PREFIX bool Internal_System2CreatePty(System2CommandInfo* inOutCommandInfo)
     {
-        if(!info)
-            return SYSTEM2_RESULT_INVALID_ARGUMENT;
+        int masterFd = posix_openpt(O_RDWR | O_NOCTTY);
+        if(masterFd == -1)
+            return false;
         
-        int result = kill(info->ChildProcessID, SIGKILL);
-        if(result == 0)
-            return SYSTEM2_RESULT_SUCCESS;
-        else
-            return SYSTEM2_RESULT_KILL_FAILED;
+        fcntl(masterFd, F_SETFD, FD_CLOEXEC);
+        
+        int terminalFd = -1;
+        if(grantpt(masterFd) == 0 && unlockpt(masterFd) == 0)
+        {
+            //ptsname() is not thread safe
+            #if defined(__linux__) && defined(TIOCGPTN)
+                unsigned int terminalNumber;
+                char terminalPath[32];
+                if(ioctl(masterFd, TIOCGPTN, &terminalNumber) == 0)
+                {
+                    snprintf(terminalPath, sizeof(terminalPath), "/dev/pts/%u", terminalNumber);
+                    terminalFd = open(terminalPath, O_RDWR | O_NOCTTY | O_CLOEXEC);
+                }
+            #else
+                const char* terminalPath = ptsname(masterFd);
+                if(terminalPath)
+                    terminalFd = open(terminalPath, O_RDWR | O_NOCTTY | O_CLOEXEC);
+            #endif
+        }
+        
+        if(terminalFd == -1)
+        {
+            close(masterFd);
+            return false;
+        }
+        
+        struct termios settings;
+        if(tcgetattr(terminalFd, &settings) == 0)
+        {
+            //Same as cfmakeraw(), which is not in POSIX
+            if(inOutCommandInfo->PtyRawMode)
+            {
+                settings.c_iflag &= ~(  IGNBRK | BRKINT | PARMRK | ISTRIP | 
+                                        INLCR | IGNCR | ICRNL | IXON);
+                settings.c_oflag &= ~OPOST;
+                settings.c_lflag &= ~(ECHO | ECHONL | ICANON | ISIG | IEXTEN);
+                settings.c_cflag &= ~(CSIZE | PARENB);
+                settings.c_cflag |= CS8;
+                settings.c_cc[VMIN] = 1;
+                settings.c_cc[VTIME] = 0;
+            }
+            
+            if(inOutCommandInfo->PtyNoEcho)
+                settings.c_lflag &= ~(ECHO | ECHOE | ECHOK | ECHONL);
+            
+            tcsetattr(terminalFd, TCSANOW, &settings);
+        }
+        
+        struct winsize windowSize;
+        memset(&windowSize, 0, sizeof(windowSize));
+        windowSize.ws_col = inOutCommandInfo->PtyColumns ? inOutCommandInfo->PtyColumns : 80;
+        windowSize.ws_row = inOutCommandInfo->PtyRows ? inOutCommandInfo->PtyRows : 24;
+        ioctl(terminalFd, TIOCSWINSZ, &windowSize);
+        
+        //Each end is closed on its own, so they need their own fd
+        int masterWriteFd = fcntl(masterFd, F_DUPFD_CLOEXEC, 0);
+        int terminalWriteFd = fcntl(terminalFd, F_DUPFD_CLOEXEC, 0);
+        if(masterWriteFd == -1 || terminalWriteFd == -1)
+        {
+            if(masterWriteFd != -1)
+                close(masterWriteFd);
+            
+            if(terminalWriteFd != -1)
+                close(terminalWriteFd);
+            
+            close(masterFd);
+            close(terminalFd);
+            return false;
+        }
+        
+        inOutCommandInfo->ParentToChildPipes[SYSTEM2_FD_READ] = terminalFd;
+        inOutCommandInfo->ParentToChildPipes[SYSTEM2_FD_WRITE] = masterWriteFd;
+        inOutCommandInfo->ChildToParentPipes[SYSTEM2_FD_READ] = masterFd;
+        inOutCommandInfo->ChildToParentPipes[SYSTEM2_FD_WRITE] = terminalWriteFd;
+        memset(inOutCommandInfo->ChildToParentPipesErr, 0, sizeof(int) * 2);
+        return true;
     }
     
-    SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2TermPosix(const System2CommandInfo* info)
+    /*
+    Makes `fd` available to the executable as `targetFd`. Only async-signal-safe calls are made 
+    here since it is called after `fork()`.
+    */
+    SYSTEM2_FUNC_PREFIX bool Internal_System2DupTo(int fd, int targetFd)
     {
-        if(!info)
-            return SYSTEM2_RESULT_INVALID_ARGUMENT;
+        //dup2() does nothing if they are the same, which would leave the pipe closed on exec
+        if(fd == targetFd)
+            return fcntl(fd, F_SETFD, 0) != -1;
         
-        int result = kill(info->ChildProcessID, SIGTERM);
-        if(result == 0)
-            return SYSTEM2_RESULT_SUCCESS;
-        else
-            return SYSTEM2_RESULT_TERM_FAILED;
+        return dup2(fd, targetFd) != -1;
     }
     
+    //Environment variables of the parent, read once for all the commands started together
     typedef struct
     {
-        char** Envs;
-        int EnvsLength;
-    } System2EnvVarInfoPosix;
+        char** Entries;         //`NAME=value`, pointing to the strings in `environ`
+        int* NameLengths;
+        int Count;
+    } Internal_System2EnvSnapshot;
     
     SYSTEM2_FUNC_PREFIX 
-    SYSTEM2_RESULT System2GetEnvironmentVariablesCountPosix(int* outCount, void** outResource)
+    SYSTEM2_RESULT Internal_System2TakeEnvSnapshot(Internal_System2EnvSnapshot* outSnapshot)
     {
-        if(!outCount || !outResource)
-            return SYSTEM2_RESULT_INVALID_ARGUMENT;
-        
-        *outResource = NULL;
-        *outCount = 0;
-        while(environ[*outCount])
-            ++(*outCount);
+        int count = 0;
+        while(environ[count])
+            ++count;
         
-        System2EnvVarInfoPosix* info = 
-            (System2EnvVarInfoPosix*)calloc(1, sizeof(System2EnvVarInfoPosix));
-        if(!info)
+        //Both arrays in one allocation, freed with `Entries`
+        outSnapshot->Entries = (char**)malloc((sizeof(char*) + sizeof(int)) * (count + 1));
+        if(!outSnapshot->Entries)
             return SYSTEM2_RESULT_MALLOC_FAILED;
         
-        info->Envs = (char**)calloc(*outCount, sizeof(char*));
-        if(!info->Envs)
+        outSnapshot->NameLengths = (int*)(outSnapshot->Entries + count + 1);
+        outSnapshot->Count = count;
+        for(int i = 0; i < count; ++i)
         {
-            free(info);
-            return SYSTEM2_RESULT_MALLOC_FAILED;
+            const char* separator = strchr(environ[i], '=');
+            outSnapshot->Entries[i] = environ[i];
+            outSnapshot->NameLengths[i] =   separator ? 
+                                            (int)(separator - environ[i]) : 
+                                            (int)strlen(environ[i]);
         }
         
-        info->EnvsLength = *outCount;
-        int i;
-        for(i = 0; i < *outCount; ++i)
+        outSnapshot->Entries[count] = NULL;
+        return SYSTEM2_RESULT_SUCCESS;
+    }
+    
+    /*
+    Creates the environment of the command from the snapshot and the overrides in `commandInfo`, in
+    one allocation to be freed with `free()`. Entries that are not overridden are not copied.
+    */
+    SYSTEM2_FUNC_PREFIX 
+    char** Internal_System2CreateChildEnv(  const Internal_System2EnvSnapshot* snapshot,
+                                            const System2CommandInfo* commandInfo)
+    {
+        size_t stringsSize = 0;
+        for(int i = 0; i < commandInfo->EnvVarsCount; ++i)
         {
-            int memNeeded = strlen(environ[i]) + 1;
-            char* envVar = (char*)malloc(memNeeded);
-            if(!envVar)
-                break;
+            //+2 for `=` & `\0`
+            if(commandInfo->EnvVarsValues[i])
+            {
+                stringsSize +=  strlen(commandInfo->EnvVarsNames[i]) + 
+                                strlen(commandInfo->EnvVarsValues[i]) + 2;
+            }
+        }
+        
+        size_t entriesCount = snapshot->Count + commandInfo->EnvVarsCount + 1;
+        char** entries = (char**)malloc(sizeof(char*) * entriesCount + stringsSize);
+        if(!entries)
+            return NULL;
+        
+        //Keep the existing ones that are not mentioned by the user
+        int entryIndex = 0;
+        for(int i = 0; i < snapshot->Count; ++i)
+        {
+            int nameLength = snapshot->NameLengths[i];
+            bool overridden = false;
+            for(int j = 0; j < commandInfo->EnvVarsCount && !overridden; ++j)
+            {
+                const char* name = commandInfo->EnvVarsNames[j];
+                overridden =    strncmp(name, snapshot->Entries[i], nameLength) == 0 && 
+                                name[nameLength] == '\0';
+            }
             
-            memcpy(envVar, environ[i], memNeeded);
-            info->Envs[i] = envVar;
+            if(!overridden)
+                entries[entryIndex++] = snapshot->Entries[i];
         }
         
-        //Failed to allocate for all of the env strings
-        if(i != *outCount)
+        //Then add the user defined ones, NULL values are unset by leaving them out
+        char* strings = (char*)(entries + entriesCount);
+        for(int i = 0; i < commandInfo->EnvVarsCount; ++i)
         {
-            for(int j = 0; j < i; ++j)
-                free(info->Envs[j]);
+            if(!commandInfo->EnvVarsValues[i])
+                continue;
             
-            free(info->Envs);
-            free(info);
-            return SYSTEM2_RESULT_MALLOC_FAILED;
+            size_t nameLength = strlen(commandInfo->EnvVarsNames[i]);
+            size_t valueLength = strlen(commandInfo->EnvVarsValues[i]);
+            memcpy(strings, commandInfo->EnvVarsNames[i], nameLength);
+            strings[nameLength] = '=';
+            memcpy(strings + nameLength + 1, commandInfo->EnvVarsValues[i], valueLength + 1);
+            
+            entries[entryIndex++] = strings;
+            strings += nameLength + valueLength + 2;
         }
         
-        *outResource = info;
-        return SYSTEM2_RESULT_SUCCESS;
+        entries[entryIndex] = NULL;
+        return entries;
     }
     
-    SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2GetEnvironmentVariablePosix(  const void* resource,
-                                                                            const char** outName,
-                                                                            int* outNameLength,
-                                                                            const char** outValue,
-                                                                            int* outValueLength,
-                                                                            int index)
+    /*
+    Creates an empty close-on-exec file named `name` that isn't linked anywhere, which is a memfd 
+    on Linux or an unlinked temporary file otherwise. Returns -1 if it fails.
+    */
+    SYSTEM2_FUNC_PREFIX int Internal_System2CreateTempFile(const char* name)
     {
-        if(!outName || !outNameLength || !outValue || !outValueLength || !resource)
-            return SYSTEM2_RESULT_INVALID_ARGUMENT;
+        int fd = -1;
+        #if defined(__linux__) && defined(SYS_memfd_create)
+            fd = (int)syscall(SYS_memfd_create, name, MFD_CLOEXEC | MFD_ALLOW_SEALING);
+            if(fd != -1)
+                return fd;
+        #endif
         
-        char* env = ((System2EnvVarInfoPosix*)resource)->Envs[index];
-        *outName = env;
-        char* equal = env;
-        while(equal)
-        {
-            if(*equal == '=')
-                break;
-            ++equal;
-        }
-        *outNameLength = (int)(equal - env);
+        //Older kernels and other systems
+        const char* tempDirectory = getenv("TMPDIR");
+        if(!tempDirectory || tempDirectory[0] == '\0')
+            tempDirectory = "/tmp";
         
-        env = equal + 1;
-        *outValue = env;
-        while(*env)
-            ++env;
+        char path[4096];
+        int pathLength = snprintf(path, sizeof(path), "%s/%sXXXXXX", tempDirectory, name);
+        if(pathLength < 0 || pathLength >= (int)sizeof(path))
+            return -1;
         
-        *outValueLength = (int)(env - (equal + 1));
-        return SYSTEM2_RESULT_SUCCESS;
+        fd = mkstemp(path);
+        if(fd == -1)
+            return -1;
+        
+        unlink(path);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+        return fd;
     }
     
-    SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2EnvironmentVariableFreePosix(void** resource)
+    /*
+    Creates a file with the `size` bytes of `data` for the command to use as its stdin, which is a 
+    sealed memfd on Linux or an unlinked temporary file otherwise. Returns -1 if it fails.
+    */
+    SYSTEM2_FUNC_PREFIX int Internal_System2CreateInputFile(const void* data, uint64_t size)
     {
-        if(!resource)
-            return SYSTEM2_RESULT_INVALID_ARGUMENT;
+        int fd = Internal_System2CreateTempFile("System2Input");
+        if(fd == -1)
+            return -1;
         
-        if(!(*resource))
-            return SYSTEM2_RESULT_SUCCESS;
+        const char* current = (const char*)data;
+        while(size > 0)
+        {
+            size_t writeSize = size > (1 << 30) ? (1 << 30) : (size_t)size;
+            ssize_t writtenSize = write(fd, current, writeSize);
+            if(writtenSize < 0)
+            {
+                if(errno == EINTR)
+                    continue;
+                
+                close(fd);
+                return -1;
+            }
+            
+            current += writtenSize;
+            size -= (uint64_t)writtenSize;
+        }
         
-        free(*resource);
-        *resource = NULL;
-        return SYSTEM2_RESULT_SUCCESS;
+        //Nothing can change it after this, including the command. Fails for temporary files.
+        #if defined(__linux__)
+            fcntl(fd, F_ADD_SEALS, F_SEAL_SEAL | F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE);
+        #endif
+        
+        if(lseek(fd, 0, SEEK_SET) != 0)
+        {
+            close(fd);
+            return -1;
+        }
+        
+        return fd;
     }
     
-    SYSTEM2_FUNC_PREFIX
-    SYSTEM2_RESULT System2SetEnvironmentVariablePosix(const char* envName, const char* envValue)
+    //Returns true if the command sets or unsets PATH for itself
+    SYSTEM2_FUNC_PREFIX bool Internal_System2OverridesPath(const System2CommandInfo* commandInfo)
     {
-        if(!envName)
-            return SYSTEM2_RESULT_INVALID_ARGUMENT;
+        if(!commandInfo->EnvVarsNames)
+            return false;
         
-        if(envValue)
+        for(int i = 0; i < commandInfo->EnvVarsCount; ++i)
         {
-            int result = setenv(envName, envValue, 1);
-            if(result != 0)
-                return SYSTEM2_RESULT_INVALID_ARGUMENT;
+            if(commandInfo->EnvVarsNames[i] && strcmp(commandInfo->EnvVarsNames[i], "PATH") == 0)
+                return true;
         }
-        else
+        
+        return false;
+    }
+    
+    /*
+    Looks up `executable` in PATH like `execvp()` does. Returns the path found, to be freed with 
+    `free()`, or NULL if it is a path already, if it is not found or if PATH has relative entries 
+    (which depend on the run directory). Exec looks it up again in that case.
+    */
+    SYSTEM2_FUNC_PREFIX char* Internal_System2FindExecutable(const char* executable)
+    {
+        if(executable[0] == '\0' || strchr(executable, '/'))
+            return NULL;
+        
+        //Same default as glibc
+        const char* path = getenv("PATH");
+        if(!path)
+            path = "/bin:/usr/bin";
+        
+        size_t executableLength = strlen(executable);
+        char* candidate = (char*)malloc(strlen(path) + executableLength + 2);
+        if(!candidate)
+            return NULL;
+        
+        while(path[0] == '/')
         {
-            int result = unsetenv(envName);
-            if(result != 0)
-                return SYSTEM2_RESULT_INVALID_ARGUMENT;
+            const char* separator = strchr(path, ':');
+            size_t directoryLength = separator ? (size_t)(separator - path) : strlen(path);
+            
+            memcpy(candidate, path, directoryLength);
+            candidate[directoryLength] = '/';
+            memcpy(candidate + directoryLength + 1, executable, executableLength + 1);
+            
+            struct stat fileStat;
+            if( stat(candidate, &fileStat) == 0 && 
+                S_ISREG(fileStat.st_mode) && 
+                access(candidate, X_OK) == 0)
+            {
+                return candidate;
+            }
+            
+            if(!separator)
+                break;
+            
+            path = separator + 1;
         }
         
-        return SYSTEM2_RESULT_SUCCESS;
+        free(candidate);
+        return NULL;
     }
-#endif //defined(__unix__) || defined(__APPLE__)
 
-#if defined(_WIN32)
-    #include <strsafe.h>
-    #include <tlhelp32.h>
-    
-    SYSTEM2_FUNC_PREFIX void PrintError(LPCTSTR lpszFunction)
-    { 
-        (void)lpszFunction;
+    /*
+    Returns true if exec can run the file at `path` on its own, which is the case for ELF 
+    executables and scripts starting with `#!`. Anything else fails with ENOEXEC, and only the 
+    shell would run it as a script.
+    */
+    SYSTEM2_FUNC_PREFIX bool Internal_System2CanExecDirectly(const char* path)
+    {
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        if(fd == -1)
+            return false;
         
-        // Retrieve the system error message for the last-error code
-        LPVOID lpMsgBuf;
-        DWORD dw = GetLastError(); 
-    
-        FormatMessage(  FORMAT_MESSAGE_ALLOCATE_BUFFER | 
-                        FORMAT_MESSAGE_FROM_SYSTEM |
-                        FORMAT_MESSAGE_IGNORE_INSERTS,
-                        NULL,
-                        dw,
-                        MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT),
-                        (LPTSTR) &lpMsgBuf,
-                        0, 
-                        NULL );
-    
-        // Display the error message and exit the process
-        printf("Error %d: %s\n", dw, (char*)lpMsgBuf);
-        LocalFree(lpMsgBuf);
+        char header[4];
+        ssize_t readSize;
+        do
+            readSize = read(fd, header, sizeof(header));
+        while(readSize == -1 && errno == EINTR);
+        
+        close(fd);
+        if(readSize >= 2 && header[0] == '#' && header[1] == '!')
+            return true;
+        
+        return readSize == 4 && memcmp(header, "\x7f" "ELF", 4) == 0;
     }
 
-    //https://learn.microsoft.com/en-gb/archive/blogs/twistylittlepassagesallalike/everyone-quotes-command-line-arguments-the-wrong-way
-    SYSTEM2_FUNC_PREFIX int ConstructCommandLineWindows(const char* const* args,
-                                                        size_t argsCount,
-                                                        bool disableEscape,
-                                                        int resultSize,
-                                                        char* outResult)
+    /*
+    Splits `command` into words like the shell does, if it only has plain words, quotes and 
+    backslashes. Returns false if it needs the shell, otherwise `*outWords` is NULL terminated and 
+    should be freed with `free()`, which frees the words too.
+    */
+    SYSTEM2_FUNC_PREFIX bool Internal_System2SplitCommand(  const char* command, 
+                                                            char*** outWords, 
+                                                            int* outWordsCount)
     {
-        size_t currentIndex = 0;
+        //Run differently or not at all without the shell
+        static const char* const shellWords[] = 
+        {
+            ".", ":", "alias", "bg", "break", "case", "cd", "command", "continue", "do", "done", 
+            "echo", "elif", "else", "esac", "eval", "exec", "exit", "export", "fc", "fg", "fi", 
+            "for", "function", "getopts", "hash", "if", "in", "jobs", "local", "pwd", "read", 
+            "readonly", "return", "select", "set", "shift", "source", "then", "time", "times", 
+            "trap", "type", "ulimit", "umask", "unalias", "unset", "until", "wait", "while"
+        };
         
-        if(argsCount == 0)
+        //Each word takes at least 2 characters with its separator, and is never longer than its 
+        //text in the command. The words are stored right after the pointers.
+        size_t commandLength = strlen(command);
+        size_t maxWordsCount = commandLength / 2 + 2;
+        char** words = (char**)malloc(sizeof(char*) * maxWordsCount + commandLength + 1);
+        if(!words)
+            return false;
+        
+        char* output = (char*)(words + maxWordsCount);
+        const char* current = command;
+        int wordsCount = 0;
+        bool inWord = false;
+        while(true)
         {
-            if(outResult != NULL)
+            char character = *current++;
+            if(character == '\0' || character == ' ' || character == '\t')
             {
-                if(resultSize < 1)
-                    return -1;
-                else
-                {
-                    outResult[0] = '\0';
-                    return 1;
-                }
+                if(inWord)
+                    *output++ = '\0';
+                
+                inWord = false;
+                if(character == '\0')
+                    break;
+                
+                continue;
             }
-            else
-                return 1;
-        }
-        
-        for(size_t i = 0; i < argsCount; ++i)
-        {
-            size_t currentArgLength = strlen(args[i]);
             
-            if( currentArgLength != 0 &&
-                strchr(args[i], ' ') == NULL &&
-                strchr(args[i], '\t') == NULL &&
-                strchr(args[i], '\n') == NULL &&
-                strchr(args[i], '\v') == NULL &&
-                strchr(args[i], '"') == NULL)
+            if(!inWord)
             {
-                if(outResult != NULL)
-                {
-                    memcpy(&outResult[currentIndex], args[i], currentArgLength);
-                    currentIndex += currentArgLength;
-                    
-                    //Bound check
-                    if(currentIndex >= resultSize)
-                        return -1;
-                    
-                    if(i != argsCount - 1)
-                        outResult[currentIndex++] = ' ';
-                    else
-                        outResult[currentIndex++] = '\0';
-                }
-                else
-                {
-                    currentIndex += currentArgLength;
-                    ++currentIndex;
-                }
+                words[wordsCount++] = output;
+                inWord = true;
             }
-            else
+            
+            switch(character)
             {
-                if(outResult != NULL)
-                {
-                    //Bound check
-                    if(currentIndex >= resultSize)
-                        return -1;
-                    
-                    outResult[currentIndex++] = '"';
-                }
-                else
-                    ++currentIndex;
-                
-                for(int j = 0; j < currentArgLength; ++j)
-                {
-                    int numberBackslashes = 0;
-                
-                    if(!disableEscape)
+                case '\'':
+                    while(*current != '\'')
                     {
-                        for(; j < currentArgLength && args[i][j] == '\\'; ++j)
-                            ++numberBackslashes;
+                        if(*current == '\0')
+                            goto useShell;
+                        
+                        *output++ = *current++;
                     }
+                    
+                    ++current;
+                    break;
                 
-                    if(j == currentArgLength && !disableEscape)
+                //Only backslashes are handled in double quotes, anything expanded needs the shell
+                case '"':
+                    while(*current != '"')
                     {
-                        // Escape all backslashes, but let the terminating
-                        // double quotation mark we add below be interpreted
-                        // as a metacharacter.
-                        if(outResult != NULL)
+                        if(*current == '\0' || *current == '$' || *current == '`')
+                            goto useShell;
+                        
+                        if(*current == '\\')
                         {
-                            //Bound check
-                            if(currentIndex + numberBackslashes * 2 >= resultSize)
-                                return -1;
+                            if(current[1] == '\n' || current[1] == '\0')
+                                goto useShell;
                             
-                            for(int k = 0; k < numberBackslashes * 2; ++k)
-                                outResult[currentIndex++] = '\\';
-                        }
-                        else
-                        {
-                            for(int k = 0; k < numberBackslashes * 2; ++k)
-                                ++currentIndex;
+                            if(strchr("$`\"\\", current[1]))
+                                ++current;
                         }
+                        
+                        *output++ = *current++;
                     }
-                    else if(args[i][j] == '"' && !disableEscape)
+                    
+                    ++current;
+                    break;
+                
+                case '\\':
+                    if(*current == '\0' || *current == '\n')
+                        goto useShell;
+                    
+                    *output++ = *current++;
+                    break;
+                
+                //Anything else the shell would treat specially, and assignments before the command
+                default:
+                    if( strchr("|&;<>()$`*?[#~{}!\n", character) || 
+                        (character == '=' && wordsCount == 1))
                     {
-                        // Escape all backslashes and the following
-                        // double quotation mark.
-                        if(outResult != NULL)
-                        {
-                            //Bound check
-                            if(currentIndex + numberBackslashes * 2 + 1 + 1 >= resultSize)
-                                return -1;
-                            
-                            for(int k = 0; k < numberBackslashes * 2 + 1; ++k)
-                                outResult[currentIndex++] = '\\';
-                            
-                            outResult[currentIndex++] = '"';
-                        }
-                        else
-                        {
-                            for(int k = 0; k < numberBackslashes * 2 + 1; ++k)
-                                ++currentIndex;
-                            
-                            ++currentIndex;
-                        }
-                    }
-                    else
-                    {
-                        if(outResult != NULL)
-                        {
-                            //Bound check
-                            if(currentIndex + numberBackslashes + 1 >= resultSize)
-                                return -1;
-                            
-                            // Backslashes aren't special here.
-                            for(int k = 0; k < numberBackslashes; ++k)
-                                outResult[currentIndex++] = '\\';
-                            
-                            outResult[currentIndex++] = args[i][j];
-                        }
-                        else
-                        {
-                            for(int k = 0; k < numberBackslashes; ++k)
-                                ++currentIndex;
-                            
-                            ++currentIndex;
-                        }
+                        goto useShell;
                     }
-                }
-                
-                if(outResult != NULL)
-                {
-                    //Bound check
-                    if(currentIndex + 2 > resultSize)
-                        return -1;
                     
-                    outResult[currentIndex++] = '"';
-                    if(i != argsCount - 1)
-                        outResult[currentIndex++] = ' ';
-                    else
-                        outResult[currentIndex++] = '\0';
-                }
-                else
-                    currentIndex += 2;
+                    *output++ = character;
+                    break;
             }
         }
         
-        return (int)currentIndex;
+        if(wordsCount == 0)
+            goto useShell;
+        
+        for(size_t i = 0; i < sizeof(shellWords) / sizeof(shellWords[0]); ++i)
+        {
+            if(strcmp(words[0], shellWords[i]) == 0)
+                goto useShell;
+        }
+        
+        words[wordsCount] = NULL;
+        *outWords = words;
+        *outWordsCount = wordsCount;
+        return true;
+        
+        useShell:;
+        free(words);
+        return false;
     }
-    
-    SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT 
-    Internal_System2Utf8ToUtf16(const char* utf8, int inLen, wchar_t** outUtf16, int* outLen)
+
+    /*
+    Sets up the calling process to become the command after `fork()` or `vfork()`, and returns the 
+    code to exit with if it fails, or 0. Only async-signal-safe calls are made here, and nothing 
+    is written to the memory shared with the parent.
+    */
+    SYSTEM2_FUNC_PREFIX 
+    int Internal_System2PrepareChild(const System2CommandInfo* commandInfo, int inputFd)
     {
-        if(!utf8 || !outUtf16 || !outLen)
-            return SYSTEM2_RESULT_INVALID_ARGUMENT;
+        if(commandInfo->ParentToChildPipes[SYSTEM2_FD_WRITE])
+        {
+            if(close(commandInfo->ParentToChildPipes[SYSTEM2_FD_WRITE]) != 0)
+                return 2;
+        }
         
-        int wLen = MultiByteToWideChar(CP_UTF8, 0, utf8, inLen, NULL, 0);
-        if(wLen <= 0)
-            return SYSTEM2_RESULT_WINDOWS_UNICODE_FAILED;
+        if(commandInfo->ChildToParentPipes[SYSTEM2_FD_READ])
+        {
+            if(close(commandInfo->ChildToParentPipes[SYSTEM2_FD_READ]) != 0)
+                return 3;
+        }
         
-        wchar_t* w = (wchar_t*)calloc(wLen, sizeof(wchar_t));
-        if(!w)
-            return SYSTEM2_RESULT_MALLOC_FAILED;
+        if(commandInfo->ChildToParentPipesErr[SYSTEM2_FD_READ])
+        {
+            if(close(commandInfo->ChildToParentPipesErr[SYSTEM2_FD_READ]) != 0)
+                return 3;
+        }
         
-        wLen = MultiByteToWideChar(CP_UTF8, 0, utf8, inLen, w, wLen);
-        if(wLen <= 0)
+        //The terminal needs its own session to become the controlling terminal
+        if(commandInfo->UsePty)
         {
-            free(w);
-            return SYSTEM2_RESULT_WINDOWS_UNICODE_FAILED;
+            if( setsid() == -1 || 
+                ioctl(commandInfo->ParentToChildPipes[SYSTEM2_FD_READ], TIOCSCTTY, 0) == -1)
+            {
+                return 11;
+            }
+        }
+        else if(commandInfo->NewProcessGroup)
+        {
+            if(setpgid(0, 0) == -1)
+                return 12;
         }
         
-        *outUtf16 = w;
-        *outLen = wLen;
-        return SYSTEM2_RESULT_SUCCESS;
+        if(commandInfo->RunDirectory != NULL)
+        {
+            if(chdir(commandInfo->RunDirectory) != 0)
+                return 4;
+        }
+        else if(commandInfo->RunDirectoryFd > 0)
+        {
+            if(fchdir(commandInfo->RunDirectoryFd) != 0)
+                return 4;
+        }
+        
+        if(commandInfo->RedirectInput)
+            inputFd = commandInfo->ParentToChildPipes[SYSTEM2_FD_READ];
+        
+        if(inputFd != -1 && !Internal_System2DupTo(inputFd, STDIN_FILENO))
+            return 5;
+
+        if(commandInfo->RedirectOutput)
+        {
+            int outputFd = commandInfo->ChildToParentPipes[SYSTEM2_FD_WRITE];
+            int errorFd =   commandInfo->StandaloneStderr ?
+                            commandInfo->ChildToParentPipesErr[SYSTEM2_FD_WRITE] :
+                            outputFd;
+            
+            if(!Internal_System2DupTo(outputFd, STDOUT_FILENO))
+                return 6;
+            
+            if(!Internal_System2DupTo(errorFd, STDERR_FILENO))
+                return 7;
+        }
+        else if(commandInfo->CaptureOutputToFile)
+        {
+            const int* captureFds = commandInfo->InternalState->CaptureFds;
+            int errorFd = captureFds[1] != -1 ? captureFds[1] : captureFds[0];
+            
+            if(!Internal_System2DupTo(captureFds[0], STDOUT_FILENO))
+                return 6;
+            
+            if(!Internal_System2DupTo(errorFd, STDERR_FILENO))
+                return 7;
+        }
+        
+        if(!Internal_System2ApplyProcessAttributes(commandInfo, 0))
+            return 9;
+        
+        if(!Internal_System2ResetSignals(commandInfo))
+            return 10;
+        
+        return 0;
     }
     
-    
+    /*
+    Starts the command with `posix_spawnp()`, then applies the process attributes to it since 
+    posix_spawn can't do that before exec.
+    */
     SYSTEM2_FUNC_PREFIX 
-    SYSTEM2_RESULT System2RunSubprocessWindows( const char* executable,
-                                                const char* const* args,
-                                                int argsCount,
-                                                System2CommandInfo* inOutCommandInfo)
+    SYSTEM2_RESULT Internal_System2PosixSpawnSubprocess(const char* path,
+                                                        const char* const* args,
+                                                        char* const* childEnv,
+                                                        int inputFd,
+                                                        System2CommandInfo* inOutCommandInfo,
+                                                        pid_t* outPid)
     {
-        if(!executable || !inOutCommandInfo)
-            return SYSTEM2_RESULT_INVALID_ARGUMENT;
+        posix_spawn_file_actions_t file_actions;
+        posix_spawn_file_actions_init(&file_actions);
+
+        int* parentToChildPipes = inOutCommandInfo->ParentToChildPipes;
+        int* childToParentPipes = inOutCommandInfo->ChildToParentPipes;
+        int* childToParentPipesErr = inOutCommandInfo->ChildToParentPipesErr;
         
-        // Set the write handle to the pipe for STDOUT to be inherited.
-        if(inOutCommandInfo->RedirectOutput)
+        //Close unused pipe ends in the child process
+        if(inOutCommandInfo->ParentToChildPipes[SYSTEM2_FD_WRITE])
         {
-            // Create a pipe for the child process's STDOUT. 
-            if(!CreatePipe( &inOutCommandInfo->ChildToParentPipes[SYSTEM2_FD_READ], 
-                            &inOutCommandInfo->ChildToParentPipes[SYSTEM2_FD_WRITE], 
-                            NULL, 
-                            0))
-            {
-                return SYSTEM2_RESULT_PIPE_CREATE_FAILED;
-            }
-            
-            if(!SetHandleInformation(   inOutCommandInfo->ChildToParentPipes[SYSTEM2_FD_WRITE], 
-                                        HANDLE_FLAG_INHERIT, 
-                                        HANDLE_FLAG_INHERIT))
+            if(posix_spawn_file_actions_addclose(   &file_actions, 
+                                                    parentToChildPipes[SYSTEM2_FD_WRITE]) != 0) 
             {
-                return SYSTEM2_RESULT_PIPE_CREATE_FAILED;
+                posix_spawn_file_actions_destroy(&file_actions);
+                return SYSTEM2_RESULT_POSIX_SPAWN_FILE_ACTION_DESTROY_FAILED;
             }
-            
-            if(inOutCommandInfo->StandaloneStderr)
+        }
+
+        if(inOutCommandInfo->ChildToParentPipes[SYSTEM2_FD_READ])
+        {
+            if(posix_spawn_file_actions_addclose(   &file_actions, 
+                                                    childToParentPipes[SYSTEM2_FD_READ]) != 0) 
             {
-                // Create a pipe for the child process's STDERR. 
-                if(!CreatePipe( &inOutCommandInfo->ChildToParentPipesErr[SYSTEM2_FD_READ], 
-                                &inOutCommandInfo->ChildToParentPipesErr[SYSTEM2_FD_WRITE], 
-                                NULL, 
-                                0))
-                {
-                    return SYSTEM2_RESULT_PIPE_CREATE_FAILED;
-                }
-                
-                if(!SetHandleInformation(   inOutCommandInfo->ChildToParentPipesErr[SYSTEM2_FD_WRITE], 
-                                            HANDLE_FLAG_INHERIT, 
-                                            HANDLE_FLAG_INHERIT))
-                {
-                    return SYSTEM2_RESULT_PIPE_CREATE_FAILED;
-                }
+                posix_spawn_file_actions_destroy(&file_actions);
+                return SYSTEM2_RESULT_POSIX_SPAWN_FILE_ACTION_DESTROY_FAILED;
             }
-            else
-                memset(inOutCommandInfo->ChildToParentPipesErr, 0, sizeof(HANDLE) * 2);
         }
-        else
+
+        if(inOutCommandInfo->ChildToParentPipesErr[SYSTEM2_FD_READ])
         {
-            memset(inOutCommandInfo->ChildToParentPipes, 0, sizeof(HANDLE) * 2);
-            memset(inOutCommandInfo->ChildToParentPipesErr, 0, sizeof(HANDLE) * 2);
+            if(posix_spawn_file_actions_addclose(   &file_actions, 
+                                                    childToParentPipesErr[SYSTEM2_FD_READ]) != 0) 
+            {
+                posix_spawn_file_actions_destroy(&file_actions);
+                return SYSTEM2_RESULT_POSIX_SPAWN_FILE_ACTION_DESTROY_FAILED;
+            }
         }
         
+        //Redirect input
         if(inOutCommandInfo->RedirectInput)
         {
-            // Create a pipe for the child process's STDIN. 
-            if(!CreatePipe( &inOutCommandInfo->ParentToChildPipes[SYSTEM2_FD_READ], 
-                            &inOutCommandInfo->ParentToChildPipes[SYSTEM2_FD_WRITE], 
-                            NULL, 
-                            0))
+            if(posix_spawn_file_actions_adddup2(&file_actions,
+                                                parentToChildPipes[SYSTEM2_FD_READ],
+                                                STDIN_FILENO) != 0) 
             {
-                return SYSTEM2_RESULT_PIPE_CREATE_FAILED;
+                posix_spawn_file_actions_destroy(&file_actions);
+                return SYSTEM2_RESULT_POSIX_SPAWN_FILE_ACTION_DUP2_FAILED;
             }
+        }
 
-            // Set the read handle to the pipe for STDIN to be inherited. 
-            if(!SetHandleInformation(   inOutCommandInfo->ParentToChildPipes[SYSTEM2_FD_READ], 
-                                        HANDLE_FLAG_INHERIT, 
-                                        HANDLE_FLAG_INHERIT))
+        //Give the input file as stdin, which is closed on exec itself
+        if(inputFd != -1)
+        {
+            if(posix_spawn_file_actions_adddup2(&file_actions, inputFd, STDIN_FILENO) != 0) 
             {
-                return SYSTEM2_RESULT_PIPE_CREATE_FAILED;
+                posix_spawn_file_actions_destroy(&file_actions);
+                return SYSTEM2_RESULT_POSIX_SPAWN_FILE_ACTION_DUP2_FAILED;
+            }
+        }
+
+        //Redirect output
+        if(inOutCommandInfo->RedirectOutput)
+        { 
+            if(posix_spawn_file_actions_adddup2(&file_actions,
+                                                childToParentPipes[SYSTEM2_FD_WRITE],
+                                                STDOUT_FILENO) != 0)
+            {
+                posix_spawn_file_actions_destroy(&file_actions);
+                return SYSTEM2_RESULT_POSIX_SPAWN_FILE_ACTION_DUP2_FAILED;
+            }
+
+            if(posix_spawn_file_actions_adddup2(&file_actions,
+                                                (
+                                                    inOutCommandInfo->StandaloneStderr ?
+                                                    childToParentPipesErr[SYSTEM2_FD_WRITE] :
+                                                    childToParentPipes[SYSTEM2_FD_WRITE]
+                                                ),
+                                                STDERR_FILENO) != 0)
+            {
+                posix_spawn_file_actions_destroy(&file_actions);
+                return SYSTEM2_RESULT_POSIX_SPAWN_FILE_ACTION_DUP2_FAILED;
             }
         }
-        else 
-            memset(inOutCommandInfo->ParentToChildPipes, 0, sizeof(HANDLE) * 2);
-        
-        PROCESS_INFORMATION processInfo;
-        STARTUPINFOW startupInfo;
-        BOOL success = FALSE; 
         
-        //Set up members of the PROCESS_INFORMATION structure. 
-        ZeroMemory( &processInfo, sizeof(PROCESS_INFORMATION) );
-    
-        //Set up members of the STARTUPINFO structure. 
-        //This structure specifies the STDIN and STDOUT handles for redirection.
-        ZeroMemory(&startupInfo, sizeof(STARTUPINFOW));
-        startupInfo.cb = sizeof(STARTUPINFOW); 
-        if(inOutCommandInfo->RedirectInput || inOutCommandInfo->RedirectOutput)
-            startupInfo.dwFlags |= STARTF_USESTDHANDLES;
+        //Give the capture files as stdout and stderr, which are closed on exec themselves
+        if(inOutCommandInfo->CaptureOutputToFile)
+        {
+            const int* captureFds = inOutCommandInfo->InternalState->CaptureFds;
+            int errorFd = captureFds[1] != -1 ? captureFds[1] : captureFds[0];
+            
+            if( posix_spawn_file_actions_adddup2(   &file_actions, 
+                                                    captureFds[0], 
+                                                    STDOUT_FILENO) != 0 ||
+                posix_spawn_file_actions_adddup2(&file_actions, errorFd, STDERR_FILENO) != 0)
+            {
+                posix_spawn_file_actions_destroy(&file_actions);
+                return SYSTEM2_RESULT_POSIX_SPAWN_FILE_ACTION_DUP2_FAILED;
+            }
+        }
+
+        //Close the duplicated file descriptors
+        if(inOutCommandInfo->ParentToChildPipes[SYSTEM2_FD_READ])
+            posix_spawn_file_actions_addclose(&file_actions, parentToChildPipes[SYSTEM2_FD_READ]);
         
-        if(inOutCommandInfo->RedirectInput)
-            startupInfo.hStdInput = inOutCommandInfo->ParentToChildPipes[SYSTEM2_FD_READ];
-        else
-            startupInfo.hStdInput = GetStdHandle(STD_INPUT_HANDLE);;
+        if(inOutCommandInfo->ChildToParentPipes[SYSTEM2_FD_WRITE])
+            posix_spawn_file_actions_addclose(&file_actions, childToParentPipes[SYSTEM2_FD_WRITE]);
         
-        if(inOutCommandInfo->RedirectOutput)
+        if(inOutCommandInfo->ChildToParentPipesErr[SYSTEM2_FD_WRITE])
         {
-            startupInfo.hStdOutput = inOutCommandInfo->ChildToParentPipes[SYSTEM2_FD_WRITE];
-            startupInfo.hStdError =     inOutCommandInfo->StandaloneStderr ?
-                                        inOutCommandInfo->ChildToParentPipesErr[SYSTEM2_FD_WRITE] :
-                                        inOutCommandInfo->ChildToParentPipes[SYSTEM2_FD_WRITE];
+            posix_spawn_file_actions_addclose(  &file_actions, 
+                                                childToParentPipesErr[SYSTEM2_FD_WRITE]);
         }
-        else
+
+        //Change the directory before exec, which only fails to copy the path
+        #if INTERNAL_SYSTEM2_SPAWN_CHDIR
+            int chdirResult = 0;
+            const char* runDirectory = inOutCommandInfo->RunDirectory;
+            int runDirectoryFd = inOutCommandInfo->RunDirectoryFd;
+            if(runDirectory)
+                chdirResult = posix_spawn_file_actions_addchdir_np(&file_actions, runDirectory);
+            else if(runDirectoryFd > 0)
+                chdirResult = posix_spawn_file_actions_addfchdir_np(&file_actions, runDirectoryFd);
+            
+            if(chdirResult != 0)
+            {
+                posix_spawn_file_actions_destroy(&file_actions);
+                return SYSTEM2_RESULT_MALLOC_FAILED;
+            }
+        #endif
+        
+        //Reset the signals in the child
+        posix_spawnattr_t attributes;
+        if(posix_spawnattr_init(&attributes) != 0)
         {
-            startupInfo.hStdError = GetStdHandle(STD_ERROR_HANDLE);
-            startupInfo.hStdOutput = GetStdHandle(STD_OUTPUT_HANDLE);
+            posix_spawn_file_actions_destroy(&file_actions);
+            return SYSTEM2_RESULT_POSIX_SPAWN_ATTRIBUTE_FAILED;
         }
         
-        //Join and escape each argument together, then run it
         {
-            //Calculating final command count
-            int finalCommandSize = 0;
-            
-            const char** concatedArgs = (const char**)calloc(argsCount + 1, sizeof(char*));
-            concatedArgs[0] = executable;
-            for(int i = 0; i < argsCount; ++i)
-                concatedArgs[i + 1] = args[i];
+            short spawnFlags = 0;
+            int attributeResult = 0;
             
-            finalCommandSize = ConstructCommandLineWindows( concatedArgs, 
-                                                            argsCount + 1, 
-                                                            inOutCommandInfo->DisableEscapes,
-                                                            0, 
-                                                            NULL);
-            
-            if(finalCommandSize < 0)
+            if(!inOutCommandInfo->KeepSignalMask)
             {
-                free(concatedArgs);
-                return SYSTEM2_RESULT_COMMAND_CONSTRUCT_FAILED;
+                sigset_t mask;
+                Internal_System2GetChildSignalMask(inOutCommandInfo, &mask);
+                attributeResult |= posix_spawnattr_setsigmask(&attributes, &mask);
+                spawnFlags |= POSIX_SPAWN_SETSIGMASK;
             }
             
-            char* commandCopy = (char*)malloc(finalCommandSize);
-            if(commandCopy == NULL)
+            if(!inOutCommandInfo->KeepIgnoredSignals)
             {
-                free(concatedArgs);
-                return SYSTEM2_RESULT_COMMAND_CONSTRUCT_FAILED;
+                sigset_t defaultSignals;
+                sigfillset(&defaultSignals);
+                sigdelset(&defaultSignals, SIGKILL);
+                sigdelset(&defaultSignals, SIGSTOP);
+                attributeResult |= posix_spawnattr_setsigdefault(&attributes, &defaultSignals);
+                spawnFlags |= POSIX_SPAWN_SETSIGDEF;
             }
             
-            int wroteSize = ConstructCommandLineWindows(concatedArgs, 
-                                                        argsCount + 1, 
-                                                        inOutCommandInfo->DisableEscapes, 
-                                                        finalCommandSize, 
-                                                        commandCopy);
-            
-            free((void*)concatedArgs);
-            
-            if(wroteSize != finalCommandSize)
+            if(inOutCommandInfo->NewProcessGroup)
             {
-                printf( "wroteSize and finalCommandSize mismatch, %d, %d\n", 
-                        wroteSize, 
-                        finalCommandSize);
-                
-                return SYSTEM2_RESULT_COMMAND_CONSTRUCT_FAILED;
+                attributeResult |= posix_spawnattr_setpgroup(&attributes, 0);
+                spawnFlags |= POSIX_SPAWN_SETPGROUP;
             }
             
-            //Construct final command
-            int wideCommandSize = 0;
-            wchar_t* commandCopyWide = NULL;
-            SYSTEM2_RESULT result = Internal_System2Utf8ToUtf16(commandCopy, 
-                                                                finalCommandSize,
-                                                                &commandCopyWide,
-                                                                &wideCommandSize);
-            if(result != SYSTEM2_RESULT_SUCCESS)
-                return result;
-            
-            free(commandCopy);
-            
-            //Convert working directory to wide chars
-            wchar_t* workingDirectoryWide = NULL;
-            int wideWorkingWideDirSize = 0;
-            if(inOutCommandInfo->RunDirectory != NULL)
+            attributeResult |= posix_spawnattr_setflags(&attributes, spawnFlags);
+            if(attributeResult != 0)
             {
-                result = 
-                    Internal_System2Utf8ToUtf16(inOutCommandInfo->RunDirectory, 
-                                                (int)strlen(inOutCommandInfo->RunDirectory) + 1,
-                                                &workingDirectoryWide,
-                                                &wideWorkingWideDirSize);
-                
-                if(result != SYSTEM2_RESULT_SUCCESS)
-                {
-                    free(commandCopyWide);
-                    return result;
-                }
+                posix_spawnattr_destroy(&attributes);
+                posix_spawn_file_actions_destroy(&file_actions);
+                return SYSTEM2_RESULT_POSIX_SPAWN_ATTRIBUTE_FAILED;
             }
+        }
+
+        pid_t pid;
+        int spawn_status = posix_spawnp(&pid, 
+                                        path, 
+                                        &file_actions, 
+                                        &attributes, 
+                                        (char**)args, 
+                                        childEnv ? (char**)childEnv : environ);
+
+        posix_spawnattr_destroy(&attributes);
+        posix_spawn_file_actions_destroy(&file_actions);
+        if(spawn_status != 0)
+        {
+            fprintf(stderr, "posix_spawn failed: %s\n", strerror(spawn_status));
+            return SYSTEM2_RESULT_CREATE_CHILD_PROCESS_FAILED;
+        }
+        
+        //posix_spawn has no hook before exec, so the best we can do is right after the spawn
+        if(!Internal_System2ApplyProcessAttributes(inOutCommandInfo, pid))
+        {
+            kill(pid, SIGKILL);
+            waitpid(pid, NULL, 0);
+            return SYSTEM2_RESULT_SET_PROCESS_ATTRIBUTE_FAILED;
+        }
+        
+        *outPid = pid;
+        return SYSTEM2_RESULT_SUCCESS;
+    }
+    
+    /*
+    Runs `path` with `env` as the environment, searching `searchPath` like `execvp()` does. This 
+    doesn't touch `environ` or allocate, since the memory is shared with the parent after 
+    `vfork()`. Only returns if it fails.
+    */
+    SYSTEM2_FUNC_PREFIX void Internal_System2ExecSearch(const char* path, 
+                                                        char* const* args, 
+                                                        char* const* env,
+                                                        const char* searchPath)
+    {
+        if(strchr(path, '/'))
+        {
+            execve(path, args, env);
+            return;
+        }
+        
+        size_t pathLength = strlen(path);
+        char candidate[4096];
+        const char* entry = searchPath;
+        while(true)
+        {
+            const char* entryEnd = strchr(entry, ':');
+            if(!entryEnd)
+                entryEnd = entry + strlen(entry);
             
-            wchar_t* allEnvVarsW = NULL;
-            int allEnvVarsWCount = 0;
-            if(inOutCommandInfo->EnvVarsNames)
+            //An empty entry is the current directory
+            size_t entryLength = (size_t)(entryEnd - entry);
+            if(entryLength + pathLength + 2 <= sizeof(candidate))
             {
-                char* allEnvVars = NULL;
-                size_t charsCount = 0;
-                size_t charsIndex = 0;
-                
-                int curEnvCounts;
-                void* res;
-                result = System2GetEnvironmentVariablesCount(&curEnvCounts, &res);
-                if(result != SYSTEM2_RESULT_SUCCESS)
-                    return SYSTEM2_RESULT_CREATE_CHILD_PROCESS_FAILED;
-                
-                charsCount = (curEnvCounts + inOutCommandInfo->EnvVarsCount) * 16;
-                allEnvVars = (char*)calloc(charsCount, sizeof(char));
-                
-                bool* newUserEntries = (bool*)malloc(inOutCommandInfo->EnvVarsCount * sizeof(bool));
-                memset(newUserEntries, 1, inOutCommandInfo->EnvVarsCount * sizeof(bool));
-                
-                #define ENSURE_SIZE(sizeNeeded) \
-                    do \
-                    { \
-                        if(charsCount - charsIndex < sizeNeeded) \
-                        { \
-                            char* newMem = (char*)realloc(allEnvVars, charsCount + sizeNeeded); \
-                            if(!newMem) \
-                            { \
-                                free(allEnvVars); \
-                                free(newUserEntries); \
-                                free(workingDirectoryWide); \
-                                free(commandCopyWide); \
-                                return SYSTEM2_RESULT_MALLOC_FAILED; \
-                            } \
-                            allEnvVars = newMem; \
-                            charsCount += sizeNeeded; \
-                        } \
-                    } \
-                    while(0)
-                
-                //Add the current existing env vars first
-                for(int i = 0; i < curEnvCounts; ++i)
-                {
-                    const char* envName;
-                    int envNameLength;
-                    const char* envValue;
-                    int envValueLength;
-                    result = System2GetEnvironmentVariable( res, 
-                                                            &envName, 
-                                                            &envNameLength,
-                                                            &envValue,
-                                                            &envValueLength,
-                                                            i);
-                    if(result != SYSTEM2_RESULT_SUCCESS)
-                        continue;
-                    
-                    //See if the current existing environment variable is mentioned from the user
-                    bool skipThis = false;
-                    for(int j = 0; j < inOutCommandInfo->EnvVarsCount; ++j)
-                    {
-                        if(envNameLength != (int)strlen(inOutCommandInfo->EnvVarsNames[j]))
-                            continue;
-                        
-                        if(memcmp(envName, inOutCommandInfo->EnvVarsNames[j], envNameLength) == 0)
-                        {
-                            skipThis = true;
-                            newUserEntries[j] = false;
-                            
-                            if(inOutCommandInfo->EnvVarsValues[j])
-                            {
-                                //+2 for `=` & `\0`
-                                size_t entrySize =  envNameLength + 
-                                                    strlen(inOutCommandInfo->EnvVarsValues[j]) + 2;
-                                ENSURE_SIZE(entrySize);
-                                snprintf(   allEnvVars + charsIndex, 
-                                            entrySize, 
-                                            "%.*s=%s", 
-                                            envNameLength, 
-                                            envName, 
-                                            inOutCommandInfo->EnvVarsValues[j]);
-                                charsIndex += entrySize;
-                            }
-                            break;
-                        }
-                    }
-                    
-                    if(skipThis)
-                        continue;
-                    
-                    //If the user did not mention this, add it to the envp (+2 for `=` & `\0`)
-                    size_t entrySize = envNameLength + envValueLength + 2;
-                    ENSURE_SIZE(entrySize);
-                    snprintf(   allEnvVars + charsIndex, 
-                                entrySize, 
-                                "%.*s=%.*s", 
-                                envNameLength, 
-                                envName, 
-                                envValueLength,
-                                envValue);
-                    charsIndex += entrySize;
-                } //for(int i = 0; i < curEnvCounts; ++i)
-                
-                //Then add the user defined ones
-                for(int i = 0; i < inOutCommandInfo->EnvVarsCount; ++i)
-                {
-                    if(!newUserEntries[i])
-                        continue;
-                    
-                    size_t entrySize =  strlen(inOutCommandInfo->EnvVarsNames[i]) + 
-                                        strlen(inOutCommandInfo->EnvVarsValues[i]) + 2;
-                    ENSURE_SIZE(entrySize);
-                    snprintf(   allEnvVars + charsIndex, 
-                                entrySize, 
-                                "%s=%s", 
-                                inOutCommandInfo->EnvVarsNames[i],
-                                inOutCommandInfo->EnvVarsValues[i]);
-                    charsIndex += entrySize;
-                }
-                
-                //Append \0 as a safety net in case one of the sentence is not ending with \0
-                ENSURE_SIZE(charsIndex + 2);
-                allEnvVars[charsIndex++] = '\0';
-                allEnvVars[charsIndex++] = '\0';
-                
-                
-                #undef ENSURE_SIZE
-                result = Internal_System2Utf8ToUtf16(   allEnvVars, 
-                                                        (int)charsIndex,
-                                                        &allEnvVarsW,
-                                                        &allEnvVarsWCount);
-                //Free stuff
-                free(newUserEntries);
-                System2EnvironmentVariableFree(&res);
-                free(allEnvVars);
+                memcpy(candidate, entry, entryLength);
+                if(entryLength > 0)
+                    candidate[entryLength++] = '/';
                 
-                //Return if unicode conversion failed
-                if(result != SYSTEM2_RESULT_SUCCESS)
-                    return result;
-            } //if(inOutCommandInfo->EnvVarsNames)
+                memcpy(candidate + entryLength, path, pathLength + 1);
+                execve(candidate, args, env);
+            }
             
-            success = CreateProcessW(   NULL, 
-                                        commandCopyWide,                //command line 
-                                        //L"PrintArgs.exe a\\\\b d\"e f\"g h",
-                                        NULL,                           //process securitye attributes 
-                                        NULL,                           //primary thread security attributes 
-                                        TRUE,                           //handles are inherited 
-                                        CREATE_UNICODE_ENVIRONMENT,     //creation flags 
-                                        allEnvVarsW,                    //environment vars
-                                        workingDirectoryWide,           //use parent's current directory 
-                                        &startupInfo,                   //STARTUPINFO pointer 
-                                        &processInfo);                  //receives PROCESS_INFORMATION 
-            free(commandCopyWide);
-            free(workingDirectoryWide);
-            free(allEnvVarsW);
+            if(*entryEnd == '\0')
+                return;
+            
+            entry = entryEnd + 1;
         }
+    }
+    
+    /*
+    The child side of `Internal_System2VforkSubprocess()`. Everything the child uses is passed in 
+    or computed here, so that no local of the function calling `vfork()` has to survive it. 
+    Never returns.
+    */
+    SYSTEM2_FUNC_PREFIX void Internal_System2VforkChild(const char* path,
+                                                        const char* const* args,
+                                                        char* const* childEnv,
+                                                        int inputFd,
+                                                        const sigset_t* parentMask,
+                                                        const System2CommandInfo* commandInfo)
+    {
+        //Handlers are reset by exec anyway, but they must not run with the parent's memory
+        struct sigaction defaultAction;
+        memset(&defaultAction, 0, sizeof(defaultAction));
+        defaultAction.sa_handler = SIG_DFL;
+        sigemptyset(&defaultAction.sa_mask);
         
-        //If an error occurs, exit the application. 
-        if(!success)
+        for(int sig = 1; sig < INTERNAL_SYSTEM2_SIGNAL_COUNT; ++sig)
         {
-            PrintError("CreateProcessW");
+            struct sigaction currentAction;
+            if( sig == SIGKILL || 
+                sig == SIGSTOP || 
+                sigaction(sig, NULL, &currentAction) != 0 ||
+                currentAction.sa_handler == SIG_IGN ||
+                currentAction.sa_handler == SIG_DFL)
+            {
+                continue;
+            }
+            
+            sigaction(sig, &defaultAction, NULL);
+        }
+        
+        int exitCode = Internal_System2PrepareChild(commandInfo, inputFd);
+        if(exitCode != 0)
+            _exit(exitCode);
+        
+        //Otherwise the signal mask of the child is set by Internal_System2PrepareChild()
+        if(commandInfo->KeepSignalMask && sigprocmask(SIG_SETMASK, parentMask, NULL) != 0)
+            _exit(10);
+        
+        if(!childEnv)
+        {
+            execvp(path, (char* const*)args);
+            _exit(52);
+        }
+        
+        //The child can't call getenv() on its own environment
+        const char* searchPath = "/bin:/usr/bin";
+        for(int i = 0; childEnv[i]; ++i)
+        {
+            if(strncmp(childEnv[i], "PATH=", 5) == 0)
+                searchPath = childEnv[i] + 5;
+        }
+        
+        Internal_System2ExecSearch(path, (char* const*)args, childEnv, searchPath);
+        _exit(52);
+    }
+    
+    /*
+    Starts the command with `vfork()`, which doesn't copy the memory of the parent like fork. Like 
+    posix_spawn, the parent is suspended until the child calls exec, and all signals are blocked 
+    until then so that no handler of the parent runs in the child.
+    */
+    SYSTEM2_FUNC_PREFIX 
+    SYSTEM2_RESULT Internal_System2VforkSubprocess( const char* path,
+                                                    const char* const* args,
+                                                    char* const* childEnv,
+                                                    int inputFd,
+                                                    System2CommandInfo* inOutCommandInfo,
+                                                    pid_t* outPid)
+    {
+        sigset_t allSignals;
+        sigset_t parentMask;
+        sigfillset(&allSignals);
+        if(sigprocmask(SIG_SETMASK, &allSignals, &parentMask) != 0)
             return SYSTEM2_RESULT_CREATE_CHILD_PROCESS_FAILED;
+        
+        pid_t pid = vfork();
+        if(pid == 0)
+        {
+            Internal_System2VforkChild( path, 
+                                        args, 
+                                        childEnv, 
+                                        inputFd, 
+                                        &parentMask, 
+                                        inOutCommandInfo);
         }
-        else 
+        
+        int vforkError = errno;
+        sigprocmask(SIG_SETMASK, &parentMask, NULL);
+        if(pid < 0)
         {
-            //Close handles to the child process and its primary thread.
-            //Some applications might keep these handles to monitor the status
-            //of the child process, for example. 
-            inOutCommandInfo->ChildProcessHandle = processInfo.hProcess;
+            errno = vforkError;
+            return SYSTEM2_RESULT_CREATE_CHILD_PROCESS_FAILED;
+        }
+        
+        *outPid = pid;
+        return SYSTEM2_RESULT_SUCCESS;
+    }
+    
+    //Starts the command with `fork()`, errno is kept if it fails
+    SYSTEM2_FUNC_PREFIX 
+    SYSTEM2_RESULT Internal_System2ForkSubprocess(  const char* path,
+                                                    const char* const* args,
+                                                    char* const* childEnv,
+                                                    int inputFd,
+                                                    System2CommandInfo* inOutCommandInfo,
+                                                    pid_t* outPid)
+    {
+        pid_t pid = fork();
+        if(pid < 0)
+            return SYSTEM2_RESULT_CREATE_CHILD_PROCESS_FAILED;
+        
+        //Child
+        if(pid == 0)
+        {
+            int exitCode = Internal_System2PrepareChild(inOutCommandInfo, inputFd);
+            if(exitCode != 0)
+                _exit(exitCode);
             
-            //Close handles to the stdin and stdout pipes no longer needed by the child process.
-            //If they are not explicitly closed, there is no way to recognize that the child process has ended.
-            if(!CloseHandle(processInfo.hThread))
-                return SYSTEM2_RESULT_CREATE_CHILD_PROCESS_FAILED;
+            //Built by the parent, so that nothing is allocated after fork
+            if(childEnv)
+                environ = (char**)childEnv;
+            
+            //TODO: Send the errno back to the host and display the error
+            if(execvp(path, (char**)args) == -1)
+                _exit(52);
+            
+            //Should never be reached
+            
+            _exit(8);
+        }
+        
+        *outPid = pid;
+        return SYSTEM2_RESULT_SUCCESS;
+    }
+    
+    //Picks the backend to start the command with
+    SYSTEM2_FUNC_PREFIX 
+    SYSTEM2_RESULT Internal_System2ResolveSpawnBackend( const System2CommandInfo* commandInfo,
+                                                        SYSTEM2_SPAWN_BACKEND* outBackend)
+    {
+        SYSTEM2_SPAWN_BACKEND backend = commandInfo->SpawnBackend;
+        if(backend == SYSTEM2_SPAWN_BACKEND_DEFAULT)
+        {
+            int defaultBackend = __atomic_load_n(   &Internal_System2DefaultSpawnBackend, 
+                                                    __ATOMIC_RELAXED);
+            backend = (SYSTEM2_SPAWN_BACKEND)defaultBackend;
+        }
+        
+        bool hasResourceLimits =    commandInfo->ResourceLimits && 
+                                    commandInfo->ResourceLimitsCount > 0;
+        if(backend == SYSTEM2_SPAWN_BACKEND_AUTO)
+        {
+            //posix_spawn can only apply these after the command has started, while vfork runs the 
+            //same setup as fork in the child without copying the page tables of the parent
+            bool needsHook =    hasResourceLimits ||
+                                commandInfo->UsePty ||
+                                commandInfo->CpuAffinity ||
+                                commandInfo->NiceIncrement != 0 ||
+                                commandInfo->IoPriorityClass != SYSTEM2_IO_PRIORITY_CLASS_INHERIT ||
+                                commandInfo->SchedulePolicy != SYSTEM2_SCHEDULE_POLICY_INHERIT;
+            
+            backend = needsHook ? SYSTEM2_SPAWN_BACKEND_VFORK : SYSTEM2_SPAWN_BACKEND_POSIX_SPAWN;
+        }
+        
+        switch(backend)
+        {
+            case SYSTEM2_SPAWN_BACKEND_FORK:
+            case SYSTEM2_SPAWN_BACKEND_VFORK:
+                break;
+            case SYSTEM2_SPAWN_BACKEND_POSIX_SPAWN:
+                //There's no way to set resource limits of another process outside of Linux
+                #if !defined(__linux__)
+                    if(hasResourceLimits)
+                        return SYSTEM2_RESULT_PROCESS_ATTRIBUTE_NOT_SUPPORTED;
+                #endif
+                
+                //posix_spawn can't give the child a controlling terminal
+                if(commandInfo->UsePty)
+                    backend = SYSTEM2_SPAWN_BACKEND_VFORK;
+                
+                //posix_spawn can't change the directory of the child here
+                #if !INTERNAL_SYSTEM2_SPAWN_CHDIR
+                    if(commandInfo->RunDirectory || commandInfo->RunDirectoryFd > 0)
+                        backend = SYSTEM2_SPAWN_BACKEND_VFORK;
+                #endif
+                break;
+            default:
+                return SYSTEM2_RESULT_INVALID_ARGUMENT;
+        }
+        
+        *outBackend = backend;
+        return SYSTEM2_RESULT_SUCCESS;
+    }
+    
+    SYSTEM2_FUNC_PREFIX 
+    SYSTEM2_RESULT Internal_System2SpawnWithBackend(SYSTEM2_SPAWN_BACKEND backend,
+                                                    const char* path,
+                                                    const char* const* args,
+                                                    char* const* childEnv,
+                                                    int inputFd,
+                                                    System2CommandInfo* inOutCommandInfo,
+                                                    pid_t* outPid)
+    {
+        switch(backend)
+        {
+            case SYSTEM2_SPAWN_BACKEND_FORK:
+                return Internal_System2ForkSubprocess(  path, 
+                                                        args, 
+                                                        childEnv, 
+                                                        inputFd, 
+                                                        inOutCommandInfo, 
+                                                        outPid);
+            case SYSTEM2_SPAWN_BACKEND_POSIX_SPAWN:
+                return Internal_System2PosixSpawnSubprocess(path, 
+                                                            args, 
+                                                            childEnv, 
+                                                            inputFd, 
+                                                            inOutCommandInfo, 
+                                                            outPid);
+            default:
+                return Internal_System2VforkSubprocess( path, 
+                                                        args, 
+                                                        childEnv, 
+                                                        inputFd, 
+                                                        inOutCommandInfo, 
+                                                        outPid);
+        }
+    }
+    
+    /*
+    Runs `executable` from `path` if it is not NULL, with `childEnv` as its environment if it is 
+    not NULL, and `inputFd` as its stdin if it is not -1. The command info must have been validated 
+    already.
+    */
+    SYSTEM2_FUNC_PREFIX 
+    SYSTEM2_RESULT Internal_System2RunSubprocessPosix(  const char* path,
+                                                        const char* executable,
+                                                        const char* const* args,
+                                                        int argsCount,
+                                                        char* const* childEnv,
+                                                        int inputFd,
+                                                        System2CommandInfo* inOutCommandInfo)
+    {
+        if(!path)
+            path = executable;
+        
+        SYSTEM2_SPAWN_BACKEND backend;
+        SYSTEM2_RESULT result = Internal_System2ResolveSpawnBackend(inOutCommandInfo, &backend);
+        if(result != SYSTEM2_RESULT_SUCCESS)
+            return result;
+        
+        if(inOutCommandInfo->UsePty)
+        {
+            if(!Internal_System2CreatePty(inOutCommandInfo))
+                return SYSTEM2_RESULT_PTY_CREATE_FAILED;
+        }
+        else
+        {
+            if(inOutCommandInfo->RedirectInput)
+            {
+                if(!Internal_System2CreatePipe(inOutCommandInfo->ParentToChildPipes))
+                    return SYSTEM2_RESULT_PIPE_CREATE_FAILED;
+                
+                Internal_System2SetPipeSize(inOutCommandInfo->ParentToChildPipes[SYSTEM2_FD_WRITE], 
+                                            &inOutCommandInfo->StdinPipeSize);
+            }
+            else
+                memset(inOutCommandInfo->ParentToChildPipes, 0, sizeof(int) * 2);
+            
+            if(inOutCommandInfo->RedirectOutput)
+            {
+                if(!Internal_System2CreatePipe(inOutCommandInfo->ChildToParentPipes))
+                    return SYSTEM2_RESULT_PIPE_CREATE_FAILED;
+                
+                Internal_System2SetPipeSize(inOutCommandInfo->ChildToParentPipes[SYSTEM2_FD_READ], 
+                                            &inOutCommandInfo->StdoutPipeSize);
+                
+                if(inOutCommandInfo->StandaloneStderr)
+                {
+                    if(!Internal_System2CreatePipe(inOutCommandInfo->ChildToParentPipesErr))
+                        return SYSTEM2_RESULT_PIPE_CREATE_FAILED;
+                    
+                    int* stderrPipes = inOutCommandInfo->ChildToParentPipesErr;
+                    Internal_System2SetPipeSize(stderrPipes[SYSTEM2_FD_READ], 
+                                                &inOutCommandInfo->StderrPipeSize);
+                }
+                else
+                    memset(inOutCommandInfo->ChildToParentPipesErr, 0, sizeof(int) * 2);
+            }
+            else
+            {
+                memset(inOutCommandInfo->ChildToParentPipes, 0, sizeof(int) * 2);
+                memset(inOutCommandInfo->ChildToParentPipesErr, 0, sizeof(int) * 2);
+            }
+        }
+
+        const char** nullTerminatedArgs = (const char**)calloc(argsCount + 2, sizeof(char*));
+        if(nullTerminatedArgs == NULL)
+            return SYSTEM2_RESULT_COMMAND_CONSTRUCT_FAILED;
+        
+        nullTerminatedArgs[0] = executable;
+        for(int i = 0; i < argsCount; ++i)
+            nullTerminatedArgs[i + 1] = args[i];
+        
+        pid_t pid = -1;
+        result = Internal_System2SpawnWithBackend(  backend, 
+                                                    path, 
+                                                    nullTerminatedArgs, 
+                                                    childEnv, 
+                                                    inputFd, 
+                                                    inOutCommandInfo, 
+                                                    &pid);
+        
+        if(result != SYSTEM2_RESULT_SUCCESS)
+        {
+            free(nullTerminatedArgs);
+            return result;
+        }
+        
+        inOutCommandInfo->SpawnBackendUsed = backend;
+        
+        //Also done by the child, but the group has to exist before anyone can signal it. 
+        //This fails harmlessly if the child has already started the command.
+        if(inOutCommandInfo->NewProcessGroup && !inOutCommandInfo->UsePty)
+            setpgid(pid, pid);
+        
+        //Parent code
+        {
+            free(nullTerminatedArgs);
+            
+            if(inOutCommandInfo->ParentToChildPipes[SYSTEM2_FD_READ])
+            {
+                if(close(inOutCommandInfo->ParentToChildPipes[SYSTEM2_FD_READ]) != 0)
+                    return SYSTEM2_RESULT_PIPE_FD_CLOSE_FAILED;
+            }
+            
+            if(inOutCommandInfo->ChildToParentPipes[SYSTEM2_FD_WRITE])
+            {
+                if(close(inOutCommandInfo->ChildToParentPipes[SYSTEM2_FD_WRITE]) != 0)
+                    return SYSTEM2_RESULT_PIPE_FD_CLOSE_FAILED;
+            }
+            
+            if(inOutCommandInfo->ChildToParentPipesErr[SYSTEM2_FD_WRITE])
+            {
+                if(close(inOutCommandInfo->ChildToParentPipesErr[SYSTEM2_FD_WRITE]) != 0)
+                    return SYSTEM2_RESULT_PIPE_FD_CLOSE_FAILED;
+            }
+            
+            inOutCommandInfo->ChildProcessID = pid;
+        }
+        return SYSTEM2_RESULT_SUCCESS;
+    }
+    
+    /*
+    Starts a command with the environment based on `snapshot`, which can be NULL to read it from 
+    `environ` if needed. `path` is the one found for `executable`, or NULL for exec to look it up.
+    */
+    SYSTEM2_FUNC_PREFIX 
+    SYSTEM2_RESULT Internal_System2StartSubprocessPosix(const char* path,
+                                                        const char* executable,
+                                                        const char* const* args,
+                                                        int argsCount,
+                                                        const Internal_System2EnvSnapshot* snapshot,
+                                                        System2CommandInfo* inOutCommandInfo)
+    {
+        if(!executable || !inOutCommandInfo)
+            return SYSTEM2_RESULT_INVALID_ARGUMENT;
+        
+        #if !INTERNAL_SYSTEM2_REAPER
+            if(inOutCommandInfo->ReapOnCleanup)
+                return SYSTEM2_RESULT_REAPER_NOT_SUPPORTED;
+        #endif
+        
+        SYSTEM2_RESULT result = Internal_System2ValidateCustomEnv(inOutCommandInfo);
+        if(result != SYSTEM2_RESULT_SUCCESS)
+            return result;
+        
+        result = Internal_System2ValidateProcessAttributes(inOutCommandInfo);
+        if(result != SYSTEM2_RESULT_SUCCESS)
+            return result;
+        
+        if(inOutCommandInfo->InputBuffer && inOutCommandInfo->RedirectInput)
+            return SYSTEM2_RESULT_INVALID_ARGUMENT;
+        
+        if(inOutCommandInfo->CaptureOutputToFile && inOutCommandInfo->RedirectOutput)
+            return SYSTEM2_RESULT_INVALID_ARGUMENT;
+        
+        if(inOutCommandInfo->RunDirectory && inOutCommandInfo->RunDirectoryFd > 0)
+            return SYSTEM2_RESULT_INVALID_ARGUMENT;
+        
+        if( inOutCommandInfo->UsePty && 
+            (   !inOutCommandInfo->RedirectInput || 
+                !inOutCommandInfo->RedirectOutput || 
+                inOutCommandInfo->StandaloneStderr))
+        {
+            return SYSTEM2_RESULT_INVALID_ARGUMENT;
+        }
+        
+        char** childEnv = NULL;
+        if(inOutCommandInfo->EnvVarsNames)
+        {
+            Internal_System2EnvSnapshot ownSnapshot;
+            if(!snapshot)
+            {
+                result = Internal_System2TakeEnvSnapshot(&ownSnapshot);
+                if(result != SYSTEM2_RESULT_SUCCESS)
+                    return result;
+            }
+            
+            childEnv = Internal_System2CreateChildEnv(snapshot ? snapshot : &ownSnapshot, 
+                                                      inOutCommandInfo);
+            if(!snapshot)
+                free(ownSnapshot.Entries);
+            
+            if(!childEnv)
+                return SYSTEM2_RESULT_MALLOC_FAILED;
+        }
+        
+        int inputFd = -1;
+        if(inOutCommandInfo->InputBuffer)
+        {
+            inputFd = Internal_System2CreateInputFile(  inOutCommandInfo->InputBuffer, 
+                                                        inOutCommandInfo->InputBufferSize);
+            if(inputFd == -1)
+            {
+                free(childEnv);
+                return SYSTEM2_RESULT_INPUT_BUFFER_CREATE_FAILED;
+            }
+        }
+        
+        result = Internal_System2CreateCommandState(inOutCommandInfo);
+        if(result != SYSTEM2_RESULT_SUCCESS)
+        {
+            if(inputFd != -1)
+                close(inputFd);
+            
+            free(childEnv);
+            return result;
+        }
+        
+        result = Internal_System2RunSubprocessPosix(path, 
+                                                    executable, 
+                                                    args, 
+                                                    argsCount, 
+                                                    childEnv, 
+                                                    inputFd,
+                                                    inOutCommandInfo);
+        
+        //The command has its own copy of it now
+        if(inputFd != -1)
+            close(inputFd);
+        
+        free(childEnv);
+        
+        #if INTERNAL_SYSTEM2_REAPER
+            if(result == SYSTEM2_RESULT_SUCCESS && inOutCommandInfo->ReapOnCleanup)
+            {
+                result = Internal_System2ReaperAdd(inOutCommandInfo->ChildProcessID);
+                
+                //It can't be handed off later, so don't leave it running
+                if(result != SYSTEM2_RESULT_SUCCESS)
+                {
+                    kill(inOutCommandInfo->ChildProcessID, SIGKILL);
+                    waitpid(inOutCommandInfo->ChildProcessID, NULL, 0);
+                    
+                    int parentPipes[] = 
+                    { 
+                        inOutCommandInfo->ParentToChildPipes[SYSTEM2_FD_WRITE],
+                        inOutCommandInfo->ChildToParentPipes[SYSTEM2_FD_READ],
+                        inOutCommandInfo->ChildToParentPipesErr[SYSTEM2_FD_READ]
+                    };
+                    
+                    for(int i = 0; i < 3; ++i)
+                    {
+                        if(parentPipes[i])
+                            close(parentPipes[i]);
+                    }
+                }
+            }
+        #endif
+        
+        if(result != SYSTEM2_RESULT_SUCCESS)
+        {
+            Internal_System2FreeCommandState(inOutCommandInfo->InternalState);
+            inOutCommandInfo->InternalState = NULL;
+        }
+        
+        return result;
+    }
+
+    SYSTEM2_FUNC_PREFIX 
+    SYSTEM2_RESULT System2RunSubprocessPosix(   const char* executable,
+                                                const char* const* args,
+                                                int argsCount,
+                                                System2CommandInfo* inOutCommandInfo)
+    {
+        return Internal_System2StartSubprocessPosix(NULL, 
+                                                    executable, 
+                                                    args, 
+                                                    argsCount, 
+                                                    NULL, 
+                                                    inOutCommandInfo);
+    }
+
+    /*
+    Starts `command` directly if it doesn't need the shell and its executable can be found and 
+    exec'd, or with `sh -c` otherwise, so that the shell reports the executables that can't be run 
+    and runs the scripts without `#!` like before.
+    */
+    SYSTEM2_FUNC_PREFIX 
+    SYSTEM2_RESULT Internal_System2StartCommandPosix(   const char* command, 
+                                                        const Internal_System2EnvSnapshot* snapshot,
+                                                        System2CommandInfo* inOutCommandInfo)
+    {
+        if(!command || !inOutCommandInfo)
+            return SYSTEM2_RESULT_INVALID_ARGUMENT;
+        
+        char** words;
+        int wordsCount;
+        if( !inOutCommandInfo->AlwaysUseShell && 
+            !Internal_System2OverridesPath(inOutCommandInfo) &&
+            Internal_System2SplitCommand(command, &words, &wordsCount))
+        {
+            char* path = NULL;
+            bool found;
+            if(strchr(words[0], '/'))
+            {
+                //Relative paths depend on the run directory
+                struct stat fileStat;
+                found = words[0][0] == '/' &&
+                        stat(words[0], &fileStat) == 0 && 
+                        S_ISREG(fileStat.st_mode) && 
+                        access(words[0], X_OK) == 0;
+            }
+            else
+            {
+                path = Internal_System2FindExecutable(words[0]);
+                found = path != NULL;
+            }
+            
+            //Scripts without `#!` are run by the shell
+            if(found && !Internal_System2CanExecDirectly(path ? path : words[0]))
+            {
+                free(path);
+                found = false;
+            }
+            
+            if(found)
+            {
+                SYSTEM2_RESULT result = 
+                    Internal_System2StartSubprocessPosix(   path, 
+                                                            words[0], 
+                                                            (const char* const*)words + 1, 
+                                                            wordsCount - 1, 
+                                                            snapshot, 
+                                                            inOutCommandInfo);
+                free(path);
+                free(words);
+                return result;
+            }
+            
+            free(words);
+        }
+        
+        const char* args[] = { "-c", command };
+        return Internal_System2StartSubprocessPosix(NULL, 
+                                                    "/bin/sh", 
+                                                    args, 
+                                                    2, 
+                                                    snapshot, 
+                                                    inOutCommandInfo);
+    }
+    
+    SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2RunPosix( const char* command, 
+                                                        System2CommandInfo* inOutCommandInfo)
+    {
+        return Internal_System2StartCommandPosix(command, NULL, inOutCommandInfo);
+    }
+    
+    //Shared by the threads starting the commands of `System2RunMany()`
+    typedef struct
+    {
+        const System2SpawnSpec* Specs;
+        System2CommandInfo* CommandInfos;
+        SYSTEM2_RESULT* Results;
+        char** Paths;                               //Found in PATH for each command, can be NULL
+        const Internal_System2EnvSnapshot* Snapshot;//NULL if no command overrides the environment
+        int Count;
+        int NextIndex;
+        #if INTERNAL_SYSTEM2_PARALLEL_SPAWN
+            pthread_mutex_t Mutex;
+        #endif
+    } Internal_System2RunManyState;
+    
+    //Starts the commands that are not taken by other threads yet, until there are none left
+    SYSTEM2_FUNC_PREFIX void* Internal_System2RunManyWorker(void* data)
+    {
+        Internal_System2RunManyState* state = (Internal_System2RunManyState*)data;
+        while(true)
+        {
+            #if INTERNAL_SYSTEM2_PARALLEL_SPAWN
+                pthread_mutex_lock(&state->Mutex);
+            #endif
+            
+            int index = state->NextIndex++;
+            
+            #if INTERNAL_SYSTEM2_PARALLEL_SPAWN
+                pthread_mutex_unlock(&state->Mutex);
+            #endif
+            
+            if(index >= state->Count)
+                return NULL;
+            
+            const System2SpawnSpec* spec = &state->Specs[index];
+            System2CommandInfo* commandInfo = &state->CommandInfos[index];
+            uint64_t beginTimestamp = Internal_System2InstrumentBegin(  SYSTEM2_OPERATION_SPAWN, 
+                                                                        commandInfo);
+            SYSTEM2_RESULT result;
+            if(spec->Command)
+            {
+                result = Internal_System2StartCommandPosix( spec->Command, 
+                                                            state->Snapshot, 
+                                                            commandInfo);
+            }
+            else
+            {
+                result = Internal_System2StartSubprocessPosix(  state->Paths[index],
+                                                                spec->Executable,
+                                                                spec->Args,
+                                                                spec->ArgsCount,
+                                                                state->Snapshot,
+                                                                commandInfo);
+            }
+            
+            Internal_System2InstrumentEnd(  SYSTEM2_OPERATION_SPAWN, 
+                                            commandInfo, 
+                                            beginTimestamp, 
+                                            result, 
+                                            0);
+            state->Results[index] = result;
+        }
+    }
+    
+    SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2RunManyPosix( const System2SpawnSpec* specs,
+                                                            int count,
+                                                            System2CommandInfo* inOutCommandInfos,
+                                                            SYSTEM2_RESULT* outResults)
+    {
+        if(!specs || count < 0 || (count > 0 && (!inOutCommandInfos || !outResults)))
+            return SYSTEM2_RESULT_INVALID_ARGUMENT;
+        
+        if(count == 0)
+            return SYSTEM2_RESULT_SUCCESS;
+        
+        //Paths for each command, followed by the index of the first command with each executable
+        char** paths = (char**)calloc(count, sizeof(char*) + sizeof(int));
+        if(!paths)
+            return SYSTEM2_RESULT_MALLOC_FAILED;
+        
+        int* distinctIndices = (int*)(paths + count);
+        int distinctCount = 0;
+        
+        //Look up each executable in PATH once. Ones overriding PATH are left to exec.
+        bool needsSnapshot = false;
+        for(int i = 0; i < count; ++i)
+        {
+            needsSnapshot = needsSnapshot || inOutCommandInfos[i].EnvVarsNames != NULL;
+            if( specs[i].Command || 
+                !specs[i].Executable || 
+                Internal_System2OverridesPath(&inOutCommandInfos[i]))
+            {
+                continue;
+            }
+            
+            int j = 0;
+            while(  j < distinctCount && 
+                    strcmp(specs[distinctIndices[j]].Executable, specs[i].Executable) != 0)
+            {
+                ++j;
+            }
+            
+            if(j == distinctCount)
+            {
+                distinctIndices[distinctCount++] = i;
+                paths[i] = Internal_System2FindExecutable(specs[i].Executable);
+            }
+            else
+                paths[i] = paths[distinctIndices[j]];
+        }
+        
+        Internal_System2EnvSnapshot snapshot;
+        SYSTEM2_RESULT result = SYSTEM2_RESULT_SUCCESS;
+        if(needsSnapshot)
+            result = Internal_System2TakeEnvSnapshot(&snapshot);
+        
+        if(result == SYSTEM2_RESULT_SUCCESS)
+        {
+            Internal_System2RunManyState state;
+            state.Specs = specs;
+            state.CommandInfos = inOutCommandInfos;
+            state.Results = outResults;
+            state.Paths = paths;
+            state.Snapshot = needsSnapshot ? &snapshot : NULL;
+            state.Count = count;
+            state.NextIndex = 0;
+            
+            #if INTERNAL_SYSTEM2_PARALLEL_SPAWN
+                //This thread starts commands as well
+                pthread_t threads[SYSTEM2_PARALLEL_SPAWN_THREADS];
+                int threadsCount = count < SYSTEM2_PARALLEL_SPAWN_THREADS ? 
+                                    count - 1 : 
+                                    SYSTEM2_PARALLEL_SPAWN_THREADS - 1;
+                int threadsStarted = 0;
+                
+                pthread_mutex_init(&state.Mutex, NULL);
+                for(; threadsStarted < threadsCount; ++threadsStarted)
+                {
+                    if(pthread_create(  &threads[threadsStarted], 
+                                        NULL, 
+                                        Internal_System2RunManyWorker, 
+                                        &state) != 0)
+                    {
+                        break;
+                    }
+                }
+                
+                Internal_System2RunManyWorker(&state);
+                
+                for(int i = 0; i < threadsStarted; ++i)
+                    pthread_join(threads[i], NULL);
+                
+                pthread_mutex_destroy(&state.Mutex);
+            #else
+                Internal_System2RunManyWorker(&state);
+            #endif
+            
+            for(int i = 0; i < count && result == SYSTEM2_RESULT_SUCCESS; ++i)
+                result = outResults[i];
+            
+            if(needsSnapshot)
+                free(snapshot.Entries);
+        }
+        
+        for(int i = 0; i < distinctCount; ++i)
+            free(paths[distinctIndices[i]]);
+        
+        free(paths);
+        return result;
+    }
+    
+    SYSTEM2_FUNC_PREFIX void Internal_System2RecordOutput(const System2CommandInfo* info)
+    {
+        if(info->InternalState && Internal_System2HasWatchdogs(info))
+            info->InternalState->LastOutputTimeMs = Internal_System2GetTimeMs();
+    }
+    
+    /*
+    Terms or kills the command if one of its watchdogs is due, or kills it once the grace period 
+    after terming it is over. Returns how many milliseconds until the next check is due, or -1 if 
+    there is nothing left to check.
+    */
+    SYSTEM2_FUNC_PREFIX int Internal_System2CheckWatchdogs(const System2CommandInfo* info)
+    {
+        struct Internal_System2CommandState* state = info->InternalState;
+        if(!state || !Internal_System2HasWatchdogs(info) || state->WatchdogStopped)
+            return -1;
+        
+        //Nothing is due while the command is paused, but it could be resumed at any time
+        if(state->PausedTimeMs >= 0)
+            return 100;
+        
+        int64_t now = Internal_System2GetTimeMs();
+        int64_t deadline = -1;
+        SYSTEM2_WATCHDOG watchdog = state->FiredWatchdog;
+        
+        if(watchdog != SYSTEM2_WATCHDOG_NONE)
+            deadline = state->TermSentTimeMs + info->WatchdogTermGraceMs;
+        else
+        {
+            if(info->FirstOutputTimeoutMs > 0 && state->LastOutputTimeMs < 0)
+            {
+                deadline = state->StartTimeMs + info->FirstOutputTimeoutMs;
+                watchdog = SYSTEM2_WATCHDOG_FIRST_OUTPUT;
+            }
+            
+            if(info->OutputGapTimeoutMs > 0 && state->LastOutputTimeMs >= 0)
+            {
+                deadline = state->LastOutputTimeMs + info->OutputGapTimeoutMs;
+                watchdog = SYSTEM2_WATCHDOG_OUTPUT_GAP;
+            }
+            
+            if( info->InputClosedTimeoutMs > 0 && 
+                state->InputClosedTimeMs >= 0 &&
+                (deadline < 0 || state->InputClosedTimeMs + info->InputClosedTimeoutMs < deadline))
+            {
+                deadline = state->InputClosedTimeMs + info->InputClosedTimeoutMs;
+                watchdog = SYSTEM2_WATCHDOG_INPUT_CLOSED;
+            }
+        }
+        
+        if(deadline < 0)
+            return -1;
+        
+        //Nothing to stop if the command has exited by itself. While waiting for it to exit after 
+        //terming it, this is checked every 10 milliseconds since its pipes could stay open.
+        int returnCode = 0;
+        bool terming = state->FiredWatchdog != SYSTEM2_WATCHDOG_NONE;
+        if(now < deadline && !terming)
+            return deadline - now > INT32_MAX ? INT32_MAX : (int)(deadline - now);
+        
+        if(Internal_System2PeekExit(info, &returnCode) != SYSTEM2_RESULT_COMMAND_NOT_FINISHED)
+        {
+            state->WatchdogStopped = terming;
+            return -1;
+        }
+        
+        if(now < deadline)
+            return deadline - now > 10 ? 10 : (int)(deadline - now);
+        
+        if( state->FiredWatchdog == SYSTEM2_WATCHDOG_NONE && 
+            info->WatchdogTermGraceMs > 0 &&
+            System2Term(info) == SYSTEM2_RESULT_SUCCESS)
+        {
+            state->FiredWatchdog = watchdog;
+            state->TermSentTimeMs = now;
+            return info->WatchdogTermGraceMs > 10 ? 10 : (int)info->WatchdogTermGraceMs;
+        }
+        
+        state->FiredWatchdog = watchdog;
+        state->WatchdogStopped = true;
+        System2Kill(info);
+        return -1;
+    }
+    
+    /*
+    Reads the output until the buffer is full or the end of output is reached. If `returnOnData` is 
+    true, this returns `SYSTEM2_RESULT_READ_NOT_FINISHED` as soon as anything is read instead.
+    */
+    SYSTEM2_FUNC_PREFIX 
+    SYSTEM2_RESULT Internal_System2ReadFromOutputPosix( const System2CommandInfo* info, 
+                                                        bool readStderr,
+                                                        bool returnOnData,
+                                                        char* outputBuffer, 
+                                                        uint32_t outputBufferSize,
+                                                        uint32_t* outBytesRead)
+    {
+        if(!info || !outputBuffer || !outBytesRead || !info->RedirectOutput)
+            return SYSTEM2_RESULT_INVALID_ARGUMENT;
+        
+        if(readStderr && !info->StandaloneStderr)
+            return SYSTEM2_RESULT_INVALID_ARGUMENT;
+        
+        int32_t readResult;
+        *outBytesRead = 0;
+        
+        int outputFd =  readStderr ?
+                        info->ChildToParentPipesErr[SYSTEM2_FD_READ] :
+                        info->ChildToParentPipes[SYSTEM2_FD_READ];
+        
+        #if INTERNAL_SYSTEM2_IO_URING
+            struct Internal_System2CommandState* state = info->InternalState;
+            int streamIndex = readStderr ? 1 : 0;
+            //The multishot read can't tell the end of the output of a pseudo-terminal from an 
+            //error, and the watchdogs need to wait for the pipe itself
+            if( state && 
+                !state->RingsCreated[streamIndex] && 
+                !info->UsePty && 
+                !Internal_System2HasWatchdogs(info))
+            {
+                state->OutputRings[streamIndex] = Internal_System2IoUringCreate(outputFd, true);
+                state->RingsCreated[streamIndex] = true;
+            }
+            
+            Internal_System2IoUring* ring = state ? state->OutputRings[streamIndex] : NULL;
+            if(ring && !ring->Unsupported)
+            {
+                SYSTEM2_RESULT ringResult = Internal_System2ReadFromOutputIoUring(ring,
+                                                                                  returnOnData,
+                                                                                  outputBuffer,
+                                                                                  outputBufferSize,
+                                                                                  outBytesRead);
+                //Otherwise nothing is read and we fall back to read()
+                if(!ring->Unsupported)
+                    return ringResult;
+            }
+        #endif
+        
+        while (true)
+        {
+            //Only wait for the output until the next watchdog is due. Once the command is 
+            //stopped, its children could keep the pipe open, so only what is left is read.
+            int watchdogWaitMs = Internal_System2CheckWatchdogs(info);
+            bool watchdogStopped = info->InternalState && info->InternalState->WatchdogStopped;
+            if(watchdogWaitMs >= 0 || watchdogStopped)
+            {
+                struct pollfd pollFd;
+                pollFd.fd = outputFd;
+                pollFd.events = POLLIN;
+                pollFd.revents = 0;
+                int pollResult = poll(&pollFd, 1, watchdogStopped ? 0 : watchdogWaitMs);
+                if(pollResult == 0 && watchdogStopped)
+                    break;
+                
+                if(pollResult == 0 || (pollResult < 0 && errno == EINTR))
+                    continue;
+                
+                if(pollResult < 0)
+                    return SYSTEM2_RESULT_READ_FAILED;
+            }
+            
+            readResult = read(  outputFd, 
+                                outputBuffer, 
+                                outputBufferSize - *outBytesRead);
+            
+            if(readResult == 0)
+                break;
+            
+            //The pseudo-terminal reports the end of the output as EIO
+            if(readResult == -1 && info->UsePty && errno == EIO)
+                break;
+            
+            if(readResult == -1)
+                return SYSTEM2_RESULT_READ_FAILED;
+            
+            Internal_System2RecordOutput(info);
+            outputBuffer += readResult;
+            *outBytesRead += readResult;
+            
+            if(returnOnData || outputBufferSize - *outBytesRead == 0)
+                return SYSTEM2_RESULT_READ_NOT_FINISHED;
+        }
+        
+        return SYSTEM2_RESULT_SUCCESS;
+    }
+    
+    SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2ReadFromOutputPosix(  const System2CommandInfo* info, 
+                                                                    bool readStderr,
+                                                                    char* outputBuffer, 
+                                                                    uint32_t outputBufferSize,
+                                                                    uint32_t* outBytesRead)
+    {
+        return Internal_System2ReadFromOutputPosix( info, 
+                                                    readStderr, 
+                                                    false, 
+                                                    outputBuffer, 
+                                                    outputBufferSize, 
+                                                    outBytesRead);
+    }
+    
+    SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2WriteToInputPosix(const System2CommandInfo* info, 
+                                                                const char* inputBuffer, 
+                                                                const uint32_t inputBufferSize)
+    {
+        if(!info || !inputBuffer || !info->RedirectInput)
+            return SYSTEM2_RESULT_INVALID_ARGUMENT;
+        
+        //Closed by `System2CloseInput()`
+        if(!info->ParentToChildPipes[SYSTEM2_FD_WRITE])
+            return SYSTEM2_RESULT_WRITE_FAILED;
+        
+        uint32_t currentWriteLengthLeft = inputBufferSize;
+        
+        #if INTERNAL_SYSTEM2_IO_URING
+            struct Internal_System2CommandState* state = info->InternalState;
+            if(state && !state->RingsCreated[2])
+            {
+                state->InputRing = 
+                    Internal_System2IoUringCreate(info->ParentToChildPipes[SYSTEM2_FD_WRITE], false);
+                state->RingsCreated[2] = true;
+            }
+            
+            if(state && state->InputRing && !state->InputRing->Unsupported)
+            {
+                uint32_t bytesWritten = 0;
+                SYSTEM2_RESULT ringResult = Internal_System2WriteToInputIoUring(state->InputRing,
+                                                                                inputBuffer,
+                                                                                inputBufferSize,
+                                                                                &bytesWritten);
+                //Otherwise write the rest with write()
+                if(!state->InputRing->Unsupported || ringResult != SYSTEM2_RESULT_SUCCESS)
+                    return ringResult;
+                
+                inputBuffer += bytesWritten;
+                currentWriteLengthLeft -= bytesWritten;
+                if(currentWriteLengthLeft == 0)
+                    return SYSTEM2_RESULT_SUCCESS;
+            }
+        #endif
+        
+        while(true)
+        {
+            int32_t writeResult = write(info->ParentToChildPipes[SYSTEM2_FD_WRITE], 
+                                        inputBuffer, 
+                                        currentWriteLengthLeft);
+
+            if(writeResult == -1)
+                return SYSTEM2_RESULT_WRITE_FAILED;
+            
+            inputBuffer += writeResult;
+            currentWriteLengthLeft -= writeResult;
+            
+            if(currentWriteLengthLeft == 0)
+                break;
+        }
+        
+        return SYSTEM2_RESULT_SUCCESS;
+    }
+    
+    SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2CloseInputPosix(System2CommandInfo* info)
+    {
+        if(!info || !info->RedirectInput || !info->ParentToChildPipes[SYSTEM2_FD_WRITE])
+            return SYSTEM2_RESULT_INVALID_ARGUMENT;
+        
+        int inputFd = info->ParentToChildPipes[SYSTEM2_FD_WRITE];
+        struct Internal_System2CommandState* state = info->InternalState;
+        
+        //The terminal stays open through the output side, so it is told about the end instead
+        if(info->UsePty && !info->PtyRawMode)
+        {
+            struct termios attributes;
+            if(tcgetattr(inputFd, &attributes) != 0)
+                return SYSTEM2_RESULT_WRITE_FAILED;
+            
+            char endOfFile = (char)attributes.c_cc[VEOF];
+            if(write(inputFd, &endOfFile, 1) != 1)
+                return SYSTEM2_RESULT_WRITE_FAILED;
+        }
+        
+        #if INTERNAL_SYSTEM2_IO_URING
+            if(state && state->InputRing)
+            {
+                Internal_System2IoUringDestroy(state->InputRing);
+                state->InputRing = NULL;
+            }
+        #endif
+        
+        //Marked as closed for `System2WriteToInput()` and `System2CleanupCommand()`
+        info->ParentToChildPipes[SYSTEM2_FD_WRITE] = 0;
+        if(close(inputFd) != 0)
+            return SYSTEM2_RESULT_PIPE_FD_CLOSE_FAILED;
+        
+        if(state && Internal_System2HasWatchdogs(info))
+            state->InputClosedTimeMs = Internal_System2GetTimeMs();
+        
+        return SYSTEM2_RESULT_SUCCESS;
+    }
+    
+    SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2CleanupCommandPosix(const System2CommandInfo* info)
+    {
+        if(!info)
+            return SYSTEM2_RESULT_INVALID_ARGUMENT;
+        
+        Internal_System2FreeCommandState(info->InternalState);
+        
+        SYSTEM2_RESULT reaperResult = SYSTEM2_RESULT_SUCCESS;
+        #if INTERNAL_SYSTEM2_REAPER
+            if(info->ReapOnCleanup)
+                reaperResult = Internal_System2ReaperHandOff(info->ChildProcessID);
+        #endif
+
+        if(info->ChildToParentPipes[SYSTEM2_FD_READ])
+        {
+            if(close(info->ChildToParentPipes[SYSTEM2_FD_READ]) != 0)
+                return SYSTEM2_RESULT_PIPE_FD_CLOSE_FAILED;
+        }
+
+        if(info->ChildToParentPipesErr[SYSTEM2_FD_READ])
+        {
+            if(close(info->ChildToParentPipesErr[SYSTEM2_FD_READ]) != 0)
+                return SYSTEM2_RESULT_PIPE_FD_CLOSE_FAILED;
+        }
+        
+        if(info->ParentToChildPipes[SYSTEM2_FD_WRITE])
+        {
+            if(close(info->ParentToChildPipes[SYSTEM2_FD_WRITE]) != 0)
+                return SYSTEM2_RESULT_PIPE_FD_CLOSE_FAILED;
+        }
+        
+        return reaperResult;
+    }
+    
+    SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT Internal_System2WaitPid( const System2CommandInfo* info, 
+                                                                bool noHang,
+                                                                int* outReturnCode)
+    {
+        if(!info || !outReturnCode)
+            return SYSTEM2_RESULT_INVALID_ARGUMENT;
+        
+        int status;
+        pid_t pidResult = waitpid(info->ChildProcessID, &status, noHang ? WNOHANG : 0);
+        if(pidResult == 0)
+            return SYSTEM2_RESULT_COMMAND_NOT_FINISHED;
+        else if(pidResult == -1)
+            return SYSTEM2_RESULT_COMMAND_WAIT_FAILED;
+        
+        #if INTERNAL_SYSTEM2_REAPER
+            if(info->ReapOnCleanup)
+                Internal_System2ReaperSetWaited(info->ChildProcessID);
+        #endif
+        
+        return Internal_System2GetExitResult(status, outReturnCode);
+    }
+    
+    //Waits up to `timeoutMs` for the command to exit, or returns early if another child exits
+    SYSTEM2_FUNC_PREFIX void Internal_System2WaitForExitMs( const System2CommandInfo* info, 
+                                                            int timeoutMs)
+    {
+        #if defined(__linux__) && defined(SYS_pidfd_open)
+            struct Internal_System2CommandState* state = info->InternalState;
+            if(!state->PidFdOpened)
+            {
+                state->PidFd = (int)syscall(SYS_pidfd_open, info->ChildProcessID, 0);
+                state->PidFdOpened = true;
+            }
+            
+            if(state->PidFd >= 0)
+            {
+                struct pollfd pidFd = { state->PidFd, POLLIN, 0 };
+                poll(&pidFd, 1, timeoutMs);
+                return;
+            }
+        #endif
+        
+        struct timespec timeout;
+        timeout.tv_sec = timeoutMs / 1000;
+        timeout.tv_nsec = (long)(timeoutMs % 1000) * 1000000;
+        
+        sigset_t mask;
+        sigset_t origMask;
+        sigemptyset(&mask);
+        sigaddset(&mask, SIGCHLD);
+        if(sigprocmask(SIG_BLOCK, &mask, &origMask) < 0)
+        {
+            //Check again in a bit instead
+            if(timeoutMs > 10)
+            {
+                timeout.tv_sec = 0;
+                timeout.tv_nsec = 10 * 1000000;
+            }
+            
+            nanosleep(&timeout, NULL);
+            return;
+        }
+        
+        //The command could have exited before SIGCHLD was blocked
+        int returnCode;
+        if(Internal_System2PeekExit(info, &returnCode) == SYSTEM2_RESULT_COMMAND_NOT_FINISHED)
+            sigtimedwait(&mask, NULL, &timeout);
+        
+        sigprocmask(SIG_SETMASK, &origMask, NULL);
+    }
+    
+    /*
+    Same as `System2GetCommandReturnValuePosix()` for a command with watchdogs, which are checked 
+    while waiting so that a command that only gets waited for is still stopped by them.
+    */
+    SYSTEM2_FUNC_PREFIX 
+    SYSTEM2_RESULT Internal_System2WaitWithWatchdogs(   const System2CommandInfo* info, 
+                                                        int timeoutSec,
+                                                        int* outReturnCode)
+    {
+        int64_t endTime = Internal_System2GetTimeMs() + (int64_t)timeoutSec * 1000;
+        while(true)
+        {
+            int watchdogWaitMs = Internal_System2CheckWatchdogs(info);
+            SYSTEM2_RESULT result = Internal_System2WaitPid(info, true, outReturnCode);
+            if(result != SYSTEM2_RESULT_COMMAND_NOT_FINISHED || timeoutSec == 0)
+                return result;
+            
+            int64_t waitMs = watchdogWaitMs;
+            if(timeoutSec > 0)
+            {
+                int64_t remainingMs = endTime - Internal_System2GetTimeMs();
+                if(remainingMs <= 0)
+                    return result;
+                
+                if(waitMs < 0 || remainingMs < waitMs)
+                    waitMs = remainingMs;
+            }
+            
+            //Nothing left for the watchdogs to do
+            if(waitMs < 0)
+                return Internal_System2WaitPid(info, false, outReturnCode);
+            
+            Internal_System2WaitForExitMs(info, waitMs > INT32_MAX ? INT32_MAX : (int)waitMs);
+        }
+    }
+    
+    SYSTEM2_FUNC_PREFIX 
+    SYSTEM2_RESULT System2GetCommandReturnValuePosix(   const System2CommandInfo* info, 
+                                                        int timeoutSec,
+                                                        int* outReturnCode)
+    {
+        if(!info || !outReturnCode)
+            return SYSTEM2_RESULT_INVALID_ARGUMENT;
+        
+        //The reaper thread has it if it was handed off on cleanup
+        #if INTERNAL_SYSTEM2_REAPER
+            SYSTEM2_RESULT reapedResult;
+            if( info->ReapOnCleanup &&
+                Internal_System2ReaperGetReturnValue(   info->ChildProcessID, 
+                                                        timeoutSec, 
+                                                        outReturnCode, 
+                                                        &reapedResult))
+            {
+                return reapedResult;
+            }
+        #endif
+        
+        if( info->InternalState && 
+            Internal_System2HasWatchdogs(info) && 
+            !info->InternalState->WatchdogStopped)
+        {
+            return Internal_System2WaitWithWatchdogs(info, timeoutSec, outReturnCode);
+        }
+        
+        if(timeoutSec == 0)
+            return Internal_System2WaitPid(info, true, outReturnCode);
+        else if(timeoutSec < 0)
+            return Internal_System2WaitPid(info, false, outReturnCode);
+        
+        //Modified from https://stackoverflow.com/a/20173592
+        sigset_t mask;
+        sigset_t origMask;
+        struct timespec timeout;
+        timeout.tv_sec = (time_t)timeoutSec;
+        timeout.tv_nsec = 0;
+
+        sigemptyset(&mask);
+        sigemptyset(&origMask);
+        sigaddset(&mask, SIGCHLD);
+        if(sigprocmask(SIG_BLOCK, &mask, &origMask) < 0) 
+            return SYSTEM2_RESULT_TIMEOUT_SIGPROCMASK_FAILED;
+        
+        time_t curTime = time(NULL);
+        
+        SYSTEM2_RESULT result;
+        while(true)
+        {
+            if(sigtimedwait(&mask, NULL, &timeout) < 0)
+            {
+                //Interrupted by a signal other than SIGCHLD.
+                if(errno == EINTR) 
+                    goto rewait;
+            }
+            
+            //A child terminated early, check if it is our child
+            if(time(NULL) - curTime < timeoutSec)
+            {
+                result = Internal_System2WaitPid(info, true, outReturnCode);
+                
+                //It is our child, return
+                if(result != SYSTEM2_RESULT_COMMAND_NOT_FINISHED)
+                {
+                    sigprocmask(SIG_SETMASK, &origMask, NULL);
+                    return result;
+                }
+                
+                //Otherwise continue waiting
+                rewait:;
+                timeoutSec -= time(NULL) - curTime;
+                if(timeoutSec < 0)
+                    break;
+                
+                curTime = time(NULL);
+                timeout.tv_sec = (time_t)timeoutSec;
+                continue;
+            }
+
+            break;
+        }
+        
+        //Don't leave SIGCHLD blocked, otherwise it will be inherited by the commands we spawn later
+        sigprocmask(SIG_SETMASK, &origMask, NULL);
+        return Internal_System2WaitPid(info, true, outReturnCode);
+    }
+    
+    /*
+    Sends `sig` to the process group of the command if it has one, otherwise to the command itself. 
+    With `UsePty`, the group only exists once the child has called `setsid()`, which it may not 
+    have done yet right after the fork. The child is signalled directly in that case, since it 
+    can't have started anything else yet.
+    */
+    SYSTEM2_FUNC_PREFIX int Internal_System2SignalCommand(const System2CommandInfo* info, int sig)
+    {
+        if(!info->NewProcessGroup && !info->UsePty)
+            return kill(info->ChildProcessID, sig);
+        
+        if(kill(-info->ChildProcessID, sig) == 0)
+            return 0;
+        
+        if(errno != ESRCH)
+            return -1;
+        
+        return kill(info->ChildProcessID, sig);
+    }
+    
+    SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2KillPosix(const System2CommandInfo* info)
+    {
+        if(!info)
+            return SYSTEM2_RESULT_INVALID_ARGUMENT;
+        
+        int result = Internal_System2SignalCommand(info, SIGKILL);
+        if(result == 0)
+            return SYSTEM2_RESULT_SUCCESS;
+        else
+            return SYSTEM2_RESULT_KILL_FAILED;
+    }
+    
+    SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2TermPosix(const System2CommandInfo* info)
+    {
+        if(!info)
+            return SYSTEM2_RESULT_INVALID_ARGUMENT;
+        
+        int result = Internal_System2SignalCommand(info, SIGTERM);
+        if(result == 0)
+            return SYSTEM2_RESULT_SUCCESS;
+        else
+            return SYSTEM2_RESULT_TERM_FAILED;
+    }
+    
+    SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2PausePosix(const System2CommandInfo* info)
+    {
+        if(!info)
+            return SYSTEM2_RESULT_INVALID_ARGUMENT;
+        
+        if(Internal_System2SignalCommand(info, SIGSTOP) != 0)
+            return SYSTEM2_RESULT_PAUSE_FAILED;
+        
+        struct Internal_System2CommandState* state = info->InternalState;
+        if(state && state->PausedTimeMs < 0)
+            state->PausedTimeMs = Internal_System2GetTimeMs();
+        
+        return SYSTEM2_RESULT_SUCCESS;
+    }
+    
+    SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2ResumePosix(const System2CommandInfo* info)
+    {
+        if(!info)
+            return SYSTEM2_RESULT_INVALID_ARGUMENT;
+        
+        if(Internal_System2SignalCommand(info, SIGCONT) != 0)
+            return SYSTEM2_RESULT_RESUME_FAILED;
+        
+        //Move the watchdog times forward so that the pause isn't counted
+        struct Internal_System2CommandState* state = info->InternalState;
+        if(state && state->PausedTimeMs >= 0)
+        {
+            int64_t pausedMs = Internal_System2GetTimeMs() - state->PausedTimeMs;
+            int64_t* times[] =  {
+                                    &state->StartTimeMs, 
+                                    &state->LastOutputTimeMs, 
+                                    &state->InputClosedTimeMs, 
+                                    &state->TermSentTimeMs
+                                };
+            
+            for(int i = 0; i < (int)(sizeof(times) / sizeof(times[0])); ++i)
+            {
+                if(*times[i] >= 0)
+                    *times[i] += pausedMs;
+            }
+            
+            state->PausedTimeMs = -1;
+        }
+        
+        return SYSTEM2_RESULT_SUCCESS;
+    }
+    
+    /*
+    Discards what is in the output pipe beyond the last `keepBytes` without copying it. 
+    `*outBytesDiscarded` is 0 if nothing can be discarded this way, in which case the output should 
+    be read instead. `*inOutNullFd` should be -1 at first, and closed after if it is not negative.
+    */
+    SYSTEM2_FUNC_PREFIX 
+    SYSTEM2_RESULT Internal_System2DiscardOutputPosix(  const System2CommandInfo* info,
+                                                        bool readStderr,
+                                                        uint32_t keepBytes,
+                                                        int* inOutNullFd,
+                                                        uint64_t* outBytesDiscarded)
+    {
+        *outBytesDiscarded = 0;
+        
+        //Splicing would race with the multishot reads of io_uring
+        #if defined(__linux__) && defined(SYS_splice) && !INTERNAL_SYSTEM2_IO_URING
+            int outputFd =  readStderr ?
+                            info->ChildToParentPipesErr[SYSTEM2_FD_READ] :
+                            info->ChildToParentPipes[SYSTEM2_FD_READ];
+            
+            //-2 if /dev/null can't be spliced to
+            int available = 0;
+            if( *inOutNullFd == -2 || 
+                ioctl(outputFd, FIONREAD, &available) != 0 || 
+                available <= 0 ||
+                (uint32_t)available <= keepBytes)
+            {
+                return SYSTEM2_RESULT_SUCCESS;
+            }
+            
+            if(*inOutNullFd == -1)
+            {
+                *inOutNullFd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+                if(*inOutNullFd == -1)
+                {
+                    *inOutNullFd = -2;
+                    return SYSTEM2_RESULT_SUCCESS;
+                }
+            }
+            
+            long splicedBytes = syscall(SYS_splice, 
+                                        outputFd, 
+                                        NULL, 
+                                        *inOutNullFd, 
+                                        NULL, 
+                                        (size_t)available - keepBytes, 
+                                        0);
+            if(splicedBytes < 0)
+            {
+                if(errno == EINTR)
+                    return SYSTEM2_RESULT_SUCCESS;
+                
+                if(errno == EINVAL || errno == ENOSYS)
+                {
+                    close(*inOutNullFd);
+                    *inOutNullFd = -2;
+                    return SYSTEM2_RESULT_SUCCESS;
+                }
+                
+                return SYSTEM2_RESULT_READ_FAILED;
+            }
+            
+            *outBytesDiscarded = (uint64_t)splicedBytes;
+            if(splicedBytes > 0)
+                Internal_System2RecordOutput(info);
+        #else
+            (void)info;
+            (void)readStderr;
+            (void)keepBytes;
+            (void)inOutNullFd;
+        #endif
+        
+        return SYSTEM2_RESULT_SUCCESS;
+    }
+    
+    //Same as `Internal_System2WaitPid()` without waiting, but leaves the command to be waited again
+    SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT Internal_System2PeekExit(const System2CommandInfo* info, 
+                                                                int* outReturnCode)
+    {
+        siginfo_t exitInfo;
+        memset(&exitInfo, 0, sizeof(siginfo_t));
+        if(waitid(P_PID, (id_t)info->ChildProcessID, &exitInfo, WEXITED | WNOHANG | WNOWAIT) != 0)
+            return SYSTEM2_RESULT_COMMAND_WAIT_FAILED;
+        
+        if(exitInfo.si_pid == 0)
+            return SYSTEM2_RESULT_COMMAND_NOT_FINISHED;
+        
+        if(exitInfo.si_code != CLD_EXITED)
+        {
+            *outReturnCode = -1;
+            return SYSTEM2_RESULT_COMMAND_TERMINATED;
+        }
+        
+        *outReturnCode = exitInfo.si_status;
+        return SYSTEM2_RESULT_SUCCESS;
+    }
+    
+    SYSTEM2_FUNC_PREFIX int64_t Internal_System2GetTimeMs(void)
+    {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+    }
+    
+    SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2PollPosix(System2CommandInfo** commands, 
+                                                        int commandsCount, 
+                                                        int timeoutMs,
+                                                        bool returnOnExit)
+    {
+        if(!commands || commandsCount < 0)
+            return SYSTEM2_RESULT_INVALID_ARGUMENT;
+        
+        for(int i = 0; i < commandsCount; ++i)
+        {
+            if(!commands[i])
+                return SYSTEM2_RESULT_INVALID_ARGUMENT;
+        }
+        
+        //Each command has up to 3 fds to poll: stdout, stderr and pidfd. 
+        //`pollOwners` stores the index of the command * 3 + which fd it is.
+        size_t maxPollCount = (size_t)commandsCount * 3 + 1;
+        struct pollfd* pollFds = (struct pollfd*)malloc(sizeof(struct pollfd) * maxPollCount);
+        int* pollOwners = (int*)malloc(sizeof(int) * maxPollCount);
+        if(!pollFds || !pollOwners)
+        {
+            free(pollFds);
+            free(pollOwners);
+            return SYSTEM2_RESULT_MALLOC_FAILED;
+        }
+        
+        int64_t startTime = Internal_System2GetTimeMs();
+        bool polled = false;
+        SYSTEM2_RESULT result = SYSTEM2_RESULT_COMMAND_NOT_FINISHED;
+        
+        while(true)
+        {
+            int pollCount = 0;
+            bool anyPending = false;
+            bool anyExitReported = false;
+            bool needsTimeSlices = false;
+            int watchdogsWaitMs = -1;
+            
+            for(int i = 0; i < commandsCount; ++i)
+            {
+                System2CommandInfo* info = commands[i];
+                struct Internal_System2CommandState* state = info->InternalState;
+                if(!state || state->ExitReported)
+                    continue;
+                
+                bool outputPending = false;
+                for(int streamIndex = 0; streamIndex < 2; ++streamIndex)
+                {
+                    if( !Internal_System2IsPolledStream(info, streamIndex) || 
+                        state->OutputFinished[streamIndex])
+                    {
+                        continue;
+                    }
+                    
+                    pollFds[pollCount].fd = streamIndex == 0 ? 
+                                            info->ChildToParentPipes[SYSTEM2_FD_READ] :
+                                            info->ChildToParentPipesErr[SYSTEM2_FD_READ];
+                    pollFds[pollCount].events = POLLIN;
+                    pollFds[pollCount].revents = 0;
+                    pollOwners[pollCount++] = i * 3 + streamIndex;
+                    outputPending = true;
+                }
+                
+                //Wake up in time for the next watchdog
+                if(outputPending || info->OnExit)
+                {
+                    int waitMs = Internal_System2CheckWatchdogs(info);
+                    if(waitMs >= 0 && (watchdogsWaitMs < 0 || waitMs < watchdogsWaitMs))
+                        watchdogsWaitMs = waitMs;
+                }
+                
+                //Only report the exit after all the output
+                if(outputPending)
+                {
+                    anyPending = true;
+                    continue;
+                }
+                
+                if(!info->OnExit)
+                    continue;
+                
+                int returnCode = -1;
+                SYSTEM2_RESULT exitResult = Internal_System2PeekExit(info, &returnCode);
+                if(exitResult == SYSTEM2_RESULT_COMMAND_WAIT_FAILED)
+                {
+                    result = exitResult;
+                    goto end;
+                }
+                
+                if(exitResult != SYSTEM2_RESULT_COMMAND_NOT_FINISHED)
+                {
+                    state->ExitReported = true;
+                    anyExitReported = true;
+                    info->OnExit(   info->CallbackUserData, 
+                                    returnCode, 
+                                    exitResult == SYSTEM2_RESULT_COMMAND_TERMINATED);
+                    continue;
+                }
+                
+                anyPending = true;
+                
+                //Wait for the exit with pidfd if we can, otherwise check it periodically
+                #if defined(__linux__) && defined(SYS_pidfd_open)
+                    if(!state->PidFdOpened)
+                    {
+                        state->PidFd = (int)syscall(SYS_pidfd_open, info->ChildProcessID, 0);
+                        state->PidFdOpened = true;
+                    }
+                    
+                    if(state->PidFd >= 0)
+                    {
+                        pollFds[pollCount].fd = state->PidFd;
+                        pollFds[pollCount].events = POLLIN;
+                        pollFds[pollCount].revents = 0;
+                        pollOwners[pollCount++] = i * 3 + 2;
+                        continue;
+                    }
+                #endif
+                
+                needsTimeSlices = true;
+            }
+            
+            if(!anyPending)
+            {
+                result = SYSTEM2_RESULT_SUCCESS;
+                break;
+            }
+            
+            if(returnOnExit && anyExitReported)
+                break;
+            
+            int waitTimeMs = -1;
+            if(timeoutMs >= 0)
+            {
+                int64_t elapsedMs = Internal_System2GetTimeMs() - startTime;
+                if(polled && elapsedMs >= timeoutMs)
+                    break;
+                
+                waitTimeMs = elapsedMs >= timeoutMs ? 0 : (int)(timeoutMs - elapsedMs);
+            }
+            
+            if(needsTimeSlices && (waitTimeMs < 0 || waitTimeMs > 10))
+                waitTimeMs = 10;
+            
+            if(watchdogsWaitMs >= 0 && (waitTimeMs < 0 || waitTimeMs > watchdogsWaitMs))
+                waitTimeMs = watchdogsWaitMs;
+            
+            int pollResult = poll(pollFds, (nfds_t)pollCount, waitTimeMs);
+            polled = true;
+            if(pollResult < 0)
+            {
+                if(errno == EINTR)
+                    continue;
+                
+                result = SYSTEM2_RESULT_READ_FAILED;
+                break;
+            }
+            
+            for(int i = 0; i < pollCount && pollResult > 0; ++i)
+            {
+                //The exit is checked again when we go through the commands
+                int streamIndex = pollOwners[i] % 3;
+                if(pollFds[i].revents == 0 || streamIndex == 2)
+                    continue;
+                
+                System2CommandInfo* info = commands[pollOwners[i] / 3];
+                struct Internal_System2CommandState* state = info->InternalState;
+                
+                ssize_t readResult = read(  pollFds[i].fd, 
+                                            state->CallbackBuffer, 
+                                            state->CallbackChunkSize);
+                if(readResult > 0)
+                {
+                    Internal_System2RecordOutput(info);
+                    System2OutputCallback callback = streamIndex == 0 ? info->OnStdout : info->OnStderr;
+                    callback(info->CallbackUserData, state->CallbackBuffer, (uint32_t)readResult);
+                }
+                else if(readResult == 0 || (info->UsePty && errno == EIO))
+                    state->OutputFinished[streamIndex] = true;
+                else if(errno != EINTR && errno != EAGAIN)
+                {
+                    result = SYSTEM2_RESULT_READ_FAILED;
+                    goto end;
+                }
+            }
+            
+            //Children of a command stopped by a watchdog could keep its pipes open
+            for(int i = 0; i < pollCount; ++i)
+            {
+                int streamIndex = pollOwners[i] % 3;
+                struct Internal_System2CommandState* state = 
+                    commands[pollOwners[i] / 3]->InternalState;
+                if(pollFds[i].revents == 0 && streamIndex != 2 && state->WatchdogStopped)
+                    state->OutputFinished[streamIndex] = true;
+            }
+        }
+        
+        end:;
+        free(pollFds);
+        free(pollOwners);
+        return result;
+    }
+    
+    typedef struct
+    {
+        char** Envs;
+        int EnvsLength;
+    } System2EnvVarInfoPosix;
+    
+    SYSTEM2_FUNC_PREFIX 
+    SYSTEM2_RESULT System2GetEnvironmentVariablesCountPosix(int* outCount, void** outResource)
+    {
+        if(!outCount || !outResource)
+            return SYSTEM2_RESULT_INVALID_ARGUMENT;
+        
+        *outResource = NULL;
+        *outCount = 0;
+        while(environ[*outCount])
+            ++(*outCount);
+        
+        System2EnvVarInfoPosix* info = 
+            (System2EnvVarInfoPosix*)calloc(1, sizeof(System2EnvVarInfoPosix));
+        if(!info)
+            return SYSTEM2_RESULT_MALLOC_FAILED;
+        
+        info->Envs = (char**)calloc(*outCount, sizeof(char*));
+        if(!info->Envs)
+        {
+            free(info);
+            return SYSTEM2_RESULT_MALLOC_FAILED;
+        }
+        
+        info->EnvsLength = *outCount;
+        int i;
+        for(i = 0; i < *outCount; ++i)
+        {
+            int memNeeded = strlen(environ[i]) + 1;
+            char* envVar = (char*)malloc(memNeeded);
+            if(!envVar)
+                break;
+            
+            memcpy(envVar, environ[i], memNeeded);
+            info->Envs[i] = envVar;
+        }
+        
+        //Failed to allocate for all of the env strings
+        if(i != *outCount)
+        {
+            for(int j = 0; j < i; ++j)
+                free(info->Envs[j]);
+            
+            free(info->Envs);
+            free(info);
+            return SYSTEM2_RESULT_MALLOC_FAILED;
+        }
+        
+        *outResource = info;
+        return SYSTEM2_RESULT_SUCCESS;
+    }
+    
+    SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2GetEnvironmentVariablePosix(  const void* resource,
+                                                                            const char** outName,
+                                                                            int* outNameLength,
+                                                                            const char** outValue,
+                                                                            int* outValueLength,
+                                                                            int index)
+    {
+        if(!outName || !outNameLength || !outValue || !outValueLength || !resource)
+            return SYSTEM2_RESULT_INVALID_ARGUMENT;
+        
+        char* env = ((System2EnvVarInfoPosix*)resource)->Envs[index];
+        *outName = env;
+        char* equal = env;
+        while(equal)
+        {
+            if(*equal == '=')
+                break;
+            ++equal;
+        }
+        *outNameLength = (int)(equal - env);
+        
+        env = equal + 1;
+        *outValue = env;
+        while(*env)
+            ++env;
+        
+        *outValueLength = (int)(env - (equal + 1));
+        return SYSTEM2_RESULT_SUCCESS;
+    }
+    
+    SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2EnvironmentVariableFreePosix(void** resource)
+    {
+        if(!resource)
+            return SYSTEM2_RESULT_INVALID_ARGUMENT;
+        
+        if(!(*resource))
+            return SYSTEM2_RESULT_SUCCESS;
+        
+        free(*resource);
+        *resource = NULL;
+        return SYSTEM2_RESULT_SUCCESS;
+    }
+    
+    SYSTEM2_FUNC_PREFIX
+    SYSTEM2_RESULT System2SetEnvironmentVariablePosix(const char* envName, const char* envValue)
+    {
+        if(!envName)
+            return SYSTEM2_RESULT_INVALID_ARGUMENT;
+        
+        if(envValue)
+        {
+            int result = setenv(envName, envValue, 1);
+            if(result != 0)
+                return SYSTEM2_RESULT_INVALID_ARGUMENT;
+        }
+        else
+        {
+            int result = unsetenv(envName);
+            if(result != 0)
+                return SYSTEM2_RESULT_INVALID_ARGUMENT;
+        }
+        
+        return SYSTEM2_RESULT_SUCCESS;
+    }
+#endif //defined(__unix__) || defined(__APPLE__)
+
+#if defined(_WIN32)
+    #include <strsafe.h>
+    #include <tlhelp32.h>
+    
+    //State of a command that needs to be kept between calls
+    struct Internal_System2CommandState
+    {
+        //Used by `System2Poll()`
+        char* CallbackBuffer;                           //Reused for every output callback
+        uint32_t CallbackChunkSize;
+        bool OutputFinished[2];                         //stdout, stderr
+        bool ExitReported;
+    };
+    
+    SYSTEM2_FUNC_PREFIX
+    void Internal_System2FreeCommandState(struct Internal_System2CommandState* state)
+    {
+        if(!state)
+            return;
+        
+        free(state->CallbackBuffer);
+        free(state);
+    }
+    
+    //Only commands with callbacks need a state
+    SYSTEM2_FUNC_PREFIX
+    SYSTEM2_RESULT Internal_System2CreateCommandState(System2CommandInfo* commandInfo)
+    {
+        commandInfo->InternalState = NULL;
+        
+        bool hasOutputCallback = commandInfo->OnStdout || commandInfo->OnStderr;
+        if(!hasOutputCallback && !commandInfo->OnExit)
+            return SYSTEM2_RESULT_SUCCESS;
+        
+        struct Internal_System2CommandState* state = 
+            (struct Internal_System2CommandState*)calloc(1, sizeof(struct Internal_System2CommandState));
+        if(!state)
+            return SYSTEM2_RESULT_MALLOC_FAILED;
+        
+        if(hasOutputCallback)
+        {
+            state->CallbackChunkSize =  commandInfo->CallbackChunkSize > 0 ? 
+                                        commandInfo->CallbackChunkSize : 
+                                        SYSTEM2_CALLBACK_CHUNK_SIZE;
+            
+            state->CallbackBuffer = (char*)malloc(state->CallbackChunkSize);
+            if(!state->CallbackBuffer)
+            {
+                free(state);
+                return SYSTEM2_RESULT_MALLOC_FAILED;
+            }
+        }
+        
+        commandInfo->InternalState = state;
+        return SYSTEM2_RESULT_SUCCESS;
+    }
+    
+    SYSTEM2_FUNC_PREFIX void PrintError(LPCTSTR lpszFunction)
+    { 
+        (void)lpszFunction;
+        
+        // Retrieve the system error message for the last-error code
+        LPVOID lpMsgBuf;
+        DWORD dw = GetLastError(); 
+    
+        FormatMessage(  FORMAT_MESSAGE_ALLOCATE_BUFFER | 
+                        FORMAT_MESSAGE_FROM_SYSTEM |
+                        FORMAT_MESSAGE_IGNORE_INSERTS,
+                        NULL,
+                        dw,
+                        MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT),
+                        (LPTSTR) &lpMsgBuf,
+                        0, 
+                        NULL );
+    
+        // Display the error message and exit the process
+        printf("Error %d: %s\n", dw, (char*)lpMsgBuf);
+        LocalFree(lpMsgBuf);
+    }
+
+    //https://learn.microsoft.com/en-gb/archive/blogs/twistylittlepassagesallalike/everyone-quotes-command-line-arguments-the-wrong-way
+    SYSTEM2_FUNC_PREFIX int ConstructCommandLineWindows(const char* const* args,
+                                                        size_t argsCount,
+                                                        bool disableEscape,
+                                                        int resultSize,
+                                                        char* outResult)
+    {
+        size_t currentIndex = 0;
+        
+        if(argsCount == 0)
+        {
+            if(outResult != NULL)
+            {
+                if(resultSize < 1)
+                    return -1;
+                else
+                {
+                    outResult[0] = '\0';
+                    return 1;
+                }
+            }
+            else
+                return 1;
+        }
+        
+        for(size_t i = 0; i < argsCount; ++i)
+        {
+            size_t currentArgLength = strlen(args[i]);
+            
+            if( currentArgLength != 0 &&
+                strchr(args[i], ' ') == NULL &&
+                strchr(args[i], '\t') == NULL &&
+                strchr(args[i], '\n') == NULL &&
+                strchr(args[i], '\v') == NULL &&
+                strchr(args[i], '"') == NULL)
+            {
+                if(outResult != NULL)
+                {
+                    memcpy(&outResult[currentIndex], args[i], currentArgLength);
+                    currentIndex += currentArgLength;
+                    
+                    //Bound check
+                    if(currentIndex >= resultSize)
+                        return -1;
+                    
+                    if(i != argsCount - 1)
+                        outResult[currentIndex++] = ' ';
+                    else
+                        outResult[currentIndex++] = '\0';
+                }
+                else
+                {
+                    currentIndex += currentArgLength;
+                    ++currentIndex;
+                }
+            }
+            else
+            {
+                if(outResult != NULL)
+                {
+                    //Bound check
+                    if(currentIndex >= resultSize)
+                        return -1;
+                    
+                    outResult[currentIndex++] = '"';
+                }
+                else
+                    ++currentIndex;
+                
+                for(int j = 0; j < currentArgLength; ++j)
+                {
+                    int numberBackslashes = 0;
+                
+                    if(!disableEscape)
+                    {
+                        for(; j < currentArgLength && args[i][j] == '\\'; ++j)
+                            ++numberBackslashes;
+                    }
+                
+                    if(j == currentArgLength && !disableEscape)
+                    {
+                        // Escape all backslashes, but let the terminating
+                        // double quotation mark we add below be interpreted
+                        // as a metacharacter.
+                        if(outResult != NULL)
+                        {
+                            //Bound check
+                            if(currentIndex + numberBackslashes * 2 >= resultSize)
+                                return -1;
+                            
+                            for(int k = 0; k < numberBackslashes * 2; ++k)
+                                outResult[currentIndex++] = '\\';
+                        }
+                        else
+                        {
+                            for(int k = 0; k < numberBackslashes * 2; ++k)
+                                ++currentIndex;
+                        }
+                    }
+                    else if(args[i][j] == '"' && !disableEscape)
+                    {
+                        // Escape all backslashes and the following
+                        // double quotation mark.
+                        if(outResult != NULL)
+                        {
+                            //Bound check
+                            if(currentIndex + numberBackslashes * 2 + 1 + 1 >= resultSize)
+                                return -1;
+                            
+                            for(int k = 0; k < numberBackslashes * 2 + 1; ++k)
+                                outResult[currentIndex++] = '\\';
+                            
+                            outResult[currentIndex++] = '"';
+                        }
+                        else
+                        {
+                            for(int k = 0; k < numberBackslashes * 2 + 1; ++k)
+                                ++currentIndex;
+                            
+                            ++currentIndex;
+                        }
+                    }
+                    else
+                    {
+                        if(outResult != NULL)
+                        {
+                            //Bound check
+                            if(currentIndex + numberBackslashes + 1 >= resultSize)
+                                return -1;
+                            
+                            // Backslashes aren't special here.
+                            for(int k = 0; k < numberBackslashes; ++k)
+                                outResult[currentIndex++] = '\\';
+                            
+                            outResult[currentIndex++] = args[i][j];
+                        }
+                        else
+                        {
+                            for(int k = 0; k < numberBackslashes; ++k)
+                                ++currentIndex;
+                            
+                            ++currentIndex;
+                        }
+                    }
+                }
+                
+                if(outResult != NULL)
+                {
+                    //Bound check
+                    if(currentIndex + 2 > resultSize)
+                        return -1;
+                    
+                    outResult[currentIndex++] = '"';
+                    if(i != argsCount - 1)
+                        outResult[currentIndex++] = ' ';
+                    else
+                        outResult[currentIndex++] = '\0';
+                }
+                else
+                    currentIndex += 2;
+            }
+        }
+        
+        return (int)currentIndex;
+    }
+    
+    SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT 
+    Internal_System2Utf8ToUtf16(const char* utf8, int inLen, wchar_t** outUtf16, int* outLen)
+    {
+        if(!utf8 || !outUtf16 || !outLen)
+            return SYSTEM2_RESULT_INVALID_ARGUMENT;
+        
+        int wLen = MultiByteToWideChar(CP_UTF8, 0, utf8, inLen, NULL, 0);
+        if(wLen <= 0)
+            return SYSTEM2_RESULT_WINDOWS_UNICODE_FAILED;
+        
+        wchar_t* w = (wchar_t*)calloc(wLen, sizeof(wchar_t));
+        if(!w)
+            return SYSTEM2_RESULT_MALLOC_FAILED;
+        
+        wLen = MultiByteToWideChar(CP_UTF8, 0, utf8, inLen, w, wLen);
+        if(wLen <= 0)
+        {
+            free(w);
+            return SYSTEM2_RESULT_WINDOWS_UNICODE_FAILED;
+        }
+        
+        *outUtf16 = w;
+        *outLen = wLen;
+        return SYSTEM2_RESULT_SUCCESS;
+    }
+    
+    
+    SYSTEM2_FUNC_PREFIX 
+    SYSTEM2_RESULT Internal_System2RunSubprocessWindows(const char* executable,
+                                                        const char* const* args,
+                                                        int argsCount,
+                                                        System2CommandInfo* inOutCommandInfo)
+    {
+        // Set the write handle to the pipe for STDOUT to be inherited.
+        if(inOutCommandInfo->RedirectOutput)
+        {
+            // Create a pipe for the child process's STDOUT. 
+            if(!CreatePipe( &inOutCommandInfo->ChildToParentPipes[SYSTEM2_FD_READ], 
+                            &inOutCommandInfo->ChildToParentPipes[SYSTEM2_FD_WRITE], 
+                            NULL, 
+                            0))
+            {
+                return SYSTEM2_RESULT_PIPE_CREATE_FAILED;
+            }
+            
+            if(!SetHandleInformation(   inOutCommandInfo->ChildToParentPipes[SYSTEM2_FD_WRITE], 
+                                        HANDLE_FLAG_INHERIT, 
+                                        HANDLE_FLAG_INHERIT))
+            {
+                return SYSTEM2_RESULT_PIPE_CREATE_FAILED;
+            }
+            
+            if(inOutCommandInfo->StandaloneStderr)
+            {
+                // Create a pipe for the child process's STDERR. 
+                if(!CreatePipe( &inOutCommandInfo->ChildToParentPipesErr[SYSTEM2_FD_READ], 
+                                &inOutCommandInfo->ChildToParentPipesErr[SYSTEM2_FD_WRITE], 
+                                NULL, 
+                                0))
+                {
+                    return SYSTEM2_RESULT_PIPE_CREATE_FAILED;
+                }
+                
+                if(!SetHandleInformation(   inOutCommandInfo->ChildToParentPipesErr[SYSTEM2_FD_WRITE], 
+                                            HANDLE_FLAG_INHERIT, 
+                                            HANDLE_FLAG_INHERIT))
+                {
+                    return SYSTEM2_RESULT_PIPE_CREATE_FAILED;
+                }
+            }
+            else
+                memset(inOutCommandInfo->ChildToParentPipesErr, 0, sizeof(HANDLE) * 2);
+        }
+        else
+        {
+            memset(inOutCommandInfo->ChildToParentPipes, 0, sizeof(HANDLE) * 2);
+            memset(inOutCommandInfo->ChildToParentPipesErr, 0, sizeof(HANDLE) * 2);
+        }
+        
+        if(inOutCommandInfo->RedirectInput)
+        {
+            // Create a pipe for the child process's STDIN. 
+            if(!CreatePipe( &inOutCommandInfo->ParentToChildPipes[SYSTEM2_FD_READ], 
+                            &inOutCommandInfo->ParentToChildPipes[SYSTEM2_FD_WRITE], 
+                            NULL, 
+                            0))
+            {
+                return SYSTEM2_RESULT_PIPE_CREATE_FAILED;
+            }
+
+            // Set the read handle to the pipe for STDIN to be inherited. 
+            if(!SetHandleInformation(   inOutCommandInfo->ParentToChildPipes[SYSTEM2_FD_READ], 
+                                        HANDLE_FLAG_INHERIT, 
+                                        HANDLE_FLAG_INHERIT))
+            {
+                return SYSTEM2_RESULT_PIPE_CREATE_FAILED;
+            }
+        }
+        else 
+            memset(inOutCommandInfo->ParentToChildPipes, 0, sizeof(HANDLE) * 2);
+        
+        PROCESS_INFORMATION processInfo;
+        STARTUPINFOW startupInfo;
+        BOOL success = FALSE; 
+        
+        //Set up members of the PROCESS_INFORMATION structure. 
+        ZeroMemory( &processInfo, sizeof(PROCESS_INFORMATION) );
+    
+        //Set up members of the STARTUPINFO structure. 
+        //This structure specifies the STDIN and STDOUT handles for redirection.
+        ZeroMemory(&startupInfo, sizeof(STARTUPINFOW));
+        startupInfo.cb = sizeof(STARTUPINFOW); 
+        if(inOutCommandInfo->RedirectInput || inOutCommandInfo->RedirectOutput)
+            startupInfo.dwFlags |= STARTF_USESTDHANDLES;
+        
+        if(inOutCommandInfo->RedirectInput)
+            startupInfo.hStdInput = inOutCommandInfo->ParentToChildPipes[SYSTEM2_FD_READ];
+        else
+            startupInfo.hStdInput = GetStdHandle(STD_INPUT_HANDLE);;
+        
+        if(inOutCommandInfo->RedirectOutput)
+        {
+            startupInfo.hStdOutput = inOutCommandInfo->ChildToParentPipes[SYSTEM2_FD_WRITE];
+            startupInfo.hStdError =     inOutCommandInfo->StandaloneStderr ?
+                                        inOutCommandInfo->ChildToParentPipesErr[SYSTEM2_FD_WRITE] :
+                                        inOutCommandInfo->ChildToParentPipes[SYSTEM2_FD_WRITE];
+        }
+        else
+        {
+            startupInfo.hStdError = GetStdHandle(STD_ERROR_HANDLE);
+            startupInfo.hStdOutput = GetStdHandle(STD_OUTPUT_HANDLE);
+        }
+        
+        //Join and escape each argument together, then run it
+        {
+            //Calculating final command count
+            int finalCommandSize = 0;
+            
+            const char** concatedArgs = (const char**)calloc(argsCount + 1, sizeof(char*));
+            concatedArgs[0] = executable;
+            for(int i = 0; i < argsCount; ++i)
+                concatedArgs[i + 1] = args[i];
+            
+            finalCommandSize = ConstructCommandLineWindows( concatedArgs, 
+                                                            argsCount + 1, 
+                                                            inOutCommandInfo->DisableEscapes,
+                                                            0, 
+                                                            NULL);
+            
+            if(finalCommandSize < 0)
+            {
+                free(concatedArgs);
+                return SYSTEM2_RESULT_COMMAND_CONSTRUCT_FAILED;
+            }
+            
+            char* commandCopy = (char*)malloc(finalCommandSize);
+            if(commandCopy == NULL)
+            {
+                free(concatedArgs);
+                return SYSTEM2_RESULT_COMMAND_CONSTRUCT_FAILED;
+            }
+            
+            int wroteSize = ConstructCommandLineWindows(concatedArgs, 
+                                                        argsCount + 1, 
+                                                        inOutCommandInfo->DisableEscapes, 
+                                                        finalCommandSize, 
+                                                        commandCopy);
+            
+            free((void*)concatedArgs);
+            
+            if(wroteSize != finalCommandSize)
+            {
+                printf( "wroteSize and finalCommandSize mismatch, %d, %d\n", 
+                        wroteSize, 
+                        finalCommandSize);
+                
+                return SYSTEM2_RESULT_COMMAND_CONSTRUCT_FAILED;
+            }
+            
+            //Construct final command
+            int wideCommandSize = 0;
+            wchar_t* commandCopyWide = NULL;
+            SYSTEM2_RESULT result = Internal_System2Utf8ToUtf16(commandCopy, 
+                                                                finalCommandSize,
+                                                                &commandCopyWide,
+                                                                &wideCommandSize);
+            if(result != SYSTEM2_RESULT_SUCCESS)
+                return result;
+            
+            free(commandCopy);
+            
+            //Convert working directory to wide chars
+            wchar_t* workingDirectoryWide = NULL;
+            int wideWorkingWideDirSize = 0;
+            if(inOutCommandInfo->RunDirectory != NULL)
+            {
+                result = 
+                    Internal_System2Utf8ToUtf16(inOutCommandInfo->RunDirectory, 
+                                                (int)strlen(inOutCommandInfo->RunDirectory) + 1,
+                                                &workingDirectoryWide,
+                                                &wideWorkingWideDirSize);
+                
+                if(result != SYSTEM2_RESULT_SUCCESS)
+                {
+                    free(commandCopyWide);
+                    return result;
+                }
+            }
+            
+            wchar_t* allEnvVarsW = NULL;
+            int allEnvVarsWCount = 0;
+            if(inOutCommandInfo->EnvVarsNames)
+            {
+                char* allEnvVars = NULL;
+                size_t charsCount = 0;
+                size_t charsIndex = 0;
+                
+                int curEnvCounts;
+                void* res;
+                result = System2GetEnvironmentVariablesCount(&curEnvCounts, &res);
+                if(result != SYSTEM2_RESULT_SUCCESS)
+                    return SYSTEM2_RESULT_CREATE_CHILD_PROCESS_FAILED;
+                
+                charsCount = (curEnvCounts + inOutCommandInfo->EnvVarsCount) * 16;
+                allEnvVars = (char*)calloc(charsCount, sizeof(char));
+                
+                bool* newUserEntries = (bool*)malloc(inOutCommandInfo->EnvVarsCount * sizeof(bool));
+                memset(newUserEntries, 1, inOutCommandInfo->EnvVarsCount * sizeof(bool));
+                
+                #define ENSURE_SIZE(sizeNeeded) \
+                    do \
+                    { \
+                        if(charsCount - charsIndex < sizeNeeded) \
+                        { \
+                            char* newMem = (char*)realloc(allEnvVars, charsCount + sizeNeeded); \
+                            if(!newMem) \
+                            { \
+                                free(allEnvVars); \
+                                free(newUserEntries); \
+                                free(workingDirectoryWide); \
+                                free(commandCopyWide); \
+                                return SYSTEM2_RESULT_MALLOC_FAILED; \
+                            } \
+                            allEnvVars = newMem; \
+                            charsCount += sizeNeeded; \
+                        } \
+                    } \
+                    while(0)
+                
+                //Add the current existing env vars first
+                for(int i = 0; i < curEnvCounts; ++i)
+                {
+                    const char* envName;
+                    int envNameLength;
+                    const char* envValue;
+                    int envValueLength;
+                    result = System2GetEnvironmentVariable( res, 
+                                                            &envName, 
+                                                            &envNameLength,
+                                                            &envValue,
+                                                            &envValueLength,
+                                                            i);
+                    if(result != SYSTEM2_RESULT_SUCCESS)
+                        continue;
+                    
+                    //See if the current existing environment variable is mentioned from the user
+                    bool skipThis = false;
+                    for(int j = 0; j < inOutCommandInfo->EnvVarsCount; ++j)
+                    {
+                        if(envNameLength != (int)strlen(inOutCommandInfo->EnvVarsNames[j]))
+                            continue;
+                        
+                        if(memcmp(envName, inOutCommandInfo->EnvVarsNames[j], envNameLength) == 0)
+                        {
+                            skipThis = true;
+                            newUserEntries[j] = false;
+                            
+                            if(inOutCommandInfo->EnvVarsValues[j])
+                            {
+                                //+2 for `=` & `\0`
+                                size_t entrySize =  envNameLength + 
+                                                    strlen(inOutCommandInfo->EnvVarsValues[j]) + 2;
+                                ENSURE_SIZE(entrySize);
+                                snprintf(   allEnvVars + charsIndex, 
+                                            entrySize, 
+                                            "%.*s=%s", 
+                                            envNameLength, 
+                                            envName, 
+                                            inOutCommandInfo->EnvVarsValues[j]);
+                                charsIndex += entrySize;
+                            }
+                            break;
+                        }
+                    }
+                    
+                    if(skipThis)
+                        continue;
+                    
+                    //If the user did not mention this, add it to the envp (+2 for `=` & `\0`)
+                    size_t entrySize = envNameLength + envValueLength + 2;
+                    ENSURE_SIZE(entrySize);
+                    snprintf(   allEnvVars + charsIndex, 
+                                entrySize, 
+                                "%.*s=%.*s", 
+                                envNameLength, 
+                                envName, 
+                                envValueLength,
+                                envValue);
+                    charsIndex += entrySize;
+                } //for(int i = 0; i < curEnvCounts; ++i)
+                
+                //Then add the user defined ones
+                for(int i = 0; i < inOutCommandInfo->EnvVarsCount; ++i)
+                {
+                    if(!newUserEntries[i])
+                        continue;
+                    
+                    size_t entrySize =  strlen(inOutCommandInfo->EnvVarsNames[i]) + 
+                                        strlen(inOutCommandInfo->EnvVarsValues[i]) + 2;
+                    ENSURE_SIZE(entrySize);
+                    snprintf(   allEnvVars + charsIndex, 
+                                entrySize, 
+                                "%s=%s", 
+                                inOutCommandInfo->EnvVarsNames[i],
+                                inOutCommandInfo->EnvVarsValues[i]);
+                    charsIndex += entrySize;
+                }
+                
+                //Append \0 as a safety net in case one of the sentence is not ending with \0
+                ENSURE_SIZE(charsIndex + 2);
+                allEnvVars[charsIndex++] = '\0';
+                allEnvVars[charsIndex++] = '\0';
+                
+                
+                #undef ENSURE_SIZE
+                result = Internal_System2Utf8ToUtf16(   allEnvVars, 
+                                                        (int)charsIndex,
+                                                        &allEnvVarsW,
+                                                        &allEnvVarsWCount);
+                //Free stuff
+                free(newUserEntries);
+                System2EnvironmentVariableFree(&res);
+                free(allEnvVars);
+                
+                //Return if unicode conversion failed
+                if(result != SYSTEM2_RESULT_SUCCESS)
+                    return result;
+            } //if(inOutCommandInfo->EnvVarsNames)
+            
+            success = CreateProcessW(   NULL, 
+                                        commandCopyWide,                //command line 
+                                        //L"PrintArgs.exe a\\\\b d\"e f\"g h",
+                                        NULL,                           //process securitye attributes 
+                                        NULL,                           //primary thread security attributes 
+                                        TRUE,                           //handles are inherited 
+                                        CREATE_UNICODE_ENVIRONMENT,     //creation flags 
+                                        allEnvVarsW,                    //environment vars
+                                        workingDirectoryWide,           //use parent's current directory 
+                                        &startupInfo,                   //STARTUPINFO pointer 
+                                        &processInfo);                  //receives PROCESS_INFORMATION 
+            free(commandCopyWide);
+            free(workingDirectoryWide);
+            free(allEnvVarsW);
+        }
+        
+        //If an error occurs, exit the application. 
+        if(!success)
+        {
+            PrintError("CreateProcessW");
+            return SYSTEM2_RESULT_CREATE_CHILD_PROCESS_FAILED;
+        }
+        else 
+        {
+            //Close handles to the child process and its primary thread.
+            //Some applications might keep these handles to monitor the status
+            //of the child process, for example. 
+            inOutCommandInfo->ChildProcessHandle = processInfo.hProcess;
+            
+            //Close handles to the stdin and stdout pipes no longer needed by the child process.
+            //If they are not explicitly closed, there is no way to recognize that the child process has ended.
+            if(!CloseHandle(processInfo.hThread))
+                return SYSTEM2_RESULT_CREATE_CHILD_PROCESS_FAILED;
+
+            if(inOutCommandInfo->ChildToParentPipes[SYSTEM2_FD_WRITE])
+            {
+                if(!CloseHandle(inOutCommandInfo->ChildToParentPipes[SYSTEM2_FD_WRITE]))
+                    return SYSTEM2_RESULT_PIPE_FD_CLOSE_FAILED;
+            }
+            
+            if(inOutCommandInfo->ChildToParentPipesErr[SYSTEM2_FD_WRITE])
+            {
+                if(!CloseHandle(inOutCommandInfo->ChildToParentPipesErr[SYSTEM2_FD_WRITE]))
+                    return SYSTEM2_RESULT_PIPE_FD_CLOSE_FAILED;
+            }
+            
+            if(inOutCommandInfo->ParentToChildPipes[SYSTEM2_FD_READ])
+            {
+                if(!CloseHandle(inOutCommandInfo->ParentToChildPipes[SYSTEM2_FD_READ]))
+                    return SYSTEM2_RESULT_PIPE_FD_CLOSE_FAILED;
+            }
+
+            return SYSTEM2_RESULT_SUCCESS;
+        }
+    }
+    
+    SYSTEM2_FUNC_PREFIX 
+    SYSTEM2_RESULT System2RunSubprocessWindows( const char* executable,
+                                                const char* const* args,
+                                                int argsCount,
+                                                System2CommandInfo* inOutCommandInfo)
+    {
+        if(!executable || !inOutCommandInfo)
+            return SYSTEM2_RESULT_INVALID_ARGUMENT;
+        
+        if(inOutCommandInfo->InputBuffer)
+            return SYSTEM2_RESULT_INPUT_BUFFER_NOT_SUPPORTED;
+        
+        if(inOutCommandInfo->CaptureOutputToFile)
+            return SYSTEM2_RESULT_CAPTURE_FILE_NOT_SUPPORTED;
+        
+        if(inOutCommandInfo->UsePty)
+            return SYSTEM2_RESULT_PTY_NOT_SUPPORTED;
+        
+        if( inOutCommandInfo->FirstOutputTimeoutMs > 0 || 
+            inOutCommandInfo->OutputGapTimeoutMs > 0 || 
+            inOutCommandInfo->InputClosedTimeoutMs > 0)
+        {
+            return SYSTEM2_RESULT_WATCHDOG_NOT_SUPPORTED;
+        }
+        
+        SYSTEM2_RESULT result = Internal_System2CreateCommandState(inOutCommandInfo);
+        if(result != SYSTEM2_RESULT_SUCCESS)
+            return result;
+        
+        result = Internal_System2RunSubprocessWindows(executable, args, argsCount, inOutCommandInfo);
+        if(result != SYSTEM2_RESULT_SUCCESS)
+        {
+            Internal_System2FreeCommandState(inOutCommandInfo->InternalState);
+            inOutCommandInfo->InternalState = NULL;
+        }
+        
+        return result;
+    }
+    
+    SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2RunWindows(   const char* command, 
+                                                            System2CommandInfo* outCommandInfo)
+    {
+        const char* args[] = {"/s", "/v", "/c", command};
+        outCommandInfo->DisableEscapes = true;
+        return System2RunSubprocessWindows( "cmd", 
+                                            args, 
+                                            sizeof(args) / sizeof(char*), 
+                                            outCommandInfo);
+    }
+    
+    SYSTEM2_FUNC_PREFIX 
+    SYSTEM2_RESULT System2RunManyWindows(   const System2SpawnSpec* specs,
+                                            int count,
+                                            System2CommandInfo* inOutCommandInfos,
+                                            SYSTEM2_RESULT* outResults)
+    {
+        if(!specs || count < 0 || (count > 0 && (!inOutCommandInfos || !outResults)))
+            return SYSTEM2_RESULT_INVALID_ARGUMENT;
+        
+        //CreateProcess() doesn't copy the parent, so they are just started one by one
+        SYSTEM2_RESULT firstFailedResult = SYSTEM2_RESULT_SUCCESS;
+        for(int i = 0; i < count; ++i)
+        {
+            System2CommandInfo* commandInfo = &inOutCommandInfos[i];
+            uint64_t beginTimestamp = Internal_System2InstrumentBegin(  SYSTEM2_OPERATION_SPAWN, 
+                                                                        commandInfo);
+            SYSTEM2_RESULT result;
+            if(specs[i].Command)
+                result = System2RunWindows(specs[i].Command, commandInfo);
+            else if(!specs[i].Executable)
+                result = SYSTEM2_RESULT_INVALID_ARGUMENT;
+            else
+            {
+                result = System2RunSubprocessWindows(   specs[i].Executable, 
+                                                        specs[i].Args, 
+                                                        specs[i].ArgsCount, 
+                                                        commandInfo);
+            }
+            
+            Internal_System2InstrumentEnd(  SYSTEM2_OPERATION_SPAWN, 
+                                            commandInfo, 
+                                            beginTimestamp, 
+                                            result, 
+                                            0);
+            outResults[i] = result;
+            if(firstFailedResult == SYSTEM2_RESULT_SUCCESS)
+                firstFailedResult = result;
+        }
+        
+        return firstFailedResult;
+    }
+    
+    //TODO: UTF-8 output?
+    //TODO: Use peeknamedpipe to get number of bytes available before reading it 
+    //      so that it doesn't block
+    //https://learn.microsoft.com/en-us/windows/win32/api/namedpipeapi/nf-namedpipeapi-peeknamedpipe
+    //Same as `Internal_System2ReadFromOutputPosix()`
+    SYSTEM2_FUNC_PREFIX 
+    SYSTEM2_RESULT Internal_System2ReadFromOutputWindows(   const System2CommandInfo* info, 
+                                                            bool readStderr,
+                                                            bool returnOnData,
+                                                            char* outputBuffer, 
+                                                            uint32_t outputBufferSize,
+                                                            uint32_t* outBytesRead)
+    {
+        if(!info || !outputBuffer || !outBytesRead || !info->RedirectOutput)
+            return SYSTEM2_RESULT_INVALID_ARGUMENT;
+        
+        if(readStderr && !info->StandaloneStderr)
+            return SYSTEM2_RESULT_INVALID_ARGUMENT;
+        
+        DWORD readResult;
+        BOOL bSuccess;
+        *outBytesRead = 0;
+        
+        while (true)
+        {
+            bSuccess = ReadFile(( 
+                                    readStderr ?
+                                    info->ChildToParentPipesErr[SYSTEM2_FD_READ] :
+                                    info->ChildToParentPipes[SYSTEM2_FD_READ] 
+                                ),
+                                outputBuffer, 
+                                outputBufferSize - *outBytesRead, 
+                                &readResult, 
+                                NULL);
+
+            if (readResult == 0)
+                break;
+            
+            if(!bSuccess)
+                return SYSTEM2_RESULT_READ_FAILED;
+            
+            outputBuffer += readResult;
+            *outBytesRead += readResult;
+            
+            if(returnOnData || outputBufferSize - *outBytesRead == 0)
+                return SYSTEM2_RESULT_READ_NOT_FINISHED;
+        }
+
+        //if(GetLastError() == ERROR_BROKEN_PIPE)
+        //    return SYSTEM2_RESULT_SUCCESS;
+        
+        //return SYSTEM2_RESULT_READ_FAILED;
+        return SYSTEM2_RESULT_SUCCESS;
+    }
+    
+    SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2ReadFromOutputWindows(const System2CommandInfo* info, 
+                                                                    bool readStderr,
+                                                                    char* outputBuffer, 
+                                                                    uint32_t outputBufferSize,
+                                                                    uint32_t* outBytesRead)
+    {
+        return Internal_System2ReadFromOutputWindows(   info, 
+                                                        readStderr, 
+                                                        false, 
+                                                        outputBuffer, 
+                                                        outputBufferSize, 
+                                                        outBytesRead);
+    }
+    
+    SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2WriteToInputWindows(  const System2CommandInfo* info, 
+                                                                    const char* inputBuffer, 
+                                                                    const uint32_t inputBufferSize)
+    {
+        if(!info || !inputBuffer || !info->RedirectInput)
+            return SYSTEM2_RESULT_INVALID_ARGUMENT;
+        
+        DWORD currentWriteLengthLeft = inputBufferSize;
+        BOOL bSuccess;
+
+        while (true)
+        {
+            DWORD writeResult;
+
+            bSuccess = WriteFile(   info->ParentToChildPipes[SYSTEM2_FD_WRITE], 
+                                    inputBuffer, 
+                                    currentWriteLengthLeft, 
+                                    &writeResult, 
+                                    NULL);
+
+            if (!bSuccess)
+                return SYSTEM2_RESULT_WRITE_FAILED;
+
+            inputBuffer += writeResult;
+            currentWriteLengthLeft -= writeResult;
+
+            if (currentWriteLengthLeft == 0)
+                break;
+        }
+
+        return SYSTEM2_RESULT_SUCCESS;
+    }
+    
+    SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2CloseInputWindows(System2CommandInfo* info)
+    {
+        if(!info || !info->RedirectInput || !info->ParentToChildPipes[SYSTEM2_FD_WRITE])
+            return SYSTEM2_RESULT_INVALID_ARGUMENT;
+        
+        HANDLE inputHandle = info->ParentToChildPipes[SYSTEM2_FD_WRITE];
+        
+        //Marked as closed for `System2CleanupCommand()`
+        info->ParentToChildPipes[SYSTEM2_FD_WRITE] = NULL;
+        if(!CloseHandle(inputHandle))
+            return SYSTEM2_RESULT_PIPE_FD_CLOSE_FAILED;
+        
+        return SYSTEM2_RESULT_SUCCESS;
+    }
+    
+    SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2CleanupCommandWindows(const System2CommandInfo* info)
+    {
+        if(!info)
+            return SYSTEM2_RESULT_INVALID_ARGUMENT;
+        
+        Internal_System2FreeCommandState(info->InternalState);
+        
+        if(info->ChildToParentPipes[SYSTEM2_FD_READ])
+        {
+            if(!CloseHandle(info->ChildToParentPipes[SYSTEM2_FD_READ]))
+                return SYSTEM2_RESULT_PIPE_FD_CLOSE_FAILED;
+        }
+        
+        if(info->ChildToParentPipesErr[SYSTEM2_FD_READ])
+        {
+            if(!CloseHandle(info->ChildToParentPipesErr[SYSTEM2_FD_READ]))
+                return SYSTEM2_RESULT_PIPE_FD_CLOSE_FAILED;
+        }
+        
+        if(info->ParentToChildPipes[SYSTEM2_FD_WRITE])
+        {
+            if(!CloseHandle(info->ParentToChildPipes[SYSTEM2_FD_WRITE]))
+                return SYSTEM2_RESULT_PIPE_FD_CLOSE_FAILED;
+        }
+
+        CloseHandle(info->ChildProcessHandle);
+        return SYSTEM2_RESULT_SUCCESS;
+    }
+    
+    SYSTEM2_FUNC_PREFIX 
+    SYSTEM2_RESULT System2GetCommandReturnValueWindows( const System2CommandInfo* info, 
+                                                        int timeoutSec,
+                                                        int* outReturnCode)
+    {
+        if(!info || !outReturnCode)
+            return SYSTEM2_RESULT_INVALID_ARGUMENT;
+        
+        DWORD exitCode;
+        if(!GetExitCodeProcess(info->ChildProcessHandle, &exitCode))
+            return SYSTEM2_RESULT_COMMAND_WAIT_FAILED;
+        
+        if(exitCode == STILL_ACTIVE)
+        {
+            DWORD waitResult = WaitForSingleObject( info->ChildProcessHandle, 
+                                                    timeoutSec >= 0 ? timeoutSec * 1000 : INFINITE);
+            if(waitResult == WAIT_OBJECT_0)
+            {
+                if(!GetExitCodeProcess(info->ChildProcessHandle, &exitCode))
+                    return SYSTEM2_RESULT_COMMAND_WAIT_FAILED;
+            }
+            else if(waitResult == WAIT_TIMEOUT)
+                return SYSTEM2_RESULT_COMMAND_NOT_FINISHED;
+            else
+                return SYSTEM2_RESULT_COMMAND_WAIT_FAILED;
+        }
+        
+        *outReturnCode = exitCode;
+        return SYSTEM2_RESULT_SUCCESS;
+    }
+    
+    SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2KillWindows(const System2CommandInfo* info)
+    {
+        if(!info)
+            return SYSTEM2_RESULT_INVALID_ARGUMENT;
+        
+        if(TerminateProcess(info->ChildProcessHandle, 137) != 0)
+            return SYSTEM2_RESULT_SUCCESS;
+        else
+            return SYSTEM2_RESULT_KILL_FAILED;
+        
+    }
+    
+    typedef LONG (NTAPI* Internal_System2NtProcessFunction)(HANDLE process);
+    
+    //Calls `NtSuspendProcess()` or `NtResumeProcess()`, which suspend or resume all the threads
+    SYSTEM2_FUNC_PREFIX bool Internal_System2SuspendProcessWindows(HANDLE process, bool suspend)
+    {
+        HMODULE ntdll = GetModuleHandleW(L"ntdll.dll");
+        if(!ntdll)
+            return false;
+        
+        FARPROC function = GetProcAddress(ntdll, suspend ? "NtSuspendProcess" : "NtResumeProcess");
+        if(!function)
+            return false;
+        
+        return ((Internal_System2NtProcessFunction)(void*)function)(process) >= 0;
+    }
+    
+    SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2PauseWindows(const System2CommandInfo* info)
+    {
+        if(!info)
+            return SYSTEM2_RESULT_INVALID_ARGUMENT;
+        
+        if(!Internal_System2SuspendProcessWindows(info->ChildProcessHandle, true))
+            return SYSTEM2_RESULT_PAUSE_FAILED;
+        
+        return SYSTEM2_RESULT_SUCCESS;
+    }
+    
+    SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2ResumeWindows(const System2CommandInfo* info)
+    {
+        if(!info)
+            return SYSTEM2_RESULT_INVALID_ARGUMENT;
+        
+        if(!Internal_System2SuspendProcessWindows(info->ChildProcessHandle, false))
+            return SYSTEM2_RESULT_RESUME_FAILED;
+        
+        return SYSTEM2_RESULT_SUCCESS;
+    }
+    
+    //Anonymous pipes can't be waited on, so this checks them with PeekNamedPipe() periodically
+    SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2PollWindows(  System2CommandInfo** commands, 
+                                                            int commandsCount, 
+                                                            int timeoutMs,
+                                                            bool returnOnExit)
+    {
+        if(!commands || commandsCount < 0)
+            return SYSTEM2_RESULT_INVALID_ARGUMENT;
+        
+        for(int i = 0; i < commandsCount; ++i)
+        {
+            if(!commands[i])
+                return SYSTEM2_RESULT_INVALID_ARGUMENT;
+        }
+        
+        ULONGLONG startTime = GetTickCount64();
+        while(true)
+        {
+            bool anyPending = false;
+            bool anyProgress = false;
+            bool anyExitReported = false;
+            
+            for(int i = 0; i < commandsCount; ++i)
+            {
+                System2CommandInfo* info = commands[i];
+                struct Internal_System2CommandState* state = info->InternalState;
+                if(!state || state->ExitReported)
+                    continue;
+                
+                bool outputPending = false;
+                for(int streamIndex = 0; streamIndex < 2; ++streamIndex)
+                {
+                    if( !Internal_System2IsPolledStream(info, streamIndex) || 
+                        state->OutputFinished[streamIndex])
+                    {
+                        continue;
+                    }
+                    
+                    HANDLE pipe =   streamIndex == 0 ? 
+                                    info->ChildToParentPipes[SYSTEM2_FD_READ] :
+                                    info->ChildToParentPipesErr[SYSTEM2_FD_READ];
+                    
+                    DWORD bytesAvailable = 0;
+                    DWORD bytesRead = 0;
+                    BOOL success = PeekNamedPipe(pipe, NULL, 0, NULL, &bytesAvailable, NULL);
+                    if(success && bytesAvailable > 0)
+                    {
+                        success = ReadFile( pipe, 
+                                            state->CallbackBuffer, 
+                                            bytesAvailable < state->CallbackChunkSize ? 
+                                                bytesAvailable : 
+                                                state->CallbackChunkSize, 
+                                            &bytesRead, 
+                                            NULL);
+                    }
+                    
+                    if(!success)
+                    {
+                        if(GetLastError() != ERROR_BROKEN_PIPE)
+                            return SYSTEM2_RESULT_READ_FAILED;
+                        
+                        state->OutputFinished[streamIndex] = true;
+                        anyProgress = true;
+                        continue;
+                    }
+                    
+                    if(bytesRead > 0)
+                    {
+                        System2OutputCallback callback =    streamIndex == 0 ? 
+                                                            info->OnStdout : 
+                                                            info->OnStderr;
+                        callback(info->CallbackUserData, state->CallbackBuffer, bytesRead);
+                        anyProgress = true;
+                    }
+                    
+                    outputPending = true;
+                }
+                
+                //Only report the exit after all the output
+                if(outputPending)
+                {
+                    anyPending = true;
+                    continue;
+                }
+                
+                if(!info->OnExit)
+                    continue;
+                
+                DWORD waitResult = WaitForSingleObject(info->ChildProcessHandle, 0);
+                if(waitResult == WAIT_TIMEOUT)
+                {
+                    anyPending = true;
+                    continue;
+                }
+                
+                DWORD exitCode;
+                if(waitResult != WAIT_OBJECT_0 || !GetExitCodeProcess(info->ChildProcessHandle, &exitCode))
+                    return SYSTEM2_RESULT_COMMAND_WAIT_FAILED;
+                
+                state->ExitReported = true;
+                info->OnExit(info->CallbackUserData, (int)exitCode, false);
+                anyProgress = true;
+                anyExitReported = true;
+            }
+            
+            if(!anyPending)
+                return SYSTEM2_RESULT_SUCCESS;
+            
+            if(returnOnExit && anyExitReported)
+                return SYSTEM2_RESULT_COMMAND_NOT_FINISHED;
+            
+            if(anyProgress)
+                continue;
+            
+            if(timeoutMs >= 0 && GetTickCount64() - startTime >= (ULONGLONG)timeoutMs)
+                return SYSTEM2_RESULT_COMMAND_NOT_FINISHED;
+            
+            Sleep(1);
+        }
+    }
+    
+    typedef struct Internal_System2EnumStatus
+    {
+        DWORD TargetProcessId;
+        bool Found;
+    } Internal_System2EnumStatus;
+    
+    static BOOL CALLBACK Internal_System2EnumWindowsProc(HWND hwnd, LPARAM lParam)
+    {
+        DWORD processId;
+        GetWindowThreadProcessId(hwnd, &processId);
+
+        if(((Internal_System2EnumStatus*)lParam)->TargetProcessId == processId)
+        {
+            PostMessage(hwnd, WM_CLOSE, 0, 0);
+            ((Internal_System2EnumStatus*)lParam)->Found = true;
+        }
+        return true;
+    }
+
+    SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2TermWindows(const System2CommandInfo* info)
+    {
+        if(!info)
+            return SYSTEM2_RESULT_INVALID_ARGUMENT;
+        
+        Internal_System2EnumStatus enumStatus;
+        memset(&enumStatus, 0, sizeof(Internal_System2EnumStatus));
+        enumStatus.TargetProcessId = GetProcessId(info->ChildProcessHandle);
+        if(!enumStatus.TargetProcessId)
+            return SYSTEM2_RESULT_TERM_FAILED;
+        
+        EnumWindows(&Internal_System2EnumWindowsProc, (LPARAM)&enumStatus);
+        if(enumStatus.Found)
+            return SYSTEM2_RESULT_SUCCESS;
+        
+        //If we haven't found any windows associates with the process, try again with its children if
+        //it is cmd.exe
+        {
+            HANDLE snapshotHandle = CreateToolhelp32Snapshot(TH32CS_SNAPPROCESS, 0);
+            if(!snapshotHandle)
+                return SYSTEM2_RESULT_WINDOWS_TERM_NO_WINDOW;
+            
+            PROCESSENTRY32 pe32;
+            pe32.dwSize = sizeof(PROCESSENTRY32);
+            if(Process32First(snapshotHandle, &pe32) == 0)
+            {
+                CloseHandle(snapshotHandle);
+                return SYSTEM2_RESULT_WINDOWS_TERM_NO_WINDOW;
+            }
+            
+            bool isCmd = false;
+            bool found = false;
+            int childCap = 4;
+            DWORD* childProcessesIds = (DWORD*)malloc(sizeof(DWORD) * childCap);
+            if(!childProcessesIds)
+            {
+                CloseHandle(snapshotHandle);
+                free(childProcessesIds);
+                return SYSTEM2_RESULT_MALLOC_FAILED;
+            }
+            int childCount = 0;
+            
+            do
+            {
+                if(pe32.th32ProcessID == enumStatus.TargetProcessId)
+                {
+                    if(strcmp(pe32.szExeFile, "cmd.exe") == 0)
+                        isCmd = true;
+                    found = true;
+                }
+                else if(pe32.th32ParentProcessID == enumStatus.TargetProcessId)
+                {
+                    if(childCount + 1 > childCap)
+                    {
+                        DWORD* tmp = (DWORD*)realloc(childProcessesIds, childCap * 2);
+                        if(!tmp)
+                        {
+                            CloseHandle(snapshotHandle);
+                            free(childProcessesIds);
+                            return SYSTEM2_RESULT_MALLOC_FAILED;
+                        }
+                        childProcessesIds = tmp;
+                    }
+                    childProcessesIds[childCount++] = pe32.th32ProcessID;
+                }
+            }
+            while(Process32Next(snapshotHandle, &pe32));
+            CloseHandle(snapshotHandle);
+            
+            //It is running under cmd, try closing the child instead
+            {
+                if(!isCmd)
+                {
+                    free(childProcessesIds);
+                    return SYSTEM2_RESULT_WINDOWS_TERM_NO_WINDOW;
+                }
+                
+                bool closedSomething = false;
+                for(int i = 0; i < childCount; ++i)
+                {
+                    enumStatus.TargetProcessId = childProcessesIds[i];
+                    EnumWindows(&Internal_System2EnumWindowsProc, (LPARAM)&enumStatus);
+                    if(enumStatus.Found)
+                        closedSomething = true;
+                }
+                free(childProcessesIds);
+                if(closedSomething)
+                    return SYSTEM2_RESULT_SUCCESS;
+                else
+                    return SYSTEM2_RESULT_WINDOWS_TERM_NO_WINDOW;
+            }
+        }
+    }
+    
+    SYSTEM2_FUNC_PREFIX char* Internal_System2GetEnvStringWindows()
+    {
+        wchar_t* envStrings = GetEnvironmentStringsW();
+        wchar_t* envStringsStart = envStrings;
+        int strCount = 0;
+        
+        while(*envStrings != L'\0' || *(envStrings + 1) != L'\0')
+        {
+            ++strCount;
+            ++envStrings;
+        }
+        strCount += 2;
+        
+        int requiredBytes = WideCharToMultiByte(CP_UTF8, 
+                                                0, 
+                                                envStringsStart, 
+                                                strCount, 
+                                                NULL, 
+                                                0, 
+                                                NULL, 
+                                                NULL);
+        if(requiredBytes <= 0)
+        {
+            FreeEnvironmentStringsW(envStringsStart);
+            return NULL;
+        }
+        
+        char* utf8EnvString = (char*)malloc(requiredBytes);
+        if(!utf8EnvString)
+        {
+            FreeEnvironmentStringsW(envStringsStart);
+            return NULL;
+        }
+        memset(utf8EnvString, 0, requiredBytes);
+        
+        int allocatedBytes = WideCharToMultiByte(   CP_UTF8, 
+                                                    0, 
+                                                    envStringsStart, 
+                                                    strCount, 
+                                                    utf8EnvString, 
+                                                    requiredBytes, 
+                                                    NULL, 
+                                                    NULL);
+        if(allocatedBytes <= 0)
+        {
+            FreeEnvironmentStringsW(envStringsStart);
+            free(utf8EnvString);
+            return NULL;
+        }
+        return utf8EnvString;
+    }
+    
+    SYSTEM2_FUNC_PREFIX 
+    SYSTEM2_RESULT System2GetEnvironmentVariablesCountWindows(int* outCount, void** outResource)
+    {
+        if(!outCount || !outResource)
+            return SYSTEM2_RESULT_INVALID_ARGUMENT;
+        
+        *outResource = NULL;
+        char* utf8EnvStringStart = Internal_System2GetEnvStringWindows();
+        if(!utf8EnvStringStart)
+            return SYSTEM2_RESULT_COMMAND_CONSTRUCT_FAILED;
+        
+        char* utf8EnvStrings = utf8EnvStringStart;
+        if(*utf8EnvStrings == '\0' && *(utf8EnvStrings + 1) == '\0')
+        {
+            *outCount = 0;
+            free(utf8EnvStringStart);
+            return SYSTEM2_RESULT_SUCCESS;
+        }
+        *outResource = utf8EnvStringStart;
+        *outCount = 0;
+        
+        /*
+        Each environment block contains the environment variables in the following format:
+
+        Var1=Value1\0
+        Var2=Value2\0
+        Var3=Value3\0
+        ...
+        VarN=ValueN\0\0
+        */
+        while(*utf8EnvStrings != '\0' || *(utf8EnvStrings + 1) != '\0')
+        {
+            if(*utf8EnvStrings == '\0')
+                ++(*outCount);
+            ++utf8EnvStrings;
+        }
+        
+        return SYSTEM2_RESULT_SUCCESS;
+    }
+    
+    SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2GetEnvironmentVariableWindows(const void* resource,
+                                                                            const char** outName,
+                                                                            int* outNameLength,
+                                                                            const char** outValue,
+                                                                            int* outValueLength,
+                                                                            int index)
+    {
+        if(!outName || !outNameLength || !outValue || !outValueLength || !resource)
+            return SYSTEM2_RESULT_INVALID_ARGUMENT;
+        
+        static const char* lastResource = NULL;
+        static int lastIndex = 0;
+        static char* lastEnv = NULL;
+        
+        bool canUseCache = resource == lastResource && lastEnv && index > lastIndex;
+        
+        const char* envStringsStart = (const char*)resource;
+        char* envStrings = canUseCache ? lastEnv : (char*)envStringsStart;
+        int currentIndex = canUseCache ? lastIndex : 0;
+        
+        lastResource = (const char*)resource;
+        do
+        {
+            if(currentIndex == index)
+            {
+                lastEnv = envStrings;
+                lastIndex = index;
+                
+                *outName = envStrings;
+                char* equal = envStrings;
+                while(equal)
+                {
+                    if(*equal == '=')
+                        break;
+                    ++equal;
+                }
+                *outNameLength = (int)(equal - envStrings);
+                
+                envStrings = equal + 1;
+                *outValue = envStrings;
+                while(*envStrings)
+                    ++envStrings;
+                
+                *outValueLength = (int)(envStrings - (equal + 1));
+                break;
+            }
+            
+            if(*envStrings == '\0')
+                ++currentIndex;
+            ++envStrings;
+        }
+        while(*envStrings != '\0' || *(envStrings + 1) != '\0');
+        
+        return SYSTEM2_RESULT_SUCCESS;
+    }
+    
+    SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2EnvironmentVariableFreeWindows(void** resource)
+    {
+        if(!resource)
+            return SYSTEM2_RESULT_INVALID_ARGUMENT;
+        
+        if(!(*resource))
+            return SYSTEM2_RESULT_SUCCESS;
+        
+        free(*resource);
+        *resource = NULL;
+        return SYSTEM2_RESULT_SUCCESS;
+    }
+    
+    SYSTEM2_FUNC_PREFIX
+    SYSTEM2_RESULT System2SetEnvironmentVariableWindows(const char* envName, const char* envValue)
+    {
+        if(!envName)
+            return SYSTEM2_RESULT_INVALID_ARGUMENT;
+        
+        wchar_t* envNameW;
+        int envNameWLen;
+        SYSTEM2_RESULT result = Internal_System2Utf8ToUtf16(envName, 
+                                                            (int)strlen(envName) + 1, 
+                                                            &envNameW, 
+                                                            &envNameWLen);
+        if(result != SYSTEM2_RESULT_SUCCESS)
+            return result;
+        
+        if(envValue)
+        {
+            wchar_t* envValueW;
+            int envValueWLen;
+            result = Internal_System2Utf8ToUtf16(   envValue, 
+                                                    (int)strlen(envValue) + 1, 
+                                                    &envValueW, 
+                                                    &envValueWLen);
+            if(result != SYSTEM2_RESULT_SUCCESS)
+            {
+                free(envNameW);
+                return result;
+            }
+            
+            if(SetEnvironmentVariableW(envNameW, envValueW) == 0)
+            {
+                free(envNameW);
+                free(envValueW);
+                return SYSTEM2_RESULT_WINDOWS_SET_ENV_FAILED;
+            }
+            free(envValueW);
+        }
+        else
+        {
+            if(SetEnvironmentVariableW(envNameW, NULL) == 0)
+            {
+                free(envNameW);
+                return SYSTEM2_RESULT_WINDOWS_SET_ENV_FAILED;
+            }
+        }
+        
+        free(envNameW);
+        return SYSTEM2_RESULT_SUCCESS;
+    }
+#endif //defined(_WIN32)
+
+SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2Run(  const char* command, 
+                                                System2CommandInfo* inOutCommandInfo)
+{
+    uint64_t beginTimestamp = Internal_System2InstrumentBegin(  SYSTEM2_OPERATION_SPAWN, 
+                                                                inOutCommandInfo);
+    SYSTEM2_RESULT result;
+    #if defined(__unix__) || defined(__APPLE__)
+        result = System2RunPosix(command, inOutCommandInfo);
+    #elif defined(_WIN32)
+        result = System2RunWindows(command, inOutCommandInfo);
+    #else
+        result = SYSTEM2_RESULT_UNSUPPORTED_PLATFORM; 
+    #endif
+    
+    Internal_System2InstrumentEnd(  SYSTEM2_OPERATION_SPAWN, 
+                                    inOutCommandInfo, 
+                                    beginTimestamp, 
+                                    result, 
+                                    0);
+    return result;
+}
+
+SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2RunSubprocess(const char* executable,
+                                                        const char* const* args,
+                                                        int argsCount,
+                                                        System2CommandInfo* inOutCommandInfo)
+{
+    uint64_t beginTimestamp = Internal_System2InstrumentBegin(  SYSTEM2_OPERATION_SPAWN, 
+                                                                inOutCommandInfo);
+    SYSTEM2_RESULT result;
+    #if defined(__unix__) || defined(__APPLE__)
+        result = System2RunSubprocessPosix(executable, args, argsCount, inOutCommandInfo);
+    #elif defined(_WIN32)
+        result = System2RunSubprocessWindows(executable, args, argsCount, inOutCommandInfo);
+    #else
+        result = SYSTEM2_RESULT_UNSUPPORTED_PLATFORM; 
+    #endif
+    
+    Internal_System2InstrumentEnd(  SYSTEM2_OPERATION_SPAWN, 
+                                    inOutCommandInfo, 
+                                    beginTimestamp, 
+                                    result, 
+                                    0);
+    return result;
+}
+
+SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2RunMany(  const System2SpawnSpec* specs,
+                                                    int count,
+                                                    System2CommandInfo* inOutCommandInfos,
+                                                    SYSTEM2_RESULT* outResults)
+{
+    //Each command is instrumented as a spawn
+    #if defined(__unix__) || defined(__APPLE__)
+        return System2RunManyPosix(specs, count, inOutCommandInfos, outResults);
+    #elif defined(_WIN32)
+        return System2RunManyWindows(specs, count, inOutCommandInfos, outResults);
+    #else
+        return SYSTEM2_RESULT_UNSUPPORTED_PLATFORM; 
+    #endif
+}
+
+SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2ReadFromOutput(   const System2CommandInfo* info, 
+                                                            char* outputBuffer, 
+                                                            uint32_t outputBufferSize,
+                                                            uint32_t* outBytesRead)
+{
+    uint64_t beginTimestamp = Internal_System2InstrumentBegin(SYSTEM2_OPERATION_READ, info);
+    SYSTEM2_RESULT result;
+    #if defined(__unix__) || defined(__APPLE__)
+        result = System2ReadFromOutputPosix(info, false, outputBuffer, outputBufferSize, outBytesRead);
+    #elif defined(_WIN32)
+        result = System2ReadFromOutputWindows(info, false, outputBuffer, outputBufferSize, outBytesRead);
+    #else
+        result = SYSTEM2_RESULT_UNSUPPORTED_PLATFORM; 
+    #endif
+    
+    uint32_t bytesRead = outBytesRead && result >= 0 ? *outBytesRead : 0;
+    Internal_System2InstrumentEnd(SYSTEM2_OPERATION_READ, info, beginTimestamp, result, bytesRead);
+    return result;
+}
+
+SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2ReadFromStderr(   const System2CommandInfo* info, 
+                                                            char* outputBuffer, 
+                                                            uint32_t outputBufferSize,
+                                                            uint32_t* outBytesRead)
+{
+    uint64_t beginTimestamp = Internal_System2InstrumentBegin(SYSTEM2_OPERATION_READ, info);
+    SYSTEM2_RESULT result;
+    #if defined(__unix__) || defined(__APPLE__)
+        result = System2ReadFromOutputPosix(info, true, outputBuffer, outputBufferSize, outBytesRead);
+    #elif defined(_WIN32)
+        result = System2ReadFromOutputWindows(info, true, outputBuffer, outputBufferSize, outBytesRead);
+    #else
+        result = SYSTEM2_RESULT_UNSUPPORTED_PLATFORM; 
+    #endif
+    
+    uint32_t bytesRead = outBytesRead && result >= 0 ? *outBytesRead : 0;
+    Internal_System2InstrumentEnd(SYSTEM2_OPERATION_READ, info, beginTimestamp, result, bytesRead);
+    return result;
+}
+
+SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2WriteToInput( const System2CommandInfo* info, 
+                                                        const char* inputBuffer, 
+                                                        const uint32_t inputBufferSize)
+{
+    uint64_t beginTimestamp = Internal_System2InstrumentBegin(SYSTEM2_OPERATION_WRITE, info);
+    SYSTEM2_RESULT result;
+    #if defined(__unix__) || defined(__APPLE__)
+        result = System2WriteToInputPosix(info, inputBuffer, inputBufferSize);
+    #elif defined(_WIN32)
+        result = System2WriteToInputWindows(info, inputBuffer, inputBufferSize);
+    #else
+        result = SYSTEM2_RESULT_UNSUPPORTED_PLATFORM; 
+    #endif
+    
+    uint32_t bytesWritten = result == SYSTEM2_RESULT_SUCCESS ? inputBufferSize : 0;
+    Internal_System2InstrumentEnd(SYSTEM2_OPERATION_WRITE, info, beginTimestamp, result, bytesWritten);
+    return result;
+}
+
+//Same as `System2Poll()`, but can also return after the exit of any command is reported
+SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT Internal_System2Poll(System2CommandInfo** commands, 
+                                                        int commandsCount, 
+                                                        int timeoutMs,
+                                                        bool returnOnExit)
+{
+    #if defined(__unix__) || defined(__APPLE__)
+        return System2PollPosix(commands, commandsCount, timeoutMs, returnOnExit);
+    #elif defined(_WIN32)
+        return System2PollWindows(commands, commandsCount, timeoutMs, returnOnExit);
+    #else
+        return SYSTEM2_RESULT_UNSUPPORTED_PLATFORM;
+    #endif
+}
+
+SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2Poll( System2CommandInfo** commands, 
+                                                int commandsCount, 
+                                                int timeoutMs)
+{
+    return Internal_System2Poll(commands, commandsCount, timeoutMs, false);
+}
+
+SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2CloseInput(System2CommandInfo* info)
+{
+    #if defined(__unix__) || defined(__APPLE__)
+        return System2CloseInputPosix(info);
+    #elif defined(_WIN32)
+        return System2CloseInputWindows(info);
+    #else
+        return SYSTEM2_RESULT_UNSUPPORTED_PLATFORM;
+    #endif
+}
+
+SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2GetFiredWatchdog( const System2CommandInfo* info,
+                                                            SYSTEM2_WATCHDOG* outWatchdog)
+{
+    if(!info || !outWatchdog)
+        return SYSTEM2_RESULT_INVALID_ARGUMENT;
+    
+    *outWatchdog = SYSTEM2_WATCHDOG_NONE;
+    #if defined(__unix__) || defined(__APPLE__)
+        if(info->InternalState)
+            *outWatchdog = info->InternalState->FiredWatchdog;
+    #endif
+    
+    return SYSTEM2_RESULT_SUCCESS;
+}
+
+SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2CleanupCommand(const System2CommandInfo* info)
+{
+    SYSTEM2_RESULT result;
+    #if defined(__unix__) || defined(__APPLE__)
+        result = System2CleanupCommandPosix(info);
+    #elif defined(_WIN32)
+        result = System2CleanupCommandWindows(info);
+    #else
+        result = SYSTEM2_RESULT_UNSUPPORTED_PLATFORM; 
+    #endif
+    
+    Internal_System2InstrumentCleanup(result);
+    return result;
+}
+
+SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2GetCommandReturnValue(const System2CommandInfo* info, 
+                                                                int timeoutSec,
+                                                                int* outReturnCode)
+{
+    uint64_t beginTimestamp = Internal_System2InstrumentBegin(SYSTEM2_OPERATION_WAIT, info);
+    SYSTEM2_RESULT result;
+    #if defined(__unix__) || defined(__APPLE__)
+        result = System2GetCommandReturnValuePosix(info, timeoutSec, outReturnCode);
+    #elif defined(_WIN32)
+        result = System2GetCommandReturnValueWindows(info, timeoutSec, outReturnCode);
+    #else
+        result = SYSTEM2_RESULT_UNSUPPORTED_PLATFORM; 
+    #endif
+    
+    Internal_System2InstrumentEnd(SYSTEM2_OPERATION_WAIT, info, beginTimestamp, result, 0);
+    return result;
+}
+
+SYSTEM2_FUNC_PREFIX 
+SYSTEM2_RESULT System2GetEnvironmentVariablesCount(int* outCount, void** outResource)
+{
+    #if defined(__unix__) || defined(__APPLE__)
+        return System2GetEnvironmentVariablesCountPosix(outCount, outResource);
+    #elif defined(_WIN32)
+        return System2GetEnvironmentVariablesCountWindows(outCount, outResource);
+    #else
+        return SYSTEM2_RESULT_UNSUPPORTED_PLATFORM;
+    #endif
+}
+
+SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2GetEnvironmentVariable(   const void* resource,
+                                                                    const char** outName,
+                                                                    int* outNameLength,
+                                                                    const char** outValue,
+                                                                    int* outValueLength,
+                                                                    int index)
+{
+    #if defined(__unix__) || defined(__APPLE__)
+        return System2GetEnvironmentVariablePosix(  resource,
+                                                    outName, 
+                                                    outNameLength, 
+                                                    outValue, 
+                                                    outValueLength, 
+                                                    index);
+    #elif defined(_WIN32)
+        return System2GetEnvironmentVariableWindows(resource,
+                                                    outName, 
+                                                    outNameLength, 
+                                                    outValue, 
+                                                    outValueLength, 
+                                                    index);
+    #else
+        return SYSTEM2_RESULT_UNSUPPORTED_PLATFORM;
+    #endif
+}
+
+SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2EnvironmentVariableFree(void** resource)
+{
+    #if defined(__unix__) || defined(__APPLE__)
+        return System2EnvironmentVariableFreePosix(resource);
+    #elif defined(_WIN32)
+        return System2EnvironmentVariableFreeWindows(resource);
+    #else
+        return SYSTEM2_RESULT_UNSUPPORTED_PLATFORM;
+    #endif
+}
+
+SYSTEM2_FUNC_PREFIX 
+SYSTEM2_RESULT System2SetEnvironmentVariable(const char* envName, const char* envValue)
+{
+    #if defined(__unix__) || defined(__APPLE__)
+        return System2SetEnvironmentVariablePosix(envName, envValue);
+    #elif defined(_WIN32)
+        return System2SetEnvironmentVariableWindows(envName, envValue);
+    #else
+        return SYSTEM2_RESULT_UNSUPPORTED_PLATFORM;
+    #endif
+}
+
+SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2Kill(const System2CommandInfo* info)
+{
+    uint64_t beginTimestamp = Internal_System2InstrumentBegin(SYSTEM2_OPERATION_KILL, info);
+    SYSTEM2_RESULT result;
+    #if defined(__unix__) || defined(__APPLE__)
+        result = System2KillPosix(info);
+    #elif defined(_WIN32)
+        result = System2KillWindows(info);
+    #else
+        result = SYSTEM2_RESULT_UNSUPPORTED_PLATFORM;
+    #endif
+    
+    Internal_System2InstrumentEnd(SYSTEM2_OPERATION_KILL, info, beginTimestamp, result, 0);
+    return result;
+}
+
+SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2Term(const System2CommandInfo* info)
+{
+    uint64_t beginTimestamp = Internal_System2InstrumentBegin(SYSTEM2_OPERATION_TERM, info);
+    SYSTEM2_RESULT result;
+    #if defined(__unix__) || defined(__APPLE__)
+        result = System2TermPosix(info);
+    #elif defined(_WIN32)
+        result = System2TermWindows(info);
+    #else
+        result = SYSTEM2_RESULT_UNSUPPORTED_PLATFORM;
+    #endif
+    
+    Internal_System2InstrumentEnd(SYSTEM2_OPERATION_TERM, info, beginTimestamp, result, 0);
+    return result;
+}
 
-            if(inOutCommandInfo->ChildToParentPipes[SYSTEM2_FD_WRITE])
-            {
-                if(!CloseHandle(inOutCommandInfo->ChildToParentPipes[SYSTEM2_FD_WRITE]))
-                    return SYSTEM2_RESULT_PIPE_FD_CLOSE_FAILED;
-            }
-            
-            if(inOutCommandInfo->ChildToParentPipesErr[SYSTEM2_FD_WRITE])
-            {
-                if(!CloseHandle(inOutCommandInfo->ChildToParentPipesErr[SYSTEM2_FD_WRITE]))
-                    return SYSTEM2_RESULT_PIPE_FD_CLOSE_FAILED;
-            }
-            
-            if(inOutCommandInfo->ParentToChildPipes[SYSTEM2_FD_READ])
-            {
-                if(!CloseHandle(inOutCommandInfo->ParentToChildPipes[SYSTEM2_FD_READ]))
-                    return SYSTEM2_RESULT_PIPE_FD_CLOSE_FAILED;
-            }
+SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2Pause(const System2CommandInfo* info)
+{
+    #if defined(__unix__) || defined(__APPLE__)
+        return System2PausePosix(info);
+    #elif defined(_WIN32)
+        return System2PauseWindows(info);
+    #else
+        return SYSTEM2_RESULT_UNSUPPORTED_PLATFORM;
+    #endif
+}
 
-            return SYSTEM2_RESULT_SUCCESS;
-        }
-    }
+SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2Resume(const System2CommandInfo* info)
+{
+    #if defined(__unix__) || defined(__APPLE__)
+        return System2ResumePosix(info);
+    #elif defined(_WIN32)
+        return System2ResumeWindows(info);
+    #else
+        return SYSTEM2_RESULT_UNSUPPORTED_PLATFORM;
+    #endif
+}
+
+SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2PauseMany(System2CommandInfo** commands,
+                                                    int commandsCount,
+                                                    SYSTEM2_RESULT* outResults)
+{
+    if(!commands || commandsCount < 0)
+        return SYSTEM2_RESULT_INVALID_ARGUMENT;
     
-    SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2RunWindows(   const char* command, 
-                                                            System2CommandInfo* outCommandInfo)
+    SYSTEM2_RESULT firstFailedResult = SYSTEM2_RESULT_SUCCESS;
+    for(int i = 0; i < commandsCount; ++i)
     {
-        const char* args[] = {"/s", "/v", "/c", command};
-        outCommandInfo->DisableEscapes = true;
-        return System2RunSubprocessWindows( "cmd", 
-                                            args, 
-                                            sizeof(args) / sizeof(char*), 
-                                            outCommandInfo);
+        SYSTEM2_RESULT result = System2Pause(commands[i]);
+        if(outResults)
+            outResults[i] = result;
+        
+        if(result != SYSTEM2_RESULT_SUCCESS && firstFailedResult == SYSTEM2_RESULT_SUCCESS)
+            firstFailedResult = result;
     }
     
-    //TODO: UTF-8 output?
-    //TODO: Use peeknamedpipe to get number of bytes available before reading it 
-    //      so that it doesn't block
-    //https://learn.microsoft.com/en-us/windows/win32/api/namedpipeapi/nf-namedpipeapi-peeknamedpipe
-    SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2ReadFromOutputWindows(const System2CommandInfo* info, 
-                                                                    bool readStderr,
-                                                                    char* outputBuffer, 
-                                                                    uint32_t outputBufferSize,
-                                                                    uint32_t* outBytesRead)
+    return firstFailedResult;
+}
+
+SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2ResumeMany(   System2CommandInfo** commands,
+                                                        int commandsCount,
+                                                        SYSTEM2_RESULT* outResults)
+{
+    if(!commands || commandsCount < 0)
+        return SYSTEM2_RESULT_INVALID_ARGUMENT;
+    
+    SYSTEM2_RESULT firstFailedResult = SYSTEM2_RESULT_SUCCESS;
+    for(int i = 0; i < commandsCount; ++i)
     {
-        if(!info || !outputBuffer || !outBytesRead || !info->RedirectOutput)
-            return SYSTEM2_RESULT_INVALID_ARGUMENT;
+        SYSTEM2_RESULT result = System2Resume(commands[i]);
+        if(outResults)
+            outResults[i] = result;
         
-        if(readStderr && !info->StandaloneStderr)
-            return SYSTEM2_RESULT_INVALID_ARGUMENT;
+        if(result != SYSTEM2_RESULT_SUCCESS && firstFailedResult == SYSTEM2_RESULT_SUCCESS)
+            firstFailedResult = result;
+    }
+    
+    return firstFailedResult;
+}
+
+SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2SetSpawnBackend(SYSTEM2_SPAWN_BACKEND backend)
+{
+    //The default backend can't refer to itself
+    if(backend <= SYSTEM2_SPAWN_BACKEND_DEFAULT || backend > SYSTEM2_SPAWN_BACKEND_VFORK)
+        return SYSTEM2_RESULT_INVALID_ARGUMENT;
+    
+    #if defined(__unix__) || defined(__APPLE__)
+        __atomic_store_n(&Internal_System2DefaultSpawnBackend, (int)backend, __ATOMIC_RELAXED);
+    #endif
+    
+    return SYSTEM2_RESULT_SUCCESS;
+}
+
+SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2RegisterForkExcludedMemory(   void* address, 
+                                                                        size_t size, 
+                                                                        bool wipeOnFork)
+{
+    if(!address || size == 0)
+        return SYSTEM2_RESULT_INVALID_ARGUMENT;
+    
+    #if defined(__linux__)
+        for(int i = 0; i < Internal_System2ForkExcludedRegionsCount; ++i)
+        {
+            if(Internal_System2ForkExcludedRegions[i].Address == address)
+                return SYSTEM2_RESULT_INVALID_ARGUMENT;
+        }
         
-        DWORD readResult;
-        BOOL bSuccess;
-        *outBytesRead = 0;
+        Internal_System2ForkExcludedMemory* regions = (Internal_System2ForkExcludedMemory*)
+            realloc(Internal_System2ForkExcludedRegions, 
+                    sizeof(Internal_System2ForkExcludedMemory) * 
+                    (Internal_System2ForkExcludedRegionsCount + 1));
+        if(!regions)
+            return SYSTEM2_RESULT_MALLOC_FAILED;
         
-        while (true)
-        {
-            bSuccess = ReadFile(( 
-                                    readStderr ?
-                                    info->ChildToParentPipesErr[SYSTEM2_FD_READ] :
-                                    info->ChildToParentPipes[SYSTEM2_FD_READ] 
-                                ),
-                                outputBuffer, 
-                                outputBufferSize - *outBytesRead, 
-                                &readResult, 
-                                NULL);
+        Internal_System2ForkExcludedRegions = regions;
+        if(madvise(address, size, wipeOnFork ? MADV_WIPEONFORK : MADV_DONTFORK) != 0)
+            return SYSTEM2_RESULT_INVALID_ARGUMENT;
+        
+        regions[Internal_System2ForkExcludedRegionsCount].Address = address;
+        regions[Internal_System2ForkExcludedRegionsCount].Size = size;
+        regions[Internal_System2ForkExcludedRegionsCount].WipeOnFork = wipeOnFork;
+        ++Internal_System2ForkExcludedRegionsCount;
+        return SYSTEM2_RESULT_SUCCESS;
+    #else
+        (void)wipeOnFork;
+        return SYSTEM2_RESULT_FORK_EXCLUSION_NOT_SUPPORTED;
+    #endif
+}
 
-            if (readResult == 0)
-                break;
+SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2UnregisterForkExcludedMemory(void* address)
+{
+    if(!address)
+        return SYSTEM2_RESULT_INVALID_ARGUMENT;
+    
+    #if defined(__linux__)
+        for(int i = 0; i < Internal_System2ForkExcludedRegionsCount; ++i)
+        {
+            Internal_System2ForkExcludedMemory* region = &Internal_System2ForkExcludedRegions[i];
+            if(region->Address != address)
+                continue;
             
-            if(!bSuccess)
-                return SYSTEM2_RESULT_READ_FAILED;
+            int advice = region->WipeOnFork ? MADV_KEEPONFORK : MADV_DOFORK;
+            madvise(region->Address, region->Size, advice);
             
-            outputBuffer += readResult;
-            *outBytesRead += readResult;
+            --Internal_System2ForkExcludedRegionsCount;
+            *region = Internal_System2ForkExcludedRegions[Internal_System2ForkExcludedRegionsCount];
+            if(Internal_System2ForkExcludedRegionsCount == 0)
+            {
+                free(Internal_System2ForkExcludedRegions);
+                Internal_System2ForkExcludedRegions = NULL;
+            }
             
-            if(outputBufferSize - *outBytesRead == 0)
-                return SYSTEM2_RESULT_READ_NOT_FINISHED;
+            return SYSTEM2_RESULT_SUCCESS;
         }
+        
+        return SYSTEM2_RESULT_INVALID_ARGUMENT;
+    #else
+        return SYSTEM2_RESULT_FORK_EXCLUSION_NOT_SUPPORTED;
+    #endif
+}
 
-        //if(GetLastError() == ERROR_BROKEN_PIPE)
-        //    return SYSTEM2_RESULT_SUCCESS;
+SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2SetHooks(const System2Hooks* hooks)
+{
+    #if INTERNAL_SYSTEM2_INSTRUMENTATION
+        if(hooks)
+            Internal_System2GlobalHooks = *hooks;
+        else
+            memset(&Internal_System2GlobalHooks, 0, sizeof(System2Hooks));
         
-        //return SYSTEM2_RESULT_READ_FAILED;
         return SYSTEM2_RESULT_SUCCESS;
-    }
+    #else
+        (void)hooks;
+        return SYSTEM2_RESULT_INSTRUMENTATION_NOT_ENABLED;
+    #endif
+}
+
+SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2GetStats(System2Stats* outStats)
+{
+    if(!outStats)
+        return SYSTEM2_RESULT_INVALID_ARGUMENT;
     
-    SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2WriteToInputWindows(  const System2CommandInfo* info, 
-                                                                    const char* inputBuffer, 
-                                                                    const uint32_t inputBufferSize)
-    {
-        if(!info || !inputBuffer || !info->RedirectInput)
-            return SYSTEM2_RESULT_INVALID_ARGUMENT;
+    #if INTERNAL_SYSTEM2_INSTRUMENTATION
+        //All the counters are 64 bits
+        uint64_t* counters = (uint64_t*)&Internal_System2GlobalStats;
+        uint64_t* outCounters = (uint64_t*)outStats;
+        for(size_t i = 0; i < sizeof(System2Stats) / sizeof(uint64_t); ++i)
+            outCounters[i] = (uint64_t)INTERNAL_SYSTEM2_ATOMIC_LOAD(&counters[i]);
         
-        DWORD currentWriteLengthLeft = inputBufferSize;
-        BOOL bSuccess;
-
-        while (true)
-        {
-            DWORD writeResult;
-
-            bSuccess = WriteFile(   info->ParentToChildPipes[SYSTEM2_FD_WRITE], 
-                                    inputBuffer, 
-                                    currentWriteLengthLeft, 
-                                    &writeResult, 
-                                    NULL);
+        return SYSTEM2_RESULT_SUCCESS;
+    #else
+        return SYSTEM2_RESULT_INSTRUMENTATION_NOT_ENABLED;
+    #endif
+}
 
-            if (!bSuccess)
-                return SYSTEM2_RESULT_WRITE_FAILED;
 
-            inputBuffer += writeResult;
-            currentWriteLengthLeft -= writeResult;
+//Reads whatever is available from the output, at least 1 byte unless the end of output is reached
+SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT Internal_System2ReadAvailableOutput( const System2CommandInfo* info,
+                                                                        bool readStderr,
+                                                                        char* outputBuffer, 
+                                                                        uint32_t outputBufferSize,
+                                                                        uint32_t* outBytesRead)
+{
+    #if defined(__unix__) || defined(__APPLE__)
+        return Internal_System2ReadFromOutputPosix( info, 
+                                                    readStderr, 
+                                                    true, 
+                                                    outputBuffer, 
+                                                    outputBufferSize, 
+                                                    outBytesRead);
+    #elif defined(_WIN32)
+        return Internal_System2ReadFromOutputWindows(   info, 
+                                                        readStderr, 
+                                                        true, 
+                                                        outputBuffer, 
+                                                        outputBufferSize, 
+                                                        outBytesRead);
+    #else
+        return SYSTEM2_RESULT_UNSUPPORTED_PLATFORM;
+    #endif
+}
 
-            if (currentWriteLengthLeft == 0)
-                break;
-        }
+SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2LineReaderInit(   System2LineReader* outReader,
+                                                            const System2CommandInfo* info,
+                                                            bool readStderr,
+                                                            char delimiter,
+                                                            uint32_t maxLineLength)
+{
+    if(!outReader || !info || !info->RedirectOutput)
+        return SYSTEM2_RESULT_INVALID_ARGUMENT;
+    
+    if(readStderr && !info->StandaloneStderr)
+        return SYSTEM2_RESULT_INVALID_ARGUMENT;
+    
+    memset(outReader, 0, sizeof(System2LineReader));
+    outReader->CommandInfo = info;
+    outReader->ReadStderr = readStderr;
+    outReader->Delimiter = delimiter;
+    outReader->MaxLineLength = maxLineLength;
+    
+    //The buffer only needs to be big enough to tell if a line is longer than the max line length
+    outReader->BufferSize = SYSTEM2_LINE_READER_BUFFER_SIZE;
+    if(maxLineLength > 0 && maxLineLength < outReader->BufferSize)
+        outReader->BufferSize = maxLineLength + 1;
+    
+    outReader->Buffer = (char*)malloc(outReader->BufferSize);
+    if(!outReader->Buffer)
+        return SYSTEM2_RESULT_MALLOC_FAILED;
+    
+    return SYSTEM2_RESULT_SUCCESS;
+}
 
-        return SYSTEM2_RESULT_SUCCESS;
-    }
+SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2ReadLine( System2LineReader* reader,
+                                                    const char** outLine,
+                                                    uint32_t* outLineLength,
+                                                    bool* outTruncated)
+{
+    if(!reader || !reader->Buffer || !outLine || !outLineLength)
+        return SYSTEM2_RESULT_INVALID_ARGUMENT;
     
-    SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2CleanupCommandWindows(const System2CommandInfo* info)
+    *outLine = NULL;
+    *outLineLength = 0;
+    if(outTruncated)
+        *outTruncated = false;
+    
+    while(true)
     {
-        if(!info)
-            return SYSTEM2_RESULT_INVALID_ARGUMENT;
+        //Only search the data we haven't searched yet
+        uint32_t delimiterIndex = reader->ScanEnd + 
+                                  Internal_System2FindByte( reader->Buffer + reader->ScanEnd,
+                                                            reader->DataEnd - reader->ScanEnd,
+                                                            reader->Delimiter);
+        bool foundDelimiter = delimiterIndex < reader->DataEnd;
+        uint32_t lineLength = delimiterIndex - reader->DataStart;
+        bool truncated = reader->MaxLineLength > 0 && lineLength > reader->MaxLineLength;
         
-        if(info->ChildToParentPipes[SYSTEM2_FD_READ])
+        //Drop the remaining part of a truncated line
+        if(reader->DiscardingLine)
         {
-            if(!CloseHandle(info->ChildToParentPipes[SYSTEM2_FD_READ]))
-                return SYSTEM2_RESULT_PIPE_FD_CLOSE_FAILED;
+            reader->DataStart = foundDelimiter ? delimiterIndex + 1 : reader->DataEnd;
+            reader->ScanEnd = reader->DataStart;
+            reader->DiscardingLine = !foundDelimiter;
+            
+            if(foundDelimiter)
+                continue;
         }
-        
-        if(info->ChildToParentPipesErr[SYSTEM2_FD_READ])
+        else if(foundDelimiter || truncated || (reader->ReadFinished && lineLength > 0))
         {
-            if(!CloseHandle(info->ChildToParentPipesErr[SYSTEM2_FD_READ]))
-                return SYSTEM2_RESULT_PIPE_FD_CLOSE_FAILED;
+            *outLine = reader->Buffer + reader->DataStart;
+            *outLineLength = truncated ? reader->MaxLineLength : lineLength;
+            if(outTruncated)
+                *outTruncated = truncated;
+            
+            if(foundDelimiter)
+                reader->DataStart = delimiterIndex + 1;
+            else
+            {
+                reader->DataStart = reader->DataEnd;
+                reader->DiscardingLine = truncated && !reader->ReadFinished;
+            }
+            
+            reader->ScanEnd = reader->DataStart;
+            return SYSTEM2_RESULT_READ_NOT_FINISHED;
         }
+        else
+            reader->ScanEnd = reader->DataEnd;
         
-        if(info->ParentToChildPipes[SYSTEM2_FD_WRITE])
+        if(reader->ReadFinished)
+            return SYSTEM2_RESULT_SUCCESS;
+        
+        //Move the partial line to the front to make space for reading
+        if(reader->DataStart > 0)
         {
-            if(!CloseHandle(info->ParentToChildPipes[SYSTEM2_FD_WRITE]))
-                return SYSTEM2_RESULT_PIPE_FD_CLOSE_FAILED;
+            memmove(reader->Buffer, 
+                    reader->Buffer + reader->DataStart, 
+                    reader->DataEnd - reader->DataStart);
+            
+            reader->DataEnd -= reader->DataStart;
+            reader->ScanEnd -= reader->DataStart;
+            reader->DataStart = 0;
         }
-
-        CloseHandle(info->ChildProcessHandle);
-        return SYSTEM2_RESULT_SUCCESS;
-    }
-    
-    SYSTEM2_FUNC_PREFIX 
-    SYSTEM2_RESULT System2GetCommandReturnValueWindows( const System2CommandInfo* info, 
-                                                        int timeoutSec,
-                                                        int* outReturnCode)
-    {
-        if(!info || !outReturnCode)
-            return SYSTEM2_RESULT_INVALID_ARGUMENT;
-        
-        DWORD exitCode;
-        if(!GetExitCodeProcess(info->ChildProcessHandle, &exitCode))
-            return SYSTEM2_RESULT_COMMAND_WAIT_FAILED;
         
-        if(exitCode == STILL_ACTIVE)
+        if(reader->DataEnd == reader->BufferSize)
         {
-            DWORD waitResult = WaitForSingleObject( info->ChildProcessHandle, 
-                                                    timeoutSec >= 0 ? timeoutSec * 1000 : INFINITE);
-            if(waitResult == WAIT_OBJECT_0)
-            {
-                if(!GetExitCodeProcess(info->ChildProcessHandle, &exitCode))
-                    return SYSTEM2_RESULT_COMMAND_WAIT_FAILED;
-            }
-            else if(waitResult == WAIT_TIMEOUT)
-                return SYSTEM2_RESULT_COMMAND_NOT_FINISHED;
-            else
-                return SYSTEM2_RESULT_COMMAND_WAIT_FAILED;
+            if(reader->BufferSize > UINT32_MAX / 2)
+                return SYSTEM2_RESULT_MALLOC_FAILED;
+            
+            uint32_t newBufferSize = reader->BufferSize * 2;
+            if(reader->MaxLineLength > 0 && newBufferSize > reader->MaxLineLength)
+                newBufferSize = reader->MaxLineLength + 1;
+            
+            char* newBuffer = (char*)realloc(reader->Buffer, newBufferSize);
+            if(!newBuffer)
+                return SYSTEM2_RESULT_MALLOC_FAILED;
+            
+            reader->Buffer = newBuffer;
+            reader->BufferSize = newBufferSize;
         }
         
-        *outReturnCode = exitCode;
-        return SYSTEM2_RESULT_SUCCESS;
-    }
-    
-    SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2KillWindows(const System2CommandInfo* info)
-    {
-        if(!info)
-            return SYSTEM2_RESULT_INVALID_ARGUMENT;
-        
-        if(TerminateProcess(info->ChildProcessHandle, 137) != 0)
-            return SYSTEM2_RESULT_SUCCESS;
-        else
-            return SYSTEM2_RESULT_KILL_FAILED;
+        uint32_t bytesRead = 0;
+        SYSTEM2_RESULT result = 
+            Internal_System2ReadAvailableOutput(reader->CommandInfo,
+                                                reader->ReadStderr,
+                                                reader->Buffer + reader->DataEnd,
+                                                reader->BufferSize - reader->DataEnd,
+                                                &bytesRead);
         
+        if(result == SYSTEM2_RESULT_SUCCESS)
+            reader->ReadFinished = true;
+        else if(result != SYSTEM2_RESULT_READ_NOT_FINISHED)
+            return result;
+        
+        reader->DataEnd += bytesRead;
     }
+}
+
+SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2LineReaderFree(System2LineReader* reader)
+{
+    if(!reader)
+        return SYSTEM2_RESULT_INVALID_ARGUMENT;
     
-    typedef struct Internal_System2EnumStatus
+    free(reader->Buffer);
+    memset(reader, 0, sizeof(System2LineReader));
+    return SYSTEM2_RESULT_SUCCESS;
+}
+
+//Reverses the bytes of `data` from `begin` up to `end` in place
+SYSTEM2_FUNC_PREFIX void Internal_System2Reverse(char* data, uint32_t begin, uint32_t end)
+{
+    while(begin + 1 < end)
     {
-        DWORD TargetProcessId;
-        bool Found;
-    } Internal_System2EnumStatus;
+        char temp = data[begin];
+        data[begin++] = data[--end];
+        data[end] = temp;
+    }
+}
+
+//Adds `data` after the newest byte of the tail ring buffer, overwriting the oldest ones once full
+SYSTEM2_FUNC_PREFIX void Internal_System2AppendToTail(  System2Capture* capture,
+                                                        uint32_t maxTailSize,
+                                                        uint32_t* inOutTailStart,
+                                                        const char* data,
+                                                        uint32_t size)
+{
+    if(size >= maxTailSize)
+    {
+        memcpy(capture->Tail, data + size - maxTailSize, maxTailSize);
+        capture->TailSize = maxTailSize;
+        *inOutTailStart = 0;
+        return;
+    }
     
-    static BOOL CALLBACK Internal_System2EnumWindowsProc(HWND hwnd, LPARAM lParam)
+    uint32_t writeIndex = (*inOutTailStart + capture->TailSize) % maxTailSize;
+    uint32_t firstPartSize = maxTailSize - writeIndex < size ? maxTailSize - writeIndex : size;
+    memcpy(capture->Tail + writeIndex, data, firstPartSize);
+    memcpy(capture->Tail, data + firstPartSize, size - firstPartSize);
+    
+    if(capture->TailSize + size <= maxTailSize)
+        capture->TailSize += size;
+    else
     {
-        DWORD processId;
-        GetWindowThreadProcessId(hwnd, &processId);
-
-        if(((Internal_System2EnumStatus*)lParam)->TargetProcessId == processId)
-        {
-            PostMessage(hwnd, WM_CLOSE, 0, 0);
-            ((Internal_System2EnumStatus*)lParam)->Found = true;
-        }
-        return true;
+        capture->TailSize = maxTailSize;
+        *inOutTailStart = (writeIndex + size) % maxTailSize;
     }
+}
 
-    SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2TermWindows(const System2CommandInfo* info)
+SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2CaptureOutput(const System2CommandInfo* info,
+                                                        bool readStderr,
+                                                        const System2CapturePolicy* policy,
+                                                        System2Capture* outCapture)
+{
+    if(!info || !outCapture || !info->RedirectOutput || (readStderr && !info->StandaloneStderr))
+        return SYSTEM2_RESULT_INVALID_ARGUMENT;
+    
+    memset(outCapture, 0, sizeof(System2Capture));
+    
+    bool keepAll = !policy || (policy->HeadSize == 0 && policy->TailSize == 0);
+    uint32_t maxHeadSize = keepAll ? UINT32_MAX : policy->HeadSize;
+    uint32_t maxTailSize = keepAll ? 0 : policy->TailSize;
+    uint64_t killAfter = policy ? policy->KillAfter : 0;
+    
+    uint32_t headCapacity = 0;
+    uint32_t tailStart = 0;         //Index of the oldest byte in the tail, which is a ring buffer
+    char discardBuffer[16 * 1024];  //For the bytes that can't be discarded without reading them
+    
+    #if defined(__unix__) || defined(__APPLE__)
+        int nullFd = -1;
+    #endif
+    
+    SYSTEM2_RESULT result = SYSTEM2_RESULT_READ_NOT_FINISHED;
+    while(result == SYSTEM2_RESULT_READ_NOT_FINISHED)
     {
-        if(!info)
-            return SYSTEM2_RESULT_INVALID_ARGUMENT;
+        char* readBuffer;
+        uint32_t readSize;
+        bool readingHead = outCapture->HeadSize < maxHeadSize;
         
-        Internal_System2EnumStatus enumStatus;
-        memset(&enumStatus, 0, sizeof(Internal_System2EnumStatus));
-        enumStatus.TargetProcessId = GetProcessId(info->ChildProcessHandle);
-        if(!enumStatus.TargetProcessId)
-            return SYSTEM2_RESULT_TERM_FAILED;
-        
-        EnumWindows(&Internal_System2EnumWindowsProc, (LPARAM)&enumStatus);
-        if(enumStatus.Found)
-            return SYSTEM2_RESULT_SUCCESS;
-        
-        //If we haven't found any windows associates with the process, try again with its children if
-        //it is cmd.exe
+        if(readingHead)
         {
-            HANDLE snapshotHandle = CreateToolhelp32Snapshot(TH32CS_SNAPPROCESS, 0);
-            if(!snapshotHandle)
-                return SYSTEM2_RESULT_WINDOWS_TERM_NO_WINDOW;
-            
-            PROCESSENTRY32 pe32;
-            pe32.dwSize = sizeof(PROCESSENTRY32);
-            if(Process32First(snapshotHandle, &pe32) == 0)
-            {
-                CloseHandle(snapshotHandle);
-                return SYSTEM2_RESULT_WINDOWS_TERM_NO_WINDOW;
-            }
-            
-            bool isCmd = false;
-            bool found = false;
-            int childCap = 4;
-            DWORD* childProcessesIds = (DWORD*)malloc(sizeof(DWORD) * childCap);
-            if(!childProcessesIds)
+            //Grow the head with the output, so short outputs don't take the whole head size
+            if(outCapture->HeadSize == headCapacity)
             {
-                CloseHandle(snapshotHandle);
-                free(childProcessesIds);
-                return SYSTEM2_RESULT_MALLOC_FAILED;
+                uint32_t newCapacity = 4096;
+                if(headCapacity > UINT32_MAX / 2)
+                    newCapacity = UINT32_MAX;
+                else if(headCapacity > 0)
+                    newCapacity = headCapacity * 2;
+                
+                if(newCapacity > maxHeadSize)
+                    newCapacity = maxHeadSize;
+                
+                char* newHead = (char*)realloc(outCapture->Head, newCapacity);
+                if(!newHead)
+                {
+                    result = SYSTEM2_RESULT_MALLOC_FAILED;
+                    break;
+                }
+                
+                outCapture->Head = newHead;
+                headCapacity = newCapacity;
             }
-            int childCount = 0;
             
-            do
-            {
-                if(pe32.th32ProcessID == enumStatus.TargetProcessId)
+            readBuffer = outCapture->Head + outCapture->HeadSize;
+            readSize = headCapacity - outCapture->HeadSize;
+        }
+        else
+        {
+            #if defined(__unix__) || defined(__APPLE__)
+                uint64_t bytesDiscarded = 0;
+                result = Internal_System2DiscardOutputPosix(info, 
+                                                            readStderr, 
+                                                            maxTailSize, 
+                                                            &nullFd, 
+                                                            &bytesDiscarded);
+                if(result != SYSTEM2_RESULT_SUCCESS)
+                    break;
+                
+                result = SYSTEM2_RESULT_READ_NOT_FINISHED;
+                if(bytesDiscarded > 0)
                 {
-                    if(strcmp(pe32.szExeFile, "cmd.exe") == 0)
-                        isCmd = true;
-                    found = true;
+                    //What is left in the pipe fills the whole tail, so what we have is too old
+                    outCapture->TotalBytes += bytesDiscarded;
+                    outCapture->TailSize = 0;
+                    tailStart = 0;
+                    
+                    //Otherwise read what is left for the tail before the command is killed
+                    if(killAfter == 0 || outCapture->TotalBytes <= killAfter)
+                        continue;
                 }
-                else if(pe32.th32ParentProcessID == enumStatus.TargetProcessId)
+            #endif
+            
+            if(maxTailSize > 0 && !outCapture->Tail)
+            {
+                outCapture->Tail = (char*)malloc(maxTailSize);
+                if(!outCapture->Tail)
                 {
-                    if(childCount + 1 > childCap)
-                    {
-                        DWORD* tmp = (DWORD*)realloc(childProcessesIds, childCap * 2);
-                        if(!tmp)
-                        {
-                            CloseHandle(snapshotHandle);
-                            free(childProcessesIds);
-                            return SYSTEM2_RESULT_MALLOC_FAILED;
-                        }
-                        childProcessesIds = tmp;
-                    }
-                    childProcessesIds[childCount++] = pe32.th32ProcessID;
+                    result = SYSTEM2_RESULT_MALLOC_FAILED;
+                    break;
                 }
             }
-            while(Process32Next(snapshotHandle, &pe32));
-            CloseHandle(snapshotHandle);
             
-            //It is running under cmd, try closing the child instead
+            //Small tails are filled from the discard buffer so that each read isn't as small
+            if(maxTailSize >= sizeof(discardBuffer))
             {
-                if(!isCmd)
-                {
-                    free(childProcessesIds);
-                    return SYSTEM2_RESULT_WINDOWS_TERM_NO_WINDOW;
-                }
-                
-                bool closedSomething = false;
-                for(int i = 0; i < childCount; ++i)
-                {
-                    enumStatus.TargetProcessId = childProcessesIds[i];
-                    EnumWindows(&Internal_System2EnumWindowsProc, (LPARAM)&enumStatus);
-                    if(enumStatus.Found)
-                        closedSomething = true;
-                }
-                free(childProcessesIds);
-                if(closedSomething)
-                    return SYSTEM2_RESULT_SUCCESS;
-                else
-                    return SYSTEM2_RESULT_WINDOWS_TERM_NO_WINDOW;
+                //Write after the newest byte, which overwrites the oldest ones once it is full
+                uint32_t writeIndex = (tailStart + outCapture->TailSize) % maxTailSize;
+                readBuffer = outCapture->Tail + writeIndex;
+                readSize = maxTailSize - writeIndex;
+            }
+            else
+            {
+                readBuffer = discardBuffer;
+                readSize = sizeof(discardBuffer);
             }
         }
-    }
-    
-    SYSTEM2_FUNC_PREFIX char* Internal_System2GetEnvStringWindows()
-    {
-        wchar_t* envStrings = GetEnvironmentStringsW();
-        wchar_t* envStringsStart = envStrings;
-        int strCount = 0;
         
-        while(*envStrings != L'\0' || *(envStrings + 1) != L'\0')
-        {
-            ++strCount;
-            ++envStrings;
-        }
-        strCount += 2;
+        uint32_t bytesRead = 0;
+        result = Internal_System2ReadAvailableOutput(   info, 
+                                                        readStderr, 
+                                                        readBuffer, 
+                                                        readSize, 
+                                                        &bytesRead);
+        if(result != SYSTEM2_RESULT_SUCCESS && result != SYSTEM2_RESULT_READ_NOT_FINISHED)
+            break;
         
-        int requiredBytes = WideCharToMultiByte(CP_UTF8, 
-                                                0, 
-                                                envStringsStart, 
-                                                strCount, 
-                                                NULL, 
-                                                0, 
-                                                NULL, 
-                                                NULL);
-        if(requiredBytes <= 0)
+        outCapture->TotalBytes += bytesRead;
+        if(readingHead)
+            outCapture->HeadSize += bytesRead;
+        else if(maxTailSize > 0 && readBuffer == discardBuffer)
         {
-            FreeEnvironmentStringsW(envStringsStart);
-            return NULL;
+            Internal_System2AppendToTail(   outCapture, 
+                                            maxTailSize, 
+                                            &tailStart, 
+                                            discardBuffer, 
+                                            bytesRead);
         }
-        
-        char* utf8EnvString = (char*)malloc(requiredBytes);
-        if(!utf8EnvString)
+        else if(maxTailSize > 0)
         {
-            FreeEnvironmentStringsW(envStringsStart);
-            return NULL;
+            if(outCapture->TailSize < maxTailSize)
+                outCapture->TailSize += bytesRead;
+            else
+                tailStart = (tailStart + bytesRead) % maxTailSize;
         }
-        memset(utf8EnvString, 0, requiredBytes);
         
-        int allocatedBytes = WideCharToMultiByte(   CP_UTF8, 
-                                                    0, 
-                                                    envStringsStart, 
-                                                    strCount, 
-                                                    utf8EnvString, 
-                                                    requiredBytes, 
-                                                    NULL, 
-                                                    NULL);
-        if(allocatedBytes <= 0)
-        {
-            FreeEnvironmentStringsW(envStringsStart);
-            free(utf8EnvString);
-            return NULL;
-        }
-        return utf8EnvString;
+        if(killAfter != 0 && outCapture->TotalBytes > killAfter)
+            break;
     }
     
-    SYSTEM2_FUNC_PREFIX 
-    SYSTEM2_RESULT System2GetEnvironmentVariablesCountWindows(int* outCount, void** outResource)
+    #if defined(__unix__) || defined(__APPLE__)
+        if(nullFd >= 0)
+            close(nullFd);
+    #endif
+    
+    //Put the tail in order by rotating the oldest byte to the front
+    if(tailStart != 0)
     {
-        if(!outCount || !outResource)
+        Internal_System2Reverse(outCapture->Tail, 0, tailStart);
+        Internal_System2Reverse(outCapture->Tail, tailStart, outCapture->TailSize);
+        Internal_System2Reverse(outCapture->Tail, 0, outCapture->TailSize);
+    }
+    
+    outCapture->Truncated = outCapture->TotalBytes > 
+                            (uint64_t)outCapture->HeadSize + outCapture->TailSize;
+    
+    if(killAfter != 0 && outCapture->TotalBytes > killAfter)
+    {
+        outCapture->Killed = true;
+        return System2Kill(info);
+    }
+    
+    return result;
+}
+
+SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2CaptureFree(System2Capture* capture)
+{
+    if(!capture)
+        return SYSTEM2_RESULT_INVALID_ARGUMENT;
+    
+    free(capture->Head);
+    free(capture->Tail);
+    memset(capture, 0, sizeof(System2Capture));
+    return SYSTEM2_RESULT_SUCCESS;
+}
+
+SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2MapOutput(const System2CommandInfo* info,
+                                                    bool readStderr,
+                                                    System2OutputView* outView)
+{
+    if(!info || !outView || !info->CaptureOutputToFile || (readStderr && !info->StandaloneStderr))
+        return SYSTEM2_RESULT_INVALID_ARGUMENT;
+    
+    memset(outView, 0, sizeof(System2OutputView));
+    
+    #if defined(__unix__) || defined(__APPLE__)
+        if(!info->InternalState)
             return SYSTEM2_RESULT_INVALID_ARGUMENT;
         
-        *outResource = NULL;
-        char* utf8EnvStringStart = Internal_System2GetEnvStringWindows();
-        if(!utf8EnvStringStart)
-            return SYSTEM2_RESULT_COMMAND_CONSTRUCT_FAILED;
+        int fd = info->InternalState->CaptureFds[readStderr ? 1 : 0];
+        struct stat fileStat;
+        if(fstat(fd, &fileStat) != 0 || (uint64_t)fileStat.st_size > SIZE_MAX)
+            return SYSTEM2_RESULT_READ_FAILED;
+        
+        //Nothing to map
+        if(fileStat.st_size == 0)
+            return SYSTEM2_RESULT_SUCCESS;
+        
+        void* data = mmap(NULL, (size_t)fileStat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if(data == MAP_FAILED)
+            return SYSTEM2_RESULT_READ_FAILED;
+        
+        outView->Data = (const char*)data;
+        outView->Size = (uint64_t)fileStat.st_size;
+        return SYSTEM2_RESULT_SUCCESS;
+    #else
+        return SYSTEM2_RESULT_CAPTURE_FILE_NOT_SUPPORTED;
+    #endif
+}
+
+SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2UnmapOutput(System2OutputView* view)
+{
+    if(!view)
+        return SYSTEM2_RESULT_INVALID_ARGUMENT;
+    
+    #if defined(__unix__) || defined(__APPLE__)
+        if(view->Data)
+            munmap((void*)view->Data, (size_t)view->Size);
+    #endif
+    
+    memset(view, 0, sizeof(System2OutputView));
+    return SYSTEM2_RESULT_SUCCESS;
+}
+
+#if defined(__unix__) || defined(__APPLE__)
+    //Starts the shell of the session with its settings
+    SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT 
+    Internal_System2ShellSessionStartShell(System2ShellSession* session)
+    {
+        session->ShellInfo = session->Settings;
+        
+        //So that killing the shell also kills the command it is running
+        session->ShellInfo.NewProcessGroup = true;
+        session->DataStart = 0;
+        session->DataEnd = 0;
+        
+        SYSTEM2_RESULT result = System2RunSubprocess("/bin/sh", NULL, 0, &session->ShellInfo);
+        session->ShellRunning = result == SYSTEM2_RESULT_SUCCESS;
+        return result;
+    }
+    
+    //Kills and cleans up the shell of the session if it is running
+    SYSTEM2_FUNC_PREFIX void Internal_System2ShellSessionStopShell(System2ShellSession* session)
+    {
+        if(!session->ShellRunning)
+            return;
+        
+        int returnCode = 0;
+        System2Kill(&session->ShellInfo);
+        System2GetCommandReturnValue(&session->ShellInfo, -1, &returnCode);
+        System2CleanupCommand(&session->ShellInfo);
+        session->ShellRunning = false;
+    }
+#endif
+
+SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2ShellSessionStart(System2ShellSession* outSession,
+                                                            const System2CommandInfo* settings)
+{
+    if(!outSession)
+        return SYSTEM2_RESULT_INVALID_ARGUMENT;
+    
+    memset(outSession, 0, sizeof(System2ShellSession));
+    
+    #if defined(__unix__) || defined(__APPLE__)
+        if(settings)
+            outSession->Settings = *settings;
+        
+        //The session talks to the shell through the pipes, so nothing else can use them
+        System2CommandInfo* shellSettings = &outSession->Settings;
+        shellSettings->RedirectInput = true;
+        shellSettings->RedirectOutput = true;
+        shellSettings->StandaloneStderr = false;
+        shellSettings->InputBuffer = NULL;
+        shellSettings->InputBufferSize = 0;
+        shellSettings->CaptureOutputToFile = false;
+        shellSettings->UsePty = false;
+        shellSettings->OnStdout = NULL;
+        shellSettings->OnStderr = NULL;
+        shellSettings->OnExit = NULL;
+        shellSettings->InternalState = NULL;
+        
+        snprintf(   outSession->Token, 
+                    sizeof(outSession->Token), 
+                    "%ld_%lld", 
+                    (long)getpid(), 
+                    (long long)Internal_System2GetTimeMs());
         
-        char* utf8EnvStrings = utf8EnvStringStart;
-        if(*utf8EnvStrings == '\0' && *(utf8EnvStrings + 1) == '\0')
-        {
-            *outCount = 0;
-            free(utf8EnvStringStart);
-            return SYSTEM2_RESULT_SUCCESS;
-        }
-        *outResource = utf8EnvStringStart;
-        *outCount = 0;
+        outSession->BufferSize = SYSTEM2_SHELL_SESSION_BUFFER_SIZE;
+        outSession->Buffer = (char*)malloc(outSession->BufferSize);
+        if(!outSession->Buffer)
+            return SYSTEM2_RESULT_MALLOC_FAILED;
         
-        /*
-        Each environment block contains the environment variables in the following format:
-
-        Var1=Value1\0
-        Var2=Value2\0
-        Var3=Value3\0
-        ...
-        VarN=ValueN\0\0
-        */
-        while(*utf8EnvStrings != '\0' || *(utf8EnvStrings + 1) != '\0')
+        SYSTEM2_RESULT result = Internal_System2ShellSessionStartShell(outSession);
+        if(result != SYSTEM2_RESULT_SUCCESS)
         {
-            if(*utf8EnvStrings == '\0')
-                ++(*outCount);
-            ++utf8EnvStrings;
+            free(outSession->Buffer);
+            outSession->Buffer = NULL;
         }
         
-        return SYSTEM2_RESULT_SUCCESS;
-    }
+        return result;
+    #else
+        (void)settings;
+        return SYSTEM2_RESULT_SHELL_SESSION_NOT_SUPPORTED;
+    #endif
+}
+
+SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2ShellSessionRun(  System2ShellSession* session,
+                                                            const char* command,
+                                                            int timeoutMs,
+                                                            const char** outOutput,
+                                                            uint32_t* outOutputSize,
+                                                            int* outReturnCode)
+{
+    if(!session || !session->Buffer || !command || !outOutput || !outOutputSize || !outReturnCode)
+        return SYSTEM2_RESULT_INVALID_ARGUMENT;
     
-    SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2GetEnvironmentVariableWindows(const void* resource,
-                                                                            const char** outName,
-                                                                            int* outNameLength,
-                                                                            const char** outValue,
-                                                                            int* outValueLength,
-                                                                            int index)
-    {
-        if(!outName || !outNameLength || !outValue || !outValueLength || !resource)
+    *outOutput = NULL;
+    *outOutputSize = 0;
+    *outReturnCode = -1;
+    
+    #if defined(__unix__) || defined(__APPLE__)
+        if(!session->ShellRunning)
             return SYSTEM2_RESULT_INVALID_ARGUMENT;
         
-        static const char* lastResource = NULL;
-        static int lastIndex = 0;
-        static char* lastEnv = NULL;
+        //Drop the output returned by the last call
+        memmove(session->Buffer, 
+                session->Buffer + session->DataStart, 
+                session->DataEnd - session->DataStart);
+        session->DataEnd -= session->DataStart;
+        session->DataStart = 0;
         
-        bool canUseCache = resource == lastResource && lastEnv && index > lastIndex;
+        //The output of the command ends with "\n<marker> <exit code>\n"
+        char marker[sizeof(session->Token) + 48];
+        int markerLength = snprintf(marker, 
+                                    sizeof(marker), 
+                                    "\n__SYSTEM2_%s_%llu__ ", 
+                                    session->Token, 
+                                    (unsigned long long)++session->CommandsCount);
         
-        const char* envStringsStart = (const char*)resource;
-        char* envStrings = canUseCache ? lastEnv : (char*)envStringsStart;
-        int currentIndex = canUseCache ? lastIndex : 0;
+        //The command is run with `eval` in single quotes so that the shell survives syntax errors, 
+        //and stdin is /dev/null so that it can't read the rest of our input
+        uint32_t commandLength = strlen(command);
+        uint32_t quotesCount = 0;
+        for(uint32_t i = 0; i < commandLength; ++i)
+            quotesCount += command[i] == '\'';
         
-        lastResource = (const char*)resource;
-        do
+        uint64_t scriptSize = (uint64_t)commandLength + quotesCount * 3 + markerLength + 64;
+        if(scriptSize > UINT32_MAX)
+            return SYSTEM2_RESULT_INVALID_ARGUMENT;
+        
+        char* script = (char*)malloc(scriptSize);
+        if(!script)
+            return SYSTEM2_RESULT_MALLOC_FAILED;
+        
+        uint32_t scriptLength = 0;
+        memcpy(script, "command eval '", 14);
+        scriptLength += 14;
+        for(uint32_t i = 0; i < commandLength; ++i)
         {
-            if(currentIndex == index)
+            if(command[i] == '\'')
             {
-                lastEnv = envStrings;
-                lastIndex = index;
+                memcpy(script + scriptLength, "'\\''", 4);
+                scriptLength += 4;
+            }
+            else
+                script[scriptLength++] = command[i];
+        }
+        
+        //The marker is printed without its first newline and trailing space
+        scriptLength += snprintf(   script + scriptLength, 
+                                    scriptSize - scriptLength,
+                                    "' </dev/null; printf '\\n%%s %%d\\n' '%.*s' \"$?\"\n",
+                                    markerLength - 2,
+                                    marker + 1);
+        
+        SYSTEM2_RESULT result = System2WriteToInput(&session->ShellInfo, script, scriptLength);
+        free(script);
+        if(result != SYSTEM2_RESULT_SUCCESS)
+            return result;
+        
+        int64_t startTime = Internal_System2GetTimeMs();
+        uint32_t scanEnd = 0;
+        while(true)
+        {
+            //Look for the marker in the data we haven't searched yet
+            for(uint32_t i = scanEnd; i + markerLength <= session->DataEnd; ++i)
+            {
+                i += Internal_System2FindByte(session->Buffer + i, session->DataEnd - i, '\n');
+                if(i + markerLength > session->DataEnd)
+                    break;
                 
-                *outName = envStrings;
-                char* equal = envStrings;
-                while(equal)
-                {
-                    if(*equal == '=')
-                        break;
-                    ++equal;
-                }
-                *outNameLength = (int)(equal - envStrings);
+                if(memcmp(session->Buffer + i, marker, markerLength) != 0)
+                    continue;
                 
-                envStrings = equal + 1;
-                *outValue = envStrings;
-                while(*envStrings)
-                    ++envStrings;
+                //Wait for the rest of the line if the exit code isn't here yet
+                uint32_t codeStart = i + markerLength;
+                uint32_t codeEnd = 
+                    codeStart + Internal_System2FindByte(   session->Buffer + codeStart, 
+                                                            session->DataEnd - codeStart, 
+                                                            '\n');
+                if(codeEnd == session->DataEnd)
+                    break;
                 
-                *outValueLength = (int)(envStrings - (equal + 1));
-                break;
+                *outOutput = session->Buffer;
+                *outOutputSize = i;
+                *outReturnCode = (int)strtol(session->Buffer + codeStart, NULL, 10);
+                session->DataStart = codeEnd + 1;
+                return SYSTEM2_RESULT_SUCCESS;
             }
             
-            if(*envStrings == '\0')
-                ++currentIndex;
-            ++envStrings;
+            //A complete marker line is at most this long, so it can't start before here
+            if(session->DataEnd > (uint32_t)markerLength + 16)
+                scanEnd = session->DataEnd - markerLength - 16;
+            
+            if(session->DataEnd == session->BufferSize)
+            {
+                if(session->BufferSize > UINT32_MAX / 2)
+                    return SYSTEM2_RESULT_MALLOC_FAILED;
+                
+                char* newBuffer = (char*)realloc(session->Buffer, session->BufferSize * 2);
+                if(!newBuffer)
+                    return SYSTEM2_RESULT_MALLOC_FAILED;
+                
+                session->Buffer = newBuffer;
+                session->BufferSize *= 2;
+            }
+            
+            //The pipe is read directly, since it is polled for the timeout
+            int pollTimeoutMs = -1;
+            if(timeoutMs >= 0)
+            {
+                int64_t elapsedMs = Internal_System2GetTimeMs() - startTime;
+                pollTimeoutMs = elapsedMs >= timeoutMs ? 0 : (int)(timeoutMs - elapsedMs);
+            }
+            
+            struct pollfd pollFd;
+            pollFd.fd = session->ShellInfo.ChildToParentPipes[SYSTEM2_FD_READ];
+            pollFd.events = POLLIN;
+            pollFd.revents = 0;
+            int pollResult = poll(&pollFd, 1, pollTimeoutMs);
+            if(pollResult < 0)
+            {
+                if(errno == EINTR)
+                    continue;
+                
+                return SYSTEM2_RESULT_READ_FAILED;
+            }
+            
+            if(pollResult == 0)
+            {
+                result = System2ShellSessionReset(session);
+                if(result != SYSTEM2_RESULT_SUCCESS)
+                    return result;
+                
+                return SYSTEM2_RESULT_COMMAND_NOT_FINISHED;
+            }
+            
+            ssize_t readResult = read(  pollFd.fd, 
+                                        session->Buffer + session->DataEnd, 
+                                        session->BufferSize - session->DataEnd);
+            if(readResult < 0)
+            {
+                if(errno == EINTR || errno == EAGAIN)
+                    continue;
+                
+                return SYSTEM2_RESULT_READ_FAILED;
+            }
+            
+            if(readResult > 0)
+            {
+                session->DataEnd += readResult;
+                continue;
+            }
+            
+            //The command exited the shell, return what it has output with the exit code of the 
+            //shell and start a new one. The output stays at the start of the buffer.
+            uint32_t outputSize = session->DataEnd;
+            result = System2GetCommandReturnValue(&session->ShellInfo, -1, outReturnCode);
+            System2CleanupCommand(&session->ShellInfo);
+            session->ShellRunning = false;
+            if(result != SYSTEM2_RESULT_SUCCESS && result != SYSTEM2_RESULT_COMMAND_TERMINATED)
+                return result;
+            
+            result = Internal_System2ShellSessionStartShell(session);
+            if(result != SYSTEM2_RESULT_SUCCESS)
+                return result;
+            
+            *outOutput = session->Buffer;
+            *outOutputSize = outputSize;
+            session->DataStart = outputSize;
+            session->DataEnd = outputSize;
+            return SYSTEM2_RESULT_SUCCESS;
+        }
+    #else
+        (void)timeoutMs;
+        return SYSTEM2_RESULT_SHELL_SESSION_NOT_SUPPORTED;
+    #endif
+}
+
+SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2ShellSessionReset(System2ShellSession* session)
+{
+    if(!session || !session->Buffer)
+        return SYSTEM2_RESULT_INVALID_ARGUMENT;
+    
+    #if defined(__unix__) || defined(__APPLE__)
+        Internal_System2ShellSessionStopShell(session);
+        return Internal_System2ShellSessionStartShell(session);
+    #else
+        return SYSTEM2_RESULT_SHELL_SESSION_NOT_SUPPORTED;
+    #endif
+}
+
+SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2ShellSessionEnd(System2ShellSession* session)
+{
+    if(!session)
+        return SYSTEM2_RESULT_INVALID_ARGUMENT;
+    
+    SYSTEM2_RESULT result = SYSTEM2_RESULT_SUCCESS;
+    
+    #if defined(__unix__) || defined(__APPLE__)
+        if(session->ShellRunning)
+        {
+            //Let the shell exit by itself, it is waiting for the next command
+            int returnCode = 0;
+            result = System2WriteToInput(&session->ShellInfo, "exit\n", 5);
+            if(result == SYSTEM2_RESULT_SUCCESS)
+                result = System2GetCommandReturnValue(&session->ShellInfo, -1, &returnCode);
+            else
+            {
+                System2Kill(&session->ShellInfo);
+                System2GetCommandReturnValue(&session->ShellInfo, -1, &returnCode);
+            }
+            
+            SYSTEM2_RESULT cleanupResult = System2CleanupCommand(&session->ShellInfo);
+            if(result == SYSTEM2_RESULT_SUCCESS)
+                result = cleanupResult;
+        }
+    #endif
+    
+    free(session->Buffer);
+    memset(session, 0, sizeof(System2ShellSession));
+    return result;
+}
+
+#if defined(_WIN32)
+    SYSTEM2_FUNC_PREFIX int64_t Internal_System2LimiterGetTimeMs(void)
+    {
+        return (int64_t)GetTickCount64();
+    }
+#else
+    SYSTEM2_FUNC_PREFIX int64_t Internal_System2LimiterGetTimeMs(void)
+    {
+        return Internal_System2GetTimeMs();
+    }
+#endif
+
+//Reads the stall totals of CPU, memory and IO in microseconds, returns false if not available
+SYSTEM2_FUNC_PREFIX bool Internal_System2ReadPressureTotals(uint64_t outTotalsUs[3])
+{
+    #if defined(__linux__)
+        const char* paths[] =   {
+                                    "/proc/pressure/cpu", 
+                                    "/proc/pressure/memory", 
+                                    "/proc/pressure/io"
+                                };
+        for(int i = 0; i < 3; ++i)
+        {
+            //The first line is `some avg10=0.00 avg60=0.00 avg300=0.00 total=0`. Only the total is 
+            //parsed, since the averages would be read with the decimal point of the locale.
+            FILE* file = fopen(paths[i], "r");
+            if(!file)
+                return false;
+            
+            char line[256];
+            bool lineRead = fgets(line, sizeof(line), file) != NULL;
+            fclose(file);
+            if(!lineRead || strncmp(line, "some ", 5) != 0)
+                return false;
+            
+            const char* totalText = strstr(line, "total=");
+            if(!totalText)
+                return false;
+            
+            totalText += 6;
+            char* totalEnd = NULL;
+            errno = 0;
+            unsigned long long total = strtoull(totalText, &totalEnd, 10);
+            if(totalEnd == totalText || errno != 0)
+                return false;
+            
+            outTotalsUs[i] = (uint64_t)total;
         }
-        while(*envStrings != '\0' || *(envStrings + 1) != '\0');
         
-        return SYSTEM2_RESULT_SUCCESS;
+        return true;
+    #else
+        (void)outTotalsUs;
+        return false;
+    #endif
+}
+
+//Reads the pressure if a sample is due and adjusts the limit with it
+SYSTEM2_FUNC_PREFIX void Internal_System2LimiterSample(System2AdaptiveLimiter* limiter)
+{
+    int64_t now = Internal_System2LimiterGetTimeMs();
+    int64_t elapsedMs = now - limiter->LastSampleTimeMs;
+    if(elapsedMs < (int64_t)limiter->SampleIntervalMs)
+        return;
+    
+    uint64_t totalsUs[3] = { 0, 0, 0 };
+    bool available = Internal_System2ReadPressureTotals(totalsUs);
+    float pressures[3] = { 0, 0, 0 };
+    
+    //The first sample only has the totals to compare against
+    if(available && limiter->PressureAvailable && elapsedMs > 0)
+    {
+        for(int i = 0; i < 3; ++i)
+        {
+            uint64_t stalledUs = totalsUs[i] - limiter->StallTotalsUs[i];
+            pressures[i] = (float)((double)stalledUs / ((double)elapsedMs * 10.0));
+        }
     }
     
-    SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2EnvironmentVariableFreeWindows(void** resource)
+    if(available)
+        memcpy(limiter->StallTotalsUs, totalsUs, sizeof(totalsUs));
+    
+    limiter->PressureAvailable = available;
+    limiter->CpuPressure = pressures[0];
+    limiter->MemoryPressure = pressures[1];
+    limiter->IoPressure = pressures[2];
+    limiter->LastSampleTimeMs = now;
+    
+    float newLimit = limiter->Limit;
+    if( pressures[0] > limiter->PressureThreshold || 
+        pressures[1] > limiter->PressureThreshold || 
+        pressures[2] > limiter->PressureThreshold)
     {
-        if(!resource)
-            return SYSTEM2_RESULT_INVALID_ARGUMENT;
-        
-        if(!(*resource))
-            return SYSTEM2_RESULT_SUCCESS;
-        
-        free(*resource);
-        *resource = NULL;
-        return SYSTEM2_RESULT_SUCCESS;
+        newLimit = limiter->Limit * limiter->DecreaseFactor;
+        limiter->SlowStart = false;
     }
+    //Only grow the limit if it is actually holding commands back
+    else if(limiter->LimitReached)
+        newLimit = limiter->SlowStart ? limiter->Limit * 2 : limiter->Limit + 1;
     
-    SYSTEM2_FUNC_PREFIX
-    SYSTEM2_RESULT System2SetEnvironmentVariableWindows(const char* envName, const char* envValue)
+    if(newLimit < (float)limiter->MinConcurrency)
+        newLimit = (float)limiter->MinConcurrency;
+    
+    if(newLimit > (float)limiter->MaxConcurrency)
+        newLimit = (float)limiter->MaxConcurrency;
+    
+    if(newLimit > limiter->Limit)
+        ++limiter->IncreasesCount;
+    else if(newLimit < limiter->Limit)
+        ++limiter->DecreasesCount;
+    
+    limiter->Limit = newLimit;
+    limiter->LimitReached = false;
+}
+
+SYSTEM2_FUNC_PREFIX bool Internal_System2IsCommandRunning(const System2CommandInfo* info)
+{
+    #if defined(__unix__) || defined(__APPLE__)
+        int returnCode = 0;
+        return Internal_System2PeekExit(info, &returnCode) == SYSTEM2_RESULT_COMMAND_NOT_FINISHED;
+    #elif defined(_WIN32)
+        return WaitForSingleObject(info->ChildProcessHandle, 0) == WAIT_TIMEOUT;
+    #else
+        (void)info;
+        return false;
+    #endif
+}
+
+SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2AdaptiveLimiterInit(  System2AdaptiveLimiter* outLimiter,
+                                                                int minConcurrency,
+                                                                int maxConcurrency)
+{
+    if(!outLimiter || minConcurrency <= 0 || maxConcurrency < minConcurrency)
+        return SYSTEM2_RESULT_INVALID_ARGUMENT;
+    
+    memset(outLimiter, 0, sizeof(System2AdaptiveLimiter));
+    outLimiter->MinConcurrency = minConcurrency;
+    outLimiter->MaxConcurrency = maxConcurrency;
+    outLimiter->SampleIntervalMs = 1000;
+    outLimiter->PressureThreshold = 10;
+    outLimiter->DecreaseFactor = 0.5f;
+    outLimiter->Limit = (float)minConcurrency;
+    outLimiter->SlowStart = true;
+    outLimiter->WaitStartTimeMs = -1;
+    
+    //Takes the first totals to compare the next sample against
+    outLimiter->PressureAvailable = Internal_System2ReadPressureTotals(outLimiter->StallTotalsUs);
+    outLimiter->LastSampleTimeMs = Internal_System2LimiterGetTimeMs();
+    return SYSTEM2_RESULT_SUCCESS;
+}
+
+SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT 
+System2AdaptiveLimiterAcquire(  System2AdaptiveLimiter* limiter,
+                                System2CommandInfo** runningCommands,
+                                int runningCommandsCount,
+                                int timeoutMs)
+{
+    if(!limiter || runningCommandsCount < 0 || (runningCommandsCount > 0 && !runningCommands))
+        return SYSTEM2_RESULT_INVALID_ARGUMENT;
+    
+    int64_t startTime = Internal_System2LimiterGetTimeMs();
+    while(true)
     {
-        if(!envName)
-            return SYSTEM2_RESULT_INVALID_ARGUMENT;
+        Internal_System2LimiterSample(limiter);
         
-        wchar_t* envNameW;
-        int envNameWLen;
-        SYSTEM2_RESULT result = Internal_System2Utf8ToUtf16(envName, 
-                                                            (int)strlen(envName) + 1, 
-                                                            &envNameW, 
-                                                            &envNameWLen);
-        if(result != SYSTEM2_RESULT_SUCCESS)
-            return result;
+        int runningCount = 0;
+        for(int i = 0; i < runningCommandsCount; ++i)
+        {
+            if(runningCommands[i] && Internal_System2IsCommandRunning(runningCommands[i]))
+                ++runningCount;
+        }
         
-        if(envValue)
+        int64_t now = Internal_System2LimiterGetTimeMs();
+        if(runningCount < (int)limiter->Limit)
         {
-            wchar_t* envValueW;
-            int envValueWLen;
-            result = Internal_System2Utf8ToUtf16(   envValue, 
-                                                    (int)strlen(envValue) + 1, 
-                                                    &envValueW, 
-                                                    &envValueWLen);
-            if(result != SYSTEM2_RESULT_SUCCESS)
+            ++limiter->AdmittedCount;
+            if(limiter->WaitStartTimeMs >= 0)
             {
-                free(envNameW);
-                return result;
+                uint64_t waitMs = (uint64_t)(now - limiter->WaitStartTimeMs);
+                ++limiter->WaitedCount;
+                limiter->TotalWaitMs += waitMs;
+                if(waitMs > limiter->MaxWaitMs)
+                    limiter->MaxWaitMs = waitMs;
+                
+                limiter->WaitStartTimeMs = -1;
             }
             
-            if(SetEnvironmentVariableW(envNameW, envValueW) == 0)
-            {
-                free(envNameW);
-                free(envValueW);
-                return SYSTEM2_RESULT_WINDOWS_SET_ENV_FAILED;
-            }
-            free(envValueW);
+            return SYSTEM2_RESULT_SUCCESS;
         }
-        else
+        
+        limiter->LimitReached = true;
+        if(limiter->WaitStartTimeMs < 0)
+            limiter->WaitStartTimeMs = now;
+        
+        if(timeoutMs >= 0 && now - startTime >= timeoutMs)
+            return SYSTEM2_RESULT_LIMIT_REACHED;
+        
+        //Checks for exited commands every few milliseconds, and samples on time
+        int64_t waitMs = 5;
+        if(timeoutMs >= 0 && startTime + timeoutMs - now < waitMs)
+            waitMs = startTime + timeoutMs - now;
+        
+        #if defined(__unix__) || defined(__APPLE__)
+            poll(NULL, 0, (int)waitMs);
+        #elif defined(_WIN32)
+            Sleep((DWORD)waitMs);
+        #endif
+    }
+}
+
+//Appends the output of a node to its buffer, growing it as needed
+SYSTEM2_FUNC_PREFIX void Internal_System2GraphAppend(   System2GraphNode* node,
+                                                        char** inOutBuffer,
+                                                        uint64_t* inOutSize,
+                                                        uint64_t* inOutCapacity,
+                                                        const char* data,
+                                                        uint32_t size)
+{
+    if(*inOutSize + size > *inOutCapacity)
+    {
+        uint64_t newCapacity = *inOutCapacity > 0 ? *inOutCapacity * 2 : 4096;
+        while(newCapacity < *inOutSize + size)
+            newCapacity *= 2;
+        
+        char* newBuffer = (char*)realloc(*inOutBuffer, (size_t)newCapacity);
+        if(!newBuffer)
         {
-            if(SetEnvironmentVariableW(envNameW, NULL) == 0)
-            {
-                free(envNameW);
-                return SYSTEM2_RESULT_WINDOWS_SET_ENV_FAILED;
-            }
+            //Fails the node once it has exited
+            node->Result = SYSTEM2_RESULT_MALLOC_FAILED;
+            return;
         }
         
-        free(envNameW);
-        return SYSTEM2_RESULT_SUCCESS;
+        *inOutBuffer = newBuffer;
+        *inOutCapacity = newCapacity;
     }
-#endif //defined(_WIN32)
+    
+    memcpy(*inOutBuffer + *inOutSize, data, size);
+    *inOutSize += size;
+}
 
-SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2Run(  const char* command, 
-                                                System2CommandInfo* inOutCommandInfo)
+SYSTEM2_FUNC_PREFIX void Internal_System2GraphOnStdout(  void* userData, 
+                                                        const char* data, 
+                                                        uint32_t size)
 {
-    #if defined(__unix__) || defined(__APPLE__)
-        return System2RunPosix(command, inOutCommandInfo);
-    #elif defined(_WIN32)
-        return System2RunWindows(command, inOutCommandInfo);
-    #else
-        return SYSTEM2_RESULT_UNSUPPORTED_PLATFORM; 
-    #endif
+    System2GraphNode* node = (System2GraphNode*)userData;
+    Internal_System2GraphAppend(node, 
+                                &node->Output, 
+                                &node->OutputSize, 
+                                &node->OutputCapacity, 
+                                data, 
+                                size);
 }
 
-SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2RunSubprocess(const char* executable,
-                                                        const char* const* args,
-                                                        int argsCount,
-                                                        System2CommandInfo* inOutCommandInfo)
+SYSTEM2_FUNC_PREFIX void Internal_System2GraphOnStderr(  void* userData, 
+                                                        const char* data, 
+                                                        uint32_t size)
 {
-    #if defined(__unix__) || defined(__APPLE__)
-        return System2RunSubprocessPosix(executable, args, argsCount, inOutCommandInfo);
-    #elif defined(_WIN32)
-        return System2RunSubprocessWindows(executable, args, argsCount, inOutCommandInfo);
-    #else
-        return SYSTEM2_RESULT_UNSUPPORTED_PLATFORM; 
-    #endif
+    System2GraphNode* node = (System2GraphNode*)userData;
+    Internal_System2GraphAppend(node, 
+                                &node->Stderr, 
+                                &node->StderrSize, 
+                                &node->StderrCapacity, 
+                                data, 
+                                size);
 }
 
-SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2ReadFromOutput(   const System2CommandInfo* info, 
-                                                            char* outputBuffer, 
-                                                            uint32_t outputBufferSize,
-                                                            uint32_t* outBytesRead)
+SYSTEM2_FUNC_PREFIX void Internal_System2GraphOnExit(  void* userData, 
+                                                        int returnCode, 
+                                                        bool terminated)
 {
-    #if defined(__unix__) || defined(__APPLE__)
-        return System2ReadFromOutputPosix(info, false, outputBuffer, outputBufferSize, outBytesRead);
-    #elif defined(_WIN32)
-        return System2ReadFromOutputWindows(info, false, outputBuffer, outputBufferSize, outBytesRead);
-    #else
-        return SYSTEM2_RESULT_UNSUPPORTED_PLATFORM; 
-    #endif
+    (void)returnCode;
+    (void)terminated;
+    ((System2GraphNode*)userData)->Exited = true;
 }
 
-SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2ReadFromStderr(   const System2CommandInfo* info, 
-                                                            char* outputBuffer, 
-                                                            uint32_t outputBufferSize,
-                                                            uint32_t* outBytesRead)
+//Ready nodes are kept in a max heap ordered by priority, then by the order they were added in
+SYSTEM2_FUNC_PREFIX bool Internal_System2GraphHeapBefore(   const System2Graph* graph, 
+                                                            int nodeIndex, 
+                                                            int otherIndex)
 {
-    #if defined(__unix__) || defined(__APPLE__)
-        return System2ReadFromOutputPosix(info, true, outputBuffer, outputBufferSize, outBytesRead);
-    #elif defined(_WIN32)
-        return System2ReadFromOutputWindows(info, true, outputBuffer, outputBufferSize, outBytesRead);
-    #else
-        return SYSTEM2_RESULT_UNSUPPORTED_PLATFORM; 
-    #endif
+    uint64_t priority = graph->Nodes[nodeIndex].Priority;
+    uint64_t otherPriority = graph->Nodes[otherIndex].Priority;
+    return priority > otherPriority || (priority == otherPriority && nodeIndex < otherIndex);
 }
 
-SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2WriteToInput( const System2CommandInfo* info, 
-                                                        const char* inputBuffer, 
-                                                        const uint32_t inputBufferSize)
+SYSTEM2_FUNC_PREFIX void Internal_System2GraphHeapPush( const System2Graph* graph,
+                                                        int* heap,
+                                                        int* inOutHeapCount,
+                                                        int nodeIndex)
 {
-    #if defined(__unix__) || defined(__APPLE__)
-        return System2WriteToInputPosix(info, inputBuffer, inputBufferSize);
-    #elif defined(_WIN32)
-        return System2WriteToInputWindows(info, inputBuffer, inputBufferSize);
-    #else
-        return SYSTEM2_RESULT_UNSUPPORTED_PLATFORM; 
-    #endif
+    int index = (*inOutHeapCount)++;
+    while(index > 0)
+    {
+        int parent = (index - 1) / 2;
+        if(!Internal_System2GraphHeapBefore(graph, nodeIndex, heap[parent]))
+            break;
+        
+        heap[index] = heap[parent];
+        index = parent;
+    }
+    
+    heap[index] = nodeIndex;
 }
 
-SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2CleanupCommand(const System2CommandInfo* info)
+SYSTEM2_FUNC_PREFIX int Internal_System2GraphHeapPop(   const System2Graph* graph,
+                                                        int* heap,
+                                                        int* inOutHeapCount)
 {
-    #if defined(__unix__) || defined(__APPLE__)
-        return System2CleanupCommandPosix(info);
-    #elif defined(_WIN32)
-        return System2CleanupCommandWindows(info);
-    #else
-        return SYSTEM2_RESULT_UNSUPPORTED_PLATFORM; 
-    #endif
+    int top = heap[0];
+    int last = heap[--(*inOutHeapCount)];
+    int index = 0;
+    while(true)
+    {
+        int child = index * 2 + 1;
+        if(child >= *inOutHeapCount)
+            break;
+        
+        if( child + 1 < *inOutHeapCount && 
+            Internal_System2GraphHeapBefore(graph, heap[child + 1], heap[child]))
+        {
+            ++child;
+        }
+        
+        if(!Internal_System2GraphHeapBefore(graph, heap[child], last))
+            break;
+        
+        heap[index] = heap[child];
+        index = child;
+    }
+    
+    if(*inOutHeapCount > 0)
+        heap[index] = last;
+    
+    return top;
 }
 
-SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2GetCommandReturnValue(const System2CommandInfo* info, 
-                                                                int timeoutSec,
-                                                                int* outReturnCode)
+//Starts the command of the node with the graph's callbacks
+SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT Internal_System2GraphStartNode(System2GraphNode* node)
 {
-    #if defined(__unix__) || defined(__APPLE__)
-        return System2GetCommandReturnValuePosix(info, timeoutSec, outReturnCode);
-    #elif defined(_WIN32)
-        return System2GetCommandReturnValueWindows(info, timeoutSec, outReturnCode);
-    #else
-        return SYSTEM2_RESULT_UNSUPPORTED_PLATFORM; 
-    #endif
+    System2CommandInfo* info = &node->Info;
+    *info = node->Settings;
+    info->RedirectInput = false;
+    info->UsePty = false;
+    info->CaptureOutputToFile = false;
+    info->OnStdout = node->Settings.RedirectOutput ? Internal_System2GraphOnStdout : NULL;
+    info->OnStderr =    node->Settings.RedirectOutput && node->Settings.StandaloneStderr ? 
+                        Internal_System2GraphOnStderr : 
+                        NULL;
+    info->OnExit = Internal_System2GraphOnExit;
+    info->CallbackUserData = node;
+    info->InternalState = NULL;
+    
+    if(node->Spec.Command)
+        return System2Run(node->Spec.Command, info);
+    
+    return System2RunSubprocess(node->Spec.Executable, node->Spec.Args, node->Spec.ArgsCount, info);
 }
 
-SYSTEM2_FUNC_PREFIX 
-SYSTEM2_RESULT System2GetEnvironmentVariablesCount(int* outCount, void** outResource)
+//Makes the dependents of the node ready if this was the last dependency they were waiting for
+SYSTEM2_FUNC_PREFIX void Internal_System2GraphReleaseDependents(const System2Graph* graph,
+                                                                const System2GraphNode* node,
+                                                                int* readyHeap,
+                                                                int* inOutReadyCount)
 {
-    #if defined(__unix__) || defined(__APPLE__)
-        return System2GetEnvironmentVariablesCountPosix(outCount, outResource);
-    #elif defined(_WIN32)
-        return System2GetEnvironmentVariablesCountWindows(outCount, outResource);
-    #else
-        return SYSTEM2_RESULT_UNSUPPORTED_PLATFORM;
-    #endif
+    for(int i = 0; i < node->DependentsCount; ++i)
+    {
+        int dependentIndex = node->Dependents[i];
+        if(--graph->Nodes[dependentIndex].PendingDependencies == 0)
+            Internal_System2GraphHeapPush(graph, readyHeap, inOutReadyCount, dependentIndex);
+    }
 }
 
-SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2GetEnvironmentVariable(   const void* resource,
-                                                                    const char** outName,
-                                                                    int* outNameLength,
-                                                                    const char** outValue,
-                                                                    int* outValueLength,
-                                                                    int index)
+//Applies the failure policy of the graph after a node has failed
+SYSTEM2_FUNC_PREFIX void Internal_System2GraphOnFailure(const System2Graph* graph,
+                                                        const System2GraphNode* node,
+                                                        System2CommandInfo** runningInfos,
+                                                        int runningCount,
+                                                        int* readyHeap,
+                                                        int* inOutReadyCount,
+                                                        bool* inOutStopping)
 {
-    #if defined(__unix__) || defined(__APPLE__)
-        return System2GetEnvironmentVariablePosix(  resource,
-                                                    outName, 
-                                                    outNameLength, 
-                                                    outValue, 
-                                                    outValueLength, 
-                                                    index);
-    #elif defined(_WIN32)
-        return System2GetEnvironmentVariableWindows(resource,
-                                                    outName, 
-                                                    outNameLength, 
-                                                    outValue, 
-                                                    outValueLength, 
-                                                    index);
-    #else
-        return SYSTEM2_RESULT_UNSUPPORTED_PLATFORM;
-    #endif
+    switch(graph->FailurePolicy)
+    {
+        case SYSTEM2_GRAPH_FAILURE_STOP:
+            *inOutStopping = true;
+            break;
+        case SYSTEM2_GRAPH_FAILURE_KILL:
+            if(!*inOutStopping)
+            {
+                for(int i = 0; i < runningCount; ++i)
+                    System2Kill(runningInfos[i]);
+            }
+            *inOutStopping = true;
+            break;
+        case SYSTEM2_GRAPH_FAILURE_SKIP_DEPENDENTS:
+            break;
+        case SYSTEM2_GRAPH_FAILURE_IGNORE:
+            Internal_System2GraphReleaseDependents(graph, node, readyHeap, inOutReadyCount);
+            break;
+    }
 }
 
-SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2EnvironmentVariableFree(void** resource)
+SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2GraphInit(System2Graph* outGraph)
 {
-    #if defined(__unix__) || defined(__APPLE__)
-        return System2EnvironmentVariableFreePosix(resource);
-    #elif defined(_WIN32)
-        return System2EnvironmentVariableFreeWindows(resource);
-    #else
-        return SYSTEM2_RESULT_UNSUPPORTED_PLATFORM;
-    #endif
+    if(!outGraph)
+        return SYSTEM2_RESULT_INVALID_ARGUMENT;
+    
+    memset(outGraph, 0, sizeof(System2Graph));
+    return SYSTEM2_RESULT_SUCCESS;
 }
 
-SYSTEM2_FUNC_PREFIX 
-SYSTEM2_RESULT System2SetEnvironmentVariable(const char* envName, const char* envValue)
+SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2GraphAddNode( System2Graph* graph,
+                                                        const System2SpawnSpec* spec,
+                                                        const System2CommandInfo* settings,
+                                                        uint64_t cost,
+                                                        int* outNodeIndex)
 {
-    #if defined(__unix__) || defined(__APPLE__)
-        return System2SetEnvironmentVariablePosix(envName, envValue);
-    #elif defined(_WIN32)
-        return System2SetEnvironmentVariableWindows(envName, envValue);
-    #else
-        return SYSTEM2_RESULT_UNSUPPORTED_PLATFORM;
-    #endif
+    if(!graph || !spec || (!spec->Command && !spec->Executable))
+        return SYSTEM2_RESULT_INVALID_ARGUMENT;
+    
+    if(graph->NodesCount == graph->NodesCapacity)
+    {
+        int newCapacity = graph->NodesCapacity > 0 ? graph->NodesCapacity * 2 : 16;
+        System2GraphNode* newNodes = 
+            (System2GraphNode*)realloc(graph->Nodes, sizeof(System2GraphNode) * newCapacity);
+        if(!newNodes)
+            return SYSTEM2_RESULT_MALLOC_FAILED;
+        
+        graph->Nodes = newNodes;
+        graph->NodesCapacity = newCapacity;
+    }
+    
+    System2GraphNode* node = &graph->Nodes[graph->NodesCount];
+    memset(node, 0, sizeof(System2GraphNode));
+    node->Spec = *spec;
+    if(settings)
+        node->Settings = *settings;
+    
+    node->Cost = cost;
+    
+    if(outNodeIndex)
+        *outNodeIndex = graph->NodesCount;
+    
+    ++graph->NodesCount;
+    return SYSTEM2_RESULT_SUCCESS;
 }
 
-SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2Kill(const System2CommandInfo* info)
+SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2GraphAddEdge( System2Graph* graph,
+                                                        int dependencyIndex,
+                                                        int dependentIndex)
 {
-    #if defined(__unix__) || defined(__APPLE__)
-        return System2KillPosix(info);
-    #elif defined(_WIN32)
-        return System2KillWindows(info);
-    #else
-        return SYSTEM2_RESULT_UNSUPPORTED_PLATFORM;
-    #endif
+    if( !graph || 
+        dependencyIndex < 0 || 
+        dependencyIndex >= graph->NodesCount || 
+        dependentIndex < 0 || 
+        dependentIndex >= graph->NodesCount || 
+        dependencyIndex == dependentIndex)
+    {
+        return SYSTEM2_RESULT_INVALID_ARGUMENT;
+    }
+    
+    System2GraphNode* dependency = &graph->Nodes[dependencyIndex];
+    if(dependency->DependentsCount == dependency->DependentsCapacity)
+    {
+        int newCapacity = dependency->DependentsCapacity > 0 ? 
+                          dependency->DependentsCapacity * 2 : 
+                          4;
+        int* newDependents = (int*)realloc(dependency->Dependents, sizeof(int) * newCapacity);
+        if(!newDependents)
+            return SYSTEM2_RESULT_MALLOC_FAILED;
+        
+        dependency->Dependents = newDependents;
+        dependency->DependentsCapacity = newCapacity;
+    }
+    
+    dependency->Dependents[dependency->DependentsCount++] = dependentIndex;
+    ++graph->Nodes[dependentIndex].DependenciesCount;
+    return SYSTEM2_RESULT_SUCCESS;
 }
 
-SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2Term(const System2CommandInfo* info)
+SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2GraphRun( System2Graph* graph,
+                                                    int maxConcurrency,
+                                                    System2AdaptiveLimiter* limiter)
 {
-    #if defined(__unix__) || defined(__APPLE__)
-        return System2TermPosix(info);
-    #elif defined(_WIN32)
-        return System2TermWindows(info);
-    #else
-        return SYSTEM2_RESULT_UNSUPPORTED_PLATFORM;
-    #endif
+    if(!graph)
+        return SYSTEM2_RESULT_INVALID_ARGUMENT;
+    
+    int nodesCount = graph->NodesCount;
+    if(nodesCount == 0)
+        return SYSTEM2_RESULT_SUCCESS;
+    
+    int* order = (int*)malloc(sizeof(int) * nodesCount);
+    int* readyHeap = (int*)malloc(sizeof(int) * nodesCount);
+    int* runningNodes = (int*)malloc(sizeof(int) * nodesCount);
+    System2CommandInfo** runningInfos = 
+        (System2CommandInfo**)malloc(sizeof(System2CommandInfo*) * nodesCount);
+    if(!order || !readyHeap || !runningNodes || !runningInfos)
+    {
+        free(order);
+        free(readyHeap);
+        free(runningNodes);
+        free(runningInfos);
+        return SYSTEM2_RESULT_MALLOC_FAILED;
+    }
+    
+    SYSTEM2_RESULT result = SYSTEM2_RESULT_SUCCESS;
+    int readyCount = 0;
+    int runningCount = 0;
+    bool stopping = false;
+    bool anyFailed = false;
+    
+    //Sort the nodes so that each one comes after its dependencies, which fails if there's a cycle
+    int orderCount = 0;
+    for(int i = 0; i < nodesCount; ++i)
+    {
+        System2GraphNode* node = &graph->Nodes[i];
+        node->PendingDependencies = node->DependenciesCount;
+        if(node->PendingDependencies == 0)
+            order[orderCount++] = i;
+    }
+    
+    for(int i = 0; i < orderCount; ++i)
+    {
+        System2GraphNode* node = &graph->Nodes[order[i]];
+        for(int j = 0; j < node->DependentsCount; ++j)
+        {
+            if(--graph->Nodes[node->Dependents[j]].PendingDependencies == 0)
+                order[orderCount++] = node->Dependents[j];
+        }
+    }
+    
+    if(orderCount != nodesCount)
+    {
+        result = SYSTEM2_RESULT_GRAPH_CYCLE;
+        goto end;
+    }
+    
+    //The priority of a node is the cost of the longest path from it, which is the critical path 
+    //for the nodes on it
+    for(int i = nodesCount - 1; i >= 0; --i)
+    {
+        System2GraphNode* node = &graph->Nodes[order[i]];
+        uint64_t longestDependentPath = 0;
+        for(int j = 0; j < node->DependentsCount; ++j)
+        {
+            uint64_t dependentPriority = graph->Nodes[node->Dependents[j]].Priority;
+            if(dependentPriority > longestDependentPath)
+                longestDependentPath = dependentPriority;
+        }
+        
+        node->Priority = (node->Cost > 0 ? node->Cost : 1) + longestDependentPath;
+    }
+    
+    for(int i = 0; i < nodesCount; ++i)
+    {
+        System2GraphNode* node = &graph->Nodes[i];
+        node->State = SYSTEM2_GRAPH_NODE_PENDING;
+        node->Result = SYSTEM2_RESULT_SUCCESS;
+        node->ReturnCode = 0;
+        node->OutputSize = 0;
+        node->StderrSize = 0;
+        node->Exited = false;
+        node->PendingDependencies = node->DependenciesCount;
+        if(node->PendingDependencies == 0)
+            Internal_System2GraphHeapPush(graph, readyHeap, &readyCount, i);
+    }
+    
+    while(true)
+    {
+        //Start as many ready nodes as we can, the ones on the critical path first
+        int pollTimeoutMs = -1;
+        while(  !stopping && 
+                readyCount > 0 && 
+                (maxConcurrency <= 0 || runningCount < maxConcurrency))
+        {
+            if( limiter && 
+                System2AdaptiveLimiterAcquire(limiter, runningInfos, runningCount, 0) != 
+                    SYSTEM2_RESULT_SUCCESS)
+            {
+                //Try again once a node exits or the limit could have changed
+                int64_t sampleWaitMs =  limiter->LastSampleTimeMs + limiter->SampleIntervalMs - 
+                                        Internal_System2LimiterGetTimeMs();
+                pollTimeoutMs = sampleWaitMs > 0 ? (int)sampleWaitMs : 1;
+                break;
+            }
+            
+            int nodeIndex = Internal_System2GraphHeapPop(graph, readyHeap, &readyCount);
+            System2GraphNode* node = &graph->Nodes[nodeIndex];
+            node->Result = Internal_System2GraphStartNode(node);
+            if(node->Result == SYSTEM2_RESULT_SUCCESS)
+            {
+                node->State = SYSTEM2_GRAPH_NODE_RUNNING;
+                runningNodes[runningCount] = nodeIndex;
+                runningInfos[runningCount++] = &node->Info;
+                continue;
+            }
+            
+            node->State = SYSTEM2_GRAPH_NODE_FAILED;
+            node->ReturnCode = -1;
+            anyFailed = true;
+            Internal_System2GraphOnFailure( graph, 
+                                            node, 
+                                            runningInfos, 
+                                            runningCount, 
+                                            readyHeap, 
+                                            &readyCount, 
+                                            &stopping);
+        }
+        
+        if(runningCount == 0)
+            break;
+        
+        SYSTEM2_RESULT pollResult = 
+            Internal_System2Poll(runningInfos, runningCount, pollTimeoutMs, true);
+        if( pollResult != SYSTEM2_RESULT_SUCCESS && 
+            pollResult != SYSTEM2_RESULT_COMMAND_NOT_FINISHED)
+        {
+            //Can't tell when the nodes finish anymore, so stop all of them
+            for(int i = 0; i < runningCount; ++i)
+            {
+                System2GraphNode* node = &graph->Nodes[runningNodes[i]];
+                int returnCode = 0;
+                System2Kill(&node->Info);
+                System2GetCommandReturnValue(&node->Info, -1, &returnCode);
+                System2CleanupCommand(&node->Info);
+                node->State = SYSTEM2_GRAPH_NODE_FAILED;
+                node->Result = pollResult;
+                node->ReturnCode = -1;
+            }
+            
+            result = pollResult;
+            goto end;
+        }
+        
+        for(int i = 0; i < runningCount; )
+        {
+            int nodeIndex = runningNodes[i];
+            System2GraphNode* node = &graph->Nodes[nodeIndex];
+            if(!node->Exited)
+            {
+                ++i;
+                continue;
+            }
+            
+            //The order of the running nodes doesn't matter
+            --runningCount;
+            runningNodes[i] = runningNodes[runningCount];
+            runningInfos[i] = runningInfos[runningCount];
+            
+            SYSTEM2_RESULT waitResult = 
+                System2GetCommandReturnValue(&node->Info, -1, &node->ReturnCode);
+            SYSTEM2_RESULT cleanupResult = System2CleanupCommand(&node->Info);
+            if(node->Result == SYSTEM2_RESULT_SUCCESS)
+                node->Result = waitResult != SYSTEM2_RESULT_SUCCESS ? waitResult : cleanupResult;
+            
+            if(node->Result == SYSTEM2_RESULT_SUCCESS && node->ReturnCode == 0)
+            {
+                node->State = SYSTEM2_GRAPH_NODE_SUCCEEDED;
+                Internal_System2GraphReleaseDependents(graph, node, readyHeap, &readyCount);
+                continue;
+            }
+            
+            node->State = SYSTEM2_GRAPH_NODE_FAILED;
+            anyFailed = true;
+            Internal_System2GraphOnFailure( graph, 
+                                            node, 
+                                            runningInfos, 
+                                            runningCount, 
+                                            readyHeap, 
+                                            &readyCount, 
+                                            &stopping);
+        }
+    }
+    
+    //Whatever is left is waiting for a failed node, or wasn't started after a failure
+    for(int i = 0; i < nodesCount; ++i)
+    {
+        if(graph->Nodes[i].State == SYSTEM2_GRAPH_NODE_PENDING)
+            graph->Nodes[i].State = SYSTEM2_GRAPH_NODE_SKIPPED;
+    }
+    
+    if(anyFailed)
+        result = SYSTEM2_RESULT_GRAPH_NODE_FAILED;
+    
+    end:;
+    free(order);
+    free(readyHeap);
+    free(runningNodes);
+    free(runningInfos);
+    return result;
 }
 
+SYSTEM2_FUNC_PREFIX SYSTEM2_RESULT System2GraphFree(System2Graph* graph)
+{
+    if(!graph)
+        return SYSTEM2_RESULT_INVALID_ARGUMENT;
+    
+    for(int i = 0; i < graph->NodesCount; ++i)
+    {
+        free(graph->Nodes[i].Dependents);
+        free(graph->Nodes[i].Output);
+        free(graph->Nodes[i].Stderr);
+    }
+    
+    free(graph->Nodes);
+    memset(graph, 0, sizeof(System2Graph));
+    return SYSTEM2_RESULT_SUCCESS;
+}
 
 #if defined(_WIN32)
     #if INTERNAL_SYSTEM2_APPLY_NO_WARNINGS
@@ -0,0 +1,535 @@
+#ifndef SYSTEM2_HPP
+#define SYSTEM2_HPP
+
+/*
+C++20 coroutine awaitables for System2 commands (POSIX only).
+
+A `System2::EventLoop` waits on the pipes and the exit of every command being awaited with poll(),
+so any number of commands can be awaited without a thread for each of them.
+
+    System2::EventLoop loop;
+    System2::AsyncCommand command(loop, commandInfo);   //After one of the System2Run* calls
+    System2::AsyncCommand command(loop, ownedCommand);  //Or a running `System2::Command`
+
+    //Inside a coroutine
+    System2::ReadResult read = co_await command.ReadSome(buffer);
+    SYSTEM2_RESULT written = co_await command.Write("input");
+    System2::WaitResult exit = co_await command.Wait(System2::Clock::now() + std::chrono::seconds(5));
+
+    //On the thread running the loop
+    loop.Run();
+
+Coroutines are resumed by the thread running the loop, unless an executor is given to the loop.
+The pipes of the command are made non-blocking, so they should not be used with the other System2
+read and write functions afterwards.
+*/
+
+#include "System2.h"
+#include "System2Command.hpp"
+
+#if !defined(__unix__) && !defined(__APPLE__)
+    #error "System2.hpp is only supported on POSIX platforms"
+#endif
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <coroutine>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+    #include <sys/syscall.h>
+#endif
+
+namespace System2
+{
+    using Clock = std::chrono::steady_clock;
+
+    //Result of `AsyncCommand::ReadSome()`, same as `System2ReadFromOutput()`.
+    //`SYSTEM2_RESULT_SUCCESS` is returned once all the output has been read.
+    struct ReadResult
+    {
+        SYSTEM2_RESULT Result = SYSTEM2_RESULT_SUCCESS;
+        uint32_t BytesRead = 0;
+    };
+
+    //Result of `AsyncCommand::Wait()`, same as `System2GetCommandReturnValue()`
+    struct WaitResult
+    {
+        SYSTEM2_RESULT Result = SYSTEM2_RESULT_SUCCESS;
+        int ReturnCode = -1;
+    };
+
+    //Something suspended on the event loop, waiting for a file descriptor and/or a deadline
+    class Waiter
+    {
+        public:
+            virtual ~Waiter() = default;
+
+            //Called when `Fd` is ready, or periodically if `Fd` is -1. Returns true when done.
+            virtual bool OnReady() = 0;
+
+            int Fd = -1;
+            short Events = 0;
+            std::optional<Clock::time_point> Deadline;
+            bool TimedOut = false;
+            bool Failed = false;                //The loop couldn't wait for it
+            std::coroutine_handle<> Handle;
+    };
+
+    class EventLoop
+    {
+        public:
+            //Resumes the coroutines. The default one resumes them on the thread running the loop.
+            using Executor = std::function<void(std::coroutine_handle<>)>;
+
+            //How often waiters without a file descriptor are checked
+            static constexpr std::chrono::milliseconds PeriodicCheckInterval { 10 };
+
+            EventLoop() : EventLoop(nullptr) {}
+
+            explicit EventLoop(Executor executor) : CurrentExecutor(std::move(executor))
+            {
+                if(pipe(WakePipe) != 0)
+                {
+                    WakePipe[0] = -1;
+                    WakePipe[1] = -1;
+                    return;
+                }
+
+                for(int fd : WakePipe)
+                {
+                    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+                    fcntl(fd, F_SETFD, FD_CLOEXEC);
+                }
+            }
+
+            ~EventLoop()
+            {
+                for(int fd : WakePipe)
+                {
+                    if(fd >= 0)
+                        close(fd);
+                }
+            }
+
+            EventLoop(const EventLoop&) = delete;
+            EventLoop& operator=(const EventLoop&) = delete;
+
+            //Runs until nothing is being awaited, or until poll() fails
+            void Run()
+            {
+                while(RunOnce(std::nullopt)) {}
+            }
+
+            //Waits for up to `timeout` (forever if not set) and resumes what is ready.
+            //Returns false if nothing is being awaited, or if poll() failed. In that case
+            //everything being awaited is resumed with a failure, and the errno is kept for
+            //`GetPollError()`.
+            bool RunOnce(std::optional<std::chrono::milliseconds> timeout)
+            {
+                {
+                    std::lock_guard<std::mutex> lock(Mutex);
+                    Waiters.insert(Waiters.end(), Incoming.begin(), Incoming.end());
+                    Incoming.clear();
+                }
+
+                if(Waiters.empty())
+                    return false;
+
+                Clock::time_point now = Clock::now();
+                std::optional<Clock::time_point> wakeTime;
+                if(timeout)
+                    wakeTime = now + *timeout;
+
+                PollFds.clear();
+                PollFds.push_back({ WakePipe[0], POLLIN, 0 });
+                for(Waiter* waiter : Waiters)
+                {
+                    if(waiter->Fd >= 0)
+                        PollFds.push_back({ waiter->Fd, waiter->Events, 0 });
+                    else if(!wakeTime || now + PeriodicCheckInterval < *wakeTime)
+                        wakeTime = now + PeriodicCheckInterval;
+
+                    if(waiter->Deadline && (!wakeTime || *waiter->Deadline < *wakeTime))
+                        wakeTime = waiter->Deadline;
+                }
+
+                int waitTimeMs = -1;
+                if(wakeTime)
+                {
+                    //Round up so that we don't wake up just before the deadline
+                    auto waitTime = std::chrono::ceil<std::chrono::milliseconds>(*wakeTime - now);
+                    waitTimeMs = (int)std::max<int64_t>(0, waitTime.count());
+                }
+
+                if(poll(PollFds.data(), (nfds_t)PollFds.size(), waitTimeMs) < 0 && errno != EINTR)
+                {
+                    //Retrying would fail the same way, i.e. with too many fds for RLIMIT_NOFILE
+                    PollError = errno;
+                    std::vector<Waiter*> failed;
+                    failed.swap(Waiters);
+                    for(Waiter* waiter : failed)
+                    {
+                        waiter->Failed = true;
+                        Resume(waiter->Handle);
+                    }
+
+                    return false;
+                }
+
+                if(PollFds[0].revents)
+                {
+                    char drain[64];
+                    while(read(WakePipe[0], drain, sizeof(drain)) > 0) {}
+                }
+
+                //Waiters are removed before they are resumed since resuming can destroy them
+                now = Clock::now();
+                std::vector<std::coroutine_handle<>> finished;
+                size_t pollIndex = 1;
+                for(size_t i = 0; i < Waiters.size(); ++i)
+                {
+                    Waiter* waiter = Waiters[i];
+                    bool ready = waiter->Fd < 0 || PollFds[pollIndex++].revents != 0;
+                    bool done = ready && waiter->OnReady();
+                    if(!done && waiter->Deadline && now >= *waiter->Deadline)
+                    {
+                        waiter->TimedOut = true;
+                        done = true;
+                    }
+
+                    if(done)
+                        finished.push_back(waiter->Handle);
+                    else
+                        Waiters[i - finished.size()] = waiter;
+                }
+
+                Waiters.resize(Waiters.size() - finished.size());
+
+                for(std::coroutine_handle<> handle : finished)
+                    Resume(handle);
+
+                return true;
+            }
+
+            //The errno of the last poll() that failed, or 0
+            int GetPollError() const { return PollError; }
+
+            //Starts waiting for `waiter`. This can be called from any thread.
+            void Add(Waiter* waiter)
+            {
+                std::lock_guard<std::mutex> lock(Mutex);
+                Incoming.push_back(waiter);
+
+                //Wake up the loop in case it is waiting
+                if(WakePipe[1] >= 0)
+                {
+                    char wake = 0;
+                    (void)!write(WakePipe[1], &wake, 1);
+                }
+            }
+
+        private:
+            void Resume(std::coroutine_handle<> handle)
+            {
+                if(CurrentExecutor)
+                    CurrentExecutor(handle);
+                else
+                    handle.resume();
+            }
+
+            Executor CurrentExecutor;
+            int WakePipe[2] = { -1, -1 };
+            int PollError = 0;
+
+            std::mutex Mutex;
+            std::vector<Waiter*> Incoming;                  //Guarded by `Mutex`
+
+            //Only used by the thread running the loop
+            std::vector<Waiter*> Waiters;
+            std::vector<pollfd> PollFds;
+    };
+
+    class ReadAwaitable : private Waiter
+    {
+        public:
+            ReadAwaitable(EventLoop& loop, int fd, std::span<char> buffer) :
+                Loop(loop),
+                Buffer(buffer)
+            {
+                Fd = fd;
+                Events = POLLIN;
+            }
+
+            //Reads right away if there's anything to read already
+            bool await_ready()
+            {
+                if(Fd < 0)
+                {
+                    Result.Result = SYSTEM2_RESULT_INVALID_ARGUMENT;
+                    return true;
+                }
+
+                return OnReady();
+            }
+
+            void await_suspend(std::coroutine_handle<> handle)
+            {
+                Handle = handle;
+                Loop.Add(this);
+            }
+
+            ReadResult await_resume() const
+            {
+                if(Failed)
+                    return { SYSTEM2_RESULT_READ_FAILED, 0 };
+
+                return Result;
+            }
+
+        private:
+            bool OnReady() override
+            {
+                ssize_t readResult = read(Fd, Buffer.data(), Buffer.size());
+                if(readResult < 0)
+                {
+                    if(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+                        return false;
+
+                    Result.Result = SYSTEM2_RESULT_READ_FAILED;
+                }
+                else if(readResult == 0)
+                    Result.Result = SYSTEM2_RESULT_SUCCESS;
+                else
+                {
+                    Result.Result = SYSTEM2_RESULT_READ_NOT_FINISHED;
+                    Result.BytesRead = (uint32_t)readResult;
+                }
+
+                return true;
+            }
+
+            EventLoop& Loop;
+            std::span<char> Buffer;
+            ReadResult Result;
+    };
+
+    class WriteAwaitable : private Waiter
+    {
+        public:
+            WriteAwaitable(EventLoop& loop, int fd, std::string_view data) : Loop(loop), Data(data)
+            {
+                Fd = fd;
+                Events = POLLOUT;
+            }
+
+            //Writes what fits into the pipe right away
+            bool await_ready()
+            {
+                if(Fd < 0)
+                {
+                    Result = SYSTEM2_RESULT_INVALID_ARGUMENT;
+                    return true;
+                }
+
+                return OnReady();
+            }
+
+            void await_suspend(std::coroutine_handle<> handle)
+            {
+                Handle = handle;
+                Loop.Add(this);
+            }
+
+            SYSTEM2_RESULT await_resume() const
+            {
+                return Failed ? SYSTEM2_RESULT_WRITE_FAILED : Result;
+            }
+
+        private:
+            bool OnReady() override
+            {
+                while(!Data.empty())
+                {
+                    ssize_t writeResult = write(Fd, Data.data(), Data.size());
+                    if(writeResult < 0)
+                    {
+                        if(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+                            return false;
+
+                        Result = SYSTEM2_RESULT_WRITE_FAILED;
+                        return true;
+                    }
+
+                    Data.remove_prefix((size_t)writeResult);
+                }
+
+                Result = SYSTEM2_RESULT_SUCCESS;
+                return true;
+            }
+
+            EventLoop& Loop;
+            std::string_view Data;
+            SYSTEM2_RESULT Result = SYSTEM2_RESULT_SUCCESS;
+    };
+
+    class WaitAwaitable : private Waiter
+    {
+        public:
+            WaitAwaitable(  EventLoop& loop,
+                            const System2CommandInfo& info,
+                            int pidFd,
+                            std::optional<Clock::time_point> deadline,
+                            Command* owner = nullptr) :
+                Loop(loop),
+                Info(info),
+                Owner(owner)
+            {
+                //Without a pidfd, the exit is checked periodically
+                Fd = pidFd;
+                Events = POLLIN;
+                Deadline = deadline;
+            }
+
+            bool await_ready() { return OnReady(); }
+
+            void await_suspend(std::coroutine_handle<> handle)
+            {
+                Handle = handle;
+                Loop.Add(this);
+            }
+
+            WaitResult await_resume() const
+            {
+                if(Failed)
+                    return { SYSTEM2_RESULT_COMMAND_WAIT_FAILED, -1 };
+
+                if(TimedOut)
+                    return { SYSTEM2_RESULT_COMMAND_NOT_FINISHED, -1 };
+
+                return Result;
+            }
+
+        private:
+            bool OnReady() override
+            {
+                Result.Result = System2GetCommandReturnValue(&Info, 0, &Result.ReturnCode);
+                if(Result.Result == SYSTEM2_RESULT_COMMAND_NOT_FINISHED)
+                    return false;
+
+                //So that the owning command won't wait for it again
+                if(Owner)
+                    Owner->SetWaited(Result.Result, Result.ReturnCode);
+
+                return true;
+            }
+
+            EventLoop& Loop;
+            const System2CommandInfo& Info;
+            Command* Owner;
+            WaitResult Result;
+    };
+
+    //Awaitable operations on a command started by one of the System2Run* calls or a `Command`.
+    //The command is not owned and should still be cleaned up after.
+    class AsyncCommand
+    {
+        public:
+            AsyncCommand(EventLoop& loop, Command& command) : AsyncCommand(loop, command.GetInfo())
+            {
+                Owner = &command;
+            }
+
+            AsyncCommand(EventLoop& loop, System2CommandInfo& info) : Loop(loop), Info(info)
+            {
+                int pipes[] =
+                {
+                    Info.RedirectInput ? Info.ParentToChildPipes[SYSTEM2_FD_WRITE] : -1,
+                    Info.RedirectOutput ? Info.ChildToParentPipes[SYSTEM2_FD_READ] : -1,
+                    Info.RedirectOutput && Info.StandaloneStderr ?
+                        Info.ChildToParentPipesErr[SYSTEM2_FD_READ] :
+                        -1
+                };
+
+                for(int fd : pipes)
+                {
+                    if(fd >= 0)
+                        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+                }
+
+                #if defined(__linux__) && defined(SYS_pidfd_open)
+                    PidFd = (int)syscall(SYS_pidfd_open, Info.ChildProcessID, 0);
+                    if(PidFd >= 0)
+                        fcntl(PidFd, F_SETFD, FD_CLOEXEC);
+                #endif
+            }
+
+            ~AsyncCommand()
+            {
+                if(PidFd >= 0)
+                    close(PidFd);
+            }
+
+            AsyncCommand(const AsyncCommand&) = delete;
+            AsyncCommand& operator=(const AsyncCommand&) = delete;
+
+            //Reads whatever output is available, waiting until there's any
+            ReadAwaitable ReadSome(std::span<char> buffer)
+            {
+                return ReadAwaitable(   Loop,
+                                        Info.RedirectOutput ?
+                                            Info.ChildToParentPipes[SYSTEM2_FD_READ] :
+                                            -1,
+                                        buffer);
+            }
+
+            //Same as `ReadSome()` for stderr, `StandaloneStderr` must be true
+            ReadAwaitable ReadStderrSome(std::span<char> buffer)
+            {
+                return ReadAwaitable(   Loop,
+                                        Info.RedirectOutput && Info.StandaloneStderr ?
+                                            Info.ChildToParentPipesErr[SYSTEM2_FD_READ] :
+                                            -1,
+                                        buffer);
+            }
+
+            //Writes all of `data` to stdin. `data` must stay valid until this is done.
+            WriteAwaitable Write(std::string_view data)
+            {
+                return WriteAwaitable(  Loop,
+                                        Info.RedirectInput ?
+                                            Info.ParentToChildPipes[SYSTEM2_FD_WRITE] :
+                                            -1,
+                                        data);
+            }
+
+            //Waits for the command to exit. If it doesn't exit before `deadline`,
+            //`SYSTEM2_RESULT_COMMAND_NOT_FINISHED` is returned.
+            WaitAwaitable Wait(std::optional<Clock::time_point> deadline = std::nullopt)
+            {
+                return WaitAwaitable(Loop, Info, PidFd, deadline, Owner);
+            }
+
+            System2CommandInfo& GetInfo() { return Info; }
+
+        private:
+            EventLoop& Loop;
+            System2CommandInfo& Info;
+            Command* Owner = nullptr;
+            int PidFd = -1;
+    };
+}
+
+#endif //#ifndef SYSTEM2_HPP
@@ -0,0 +1,396 @@
+#ifndef SYSTEM2_COMMAND_HPP
+#define SYSTEM2_COMMAND_HPP
+
+/*
+Move-only RAII wrapper for System2 commands (C++17, `std::span` overloads with C++20).
+
+    System2::Command command;
+    command.GetInfo().RedirectOutput = true;
+    command.SetEnvironmentVariable("MY_VAR", "value");
+
+    std::string_view args[] = { "-l", path };
+    SYSTEM2_RESULT result = command.RunSubprocess("ls", args);
+
+    std::string output;
+    result = command.ReadAllOutput(output);
+
+    int returnCode;
+    result = command.Wait(-1, returnCode);
+
+The command is cleaned up and waited for when destroyed, so no zombie process is left behind.
+Call `Kill()` first if it shouldn't be waited for, or set `ReapOnCleanup` to leave it to the reaper
+thread (see `SYSTEM2_REAPER`).
+
+Arguments are copied once into a buffer owned by the command, which is reused between runs.
+*/
+
+#include "System2.h"
+
+#include <cstddef>
+#include <cstring>
+#include <initializer_list>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#if defined(__has_include)
+    #if __has_include(<version>)
+        #include <version>
+    #endif
+#endif
+
+#if defined(__cpp_lib_span)
+    #include <span>
+#endif
+
+namespace System2
+{
+    class WaitAwaitable;
+
+    class Command
+    {
+        public:
+            Command()
+            {
+                memset(&Info, 0, sizeof(System2CommandInfo));
+            }
+
+            ~Command()
+            {
+                Reset();
+            }
+
+            Command(const Command&) = delete;
+            Command& operator=(const Command&) = delete;
+
+            Command(Command&& other) noexcept
+            {
+                MoveFrom(other);
+            }
+
+            Command& operator=(Command&& other) noexcept
+            {
+                if(this != &other)
+                {
+                    Reset();
+                    MoveFrom(other);
+                }
+
+                return *this;
+            }
+
+            //Options of the command, which can be set before running it
+            System2CommandInfo& GetInfo() { return Info; }
+            const System2CommandInfo& GetInfo() const { return Info; }
+
+            //Sets an environment variable for the command, or unsets it if `value` is 
+            //`std::nullopt`. Once any is set, these replace the `EnvVarsNames` and `EnvVarsValues` 
+            //set through `GetInfo()`
+            void SetEnvironmentVariable(std::string_view name, std::optional<std::string_view> value)
+            {
+                EnvNames.emplace_back(name);
+                EnvValues.emplace_back(value ? std::optional<std::string>(*value) : std::nullopt);
+            }
+
+            SYSTEM2_RESULT Run(std::string_view command)
+            {
+                std::string_view args[] = { command };
+                SYSTEM2_RESULT result = PrepareRun(args, 1);
+                if(result != SYSTEM2_RESULT_SUCCESS)
+                    return result;
+
+                result = System2Run(ArgPointers[0], &Info);
+                Started = result == SYSTEM2_RESULT_SUCCESS;
+                return result;
+            }
+
+            SYSTEM2_RESULT RunSubprocess(   std::string_view executable,
+                                            const std::string_view* args,
+                                            size_t argsCount)
+            {
+                //The executable goes in front of the arguments
+                ArgsScratch.clear();
+                ArgsScratch.reserve(argsCount + 1);
+                ArgsScratch.push_back(executable);
+                ArgsScratch.insert(ArgsScratch.end(), args, args + argsCount);
+
+                SYSTEM2_RESULT result = PrepareRun(ArgsScratch.data(), ArgsScratch.size());
+                if(result != SYSTEM2_RESULT_SUCCESS)
+                    return result;
+
+                result = System2RunSubprocess(  ArgPointers[0],
+                                                ArgPointers.data() + 1,
+                                                (int)argsCount,
+                                                &Info);
+                Started = result == SYSTEM2_RESULT_SUCCESS;
+                return result;
+            }
+
+            SYSTEM2_RESULT RunSubprocess(   std::string_view executable,
+                                            std::initializer_list<std::string_view> args)
+            {
+                return RunSubprocess(executable, args.begin(), args.size());
+            }
+
+            #if defined(__cpp_lib_span)
+                SYSTEM2_RESULT RunSubprocess(   std::string_view executable,
+                                                std::span<const std::string_view> args)
+                {
+                    return RunSubprocess(executable, args.data(), args.size());
+                }
+
+                //Same as `System2ReadFromOutput()`
+                SYSTEM2_RESULT ReadOutput(std::span<char> buffer, uint32_t& outBytesRead)
+                {
+                    return ReadOutput(buffer.data(), buffer.size(), outBytesRead);
+                }
+
+                //Same as `System2ReadFromStderr()`
+                SYSTEM2_RESULT ReadStderr(std::span<char> buffer, uint32_t& outBytesRead)
+                {
+                    return ReadStderr(buffer.data(), buffer.size(), outBytesRead);
+                }
+            #endif
+
+            //Same as `System2ReadFromOutput()`
+            SYSTEM2_RESULT ReadOutput(char* buffer, size_t bufferSize, uint32_t& outBytesRead)
+            {
+                return System2ReadFromOutput(&Info, buffer, ClampSize(bufferSize), &outBytesRead);
+            }
+
+            //Same as `System2ReadFromStderr()`
+            SYSTEM2_RESULT ReadStderr(char* buffer, size_t bufferSize, uint32_t& outBytesRead)
+            {
+                return System2ReadFromStderr(&Info, buffer, ClampSize(bufferSize), &outBytesRead);
+            }
+
+            //Reads all the output into `outOutput`, reusing its memory
+            SYSTEM2_RESULT ReadAllOutput(std::string& outOutput)
+            {
+                return ReadAll(false, outOutput);
+            }
+
+            //Reads all of stderr into `outOutput`, reusing its memory
+            SYSTEM2_RESULT ReadAllStderr(std::string& outOutput)
+            {
+                return ReadAll(true, outOutput);
+            }
+
+            SYSTEM2_RESULT Write(std::string_view input)
+            {
+                //Nothing to write, but the command should still be valid
+                if(input.empty())
+                    return Started ? SYSTEM2_RESULT_SUCCESS : SYSTEM2_RESULT_INVALID_ARGUMENT;
+
+                while(!input.empty())
+                {
+                    uint32_t writeSize = ClampSize(input.size());
+                    SYSTEM2_RESULT result = System2WriteToInput(&Info, input.data(), writeSize);
+                    if(result != SYSTEM2_RESULT_SUCCESS)
+                        return result;
+
+                    input.remove_prefix(writeSize);
+                }
+
+                return SYSTEM2_RESULT_SUCCESS;
+            }
+
+            //Same as `System2CloseInput()`
+            SYSTEM2_RESULT CloseInput()
+            {
+                if(!Started || CleanedUp)
+                    return SYSTEM2_RESULT_INVALID_ARGUMENT;
+
+                return System2CloseInput(&Info);
+            }
+
+            //Same as `System2GetCommandReturnValue()`
+            SYSTEM2_RESULT Wait(int timeoutSec, int& outReturnCode)
+            {
+                if(!Started)
+                    return SYSTEM2_RESULT_INVALID_ARGUMENT;
+
+                if(Reaped)
+                {
+                    outReturnCode = ReturnCode;
+                    return WaitResult;
+                }
+
+                SYSTEM2_RESULT result = System2GetCommandReturnValue(&Info, timeoutSec, &outReturnCode);
+                if(result != SYSTEM2_RESULT_COMMAND_NOT_FINISHED)
+                    SetWaited(result, outReturnCode);
+
+                return result;
+            }
+
+            SYSTEM2_RESULT Kill()
+            {
+                return Started && !Reaped ? System2Kill(&Info) : SYSTEM2_RESULT_INVALID_ARGUMENT;
+            }
+
+            SYSTEM2_RESULT Term()
+            {
+                return Started && !Reaped ? System2Term(&Info) : SYSTEM2_RESULT_INVALID_ARGUMENT;
+            }
+
+            SYSTEM2_RESULT Pause()
+            {
+                return Started && !Reaped ? System2Pause(&Info) : SYSTEM2_RESULT_INVALID_ARGUMENT;
+            }
+
+            SYSTEM2_RESULT Resume()
+            {
+                return Started && !Reaped ? System2Resume(&Info) : SYSTEM2_RESULT_INVALID_ARGUMENT;
+            }
+
+            //Closes the pipes early, the destructor does this otherwise
+            SYSTEM2_RESULT Cleanup()
+            {
+                if(!Started || CleanedUp)
+                    return SYSTEM2_RESULT_SUCCESS;
+
+                CleanedUp = true;
+                return System2CleanupCommand(&Info);
+            }
+
+            bool IsStarted() const { return Started; }
+
+        private:
+            friend class WaitAwaitable;
+
+            //For when the command is waited for outside of `Wait()`
+            void SetWaited(SYSTEM2_RESULT result, int returnCode)
+            {
+                Reaped = true;
+                ReturnCode = returnCode;
+                WaitResult = result;
+            }
+
+            static uint32_t ClampSize(size_t size)
+            {
+                return size > UINT32_MAX ? UINT32_MAX : (uint32_t)size;
+            }
+
+            //Cleans up and waits for the last command, and keeps the options for the next one
+            void Reset()
+            {
+                if(!Started)
+                    return;
+
+                //With `ReapOnCleanup`, the reaper thread waits for it instead
+                Cleanup();
+                if(!Reaped && !Info.ReapOnCleanup)
+                {
+                    int returnCode;
+                    System2GetCommandReturnValue(&Info, -1, &returnCode);
+                }
+
+                Started = false;
+            }
+
+            void MoveFrom(Command& other)
+            {
+                Info = other.Info;
+                Started = other.Started;
+                CleanedUp = other.CleanedUp;
+                Reaped = other.Reaped;
+                ReturnCode = other.ReturnCode;
+                WaitResult = other.WaitResult;
+                ArgsBuffer = std::move(other.ArgsBuffer);
+                ArgPointers = std::move(other.ArgPointers);
+                EnvNames = std::move(other.EnvNames);
+                EnvValues = std::move(other.EnvValues);
+                EnvNamePointers = std::move(other.EnvNamePointers);
+                EnvValuePointers = std::move(other.EnvValuePointers);
+
+                other.Started = false;
+                memset(&other.Info, 0, sizeof(System2CommandInfo));
+            }
+
+            //Copies the arguments into one null terminated buffer and points the C arrays at it
+            SYSTEM2_RESULT PrepareRun(const std::string_view* args, size_t argsCount)
+            {
+                Reset();
+                CleanedUp = false;
+                Reaped = false;
+
+                size_t totalSize = 0;
+                for(size_t i = 0; i < argsCount; ++i)
+                    totalSize += args[i].size() + 1;
+
+                //Resized before taking pointers so that it won't reallocate
+                ArgsBuffer.resize(totalSize);
+                ArgPointers.resize(argsCount);
+                char* current = ArgsBuffer.data();
+                for(size_t i = 0; i < argsCount; ++i)
+                {
+                    memcpy(current, args[i].data(), args[i].size());
+                    current[args[i].size()] = '\0';
+                    ArgPointers[i] = current;
+                    current += args[i].size() + 1;
+                }
+
+                EnvNamePointers.resize(EnvNames.size());
+                EnvValuePointers.resize(EnvNames.size());
+                for(size_t i = 0; i < EnvNames.size(); ++i)
+                {
+                    EnvNamePointers[i] = EnvNames[i].c_str();
+                    EnvValuePointers[i] = EnvValues[i] ? EnvValues[i]->c_str() : nullptr;
+                }
+
+                //Otherwise keep any environment set through `GetInfo()`
+                if(!EnvNames.empty())
+                {
+                    Info.EnvVarsNames = EnvNamePointers.data();
+                    Info.EnvVarsValues = EnvValuePointers.data();
+                    Info.EnvVarsCount = (int)EnvNames.size();
+                }
+
+                return SYSTEM2_RESULT_SUCCESS;
+            }
+
+            SYSTEM2_RESULT ReadAll(bool readStderr, std::string& outOutput)
+            {
+                outOutput.clear();
+                size_t chunkSize = 4096;
+                while(true)
+                {
+                    size_t oldSize = outOutput.size();
+                    outOutput.resize(oldSize + chunkSize);
+
+                    uint32_t bytesRead = 0;
+                    SYSTEM2_RESULT result = readStderr ?
+                                            ReadStderr(&outOutput[oldSize], chunkSize, bytesRead) :
+                                            ReadOutput(&outOutput[oldSize], chunkSize, bytesRead);
+
+                    outOutput.resize(oldSize + bytesRead);
+                    if(result != SYSTEM2_RESULT_READ_NOT_FINISHED)
+                        return result;
+
+                    //Grow the reads with the output so that long outputs take fewer calls
+                    if(chunkSize < 1024 * 1024)
+                        chunkSize *= 2;
+                }
+            }
+
+            System2CommandInfo Info;
+            bool Started = false;
+            bool CleanedUp = false;
+            bool Reaped = false;
+            int ReturnCode = -1;
+            SYSTEM2_RESULT WaitResult = SYSTEM2_RESULT_SUCCESS;
+
+            std::vector<char> ArgsBuffer;
+            std::vector<const char*> ArgPointers;
+            std::vector<std::string_view> ArgsScratch;
+
+            std::vector<std::string> EnvNames;
+            std::vector<std::optional<std::string>> EnvValues;
+            std::vector<const char*> EnvNamePointers;
+            std::vector<const char*> EnvValuePointers;
+    };
+}
+
+#endif //#ifndef SYSTEM2_COMMAND_HPP
@@ -2,7 +2,7 @@
     #define SYSTEM2_DECLARATION_ONLY 1
 #endif
 
-//This bypasses inheriting memory from parent process on linux (glibc 2.24) but removes the ability to use RunDirectory.
+//This bypasses inheriting memory from parent process on linux (glibc 2.24)
 //See https://github.com/Neko-Box-Coder/System2/issues/3
 //#define SYSTEM2_POSIX_SPAWN 1
 
@@ -72,6 +72,15 @@ int main(int argc, char** argv)
     #include <stdlib.h>
 #endif
 
+#if defined(__unix__) || defined(__APPLE__)
+    #include <stdlib.h>
+    #include <sys/resource.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <time.h>
+    #include <unistd.h>
+#endif
+
 void RunSubprocessExample(void);
 System2CommandInfo RedirectIOExample(void);
 void ReadRedirectedIOAsyncExample(System2CommandInfo commandInfo);
@@ -84,6 +93,23 @@ void TermExample(void);
 void KillExample(void);
 void TimeoutExample(void);
 void ReadStderrExample(void);
+void ProcessAttributesExample(void);
+void LineReaderExample(void);
+void CallbacksExample(void);
+void ShellSessionExample(void);
+void DirectExecExample(void);
+void CaptureOutputExample(void);
+void GraphExample(void);
+void WatchdogExample(void);
+void PauseResumeExample(void);
+void PtyExample(void);
+void InputBufferExample(void);
+void KillPtyExample(void);
+void ForkExcludedMemoryExample(void);
+void WaitWatchdogExample(void);
+void SpawnBackendExample(void);
+void MapOutputExample(void);
+void AdaptiveLimiterExample(void);
 
 int main(int argc, char** argv) 
 {
@@ -95,9 +121,7 @@ int main(int argc, char** argv)
         memset(testMem, 1, 50 * 1024 * 1024);
     #endif
     
-    #if !SYSTEM2_POSIX_SPAWN
-        RunSubprocessExample();
-    #endif
+    RunSubprocessExample();
     
     //Execute the first command
     System2CommandInfo commandInfo = RedirectIOExample();
@@ -124,6 +148,23 @@ int main(int argc, char** argv)
     KillExample();
     TimeoutExample();
     ReadStderrExample();
+    ProcessAttributesExample();
+    LineReaderExample();
+    CallbacksExample();
+    ShellSessionExample();
+    DirectExecExample();
+    CaptureOutputExample();
+    GraphExample();
+    WatchdogExample();
+    PauseResumeExample();
+    PtyExample();
+    InputBufferExample();
+    KillPtyExample();
+    ForkExcludedMemoryExample();
+    WaitWatchdogExample();
+    SpawnBackendExample();
+    MapOutputExample();
+    AdaptiveLimiterExample();
     
     return 0;
 }
@@ -136,6 +177,13 @@ int main(int argc, char** argv)
     }
 
 
+#define EXIT_IF_FALSE(condition) \
+    if(!(condition)) \
+    {\
+        printf("Check failed at %d: %s", __LINE__, #condition);\
+        exit(-1);\
+    }
+
 #define FUNC_HEADER() printf("\n\n---------------------\n%s\n---------------------\n", __func__)
 
 #if defined(_WIN32)
@@ -472,7 +520,7 @@ void ReadStderrExample(void)
     System2CommandInfo commandInfo;
     memset(&commandInfo, 0, sizeof(System2CommandInfo));
     commandInfo.RedirectOutput = true;
-    commandInfo.StandaloneStdErr = true;
+    commandInfo.StandaloneStderr = true;
     SYSTEM2_RESULT result;
     result = System2Run(">&2 echo Hello stderr", &commandInfo);
     
@@ -498,4 +546,1098 @@ void ReadStderrExample(void)
     EXIT_IF_FAILED(result);
 }
 
+void ProcessAttributesExample(void)
+{
+    FUNC_HEADER();
+    
+    #if defined(__unix__) || defined(__APPLE__)
+        System2CommandInfo commandInfo;
+        memset(&commandInfo, 0, sizeof(System2CommandInfo));
+        
+        //Lower the priority of the command and limit how many files it can open
+        System2ResourceLimit fileLimit = { RLIMIT_NOFILE, 64, 64 };
+        commandInfo.ResourceLimits = &fileLimit;
+        commandInfo.ResourceLimitsCount = 1;
+        commandInfo.NiceIncrement = 5;
+        
+        #if defined(__linux__)
+            //Keep it on the first core with idle I/O priority
+            int cpus[] = { 0 };
+            commandInfo.CpuAffinity = cpus;
+            commandInfo.CpuAffinityCount = 1;
+            commandInfo.IoPriorityClass = SYSTEM2_IO_PRIORITY_CLASS_IDLE;
+        #endif
+        
+        //Output: Nice value: 5, file limit: 64
+        SYSTEM2_RESULT result = System2Run("echo Nice value: $(nice), file limit: $(ulimit -n)", 
+                                           &commandInfo);
+        EXIT_IF_FAILED(result);
+        
+        int returnCode = -1;
+        result = System2GetCommandReturnValue(&commandInfo, -1, &returnCode);
+        EXIT_IF_FAILED(result);
+        
+        result = System2CleanupCommand(&commandInfo);
+        EXIT_IF_FAILED(result);
+    #endif
+}
+
+void LineReaderExample(void)
+{
+    FUNC_HEADER();
+    
+    System2CommandInfo commandInfo;
+    memset(&commandInfo, 0, sizeof(System2CommandInfo));
+    commandInfo.RedirectOutput = true;
+    SYSTEM2_RESULT result = System2Run("echo first line && echo second line", &commandInfo);
+    EXIT_IF_FAILED(result);
+    
+    //Lines longer than 1024 bytes are truncated
+    System2LineReader lineReader;
+    result = System2LineReaderInit(&lineReader, &commandInfo, false, '\n', 1024);
+    EXIT_IF_FAILED(result);
+    
+    //Output: 
+    //Line 1: first line
+    //Line 2: second line
+    const char* line;
+    uint32_t lineLength;
+    int lineNumber = 1;
+    while((result = System2ReadLine(&lineReader, &line, &lineLength, NULL)) == 
+          SYSTEM2_RESULT_READ_NOT_FINISHED)
+    {
+        printf("Line %d: %.*s\n", lineNumber++, (int)lineLength, line);
+    }
+    EXIT_IF_FAILED(result);
+    
+    System2LineReaderFree(&lineReader);
+    
+    int returnCode = -1;
+    result = System2GetCommandReturnValue(&commandInfo, -1, &returnCode);
+    EXIT_IF_FAILED(result);
+    
+    result = System2CleanupCommand(&commandInfo);
+    EXIT_IF_FAILED(result);
+}
+
+void OnOutputExample(void* userData, const char* data, uint32_t size)
+{
+    printf("%s: %.*s", (const char*)userData, (int)size, data);
+}
+
+void OnExitExample(void* userData, int returnCode, bool terminated)
+{
+    printf("%s exited with %d, terminated: %d\n", (const char*)userData, returnCode, terminated);
+}
+
+void CallbacksExample(void)
+{
+    FUNC_HEADER();
+    
+    const char* names[] = { "First", "Second" };
+    const char* commands[] = { "echo Hello from the first command && exit 1", 
+                               "echo Hello from the second command" };
+    System2CommandInfo commandInfos[2];
+    System2CommandInfo* commandInfoPtrs[2];
+    
+    for(int i = 0; i < 2; ++i)
+    {
+        memset(&commandInfos[i], 0, sizeof(System2CommandInfo));
+        commandInfos[i].RedirectOutput = true;
+        commandInfos[i].OnStdout = OnOutputExample;
+        commandInfos[i].OnExit = OnExitExample;
+        commandInfos[i].CallbackUserData = (void*)names[i];
+        
+        SYSTEM2_RESULT result = System2Run(commands[i], &commandInfos[i]);
+        EXIT_IF_FAILED(result);
+        commandInfoPtrs[i] = &commandInfos[i];
+    }
+    
+    //Output (in any order):
+    //First: Hello from the first command
+    //First exited with 1, terminated: 0
+    //Second: Hello from the second command
+    //Second exited with 0, terminated: 0
+    SYSTEM2_RESULT result = System2Poll(commandInfoPtrs, 2, -1);
+    EXIT_IF_FAILED(result);
+    
+    //The commands still need to be waited for
+    for(int i = 0; i < 2; ++i)
+    {
+        int returnCode = -1;
+        result = System2GetCommandReturnValue(&commandInfos[i], -1, &returnCode);
+        EXIT_IF_FAILED(result);
+        
+        result = System2CleanupCommand(&commandInfos[i]);
+        EXIT_IF_FAILED(result);
+    }
+}
+
+void ShellSessionExample(void)
+{
+    FUNC_HEADER();
+    
+    #if defined(_WIN32)
+        printf("Shell sessions are not supported on Windows\n");
+    #else
+        System2ShellSession session;
+        SYSTEM2_RESULT result = System2ShellSessionStart(&session, NULL);
+        EXIT_IF_FAILED(result);
+        
+        const char* output = NULL;
+        uint32_t outputSize = 0;
+        int returnCode = -1;
+        
+        //Output: Hello from the session
+        result = System2ShellSessionRun(&session, 
+                                        "echo Hello from the session", 
+                                        -1, 
+                                        &output, 
+                                        &outputSize, 
+                                        &returnCode);
+        EXIT_IF_FAILED(result);
+        printf("%.*s", (int)outputSize, output);
+        
+        //The command is stopped along with the shell when it times out, so it never writes the file
+        result = System2ShellSessionRun(&session, 
+                                        "sh -c 'sleep 1; echo leaked > System2SessionExample.txt'", 
+                                        100, 
+                                        &output, 
+                                        &outputSize, 
+                                        &returnCode);
+        if(result != SYSTEM2_RESULT_COMMAND_NOT_FINISHED)
+        {
+            printf("Error at %d: %d", __LINE__, result);
+            exit(-1);
+        }
+        
+        //Output: Nothing was left running
+        result = System2ShellSessionRun(&session, 
+                                        "sleep 2; if [ -e System2SessionExample.txt ]; then "
+                                        "rm System2SessionExample.txt; echo The command leaked; "
+                                        "else echo Nothing was left running; fi", 
+                                        -1, 
+                                        &output, 
+                                        &outputSize, 
+                                        &returnCode);
+        EXIT_IF_FAILED(result);
+        printf("%.*s", (int)outputSize, output);
+        
+        result = System2ShellSessionEnd(&session);
+        EXIT_IF_FAILED(result);
+    #endif
+}
+
+//Reads the output of the command until it finishes into `outputBuffer` as a null terminated string
+SYSTEM2_RESULT ReadAllOutput(   System2CommandInfo* commandInfo, 
+                                char* outputBuffer, 
+                                uint32_t outputBufferSize)
+{
+    uint32_t outputSize = 0;
+    SYSTEM2_RESULT result;
+    do
+    {
+        uint32_t bytesRead = 0;
+        result = System2ReadFromOutput( commandInfo, 
+                                        outputBuffer + outputSize, 
+                                        outputBufferSize - outputSize - 1, 
+                                        &bytesRead);
+        outputSize += bytesRead;
+    }
+    while(result == SYSTEM2_RESULT_READ_NOT_FINISHED && outputSize < outputBufferSize - 1);
+    
+    outputBuffer[outputSize] = '\0';
+    return result;
+}
+
+#if defined(__unix__) || defined(__APPLE__)
+    //Runs `command` and returns its output and return code, with or without the shell
+    void RunForOutput(  const char* command, 
+                        bool alwaysUseShell, 
+                        char* outputBuffer, 
+                        uint32_t outputBufferSize,
+                        int* outReturnCode)
+    {
+        System2CommandInfo commandInfo;
+        memset(&commandInfo, 0, sizeof(System2CommandInfo));
+        commandInfo.RedirectOutput = true;
+        commandInfo.StandaloneStderr = true;
+        commandInfo.AlwaysUseShell = alwaysUseShell;
+        
+        SYSTEM2_RESULT result = System2Run(command, &commandInfo);
+        EXIT_IF_FAILED(result);
+        
+        result = ReadAllOutput(&commandInfo, outputBuffer, outputBufferSize);
+        EXIT_IF_FAILED(result);
+        
+        result = System2GetCommandReturnValue(&commandInfo, -1, outReturnCode);
+        EXIT_IF_FAILED(result);
+        
+        result = System2CleanupCommand(&commandInfo);
+        EXIT_IF_FAILED(result);
+    }
+#endif
+
+void DirectExecExample(void)
+{
+    FUNC_HEADER();
+    
+    #if defined(_WIN32)
+        printf("Commands are always run in the shell on Windows\n");
+    #else
+        //A script without `#!` is only run by the shell, even when it is started directly
+        FILE* script = fopen("System2DirectExecExample.sh", "w");
+        EXIT_IF_FALSE(script != NULL);
+        fprintf(script, "echo Hello from the script\n");
+        fclose(script);
+        EXIT_IF_FALSE(chmod("System2DirectExecExample.sh", 0755) == 0);
+        
+        char scriptCommand[4096 + 64];
+        char workingDirectory[4096];
+        EXIT_IF_FALSE(getcwd(workingDirectory, sizeof(workingDirectory)) != NULL);
+        snprintf(   scriptCommand, 
+                    sizeof(scriptCommand), 
+                    "%s/System2DirectExecExample.sh", 
+                    workingDirectory);
+        
+        //Quotes, backslashes, assignments, empty words and missing commands all behave the same 
+        //whether the shell is skipped or not
+        const char* commands[] = 
+        {
+            "printf '%s|' a\\ b \"c d\" 'e'",
+            "FOO=1 env",
+            "\"\"",
+            "System2NoSuchCommand",
+            scriptCommand
+        };
+        
+        //Output: printf '%s|' a\ b "c d" 'e' -> a b|c d|e|
+        for(size_t i = 0; i < sizeof(commands) / sizeof(commands[0]); ++i)
+        {
+            char directOutput[16384];
+            char shellOutput[16384];
+            int directReturnCode = -1;
+            int shellReturnCode = -1;
+            RunForOutput(commands[i], false, directOutput, sizeof(directOutput), &directReturnCode);
+            RunForOutput(commands[i], true, shellOutput, sizeof(shellOutput), &shellReturnCode);
+            
+            if(i == 0)
+            {
+                printf("%s -> %s\n", commands[i], directOutput);
+                EXIT_IF_FALSE(strcmp(directOutput, "a b|c d|e|") == 0);
+            }
+            
+            EXIT_IF_FALSE(strcmp(directOutput, shellOutput) == 0);
+            EXIT_IF_FALSE(directReturnCode == shellReturnCode);
+        }
+        
+        remove("System2DirectExecExample.sh");
+    #endif
+}
+
+void CaptureOutputExample(void)
+{
+    FUNC_HEADER();
+    
+    #if defined(_WIN32)
+        printf("This example uses seq and yes, which are not available on Windows\n");
+    #else
+        //What `seq 1 100000` outputs
+        char* expected = (char*)malloc(600000);
+        EXIT_IF_FALSE(expected != NULL);
+        uint32_t expectedSize = 0;
+        for(int i = 1; i <= 100000; ++i)
+            expectedSize += (uint32_t)sprintf(expected + expectedSize, "%d\n", i);
+        
+        //Small tails are kept from a separate buffer, and large ones are read into directly
+        uint32_t tailSizes[] = { 13, 20000 };
+        for(int i = 0; i < 2; ++i)
+        {
+            System2CommandInfo commandInfo;
+            memset(&commandInfo, 0, sizeof(System2CommandInfo));
+            commandInfo.RedirectOutput = true;
+            SYSTEM2_RESULT result = System2Run("seq 1 100000", &commandInfo);
+            EXIT_IF_FAILED(result);
+            
+            System2CapturePolicy policy;
+            memset(&policy, 0, sizeof(System2CapturePolicy));
+            policy.HeadSize = 10;
+            policy.TailSize = tailSizes[i];
+            
+            System2Capture capture;
+            result = System2CaptureOutput(&commandInfo, false, &policy, &capture);
+            EXIT_IF_FAILED(result);
+            
+            //Output: Kept 10 + 13 of 588895 bytes
+            //Output: Kept 10 + 20000 of 588895 bytes
+            printf( "Kept %u + %u of %llu bytes\n", 
+                    capture.HeadSize, 
+                    capture.TailSize, 
+                    (unsigned long long)capture.TotalBytes);
+            
+            EXIT_IF_FALSE(capture.TotalBytes == expectedSize);
+            EXIT_IF_FALSE(capture.Truncated && !capture.Killed);
+            EXIT_IF_FALSE(capture.HeadSize == 10 && memcmp(capture.Head, expected, 10) == 0);
+            EXIT_IF_FALSE(capture.TailSize == tailSizes[i]);
+            EXIT_IF_FALSE(memcmp(   capture.Tail, 
+                                    expected + expectedSize - tailSizes[i], 
+                                    tailSizes[i]) == 0);
+            
+            System2CaptureFree(&capture);
+            
+            int returnCode = -1;
+            result = System2GetCommandReturnValue(&commandInfo, -1, &returnCode);
+            EXIT_IF_FAILED(result);
+            EXIT_IF_FALSE(returnCode == 0);
+            
+            result = System2CleanupCommand(&commandInfo);
+            EXIT_IF_FAILED(result);
+        }
+        
+        free(expected);
+        
+        //The command never stops on its own, so it is killed once it passes the limit
+        System2CommandInfo commandInfo;
+        memset(&commandInfo, 0, sizeof(System2CommandInfo));
+        commandInfo.RedirectOutput = true;
+        SYSTEM2_RESULT result = System2Run("yes", &commandInfo);
+        EXIT_IF_FAILED(result);
+        
+        System2CapturePolicy policy;
+        memset(&policy, 0, sizeof(System2CapturePolicy));
+        policy.HeadSize = 4;
+        policy.TailSize = 4;
+        policy.KillAfter = 1024 * 1024;
+        
+        System2Capture capture;
+        result = System2CaptureOutput(&commandInfo, false, &policy, &capture);
+        EXIT_IF_FAILED(result);
+        
+        //Output: Killed after 1 MB: 1
+        printf("Killed after 1 MB: %d\n", (int)capture.Killed);
+        EXIT_IF_FALSE(capture.Killed && capture.TotalBytes > policy.KillAfter);
+        EXIT_IF_FALSE(capture.HeadSize == 4 && memcmp(capture.Head, "y\ny\n", 4) == 0);
+        EXIT_IF_FALSE(capture.TailSize == 4 && memcmp(capture.Tail, "y\ny\n", 4) == 0);
+        System2CaptureFree(&capture);
+        
+        int returnCode = -1;
+        result = System2GetCommandReturnValue(&commandInfo, -1, &returnCode);
+        EXIT_IF_FALSE(result == SYSTEM2_RESULT_COMMAND_TERMINATED);
+        
+        result = System2CleanupCommand(&commandInfo);
+        EXIT_IF_FAILED(result);
+    #endif
+}
+
+#if defined(__unix__) || defined(__APPLE__)
+    //Adds a node running `command` in the shell to the graph, keeping its output
+    int AddGraphNode(System2Graph* graph, const char* command, uint64_t cost)
+    {
+        System2SpawnSpec spec;
+        memset(&spec, 0, sizeof(System2SpawnSpec));
+        spec.Command = command;
+        
+        System2CommandInfo settings;
+        memset(&settings, 0, sizeof(System2CommandInfo));
+        settings.RedirectOutput = true;
+        
+        int nodeIndex = -1;
+        SYSTEM2_RESULT result = System2GraphAddNode(graph, &spec, &settings, cost, &nodeIndex);
+        EXIT_IF_FAILED(result);
+        return nodeIndex;
+    }
+#endif
+
+void GraphExample(void)
+{
+    FUNC_HEADER();
+    
+    #if defined(_WIN32)
+        printf("This example uses shell commands which are not available on Windows\n");
+    #else
+        //init -> fetch -> build
+        //init -> lint (fails) -> publish (skipped)
+        System2Graph graph;
+        SYSTEM2_RESULT result = System2GraphInit(&graph);
+        EXIT_IF_FAILED(result);
+        graph.FailurePolicy = SYSTEM2_GRAPH_FAILURE_SKIP_DEPENDENTS;
+        
+        int init = AddGraphNode(&graph, "echo init", 1);
+        int fetch = AddGraphNode(&graph, "echo fetch", 1);
+        int build = AddGraphNode(&graph, "echo build", 1);
+        int lint = AddGraphNode(&graph, "echo lint; exit 3", 1);
+        int publish = AddGraphNode(&graph, "echo publish", 1);
+        
+        int edges[][2] = { { init, fetch }, { fetch, build }, { init, lint }, { lint, publish } };
+        for(size_t i = 0; i < sizeof(edges) / sizeof(edges[0]); ++i)
+        {
+            result = System2GraphAddEdge(&graph, edges[i][0], edges[i][1]);
+            EXIT_IF_FAILED(result);
+        }
+        
+        //Output: init: 2, fetch: 2, build: 2, lint: 3 (3), publish: 4
+        result = System2GraphRun(&graph, 0, NULL);
+        printf( "init: %d, fetch: %d, build: %d, lint: %d (%d), publish: %d\n", 
+                (int)graph.Nodes[init].State, 
+                (int)graph.Nodes[fetch].State, 
+                (int)graph.Nodes[build].State, 
+                (int)graph.Nodes[lint].State, 
+                graph.Nodes[lint].ReturnCode,
+                (int)graph.Nodes[publish].State);
+        
+        EXIT_IF_FALSE(result == SYSTEM2_RESULT_GRAPH_NODE_FAILED);
+        EXIT_IF_FALSE(graph.Nodes[build].State == SYSTEM2_GRAPH_NODE_SUCCEEDED);
+        EXIT_IF_FALSE(graph.Nodes[lint].State == SYSTEM2_GRAPH_NODE_FAILED);
+        EXIT_IF_FALSE(graph.Nodes[lint].ReturnCode == 3);
+        EXIT_IF_FALSE(graph.Nodes[publish].State == SYSTEM2_GRAPH_NODE_SKIPPED);
+        EXIT_IF_FALSE(  graph.Nodes[build].OutputSize == 6 && 
+                        memcmp(graph.Nodes[build].Output, "build\n", 6) == 0);
+        
+        //A cycle is found before anything is run
+        result = System2GraphAddEdge(&graph, build, init);
+        EXIT_IF_FAILED(result);
+        result = System2GraphRun(&graph, 0, NULL);
+        EXIT_IF_FALSE(result == SYSTEM2_RESULT_GRAPH_CYCLE);
+        
+        result = System2GraphFree(&graph);
+        EXIT_IF_FAILED(result);
+        
+        //With one node at a time, the one on the longest path of cost goes first
+        result = System2GraphInit(&graph);
+        EXIT_IF_FAILED(result);
+        
+        int shortPath = AddGraphNode(&graph, "echo short >> System2GraphExample.txt", 1);
+        int longPath = AddGraphNode(&graph, "echo long >> System2GraphExample.txt", 1);
+        int longPathEnd = AddGraphNode(&graph, "echo end >> System2GraphExample.txt", 10);
+        (void)shortPath;
+        result = System2GraphAddEdge(&graph, longPath, longPathEnd);
+        EXIT_IF_FAILED(result);
+        
+        remove("System2GraphExample.txt");
+        result = System2GraphRun(&graph, 1, NULL);
+        EXIT_IF_FAILED(result);
+        
+        result = System2GraphFree(&graph);
+        EXIT_IF_FAILED(result);
+        
+        char order[64] = { 0 };
+        FILE* orderFile = fopen("System2GraphExample.txt", "r");
+        EXIT_IF_FALSE(orderFile != NULL);
+        size_t orderSize = fread(order, 1, sizeof(order) - 1, orderFile);
+        fclose(orderFile);
+        remove("System2GraphExample.txt");
+        
+        //Output: long end short
+        for(size_t i = 0; i < orderSize; ++i)
+            printf("%c", order[i] == '\n' ? (i + 1 == orderSize ? '\n' : ' ') : order[i]);
+        
+        EXIT_IF_FALSE(strcmp(order, "long\nend\nshort\n") == 0);
+    #endif
+}
+
+#if defined(__unix__) || defined(__APPLE__)
+    int64_t GetTimeMs(void)
+    {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+    }
+#endif
+
+void WatchdogExample(void)
+{
+    FUNC_HEADER();
+    
+    #if defined(_WIN32)
+        printf("Watchdogs are not supported on Windows\n");
+    #else
+        //The command is stopped if it doesn't output anything within half a second
+        System2CommandInfo commandInfo;
+        memset(&commandInfo, 0, sizeof(System2CommandInfo));
+        commandInfo.RedirectOutput = true;
+        commandInfo.FirstOutputTimeoutMs = 500;
+        
+        int64_t startTime = GetTimeMs();
+        SYSTEM2_RESULT result = System2Run("sleep 5", &commandInfo);
+        EXIT_IF_FAILED(result);
+        
+        char outputBuffer[64];
+        result = ReadAllOutput(&commandInfo, outputBuffer, sizeof(outputBuffer));
+        EXIT_IF_FAILED(result);
+        int64_t elapsedMs = GetTimeMs() - startTime;
+        
+        SYSTEM2_WATCHDOG watchdog = SYSTEM2_WATCHDOG_NONE;
+        result = System2GetFiredWatchdog(&commandInfo, &watchdog);
+        EXIT_IF_FAILED(result);
+        
+        //Output: Stopped by watchdog 1 instead of sleeping for 5 seconds
+        printf("Stopped by watchdog %d instead of sleeping for 5 seconds\n", (int)watchdog);
+        EXIT_IF_FALSE(watchdog == SYSTEM2_WATCHDOG_FIRST_OUTPUT);
+        EXIT_IF_FALSE(elapsedMs >= 500 && elapsedMs < 2500);
+        
+        int returnCode = -1;
+        result = System2GetCommandReturnValue(&commandInfo, -1, &returnCode);
+        EXIT_IF_FALSE(result == SYSTEM2_RESULT_COMMAND_TERMINATED);
+        
+        result = System2CleanupCommand(&commandInfo);
+        EXIT_IF_FAILED(result);
+    #endif
+}
+
+void PauseResumeExample(void)
+{
+    FUNC_HEADER();
+    
+    #if defined(_WIN32)
+        printf("This example uses a shell command which is not available on Windows\n");
+    #else
+        //The shell and the sleep it runs are both paused as they are in the same process group
+        System2CommandInfo commandInfo;
+        memset(&commandInfo, 0, sizeof(System2CommandInfo));
+        commandInfo.NewProcessGroup = true;
+        SYSTEM2_RESULT result = System2Run("sleep 1; echo Finished after being resumed", 
+                                           &commandInfo);
+        EXIT_IF_FAILED(result);
+        
+        result = System2Pause(&commandInfo);
+        EXIT_IF_FAILED(result);
+        
+        //It would have finished by now if it wasn't paused
+        sleep(2);
+        int returnCode = -1;
+        result = System2GetCommandReturnValue(&commandInfo, 0, &returnCode);
+        printf("Paused: %d\n", (int)(result == SYSTEM2_RESULT_COMMAND_NOT_FINISHED));
+        EXIT_IF_FALSE(result == SYSTEM2_RESULT_COMMAND_NOT_FINISHED);
+        
+        result = System2Resume(&commandInfo);
+        EXIT_IF_FAILED(result);
+        
+        //Output: Paused: 1
+        //Output: Finished after being resumed
+        result = System2GetCommandReturnValue(&commandInfo, -1, &returnCode);
+        EXIT_IF_FAILED(result);
+        EXIT_IF_FALSE(returnCode == 0);
+        
+        result = System2CleanupCommand(&commandInfo);
+        EXIT_IF_FAILED(result);
+    #endif
+}
+
+void PtyExample(void)
+{
+    FUNC_HEADER();
+    
+    #if defined(_WIN32)
+        printf("Pseudo-terminals are not supported on Windows\n");
+    #else
+        //The command only sees a terminal with `UsePty`
+        for(int i = 0; i < 2; ++i)
+        {
+            bool usePty = i == 0;
+            System2CommandInfo commandInfo;
+            memset(&commandInfo, 0, sizeof(System2CommandInfo));
+            commandInfo.RedirectInput = true;
+            commandInfo.RedirectOutput = true;
+            commandInfo.UsePty = usePty;
+            commandInfo.PtyNoEcho = true;
+            SYSTEM2_RESULT result = System2Run("sh -c 'test -t 1 && echo tty'", &commandInfo);
+            EXIT_IF_FAILED(result);
+            
+            char outputBuffer[64];
+            result = ReadAllOutput(&commandInfo, outputBuffer, sizeof(outputBuffer));
+            EXIT_IF_FAILED(result);
+            
+            //Output: With pty: tty
+            //Output: Without pty: 
+            printf( "%s: %.*s\n", 
+                    usePty ? "With pty" : "Without pty", 
+                    (int)strcspn(outputBuffer, "\r\n"), 
+                    outputBuffer);
+            
+            //The terminal translates `\n` to `\r\n` unless `PtyRawMode` is set
+            EXIT_IF_FALSE(strcmp(outputBuffer, usePty ? "tty\r\n" : "") == 0);
+            
+            int returnCode = -1;
+            result = System2GetCommandReturnValue(&commandInfo, -1, &returnCode);
+            EXIT_IF_FAILED(result);
+            EXIT_IF_FALSE(returnCode == (usePty ? 0 : 1));
+            
+            result = System2CleanupCommand(&commandInfo);
+            EXIT_IF_FAILED(result);
+        }
+        
+        //The terminal echoes the input back unless `PtyNoEcho` is set
+        for(int i = 0; i < 2; ++i)
+        {
+            bool noEcho = i == 0;
+            System2CommandInfo commandInfo;
+            memset(&commandInfo, 0, sizeof(System2CommandInfo));
+            commandInfo.RedirectInput = true;
+            commandInfo.RedirectOutput = true;
+            commandInfo.UsePty = true;
+            commandInfo.PtyNoEcho = noEcho;
+            SYSTEM2_RESULT result = System2Run("sh -c 'read line; echo got:$line'", &commandInfo);
+            EXIT_IF_FAILED(result);
+            
+            const char input[] = "hello\n";
+            result = System2WriteToInput(&commandInfo, input, sizeof(input) - 1);
+            EXIT_IF_FAILED(result);
+            
+            char outputBuffer[64];
+            result = ReadAllOutput(&commandInfo, outputBuffer, sizeof(outputBuffer));
+            EXIT_IF_FAILED(result);
+            
+            //Output: Without echo: got:hello
+            //Output: With echo: hello
+            printf( "%s: %.*s\n",
+                    noEcho ? "Without echo" : "With echo",
+                    (int)strcspn(outputBuffer, "\r\n"),
+                    outputBuffer);
+            
+            const char* expected = noEcho ? "got:hello\r\n" : "hello\r\ngot:hello\r\n";
+            EXIT_IF_FALSE(strcmp(outputBuffer, expected) == 0);
+            
+            int returnCode = -1;
+            result = System2GetCommandReturnValue(&commandInfo, -1, &returnCode);
+            EXIT_IF_FAILED(result);
+            EXIT_IF_FALSE(returnCode == 0);
+            
+            result = System2CleanupCommand(&commandInfo);
+            EXIT_IF_FAILED(result);
+        }
+        
+        //`PtyColumns`/`PtyRows` set the window size and `PtyRawMode` turns off line editing,
+        //  echo and output processing
+        for(int i = 0; i < 2; ++i)
+        {
+            bool rawMode = i == 0;
+            System2CommandInfo commandInfo;
+            memset(&commandInfo, 0, sizeof(System2CommandInfo));
+            commandInfo.RedirectInput = true;
+            commandInfo.RedirectOutput = true;
+            commandInfo.UsePty = true;
+            commandInfo.PtyRawMode = rawMode;
+            commandInfo.PtyColumns = 120;
+            commandInfo.PtyRows = 40;
+            SYSTEM2_RESULT result = System2Run("sh -c 'stty size; stty -a'", &commandInfo);
+            EXIT_IF_FAILED(result);
+            
+            char outputBuffer[4096];
+            result = ReadAllOutput(&commandInfo, outputBuffer, sizeof(outputBuffer));
+            EXIT_IF_FAILED(result);
+            
+            //Output: Raw mode: 40 120
+            //Output: Cooked mode: 40 120
+            printf( "%s: %.*s\n",
+                    rawMode ? "Raw mode" : "Cooked mode",
+                    (int)strcspn(outputBuffer, "\r\n"),
+                    outputBuffer);
+            
+            //No `\r` is added to the output in raw mode
+            const char* expectedSize = rawMode ? "40 120\n" : "40 120\r\n";
+            EXIT_IF_FALSE(strncmp(outputBuffer, expectedSize, strlen(expectedSize)) == 0);
+            EXIT_IF_FALSE((strstr(outputBuffer, "-icanon") != NULL) == rawMode);
+            EXIT_IF_FALSE((strstr(outputBuffer, "-echo ") != NULL) == rawMode);
+            EXIT_IF_FALSE((strstr(outputBuffer, "-opost") != NULL) == rawMode);
+            EXIT_IF_FALSE((strstr(outputBuffer, "-isig") != NULL) == rawMode);
+            
+            int returnCode = -1;
+            result = System2GetCommandReturnValue(&commandInfo, -1, &returnCode);
+            EXIT_IF_FAILED(result);
+            EXIT_IF_FALSE(returnCode == 0);
+            
+            result = System2CleanupCommand(&commandInfo);
+            EXIT_IF_FAILED(result);
+        }
+    #endif
+}
+
+void InputBufferExample(void)
+{
+    FUNC_HEADER();
+    
+    #if defined(_WIN32)
+        printf("This example uses wc which is not available on Windows\n");
+    #else
+        //The whole input is ready before the command starts, so it doesn't need to be written
+        static char input[1024 * 1024];
+        memset(input, 'a', sizeof(input));
+        
+        System2CommandInfo commandInfo;
+        memset(&commandInfo, 0, sizeof(System2CommandInfo));
+        commandInfo.RedirectOutput = true;
+        commandInfo.InputBuffer = input;
+        commandInfo.InputBufferSize = sizeof(input);
+        SYSTEM2_RESULT result = System2Run("wc -c", &commandInfo);
+        EXIT_IF_FAILED(result);
+        
+        char outputBuffer[64];
+        result = ReadAllOutput(&commandInfo, outputBuffer, sizeof(outputBuffer));
+        EXIT_IF_FAILED(result);
+        
+        //Output: wc -c: 1048576
+        printf("wc -c: %s", outputBuffer);
+        EXIT_IF_FALSE(strtol(outputBuffer, NULL, 10) == (long)sizeof(input));
+        
+        int returnCode = -1;
+        result = System2GetCommandReturnValue(&commandInfo, -1, &returnCode);
+        EXIT_IF_FAILED(result);
+        EXIT_IF_FALSE(returnCode == 0);
+        
+        result = System2CleanupCommand(&commandInfo);
+        EXIT_IF_FAILED(result);
+    #endif
+}
+
+void KillPtyExample(void)
+{
+    FUNC_HEADER();
+    
+    #if defined(_WIN32)
+        printf("Pseudo-terminals are not supported on Windows\n");
+    #else
+        //The command can be killed before its child has created the session of the terminal
+        for(int i = 0; i < 100; ++i)
+        {
+            System2CommandInfo commandInfo;
+            memset(&commandInfo, 0, sizeof(System2CommandInfo));
+            commandInfo.RedirectInput = true;
+            commandInfo.RedirectOutput = true;
+            commandInfo.UsePty = true;
+            commandInfo.SpawnBackend = SYSTEM2_SPAWN_BACKEND_FORK;
+            
+            const char* args[] = { "5" };
+            SYSTEM2_RESULT result = System2RunSubprocess("sleep", args, 1, &commandInfo);
+            EXIT_IF_FAILED(result);
+            
+            result = System2Kill(&commandInfo);
+            EXIT_IF_FAILED(result);
+            
+            int returnCode = -1;
+            result = System2GetCommandReturnValue(&commandInfo, -1, &returnCode);
+            EXIT_IF_FALSE(result == SYSTEM2_RESULT_COMMAND_TERMINATED);
+            
+            result = System2CleanupCommand(&commandInfo);
+            EXIT_IF_FAILED(result);
+        }
+        
+        //Output: Killed 100 commands right after starting them
+        printf("Killed 100 commands right after starting them\n");
+    #endif
+}
+
+void ForkExcludedMemoryExample(void)
+{
+    FUNC_HEADER();
+    
+    #if !defined(__linux__)
+        printf("Fork excluded memory is only supported on Linux\n");
+    #else
+        //A big buffer that the commands don't need, so its page tables aren't copied for them
+        size_t size = 64 * 1024 * 1024;
+        char* buffer = (char*)mmap( NULL, 
+                                    size, 
+                                    PROT_READ | PROT_WRITE, 
+                                    MAP_PRIVATE | MAP_ANONYMOUS, 
+                                    -1, 
+                                    0);
+        EXIT_IF_FALSE(buffer != MAP_FAILED);
+        memset(buffer, 1, size);
+        
+        SYSTEM2_RESULT result = System2RegisterForkExcludedMemory(buffer, size, false);
+        EXIT_IF_FAILED(result);
+        
+        System2CommandInfo commandInfo;
+        memset(&commandInfo, 0, sizeof(System2CommandInfo));
+        commandInfo.RedirectOutput = true;
+        commandInfo.SpawnBackend = SYSTEM2_SPAWN_BACKEND_FORK;
+        result = System2Run("echo Started without the buffer", &commandInfo);
+        EXIT_IF_FAILED(result);
+        
+        //Output: Started without the buffer
+        char outputBuffer[64];
+        result = ReadAllOutput(&commandInfo, outputBuffer, sizeof(outputBuffer));
+        EXIT_IF_FAILED(result);
+        printf("%s", outputBuffer);
+        EXIT_IF_FALSE(strcmp(outputBuffer, "Started without the buffer\n") == 0);
+        
+        int returnCode = -1;
+        result = System2GetCommandReturnValue(&commandInfo, -1, &returnCode);
+        EXIT_IF_FAILED(result);
+        EXIT_IF_FALSE(returnCode == 0);
+        
+        result = System2CleanupCommand(&commandInfo);
+        EXIT_IF_FAILED(result);
+        
+        //The parent keeps its memory
+        EXIT_IF_FALSE(buffer[0] == 1 && buffer[size - 1] == 1);
+        
+        result = System2UnregisterForkExcludedMemory(buffer);
+        EXIT_IF_FAILED(result);
+        EXIT_IF_FALSE(System2UnregisterForkExcludedMemory(buffer) == SYSTEM2_RESULT_INVALID_ARGUMENT);
+        munmap(buffer, size);
+    #endif
+}
+
+void WaitWatchdogExample(void)
+{
+    FUNC_HEADER();
+    
+    #if defined(_WIN32)
+        printf("Watchdogs are not supported on Windows\n");
+    #else
+        //The command never exits by itself, but only gets waited for after its input is closed
+        System2CommandInfo commandInfo;
+        memset(&commandInfo, 0, sizeof(System2CommandInfo));
+        commandInfo.RedirectInput = true;
+        commandInfo.InputClosedTimeoutMs = 500;
+        
+        SYSTEM2_RESULT result = System2Run("sleep 5", &commandInfo);
+        EXIT_IF_FAILED(result);
+        
+        int64_t startTime = GetTimeMs();
+        result = System2CloseInput(&commandInfo);
+        EXIT_IF_FAILED(result);
+        
+        int returnCode = -1;
+        result = System2GetCommandReturnValue(&commandInfo, -1, &returnCode);
+        int64_t elapsedMs = GetTimeMs() - startTime;
+        EXIT_IF_FALSE(result == SYSTEM2_RESULT_COMMAND_TERMINATED);
+        EXIT_IF_FALSE(elapsedMs >= 500 && elapsedMs < 2500);
+        
+        SYSTEM2_WATCHDOG watchdog = SYSTEM2_WATCHDOG_NONE;
+        result = System2GetFiredWatchdog(&commandInfo, &watchdog);
+        EXIT_IF_FAILED(result);
+        
+        //Output: Stopped by watchdog 3 while waiting
+        printf("Stopped by watchdog %d while waiting\n", (int)watchdog);
+        EXIT_IF_FALSE(watchdog == SYSTEM2_WATCHDOG_INPUT_CLOSED);
+        
+        result = System2CleanupCommand(&commandInfo);
+        EXIT_IF_FAILED(result);
+    #endif
+}
+
+void SpawnBackendExample(void)
+{
+    FUNC_HEADER();
+    
+    #if defined(_WIN32)
+        printf("Spawn backends are POSIX only\n");
+    #else
+        //`SYSTEM2_SPAWN_BACKEND_AUTO` needs vfork for the nice value, which posix_spawn can only 
+        //set after the command has started
+        SYSTEM2_SPAWN_BACKEND requested[] = 
+        { 
+            SYSTEM2_SPAWN_BACKEND_AUTO, 
+            SYSTEM2_SPAWN_BACKEND_AUTO, 
+            SYSTEM2_SPAWN_BACKEND_FORK, 
+            SYSTEM2_SPAWN_BACKEND_POSIX_SPAWN, 
+            SYSTEM2_SPAWN_BACKEND_VFORK 
+        };
+        int niceIncrements[] = { 0, 5, 0, 0, 0 };
+        SYSTEM2_SPAWN_BACKEND expected[] = 
+        { 
+            SYSTEM2_SPAWN_BACKEND_POSIX_SPAWN, 
+            SYSTEM2_SPAWN_BACKEND_VFORK, 
+            SYSTEM2_SPAWN_BACKEND_FORK, 
+            SYSTEM2_SPAWN_BACKEND_POSIX_SPAWN, 
+            SYSTEM2_SPAWN_BACKEND_VFORK 
+        };
+        
+        //Output: Requested 1, used 3
+        //Output: Requested 1, used 4
+        //Output: Requested 2, used 2
+        //Output: Requested 3, used 3
+        //Output: Requested 4, used 4
+        for(int i = 0; i < 5; ++i)
+        {
+            System2CommandInfo commandInfo;
+            memset(&commandInfo, 0, sizeof(System2CommandInfo));
+            commandInfo.SpawnBackend = requested[i];
+            commandInfo.NiceIncrement = niceIncrements[i];
+            
+            SYSTEM2_RESULT result = System2Run("true", &commandInfo);
+            EXIT_IF_FAILED(result);
+            
+            printf("Requested %d, used %d\n", (int)requested[i], (int)commandInfo.SpawnBackendUsed);
+            EXIT_IF_FALSE(commandInfo.SpawnBackendUsed == expected[i]);
+            
+            int returnCode = -1;
+            result = System2GetCommandReturnValue(&commandInfo, -1, &returnCode);
+            EXIT_IF_FAILED(result);
+            EXIT_IF_FALSE(returnCode == 0);
+            
+            result = System2CleanupCommand(&commandInfo);
+            EXIT_IF_FAILED(result);
+        }
+    #endif
+}
+
+void MapOutputExample(void)
+{
+    FUNC_HEADER();
+    
+    #if defined(_WIN32)
+        printf("Capturing the output to a file is not supported on Windows\n");
+    #else
+        //Stderr is mapped separately only with `StandaloneStderr`
+        for(int i = 0; i < 2; ++i)
+        {
+            bool standaloneStderr = i == 1;
+            System2CommandInfo commandInfo;
+            memset(&commandInfo, 0, sizeof(System2CommandInfo));
+            commandInfo.CaptureOutputToFile = true;
+            commandInfo.StandaloneStderr = standaloneStderr;
+            SYSTEM2_RESULT result = System2Run("echo out; echo err >&2", &commandInfo);
+            EXIT_IF_FAILED(result);
+            
+            int returnCode = -1;
+            result = System2GetCommandReturnValue(&commandInfo, -1, &returnCode);
+            EXIT_IF_FAILED(result);
+            EXIT_IF_FALSE(returnCode == 0);
+            
+            System2OutputView outputView;
+            result = System2MapOutput(&commandInfo, false, &outputView);
+            EXIT_IF_FAILED(result);
+            
+            System2OutputView stderrView;
+            result = System2MapOutput(&commandInfo, true, &stderrView);
+            EXIT_IF_FALSE(result == (standaloneStderr ? 
+                                        SYSTEM2_RESULT_SUCCESS : 
+                                        SYSTEM2_RESULT_INVALID_ARGUMENT));
+            
+            //The views stay valid after the cleanup
+            result = System2CleanupCommand(&commandInfo);
+            EXIT_IF_FAILED(result);
+            
+            //Output: Mixed stdout:
+            //Output: out
+            //Output: err
+            //Output: Standalone stdout:
+            //Output: out
+            //Output: Standalone stderr:
+            //Output: err
+            const char* expectedOutput = standaloneStderr ? "out\n" : "out\nerr\n";
+            printf( "%s stdout:\n%.*s", 
+                    standaloneStderr ? "Standalone" : "Mixed", 
+                    (int)outputView.Size, 
+                    outputView.Data);
+            EXIT_IF_FALSE(outputView.Size == strlen(expectedOutput));
+            EXIT_IF_FALSE(memcmp(outputView.Data, expectedOutput, outputView.Size) == 0);
+            
+            if(standaloneStderr)
+            {
+                printf("Standalone stderr:\n%.*s", (int)stderrView.Size, stderrView.Data);
+                EXIT_IF_FALSE(stderrView.Size == 4);
+                EXIT_IF_FALSE(memcmp(stderrView.Data, "err\n", 4) == 0);
+                
+                result = System2UnmapOutput(&stderrView);
+                EXIT_IF_FAILED(result);
+            }
+            
+            result = System2UnmapOutput(&outputView);
+            EXIT_IF_FAILED(result);
+            EXIT_IF_FALSE(outputView.Data == NULL && outputView.Size == 0);
+        }
+        
+        //Nothing is mapped without any output
+        {
+            System2CommandInfo commandInfo;
+            memset(&commandInfo, 0, sizeof(System2CommandInfo));
+            commandInfo.CaptureOutputToFile = true;
+            commandInfo.StandaloneStderr = true;
+            SYSTEM2_RESULT result = System2Run("true", &commandInfo);
+            EXIT_IF_FAILED(result);
+            
+            int returnCode = -1;
+            result = System2GetCommandReturnValue(&commandInfo, -1, &returnCode);
+            EXIT_IF_FAILED(result);
+            
+            for(int i = 0; i < 2; ++i)
+            {
+                System2OutputView outputView;
+                result = System2MapOutput(&commandInfo, i == 1, &outputView);
+                EXIT_IF_FAILED(result);
+                EXIT_IF_FALSE(outputView.Data == NULL && outputView.Size == 0);
+                
+                result = System2UnmapOutput(&outputView);
+                EXIT_IF_FAILED(result);
+            }
+            
+            //Output: Empty output mapped as NULL
+            printf("Empty output mapped as NULL\n");
+            
+            result = System2CleanupCommand(&commandInfo);
+            EXIT_IF_FAILED(result);
+        }
+    #endif
+}
+
+void AdaptiveLimiterExample(void)
+{
+    FUNC_HEADER();
+    
+    #if defined(_WIN32)
+        printf("This example uses the POSIX clock\n");
+    #else
+        //Only one command is admitted at a time, whatever the pressure is
+        System2AdaptiveLimiter limiter;
+        SYSTEM2_RESULT result = System2AdaptiveLimiterInit(&limiter, 1, 1);
+        EXIT_IF_FAILED(result);
+        
+        System2CommandInfo commandInfos[2];
+        System2CommandInfo* runningCommands[2] = { &commandInfos[0], &commandInfos[1] };
+        int64_t startTime = 0;
+        for(int i = 0; i < 2; ++i)
+        {
+            //The first command doesn't need to wait for anything
+            if(i == 1)
+            {
+                result = System2AdaptiveLimiterAcquire(&limiter, runningCommands, i, 0);
+                EXIT_IF_FALSE(result == SYSTEM2_RESULT_LIMIT_REACHED);
+                
+                result = System2AdaptiveLimiterAcquire(&limiter, runningCommands, i, 100);
+                EXIT_IF_FALSE(result == SYSTEM2_RESULT_LIMIT_REACHED);
+            }
+            
+            result = System2AdaptiveLimiterAcquire(&limiter, runningCommands, i, -1);
+            EXIT_IF_FAILED(result);
+            
+            memset(&commandInfos[i], 0, sizeof(System2CommandInfo));
+            result = System2Run("sleep 1", &commandInfos[i]);
+            EXIT_IF_FAILED(result);
+            
+            if(i == 0)
+                startTime = GetTimeMs();
+        }
+        
+        //The second command was only admitted once the first one has exited
+        int64_t elapsedMs = GetTimeMs() - startTime;
+        
+        //Output: Admitted 2, waited 1
+        printf( "Admitted %d, waited %d\n", 
+                (int)limiter.AdmittedCount, 
+                (int)limiter.WaitedCount);
+        
+        EXIT_IF_FALSE(limiter.AdmittedCount == 2);
+        EXIT_IF_FALSE(limiter.WaitedCount == 1);
+        EXIT_IF_FALSE(elapsedMs >= 900);
+        EXIT_IF_FALSE(limiter.TotalWaitMs >= 800 && limiter.TotalWaitMs <= (uint64_t)elapsedMs);
+        EXIT_IF_FALSE(limiter.MaxWaitMs == limiter.TotalWaitMs);
+        EXIT_IF_FALSE(limiter.Limit == 1);
+        
+        for(int i = 0; i < 2; ++i)
+        {
+            int returnCode = -1;
+            result = System2GetCommandReturnValue(&commandInfos[i], -1, &returnCode);
+            EXIT_IF_FAILED(result);
+            EXIT_IF_FALSE(returnCode == 0);
+            
+            result = System2CleanupCommand(&commandInfos[i]);
+            EXIT_IF_FAILED(result);
+        }
+    #endif
+}
+
 #endif //#else